@@ -0,0 +1,467 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "broadphase_structure.hpp"
+#include "geometry/narrowphase/aabb.hpp"
+#include "geometry/narrowphase/collision_shape.hpp"
+
+#include "geometry/equal.hpp"
+#include "geometry/point3.hpp"
+#include "geometry/vec3.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+namespace throttle {
+namespace geometry {
+
+// Octree that subdivides by occupancy instead of to a fixed depth. A node is
+// split only when it holds more than split_threshold shapes, so dense clusters
+// get deep subtrees while empty space stays a single leaf. Shapes that
+// straddle a split plane are either kept in the node, as in octree, or cloned
+// into every child they overlap when they are no larger than a child cell.
+// Clones keep the straddling shapes from piling up near the root, and every
+// pair of shapes with clones is reported only in the node on the path of a
+// reference point inside the overlap of their bounding boxes.
+template <typename T, typename t_shape = collision_shape<T>,
+          typename =
+              std::enable_if_t<std::is_base_of_v<collision_shape<T>, t_shape>>>
+class adaptive_octree
+    : public broadphase_structure<adaptive_octree<T, t_shape>, t_shape> {
+  using point_type = point3<T>;
+  using vec_type = vec3<T>;
+  using aabb_type = axis_aligned_bb<T>;
+  using hit_type = raycast_hit<T>;
+
+public:
+  using shape_type = t_shape;
+
+  static constexpr unsigned default_split_threshold = 8;
+  static constexpr unsigned default_max_depth = 16;
+
+private:
+  struct octree_node {
+    point_type m_center;
+    T m_halfwidth;
+    std::array<unsigned, 8> m_children;
+    std::vector<unsigned> m_contained_shape_indexes;
+
+    octree_node(point_type center, T halfwidth)
+        : m_center{center}, m_halfwidth{halfwidth}, m_children{},
+          m_contained_shape_indexes{} {}
+  };
+
+  std::vector<shape_type> m_stored_shapes;
+  std::vector<shape_type> m_waiting_queue;
+  std::vector<std::uint8_t> m_cloned;
+  std::vector<unsigned> m_query_marks;
+  unsigned m_query_epoch = 0;
+
+  std::vector<octree_node> m_nodes;
+  unsigned m_depth = 0;
+
+  unsigned m_split_threshold, m_max_depth;
+  bool m_clone_straddling;
+
+  // Bounding boxes are widened by this much when they are sorted into
+  // children, so that boxes which aabb::intersect considers touching share at
+  // least one node.
+  T m_margin = T{0};
+
+  unsigned root_index() const { return 1; }
+
+public:
+  adaptive_octree(unsigned split_threshold = default_split_threshold,
+                  bool clone_straddling = true,
+                  unsigned max_depth = default_max_depth)
+      : m_split_threshold{std::max(split_threshold, 1u)},
+        m_max_depth{max_depth}, m_clone_straddling{clone_straddling} {
+    m_nodes.emplace_back(point_type::origin(), T{0});
+  }
+
+  void add_collision_shape(const shape_type &shape) {
+    m_waiting_queue.push_back(shape);
+  }
+
+  void rebuild() {
+    if (m_waiting_queue.empty())
+      return;
+
+    m_stored_shapes.insert(m_stored_shapes.end(), m_waiting_queue.begin(),
+                           m_waiting_queue.end());
+    m_waiting_queue.clear();
+    build();
+  }
+
+  bool empty() const {
+    return m_stored_shapes.empty() && m_waiting_queue.empty();
+  }
+
+  unsigned size() const {
+    return m_stored_shapes.size() + m_waiting_queue.size();
+  }
+
+  shape_type &shape_at(unsigned index) {
+    rebuild();
+    return m_stored_shapes[index];
+  }
+
+  // Depth of the deepest node, the root being at depth 0.
+  unsigned depth() {
+    rebuild();
+    return m_depth;
+  }
+
+  unsigned node_count() {
+    rebuild();
+    return m_nodes.size() - 1;
+  }
+
+  template <typename t_callback>
+  void for_each_candidate_pair(t_callback &&callback) {
+    if (empty())
+      return;
+
+    rebuild();
+
+    many_to_many_collider<std::remove_reference_t<t_callback>> collider{
+        *this, callback};
+    collider.collide(root_index());
+  }
+
+  template <typename t_callback>
+  void for_each_colliding_pair(t_callback &&callback) {
+    for_each_candidate_pair([&](unsigned i, unsigned j) {
+      if (m_stored_shapes[i].collide(m_stored_shapes[j]))
+        callback(i, j);
+    });
+  }
+
+  template <typename t_callback>
+  void query_aabb(const aabb_type &box, t_callback &&callback) {
+    if (empty())
+      return;
+
+    rebuild();
+    next_query();
+    query_aabb_impl(root_index(), box, callback);
+  }
+
+  template <typename t_callback>
+  void query_point(const point_type &point, t_callback &&callback) {
+    if (empty())
+      return;
+
+    rebuild();
+    next_query();
+    query_point_impl(root_index(), point, callback);
+  }
+
+  std::optional<hit_type> raycast(const point_type &origin,
+                                  const vec_type &dir,
+                                  T tmax = std::numeric_limits<T>::max()) {
+    if (empty())
+      return std::nullopt;
+
+    rebuild();
+    if (!node_box(root_index()).ray_intersection(origin, dir, tmax))
+      return std::nullopt;
+
+    std::optional<hit_type> closest;
+    raycast_impl(root_index(), origin, dir, tmax, closest);
+    return closest;
+  }
+
+private:
+  void build() {
+    m_nodes.clear();
+    m_nodes.emplace_back(point_type::origin(), T{0}); // sentinel
+    m_cloned.assign(m_stored_shapes.size(), 0);
+    m_query_marks.assign(m_stored_shapes.size(), 0);
+    m_query_epoch = 0;
+    m_depth = 0;
+
+    auto min_corner = m_stored_shapes.front().bounding_box().minimum_corner();
+    auto max_corner = m_stored_shapes.front().bounding_box().maximum_corner();
+    T min_coord = vmin(min_corner.x, min_corner.y, min_corner.z),
+      max_coord = vmax(max_corner.x, max_corner.y, max_corner.z);
+    for (const auto &shape : m_stored_shapes) {
+      min_corner = shape.bounding_box().minimum_corner();
+      max_corner = shape.bounding_box().maximum_corner();
+      min_coord = vmin(min_coord, min_corner.x, min_corner.y, min_corner.z);
+      max_coord = vmax(max_coord, max_corner.x, max_corner.y, max_corner.z);
+    }
+
+    T center_coord = (max_coord + min_coord) / T{2};
+    T halfwidth = (max_coord - min_coord) / T{2};
+    m_margin = T{4} * default_precision<T>::m_prec *
+               vmax(T{1}, std::abs(min_coord), std::abs(max_coord));
+
+    m_nodes.emplace_back(point_type{center_coord, center_coord, center_coord},
+                         halfwidth);
+    auto &root_shapes = m_nodes[root_index()].m_contained_shape_indexes;
+    root_shapes.resize(m_stored_shapes.size());
+    for (unsigned i = 0; i < root_shapes.size(); ++i)
+      root_shapes[i] = i;
+
+    split(root_index(), 0);
+  }
+
+  // Bit i of the first mask is set if the widened box reaches below the center
+  // along axis i, and of the second if it reaches the center or above. The
+  // reference points are sorted the same way, with the center going up.
+  std::pair<unsigned, unsigned> sides(const aabb_type &box,
+                                      const point_type &center) const {
+    auto min_corner = box.minimum_corner(), max_corner = box.maximum_corner();
+    unsigned low = 0, high = 0;
+    for (unsigned i = 0; i < 3; ++i) {
+      if (min_corner[i] - m_margin < center[i])
+        low |= 1 << i;
+      if (max_corner[i] + m_margin >= center[i])
+        high |= 1 << i;
+    }
+    return {low, high};
+  }
+
+  static unsigned slot_of(const point_type &point, const point_type &center) {
+    unsigned slot = 0;
+    for (unsigned i = 0; i < 3; ++i)
+      if (point[i] >= center[i])
+        slot |= 1 << i;
+    return slot;
+  }
+
+  bool fits_child(const aabb_type &box, T halfwidth) const {
+    T extent = box.max_width() + 2 * m_margin;
+    return extent <= halfwidth;
+  }
+
+  void split(unsigned node_index, unsigned depth) {
+    m_depth = std::max(m_depth, depth);
+
+    auto &node = m_nodes[node_index];
+    if (node.m_contained_shape_indexes.size() <= m_split_threshold ||
+        depth >= m_max_depth || !(node.m_halfwidth > T{0}))
+      return;
+
+    std::array<std::vector<unsigned>, 8> children;
+    std::vector<unsigned> kept;
+    for (auto i : node.m_contained_shape_indexes) {
+      const auto &box = m_stored_shapes[i].bounding_box();
+      auto [low, high] = sides(box, node.m_center);
+      auto straddling = low & high;
+
+      if (!straddling) {
+        children[high].push_back(i);
+        continue;
+      }
+
+      if (!m_clone_straddling || !fits_child(box, node.m_halfwidth)) {
+        kept.push_back(i);
+        continue;
+      }
+
+      // A child is overlapped if it lies on an overlapped side of every axis.
+      m_cloned[i] = 1;
+      for (unsigned slot = 0; slot < 8; ++slot)
+        if ((slot & high) == slot && (~slot & 7 & low) == (~slot & 7))
+          children[slot].push_back(i);
+    }
+
+    if (kept.size() == node.m_contained_shape_indexes.size())
+      return;
+    node.m_contained_shape_indexes = std::move(kept);
+
+    T step = node.m_halfwidth * T{0.5f};
+    for (unsigned slot = 0; slot < 8; ++slot) {
+      if (children[slot].empty())
+        continue;
+
+      vec_type offset = {(slot & 1) ? step : -step, (slot & 2) ? step : -step,
+                         (slot & 4) ? step : -step};
+      unsigned child = m_nodes.size();
+      m_nodes.emplace_back(m_nodes[node_index].m_center + offset, step);
+      m_nodes[child].m_contained_shape_indexes = std::move(children[slot]);
+      m_nodes[node_index].m_children[slot] = child;
+      split(child, depth + 1);
+    }
+  }
+
+  // The point is inside both boxes, or halfway across the gap between boxes
+  // that only touch within the precision of aabb::intersect.
+  static point_type reference_point(const aabb_type &first,
+                                    const aabb_type &second) {
+    auto min_first = first.minimum_corner(), max_first = first.maximum_corner();
+    auto min_second = second.minimum_corner(),
+         max_second = second.maximum_corner();
+    point_type result;
+    for (unsigned i = 0; i < 3; ++i) {
+      T low = vmax(min_first[i], min_second[i]),
+        high = vmin(max_first[i], max_second[i]);
+      result[i] = (low <= high ? low : (low + high) / T{2});
+    }
+    return result;
+  }
+
+  template <typename t_callback> struct many_to_many_collider {
+    std::vector<unsigned> ancestor_stack, slot_stack;
+    const adaptive_octree &tree;
+    t_callback &callback;
+
+    many_to_many_collider(const adaptive_octree &p_tree,
+                          t_callback &p_callback)
+        : tree{p_tree}, callback{p_callback} {
+      ancestor_stack.reserve(tree.m_depth + 1);
+      slot_stack.reserve(tree.m_depth);
+    }
+
+    void collide(unsigned current_node) {
+      ancestor_stack.push_back(current_node);
+
+      for (unsigned n = 0; n < ancestor_stack.size(); ++n) {
+        for (const auto &i_a :
+             tree.m_nodes[ancestor_stack[n]].m_contained_shape_indexes) {
+          for (const auto &i_b :
+               tree.m_nodes[current_node].m_contained_shape_indexes) {
+            if (i_a == i_b)
+              break;
+            if (owns_pair(i_a, i_b))
+              callback(i_a, i_b);
+          }
+        }
+      }
+
+      const auto &children = tree.m_nodes[current_node].m_children;
+      for (unsigned slot = 0; slot < 8; ++slot) {
+        if (!children[slot])
+          continue;
+        slot_stack.push_back(slot);
+        collide(children[slot]);
+        slot_stack.pop_back();
+      }
+
+      ancestor_stack.pop_back();
+    }
+
+    // Shapes without clones meet in exactly one node. Otherwise the pair
+    // belongs to the current node if the reference point descends through
+    // it, which happens for exactly one of the nodes they meet in.
+    bool owns_pair(unsigned first, unsigned second) const {
+      if (!tree.m_cloned[first] && !tree.m_cloned[second])
+        return true;
+
+      const auto &first_box = tree.m_stored_shapes[first].bounding_box(),
+                 &second_box = tree.m_stored_shapes[second].bounding_box();
+      if (!first_box.intersect(second_box))
+        return false;
+
+      auto point = reference_point(first_box, second_box);
+      for (unsigned k = 0; k < slot_stack.size(); ++k)
+        if (slot_of(point, tree.m_nodes[ancestor_stack[k]].m_center) !=
+            slot_stack[k])
+          return false;
+      return true;
+    }
+  };
+
+  aabb_type node_box(unsigned node_index) const {
+    return aabb_type{m_nodes[node_index].m_center,
+                     m_nodes[node_index].m_halfwidth};
+  }
+
+  void next_query() {
+    if (++m_query_epoch)
+      return;
+    std::fill(m_query_marks.begin(), m_query_marks.end(), 0);
+    m_query_epoch = 1;
+  }
+
+  // Clones of a shape are reported once per query.
+  bool first_visit(unsigned index) {
+    if (!m_cloned[index])
+      return true;
+    if (m_query_marks[index] == m_query_epoch)
+      return false;
+    m_query_marks[index] = m_query_epoch;
+    return true;
+  }
+
+  // A clone sticks out of its cell, but some clone of every shape lies in a
+  // cell that contains any given point of the shape's bounding box, so the
+  // queries still only descend into the children that the query touches.
+  template <typename t_callback>
+  void query_aabb_impl(unsigned node_index, const aabb_type &box,
+                       t_callback &callback) {
+    const auto &node = m_nodes[node_index];
+    for (const auto &i : node.m_contained_shape_indexes) {
+      if (m_stored_shapes[i].bounding_box().intersect(box) && first_visit(i))
+        callback(i);
+    }
+
+    for (const auto &c : node.m_children) {
+      if (c && node_box(c).intersect(box))
+        query_aabb_impl(c, box, callback);
+    }
+  }
+
+  template <typename t_callback>
+  void query_point_impl(unsigned node_index, const point_type &point,
+                        t_callback &callback) {
+    const auto &node = m_nodes[node_index];
+    for (const auto &i : node.m_contained_shape_indexes) {
+      if (m_stored_shapes[i].contains(point) && first_visit(i))
+        callback(i);
+    }
+
+    for (const auto &c : node.m_children) {
+      if (c && node_box(c).contains(point))
+        query_point_impl(c, point, callback);
+    }
+  }
+
+  void raycast_impl(unsigned node_index, const point_type &origin,
+                    const vec_type &dir, T &tmax,
+                    std::optional<hit_type> &closest) const {
+    const auto &node = m_nodes[node_index];
+    for (const auto &i : node.m_contained_shape_indexes) {
+      if (auto t = m_stored_shapes[i].ray_intersection(origin, dir, tmax)) {
+        closest = hit_type{i, t.value()};
+        tmax = t.value();
+      }
+    }
+
+    std::array<std::pair<T, unsigned>, 8> order;
+    unsigned count = 0;
+    for (const auto &c : node.m_children) {
+      if (!c)
+        continue;
+      auto t = node_box(c).ray_intersection(origin, dir, tmax);
+      if (!t)
+        continue;
+      unsigned pos = count++;
+      for (; pos > 0 && order[pos - 1].first > t.value(); --pos)
+        order[pos] = order[pos - 1];
+      order[pos] = std::make_pair(t.value(), c);
+    }
+
+    for (unsigned i = 0; i < count && order[i].first <= tmax; ++i)
+      raycast_impl(order[i].second, origin, dir, tmax, closest);
+  }
+};
+
+} // namespace geometry
+} // namespace throttle
@@ -10,24 +10,103 @@
 
 #pragma once
 
+#include "geometry/narrowphase/aabb.hpp"
 #include "geometry/narrowphase/collision_shape.hpp"
+#include <limits>
+#include <memory>
+#include <optional>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace throttle {
 namespace geometry {
 
+// Closest shape hit by a ray. The hit point is origin + distance * dir.
+template <typename T> struct raycast_hit {
+  unsigned index;
+  T distance;
+};
+
 template <typename t_derived, typename shape_type> class broadphase_structure {
   using derived_ref = t_derived &;
   using shape_ptr = shape_type *;
 
 public:
+  using index_type = unsigned;
+  using index_pair_type = std::pair<index_type, index_type>;
+  using value_type = typename shape_type::value_type;
+  using point_type = point3<value_type>;
+  using vec_type = vec3<value_type>;
+  using aabb_type = axis_aligned_bb<value_type>;
+  using hit_type = raycast_hit<value_type>;
+
   void add_collision_shape(const shape_type &shape) {
     impl().add_collision_shape(shape);
   }
   derived_ref impl() { return static_cast<derived_ref>(*this); }
   void rebuild() { impl().rebuild(); }
-  std::vector<shape_ptr> many_to_many() { return impl().many_to_many(); }
+  index_type size() const {
+    return static_cast<const t_derived &>(*this).size();
+  }
+
+  // Shapes are indexed in the order they were added with add_collision_shape.
+  // The callback is invoked as callback(first, second) exactly once for each
+  // unordered pair of colliding shapes.
+  template <typename t_callback>
+  void for_each_colliding_pair(t_callback &&callback) {
+    impl().for_each_colliding_pair(std::forward<t_callback>(callback));
+  }
+
+  // Calls callback(first, second) for every pair the structure would pass to
+  // the narrowphase, in the order collide would be called with. The pairs are
+  // a superset of the colliding ones and are not tested at all.
+  template <typename t_callback>
+  void for_each_candidate_pair(t_callback &&callback) {
+    impl().for_each_candidate_pair(std::forward<t_callback>(callback));
+  }
+
+  // Calls callback(index) for every shape whose bounding box overlaps the box.
+  template <typename t_callback>
+  void query_aabb(const aabb_type &box, t_callback &&callback) {
+    impl().query_aabb(box, std::forward<t_callback>(callback));
+  }
+
+  // Calls callback(index) for every shape that contains the point.
+  template <typename t_callback>
+  void query_point(const point_type &point, t_callback &&callback) {
+    impl().query_point(point, std::forward<t_callback>(callback));
+  }
+
+  std::optional<hit_type>
+  raycast(const point_type &origin, const vec_type &dir,
+          value_type tmax = std::numeric_limits<value_type>::max()) {
+    return impl().raycast(origin, dir, tmax);
+  }
+
+  std::vector<index_pair_type> colliding_pairs() {
+    std::vector<index_pair_type> result;
+    for_each_colliding_pair([&result](index_type first, index_type second) {
+      result.emplace_back(first, second);
+    });
+    return result;
+  }
+
+  std::vector<shape_ptr> many_to_many() {
+    std::vector<bool> in_collision(size());
+    for_each_colliding_pair(
+        [&in_collision](index_type first, index_type second) {
+          in_collision[first] = true;
+          in_collision[second] = true;
+        });
+
+    std::vector<shape_ptr> result;
+    for (index_type i = 0; i < in_collision.size(); ++i) {
+      if (in_collision[i])
+        result.push_back(std::addressof(impl().shape_at(i)));
+    }
+    return result;
+  }
 };
 
 } // namespace geometry
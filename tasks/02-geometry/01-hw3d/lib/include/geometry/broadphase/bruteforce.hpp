@@ -13,8 +13,8 @@
 #include "broadphase_structure.hpp"
 #include "geometry/narrowphase/collision_shape.hpp"
 
-#include <algorithm>
-#include <set>
+#include <limits>
+#include <optional>
 #include <vector>
 
 namespace throttle {
@@ -25,7 +25,11 @@ template <typename T, typename t_shape = collision_shape<T>,
               std::enable_if_t<std::is_base_of_v<collision_shape<T>, t_shape>>>
 class bruteforce
     : public broadphase_structure<bruteforce<T, t_shape>, t_shape> {
-  using shape_ptr = t_shape *;
+  using point_type = point3<T>;
+  using vec_type = vec3<T>;
+  using aabb_type = axis_aligned_bb<T>;
+  using hit_type = raycast_hit<T>;
+
   std::vector<t_shape> m_stored_shapes;
 
 public:
@@ -37,27 +41,56 @@ public:
   void add_collision_shape(const shape_type &shape) {
     m_stored_shapes.push_back(shape);
   }
-  void rebuid() { return; }
+  void rebuild() { return; }
+
+  unsigned size() const { return m_stored_shapes.size(); }
+  shape_type &shape_at(unsigned index) { return m_stored_shapes[index]; }
 
-  std::vector<shape_ptr> many_to_many() {
-    std::set<unsigned> in_collision;
+  template <typename t_callback>
+  void for_each_candidate_pair(t_callback &&callback) {
     unsigned size = m_stored_shapes.size();
 
     for (unsigned i = 0; i < size; ++i) {
-      for (unsigned j = i + 1; j < size; ++j) {
-        if (m_stored_shapes[i].collide(m_stored_shapes[j])) {
-          in_collision.insert(i);
-          in_collision.insert(j);
-        }
-      }
+      for (unsigned j = i + 1; j < size; ++j)
+        callback(i, j);
+    }
+  }
+
+  template <typename t_callback>
+  void for_each_colliding_pair(t_callback &&callback) {
+    for_each_candidate_pair([&](unsigned i, unsigned j) {
+      if (m_stored_shapes[i].collide(m_stored_shapes[j]))
+        callback(i, j);
+    });
+  }
+
+  template <typename t_callback>
+  void query_aabb(const aabb_type &box, t_callback &&callback) {
+    for (unsigned i = 0; i < m_stored_shapes.size(); ++i) {
+      if (m_stored_shapes[i].bounding_box().intersect(box))
+        callback(i);
     }
+  }
 
-    std::vector<shape_ptr> result;
-    std::transform(in_collision.begin(), in_collision.end(),
-                   std::back_inserter(result), [&](const auto &elem) {
-                     return std::addressof(m_stored_shapes[elem]);
-                   });
-    return result;
+  template <typename t_callback>
+  void query_point(const point_type &point, t_callback &&callback) {
+    for (unsigned i = 0; i < m_stored_shapes.size(); ++i) {
+      if (m_stored_shapes[i].contains(point))
+        callback(i);
+    }
+  }
+
+  std::optional<hit_type> raycast(const point_type &origin,
+                                  const vec_type &dir,
+                                  T tmax = std::numeric_limits<T>::max()) {
+    std::optional<hit_type> closest;
+    for (unsigned i = 0; i < m_stored_shapes.size(); ++i) {
+      if (auto t = m_stored_shapes[i].ray_intersection(origin, dir, tmax)) {
+        closest = hit_type{i, t.value()};
+        tmax = t.value();
+      }
+    }
+    return closest;
   }
 };
 
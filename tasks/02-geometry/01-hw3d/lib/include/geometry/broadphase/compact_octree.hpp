@@ -0,0 +1,342 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "broadphase_structure.hpp"
+#include "geometry/narrowphase/aabb.hpp"
+#include "geometry/narrowphase/collision_shape.hpp"
+
+#include "geometry/equal.hpp"
+#include "geometry/point3.hpp"
+#include "geometry/vec3.hpp"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace throttle {
+namespace geometry {
+
+// Same partitioning as octree, but nodes are only created where shapes land
+// and are laid out flat in depth-first order. Every node knows where its
+// subtree ends, so traversals are plain forward scans that jump over the
+// subtrees they reject. Shapes themselves are reordered so that each node owns
+// a contiguous range of them, with the original indices kept alongside.
+template <typename T, typename t_shape = collision_shape<T>,
+          typename =
+              std::enable_if_t<std::is_base_of_v<collision_shape<T>, t_shape>>>
+class compact_octree
+    : public broadphase_structure<compact_octree<T, t_shape>, t_shape> {
+  using point_type = point3<T>;
+  using vec_type = vec3<T>;
+  using aabb_type = axis_aligned_bb<T>;
+  using hit_type = raycast_hit<T>;
+
+public:
+  using shape_type = t_shape;
+
+  struct node {
+    point_type m_center;
+    T m_halfwidth;
+    unsigned m_first_shape; // offset into m_stored_shapes
+    unsigned m_shape_count;
+    unsigned m_subtree_end; // index past the last node of the subtree
+  };
+
+private:
+  std::vector<shape_type> m_stored_shapes; // in node order once built
+  std::vector<unsigned> m_shape_ids;       // stored position -> shape index
+  std::vector<unsigned> m_positions;       // shape index -> stored position
+  std::vector<node> m_nodes;
+  bool m_built = false;
+
+  unsigned m_max_depth;
+  T m_min_cell_size_half;
+
+  std::optional<T> m_max_coord, m_min_coord;
+
+  static constexpr unsigned straddling = 8;
+
+public:
+  static constexpr auto default_min_cell_size = T{1.0e-4f};
+  compact_octree(unsigned depth, T min_cell_size = default_min_cell_size)
+      : m_max_depth{depth}, m_min_cell_size_half{min_cell_size / T{2}} {}
+
+  void add_collision_shape(const shape_type &shape) {
+    auto bbox = shape.bounding_box();
+    m_positions.push_back(m_stored_shapes.size());
+    m_shape_ids.push_back(m_stored_shapes.size());
+    m_stored_shapes.push_back(shape);
+    m_built = false;
+
+    point_type min_point = bbox.minimum_corner(),
+               max_point = bbox.maximum_corner();
+    if (!m_max_coord) {
+      m_min_coord = vmin(min_point.x, min_point.y, min_point.z);
+      m_max_coord = vmax(max_point.x, max_point.y, max_point.z);
+      return;
+    }
+
+    m_min_coord =
+        vmin(m_min_coord.value(), min_point.x, min_point.y, min_point.z);
+    m_max_coord =
+        vmax(m_max_coord.value(), max_point.x, max_point.y, max_point.z);
+  }
+
+  void rebuild() {
+    if (m_built)
+      return;
+
+    m_nodes.clear();
+    m_built = true;
+
+    if (!m_max_coord)
+      return;
+
+    auto center_coord = (m_max_coord.value() + m_min_coord.value()) / T{2};
+    auto center = point_type{center_coord, center_coord, center_coord};
+    auto halfwidth = (m_max_coord.value() - m_min_coord.value()) / T{2};
+
+    auto count = m_stored_shapes.size();
+    std::vector<unsigned> order(count), scratch(count);
+    std::vector<unsigned char> octants(count);
+    for (unsigned i = 0; i < count; ++i)
+      order[i] = i;
+    build(center, halfwidth, m_max_depth, 0, count, order, scratch, octants);
+
+    std::vector<shape_type> shapes;
+    shapes.reserve(count);
+    for (unsigned i = 0; i < count; ++i) {
+      shapes.push_back(std::move(m_stored_shapes[order[i]]));
+      scratch[i] = m_shape_ids[order[i]];
+      m_positions[scratch[i]] = i;
+    }
+    m_stored_shapes = std::move(shapes);
+    m_shape_ids = std::move(scratch);
+  }
+
+  unsigned size() const { return m_stored_shapes.size(); }
+  shape_type &shape_at(unsigned index) {
+    return m_stored_shapes[m_positions[index]];
+  }
+
+  const std::vector<node> &nodes() {
+    rebuild();
+    return m_nodes;
+  }
+
+  template <typename t_callback>
+  void for_each_candidate_pair(t_callback &&callback) {
+    for_each_position_pair([&](unsigned first, unsigned second) {
+      callback(m_shape_ids[first], m_shape_ids[second]);
+    });
+  }
+
+  template <typename t_callback>
+  void for_each_colliding_pair(t_callback &&callback) {
+    for_each_position_pair([&](unsigned first, unsigned second) {
+      if (m_stored_shapes[first].collide(m_stored_shapes[second]))
+        callback(m_shape_ids[first], m_shape_ids[second]);
+    });
+  }
+
+  template <typename t_callback>
+  void query_aabb(const aabb_type &box, t_callback &&callback) {
+    rebuild();
+    for (unsigned n = 0; n < m_nodes.size();) {
+      if (!node_box(n).intersect(box)) {
+        n = m_nodes[n].m_subtree_end;
+        continue;
+      }
+      for_each_shape(n, [&](unsigned i) {
+        if (m_stored_shapes[i].bounding_box().intersect(box))
+          callback(m_shape_ids[i]);
+      });
+      ++n;
+    }
+  }
+
+  template <typename t_callback>
+  void query_point(const point_type &point, t_callback &&callback) {
+    rebuild();
+    for (unsigned n = 0; n < m_nodes.size();) {
+      if (!node_box(n).contains(point)) {
+        n = m_nodes[n].m_subtree_end;
+        continue;
+      }
+      for_each_shape(n, [&](unsigned i) {
+        if (m_stored_shapes[i].contains(point))
+          callback(m_shape_ids[i]);
+      });
+      ++n;
+    }
+  }
+
+  std::optional<hit_type> raycast(const point_type &origin, const vec_type &dir,
+                                  T tmax = std::numeric_limits<T>::max()) {
+    rebuild();
+    if (m_nodes.empty() || !node_box(0).ray_intersection(origin, dir, tmax))
+      return std::nullopt;
+
+    std::optional<hit_type> closest;
+    raycast_impl(0, origin, dir, tmax, closest);
+    return closest;
+  }
+
+private:
+  aabb_type node_box(unsigned n) const {
+    return aabb_type{m_nodes[n].m_center, m_nodes[n].m_halfwidth};
+  }
+
+  template <typename t_func> void for_each_shape(unsigned n, t_func func) {
+    auto first = m_nodes[n].m_first_shape;
+    for (auto i = first; i < first + m_nodes[n].m_shape_count; ++i)
+      func(i);
+  }
+
+  // Reports every pair of stored positions whose shapes share a node or lie in
+  // a node and one of its ancestors.
+  template <typename t_report> void for_each_position_pair(t_report report) {
+    rebuild();
+
+    // Nodes come in depth-first order, so the ancestors of a node are exactly
+    // the nodes on the stack whose subtree has not ended yet.
+    std::vector<unsigned> ancestors;
+    ancestors.reserve(m_max_depth + 1);
+
+    for (unsigned n = 0; n < m_nodes.size(); ++n) {
+      while (!ancestors.empty() && m_nodes[ancestors.back()].m_subtree_end <= n)
+        ancestors.pop_back();
+
+      const auto &curr = m_nodes[n];
+      auto first = curr.m_first_shape, last = first + curr.m_shape_count;
+
+      for (auto i_b = first; i_b != last; ++i_b) {
+        for (auto i_a = first; i_a != i_b; ++i_a)
+          report(i_a, i_b);
+      }
+
+      // Shapes of the current node are few and stay in cache, while the shapes
+      // of the ancestors are scanned once and lie contiguously.
+      for (auto a : ancestors) {
+        auto a_first = m_nodes[a].m_first_shape,
+             a_last = a_first + m_nodes[a].m_shape_count;
+        for (auto i_a = a_first; i_a != a_last; ++i_a) {
+          for (auto i_b = first; i_b != last; ++i_b)
+            report(i_a, i_b);
+        }
+      }
+
+      if (curr.m_subtree_end != n + 1)
+        ancestors.push_back(n);
+    }
+  }
+
+  unsigned octant_of(const shape_type &shape, const point_type &center) const {
+    auto bbox = shape.bounding_box();
+    unsigned index = 0;
+    for (unsigned i = 0; i < 3; ++i) {
+      if (bbox.intersect_coodrinate_plane(i, center[i]))
+        return straddling;
+      if (bbox.m_center[i] - center[i] > T{0})
+        index |= (1 << i);
+    }
+    return index;
+  }
+
+  // Appends the subtree of the shapes in order[first, last) in depth-first
+  // order. The range is reordered so that the shapes kept in the node come
+  // first, followed by the ranges of its children.
+  void build(point_type center, T halfwidth, unsigned stop, unsigned first,
+             unsigned last, std::vector<unsigned> &order,
+             std::vector<unsigned> &scratch,
+             std::vector<unsigned char> &octants) {
+    unsigned index = m_nodes.size();
+    m_nodes.push_back(node{center, halfwidth, first, last - first, 0});
+
+    // A single shape gains nothing from descending further.
+    if (!stop || halfwidth < m_min_cell_size_half || last - first < 2) {
+      m_nodes[index].m_subtree_end = m_nodes.size();
+      return;
+    }
+
+    // Counting sort by octant, the shapes kept in this node go first.
+    std::array<unsigned, straddling + 2> offsets{};
+    for (auto i = first; i < last; ++i) {
+      auto octant = octant_of(m_stored_shapes[order[i]], center);
+      octants[order[i]] = octant;
+      ++offsets[(octant + 1) % (straddling + 1) + 1];
+    }
+    for (unsigned i = 1; i < offsets.size(); ++i)
+      offsets[i] += offsets[i - 1];
+
+    auto bounds = offsets;
+    for (auto i = first; i < last; ++i) {
+      auto shape = order[i];
+      scratch[first + offsets[(octants[shape] + 1) % (straddling + 1)]++] =
+          shape;
+    }
+    std::copy(scratch.begin() + first, scratch.begin() + last,
+              order.begin() + first);
+
+    m_nodes[index].m_shape_count = bounds[1];
+
+    T step = halfwidth * T{0.5f};
+    for (unsigned i = 0; i < 8; ++i) {
+      auto child_first = first + bounds[i + 1],
+           child_last = first + bounds[i + 2];
+      if (child_first == child_last)
+        continue;
+
+      vec_type offset{(i & 1) ? step : -step, (i & 2) ? step : -step,
+                      (i & 4) ? step : -step};
+      build(center + offset, step, stop - 1, child_first, child_last, order,
+            scratch, octants);
+    }
+
+    m_nodes[index].m_subtree_end = m_nodes.size();
+  }
+
+  void raycast_impl(unsigned n, const point_type &origin, const vec_type &dir,
+                    T &tmax, std::optional<hit_type> &closest) const {
+    auto first = m_nodes[n].m_first_shape;
+    for (auto i = first; i < first + m_nodes[n].m_shape_count; ++i) {
+      if (auto t = m_stored_shapes[i].ray_intersection(origin, dir, tmax)) {
+        closest = hit_type{m_shape_ids[i], t.value()};
+        tmax = t.value();
+      }
+    }
+
+    // Children follow their parent and each other's subtrees.
+    std::array<std::pair<T, unsigned>, 8> order;
+    unsigned count = 0;
+    for (auto c = n + 1; c < m_nodes[n].m_subtree_end;
+         c = m_nodes[c].m_subtree_end) {
+      auto t = node_box(c).ray_intersection(origin, dir, tmax);
+      if (!t)
+        continue;
+      unsigned pos = count++;
+      for (; pos > 0 && order[pos - 1].first > t.value(); --pos)
+        order[pos] = order[pos - 1];
+      order[pos] = std::make_pair(t.value(), c);
+    }
+
+    for (unsigned i = 0; i < count && order[i].first <= tmax; ++i)
+      raycast_impl(order[i].second, origin, dir, tmax, closest);
+  }
+};
+
+} // namespace geometry
+} // namespace throttle
@@ -0,0 +1,385 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "geometry/equal.hpp"
+#include "geometry/narrowphase/collision_shape.hpp"
+#include "geometry/point3.hpp"
+#include "lbvh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace throttle {
+namespace geometry {
+
+// Memory-lean scene of triangles for very large inputs. Vertices are shared
+// between triangles, which only keep three indices, and shapes are decoded on
+// the fly for the narrowphase. Triangles are grouped by Morton order into
+// small clusters that form the leaves of an implicit complete tree, and the
+// bounding box of every triangle is kept as 16-bit offsets within its cluster.
+template <typename T> class compact_scene {
+public:
+  using value_type = T;
+  using point_type = point3<T>;
+  using shape_type = collision_shape<T>;
+  using index_type = unsigned;
+  using index_pair_type = std::pair<index_type, index_type>;
+
+  static constexpr unsigned cluster_size = 16;
+
+private:
+  using triangle_indices = std::array<std::uint32_t, 3>;
+
+  struct quantized_box {
+    std::array<std::uint16_t, 3> m_min, m_max;
+  };
+
+  struct bounds {
+    std::array<T, 3> m_min, m_max;
+
+    static bounds empty() {
+      constexpr auto inf = std::numeric_limits<T>::infinity();
+      return {{inf, inf, inf}, {-inf, -inf, -inf}};
+    }
+
+    bool intersect(const bounds &other) const {
+      for (unsigned i = 0; i < 3; ++i) {
+        if (m_max[i] < other.m_min[i] || other.m_max[i] < m_min[i])
+          return false;
+      }
+      return true;
+    }
+
+    void merge(const bounds &other) {
+      for (unsigned i = 0; i < 3; ++i) {
+        m_min[i] = vmin(m_min[i], other.m_min[i]);
+        m_max[i] = vmax(m_max[i], other.m_max[i]);
+      }
+    }
+
+    void inflate(T slack) {
+      for (unsigned i = 0; i < 3; ++i) {
+        m_min[i] -= slack;
+        m_max[i] += slack;
+      }
+    }
+  };
+
+  static constexpr std::uint16_t quantized_max =
+      std::numeric_limits<std::uint16_t>::max();
+
+  std::vector<point_type> m_vertices;
+  std::vector<triangle_indices> m_triangles; // in insertion order
+  std::vector<std::uint32_t> m_order;        // triangles in Morton order
+  std::vector<quantized_box> m_boxes;        // same order as m_order
+
+  // Heap layout with the root at 1 and the clusters at m_leaf_base and on.
+  std::vector<bounds> m_nodes;
+  unsigned m_leaf_base = 0;
+
+  unsigned m_unique_vertices = 0;
+  bool m_built = false;
+  T m_slack = T{0};
+
+public:
+  compact_scene(unsigned number_hint = 0) {
+    m_vertices.reserve(3 * number_hint);
+    m_triangles.reserve(number_hint);
+  }
+
+  void add_triangle(const point_type &a, const point_type &b,
+                    const point_type &c) {
+    std::uint32_t first = m_vertices.size();
+    m_vertices.push_back(a);
+    m_vertices.push_back(b);
+    m_vertices.push_back(c);
+    m_triangles.push_back({first, first + 1, first + 2});
+    m_built = false;
+  }
+
+  unsigned size() const { return m_triangles.size(); }
+  unsigned vertex_count() const { return m_vertices.size(); }
+
+  shape_type shape_at(index_type index) const {
+    const auto &tri = m_triangles[index];
+    return shape_from_three_points(m_vertices[tri[0]], m_vertices[tri[1]],
+                                   m_vertices[tri[2]]);
+  }
+
+  // Bytes held by the scene after the build.
+  std::size_t memory_usage() const {
+    return m_vertices.capacity() * sizeof(point_type) +
+           m_triangles.capacity() * sizeof(triangle_indices) +
+           m_order.capacity() * sizeof(std::uint32_t) +
+           m_boxes.capacity() * sizeof(quantized_box) +
+           m_nodes.capacity() * sizeof(bounds);
+  }
+
+  void rebuild() {
+    if (m_built)
+      return;
+
+    deduplicate_vertices();
+    m_triangles.shrink_to_fit();
+    m_built = true;
+
+    const unsigned n = m_triangles.size();
+    m_nodes.clear();
+    if (!n)
+      return;
+
+    auto scene = bounds::empty();
+    for (const auto &tri : m_triangles)
+      scene.merge(triangle_bounds(tri));
+
+    T magnitude = T{1};
+    for (unsigned i = 0; i < 3; ++i)
+      magnitude = vmax(magnitude, std::abs(scene.m_min[i]),
+                       std::abs(scene.m_max[i]));
+    m_slack = default_precision<T>::m_prec * magnitude;
+
+    sort_by_morton_code(scene);
+
+    unsigned clusters = (n + cluster_size - 1) / cluster_size;
+    m_leaf_base = 1;
+    while (m_leaf_base < clusters)
+      m_leaf_base <<= 1;
+
+    m_nodes.assign(2 * m_leaf_base, bounds::empty());
+    for (unsigned i = 0; i < n; ++i)
+      m_nodes[m_leaf_base + i / cluster_size].merge(
+          triangle_bounds(m_triangles[m_order[i]]));
+    for (unsigned k = 0; k < clusters; ++k)
+      m_nodes[m_leaf_base + k].inflate(m_slack);
+    for (unsigned i = m_leaf_base - 1; i > 0; --i) {
+      m_nodes[i] = m_nodes[2 * i];
+      m_nodes[i].merge(m_nodes[2 * i + 1]);
+    }
+
+    m_boxes.resize(n);
+    for (unsigned i = 0; i < n; ++i)
+      m_boxes[i] = quantize(triangle_bounds(m_triangles[m_order[i]]),
+                            m_nodes[m_leaf_base + i / cluster_size]);
+  }
+
+  template <typename t_callback>
+  void for_each_colliding_pair(t_callback &&callback) {
+    rebuild();
+    if (m_nodes.empty())
+      return;
+    self_collide(1, callback);
+  }
+
+  std::vector<index_pair_type> colliding_pairs() {
+    std::vector<index_pair_type> result;
+    for_each_colliding_pair([&result](index_type first, index_type second) {
+      result.emplace_back(first, second);
+    });
+    return result;
+  }
+
+private:
+  bounds triangle_bounds(const triangle_indices &tri) const {
+    auto result = bounds::empty();
+    for (auto idx : tri) {
+      for (unsigned i = 0; i < 3; ++i) {
+        result.m_min[i] = vmin(result.m_min[i], m_vertices[idx][i]);
+        result.m_max[i] = vmax(result.m_max[i], m_vertices[idx][i]);
+      }
+    }
+    return result;
+  }
+
+  // Only exactly equal vertices are merged, so decoded shapes are the same as
+  // the ones that were added.
+  void deduplicate_vertices() {
+    if (m_unique_vertices == m_vertices.size())
+      return;
+
+    auto key = [this](std::uint32_t i) {
+      return std::tie(m_vertices[i].x, m_vertices[i].y, m_vertices[i].z);
+    };
+
+    std::vector<std::uint32_t> order(m_vertices.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&key](auto a, auto b) { return key(a) < key(b); });
+
+    std::vector<std::uint32_t> remap(m_vertices.size());
+    std::vector<point_type> unique;
+    for (unsigned i = 0; i < order.size(); ++i) {
+      if (!i || key(order[i - 1]) != key(order[i]))
+        unique.push_back(m_vertices[order[i]]);
+      remap[order[i]] = unique.size() - 1;
+    }
+
+    for (auto &tri : m_triangles)
+      for (auto &idx : tri)
+        idx = remap[idx];
+
+    unique.shrink_to_fit();
+    m_vertices = std::move(unique);
+    m_unique_vertices = m_vertices.size();
+  }
+
+  void sort_by_morton_code(const bounds &scene) {
+    std::array<T, 3> scale;
+    for (unsigned i = 0; i < 3; ++i) {
+      T extent = scene.m_max[i] - scene.m_min[i];
+      scale[i] = (extent > T{0} ? T{1} / extent : T{0});
+    }
+
+    std::vector<detail::morton_key> keys(m_triangles.size());
+    for (unsigned i = 0; i < keys.size(); ++i) {
+      auto box = triangle_bounds(m_triangles[i]);
+      std::array<T, 3> center;
+      for (unsigned j = 0; j < 3; ++j)
+        center[j] = ((box.m_min[j] + box.m_max[j]) / T{2} - scene.m_min[j]) *
+                    scale[j];
+      keys[i] = {detail::morton_code_63(center[0], center[1], center[2]), i};
+    }
+
+    detail::radix_sort(keys, vmax(std::thread::hardware_concurrency(), 1u));
+
+    m_order.resize(keys.size());
+    for (unsigned i = 0; i < keys.size(); ++i)
+      m_order[i] = keys[i].index;
+  }
+
+  // Rounds outwards and adds a step on both sides, so that the decoded box
+  // always covers the original one.
+  static quantized_box quantize(const bounds &box, const bounds &cluster) {
+    quantized_box result;
+    for (unsigned i = 0; i < 3; ++i) {
+      T extent = cluster.m_max[i] - cluster.m_min[i];
+      if (!(extent > T{0})) {
+        result.m_min[i] = 0;
+        result.m_max[i] = quantized_max;
+        continue;
+      }
+
+      T scale = T{quantized_max} / extent;
+      auto clamp = [](T val) -> std::uint16_t {
+        return std::clamp(val, T{0}, T{quantized_max});
+      };
+      result.m_min[i] =
+          clamp(std::floor((box.m_min[i] - cluster.m_min[i]) * scale) - 1);
+      result.m_max[i] =
+          clamp(std::ceil((box.m_max[i] - cluster.m_min[i]) * scale) + 1);
+    }
+    return result;
+  }
+
+  bounds dequantize(const quantized_box &box, const bounds &cluster) const {
+    bounds result;
+    for (unsigned i = 0; i < 3; ++i) {
+      T step = (cluster.m_max[i] - cluster.m_min[i]) / T{quantized_max};
+      result.m_min[i] = cluster.m_min[i] + box.m_min[i] * step;
+      result.m_max[i] = (box.m_max[i] == quantized_max
+                             ? cluster.m_max[i]
+                             : cluster.m_min[i] + box.m_max[i] * step);
+    }
+    result.inflate(m_slack);
+    return result;
+  }
+
+  // Both children of a node are always on the same level, so leaves are only
+  // ever paired with leaves.
+  template <typename t_callback>
+  void self_collide(unsigned node, t_callback &callback) {
+    if (m_nodes[node].m_min[0] > m_nodes[node].m_max[0]) // Empty subtree
+      return;
+
+    if (node >= m_leaf_base)
+      return collide_clusters(node - m_leaf_base, node - m_leaf_base,
+                              callback);
+
+    self_collide(2 * node, callback);
+    self_collide(2 * node + 1, callback);
+    collide_nodes(2 * node, 2 * node + 1, callback);
+  }
+
+  template <typename t_callback>
+  void collide_nodes(unsigned first, unsigned second, t_callback &callback) {
+    if (!m_nodes[first].intersect(m_nodes[second]))
+      return;
+
+    if (first >= m_leaf_base)
+      return collide_clusters(first - m_leaf_base, second - m_leaf_base,
+                              callback);
+
+    for (unsigned i = 0; i < 2; ++i)
+      for (unsigned j = 0; j < 2; ++j)
+        collide_nodes(2 * first + i, 2 * second + j, callback);
+  }
+
+  struct decoded_cluster {
+    unsigned m_first, m_size;
+    std::array<bounds, cluster_size> m_boxes;
+    std::array<std::optional<shape_type>, cluster_size> m_shapes;
+  };
+
+  void decode_cluster(unsigned cluster, decoded_cluster &result) const {
+    result.m_first = cluster * cluster_size;
+    result.m_size = vmin<unsigned>(cluster_size, size() - result.m_first);
+    const auto &node = m_nodes[m_leaf_base + cluster];
+    for (unsigned i = 0; i < result.m_size; ++i) {
+      result.m_boxes[i] = dequantize(m_boxes[result.m_first + i], node);
+      result.m_shapes[i].reset();
+    }
+  }
+
+  const shape_type &decoded_shape(decoded_cluster &cluster, unsigned i) const {
+    if (!cluster.m_shapes[i])
+      cluster.m_shapes[i] = shape_at(m_order[cluster.m_first + i]);
+    return cluster.m_shapes[i].value();
+  }
+
+  template <typename t_callback>
+  void collide_clusters(unsigned first, unsigned second, t_callback &callback) {
+    decoded_cluster a, b;
+    decode_cluster(first, a);
+    if (first != second)
+      decode_cluster(second, b);
+    auto &other = (first == second ? a : b);
+
+    for (unsigned i = 0; i < a.m_size; ++i) {
+      for (unsigned j = (first == second ? i + 1 : 0); j < other.m_size; ++j) {
+        if (!a.m_boxes[i].intersect(other.m_boxes[j]))
+          continue;
+
+        // The narrowphase is not exactly symmetric for touching shapes, so
+        // test in the order of insertion to match the other broadphases.
+        auto first_idx = m_order[a.m_first + i],
+             second_idx = m_order[other.m_first + j];
+        const auto &first_shape = decoded_shape(a, i),
+                   &second_shape = decoded_shape(other, j);
+        if (first_idx < second_idx ? first_shape.collide(second_shape)
+                                   : second_shape.collide(first_shape))
+          callback(first_idx, second_idx);
+      }
+    }
+  }
+};
+
+} // namespace geometry
+} // namespace throttle
@@ -0,0 +1,162 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "broadphase_structure.hpp"
+#include "geometry/narrowphase/collision_shape.hpp"
+#include "uniform_grid.hpp"
+
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace throttle {
+namespace geometry {
+
+// A stack of uniform grids whose cell sizes grow as powers of two. Every shape
+// goes to the level of its size, so a single huge shape no longer inflates
+// the cells of all the others. A cell of a coarser level is never smaller
+// than any shape of a finer one, hence pairs across levels are found by
+// querying coarser levels with the bounding box of each finer shape.
+template <typename T, typename t_shape = collision_shape<T>,
+          typename =
+              std::enable_if_t<std::is_base_of_v<collision_shape<T>, t_shape>>>
+class hierarchical_grid
+    : public broadphase_structure<hierarchical_grid<T, t_shape>, t_shape> {
+  using point_type = point3<T>;
+  using vec_type = vec3<T>;
+  using aabb_type = axis_aligned_bb<T>;
+  using hit_type = raycast_hit<T>;
+
+  using index_t = unsigned;
+
+  struct level {
+    uniform_grid<T, t_shape> m_grid{0};
+    std::vector<index_t> m_indices; // local index in m_grid -> global index
+  };
+
+  // Levels are keyed by the binary exponent of their largest cell size.
+  // Zero width shapes get the lowest possible key.
+  using level_map = std::map<int, level>;
+  level_map m_levels;
+
+  std::vector<std::pair<int, index_t>> m_locations; // global -> local
+
+public:
+  using shape_type = t_shape;
+
+  hierarchical_grid() = default;
+  hierarchical_grid(index_t number_hint) { m_locations.reserve(number_hint); }
+
+  void add_collision_shape(const shape_type &shape) {
+    auto key = level_of(shape);
+    auto &lvl = m_levels[key];
+    m_locations.emplace_back(key, lvl.m_indices.size());
+    lvl.m_indices.push_back(m_locations.size() - 1);
+    lvl.m_grid.add_collision_shape(shape);
+  }
+
+  void rebuild() {
+    for (auto &[key, lvl] : m_levels)
+      lvl.m_grid.rebuild();
+  }
+
+  unsigned size() const { return m_locations.size(); }
+
+  shape_type &shape_at(index_t index) {
+    auto [key, local] = m_locations[index];
+    return m_levels.at(key).m_grid.shape_at(local);
+  }
+
+  unsigned levels() const { return m_levels.size(); }
+
+  template <typename t_callback>
+  void for_each_candidate_pair(t_callback &&callback) {
+    for_each_pair<false>(callback);
+  }
+
+  template <typename t_callback>
+  void for_each_colliding_pair(t_callback &&callback) {
+    for_each_pair<true>(callback);
+  }
+
+  template <typename t_callback>
+  void query_aabb(const aabb_type &box, t_callback &&callback) {
+    for (auto &[key, lvl] : m_levels)
+      lvl.m_grid.query_aabb(
+          box, [&](index_t local) { callback(lvl.m_indices[local]); });
+  }
+
+  template <typename t_callback>
+  void query_point(const point_type &point, t_callback &&callback) {
+    for (auto &[key, lvl] : m_levels)
+      lvl.m_grid.query_point(
+          point, [&](index_t local) { callback(lvl.m_indices[local]); });
+  }
+
+  // Each level is traced separately; the closest hit so far bounds the rest.
+  std::optional<hit_type> raycast(const point_type &origin, const vec_type &dir,
+                                  T tmax = std::numeric_limits<T>::max()) {
+    std::optional<hit_type> closest;
+    for (auto &[key, lvl] : m_levels) {
+      auto hit = lvl.m_grid.raycast(origin, dir, tmax);
+      if (!hit || (closest && hit->distance >= closest->distance))
+        continue;
+      closest = hit_type{lvl.m_indices[hit->index], hit->distance};
+      tmax = hit->distance;
+    }
+    return closest;
+  }
+
+private:
+  template <bool t_collide, typename t_callback>
+  void for_each_pair(t_callback &callback) {
+    for (auto fine = m_levels.begin(); fine != m_levels.end(); ++fine) {
+      auto &[key, lvl] = *fine;
+      auto report_local = [&](index_t first, index_t second) {
+        callback(lvl.m_indices[first], lvl.m_indices[second]);
+      };
+      if constexpr (t_collide)
+        lvl.m_grid.for_each_colliding_pair(report_local);
+      else
+        lvl.m_grid.for_each_candidate_pair(report_local);
+
+      for (auto coarse = std::next(fine); coarse != m_levels.end(); ++coarse) {
+        auto &coarse_lvl = coarse->second;
+        for (index_t i = 0; i < lvl.m_indices.size(); ++i) {
+          const auto &shape = lvl.m_grid.shape_at(i);
+          coarse_lvl.m_grid.query_aabb(shape.bounding_box(), [&](index_t j) {
+            if (!t_collide || shape.collide(coarse_lvl.m_grid.shape_at(j)))
+              callback(lvl.m_indices[i], coarse_lvl.m_indices[j]);
+          });
+        }
+      }
+    }
+  }
+
+  static int level_of(const shape_type &shape) {
+    auto width = shape.bounding_box().max_width();
+    if (!(width > T{0}))
+      return std::numeric_limits<int>::min();
+
+    int exponent;
+    std::frexp(width, &exponent); // width <= 2^exponent
+    return exponent;
+  }
+};
+
+} // namespace geometry
+} // namespace throttle
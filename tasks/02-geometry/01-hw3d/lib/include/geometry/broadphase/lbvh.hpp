@@ -0,0 +1,542 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "broadphase_structure.hpp"
+#include "geometry/narrowphase/aabb.hpp"
+#include "geometry/narrowphase/collision_shape.hpp"
+
+#include "geometry/equal.hpp"
+#include "geometry/parallel_for.hpp"
+#include "geometry/point3.hpp"
+#include "geometry/vec3.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace throttle {
+namespace geometry {
+
+namespace detail {
+
+// Spread the lower 21 bits of x, so that there are two zero bits between each
+// of them.
+inline std::uint64_t expand_bits_63(std::uint64_t x) {
+  x &= 0x1fffff;
+  x = (x | x << 32) & 0x1f00000000ffff;
+  x = (x | x << 16) & 0x1f0000ff0000ff;
+  x = (x | x << 8) & 0x100f00f00f00f00f;
+  x = (x | x << 4) & 0x10c30c30c30c30c3;
+  x = (x | x << 2) & 0x1249249249249249;
+  return x;
+}
+
+// 63-bit Morton code of a point with coordinates normalized to [0, 1].
+template <typename T> std::uint64_t morton_code_63(T x, T y, T z) {
+  constexpr T scale = T(1u << 21);
+  auto quantize = [scale](T val) -> std::uint64_t {
+    return std::uint64_t(std::clamp(val * scale, T{0}, scale - T{1}));
+  };
+  return (expand_bits_63(quantize(x)) << 2) |
+         (expand_bits_63(quantize(y)) << 1) | expand_bits_63(quantize(z));
+}
+
+struct morton_key {
+  std::uint64_t code;
+  unsigned index;
+};
+
+// Parallel least significant digit radix sort by Morton code. Each pass builds
+// per-thread histograms, turns them into scatter offsets and scatters stably.
+inline void radix_sort(std::vector<morton_key> &keys, unsigned threads) {
+  constexpr unsigned digit_bits = 8, radix = 1u << digit_bits;
+  const unsigned count = keys.size();
+  const unsigned chunks = parallel_for_threads(count, threads);
+
+  std::vector<morton_key> buffer(count);
+  std::vector<std::array<unsigned, radix>> offsets(chunks);
+
+  for (unsigned shift = 0; shift < 64; shift += digit_bits) {
+    auto digit = [shift](const morton_key &key) {
+      return unsigned(key.code >> shift) & (radix - 1);
+    };
+
+    parallel_for(count, threads, [&](unsigned begin, unsigned end, unsigned t) {
+      offsets[t].fill(0);
+      for (unsigned i = begin; i < end; ++i)
+        ++offsets[t][digit(keys[i])];
+    });
+
+    // Skip the pass if all keys share the same digit.
+    std::array<unsigned, radix> totals{};
+    for (unsigned t = 0; t < chunks; ++t)
+      for (unsigned d = 0; d < radix; ++d)
+        totals[d] += offsets[t][d];
+    if (std::find(totals.begin(), totals.end(), count) != totals.end())
+      continue;
+
+    for (unsigned d = 0, running = 0; d < radix; ++d) {
+      for (unsigned t = 0; t < chunks; ++t) {
+        unsigned size = offsets[t][d];
+        offsets[t][d] = running;
+        running += size;
+      }
+    }
+
+    parallel_for(count, threads, [&](unsigned begin, unsigned end, unsigned t) {
+      for (unsigned i = begin; i < end; ++i)
+        buffer[offsets[t][digit(keys[i])]++] = keys[i];
+    });
+
+    keys.swap(buffer);
+  }
+}
+
+} // namespace detail
+
+// Linear bounding volume hierarchy. Shapes are sorted along a Z-order curve by
+// the Morton codes of their bounding box centers, and the hierarchy is emitted
+// as a binary radix tree over the sorted codes [Karras 2012]. Every stage of
+// the build runs in parallel.
+template <typename T, typename t_shape = collision_shape<T>,
+          typename =
+              std::enable_if_t<std::is_base_of_v<collision_shape<T>, t_shape>>>
+class lbvh : public broadphase_structure<lbvh<T, t_shape>, t_shape> {
+  using point_type = point3<T>;
+  using vec_type = vec3<T>;
+  using aabb_type = axis_aligned_bb<T>;
+  using hit_type = raycast_hit<T>;
+  using index_pair_type = std::pair<unsigned, unsigned>;
+
+public:
+  using shape_type = t_shape;
+
+private:
+  struct bounds {
+    point_type m_min, m_max;
+
+    bool intersect(const bounds &other) const {
+      return m_min.x <= other.m_max.x && other.m_min.x <= m_max.x &&
+             m_min.y <= other.m_max.y && other.m_min.y <= m_max.y &&
+             m_min.z <= other.m_max.z && other.m_min.z <= m_max.z;
+    }
+
+    bool contains(const point_type &point) const {
+      return m_min.x <= point.x && point.x <= m_max.x && m_min.y <= point.y &&
+             point.y <= m_max.y && m_min.z <= point.z && point.z <= m_max.z;
+    }
+
+    bounds merge(const bounds &other) const {
+      return {{vmin(m_min.x, other.m_min.x), vmin(m_min.y, other.m_min.y),
+               vmin(m_min.z, other.m_min.z)},
+              {vmax(m_max.x, other.m_max.x), vmax(m_max.y, other.m_max.y),
+               vmax(m_max.z, other.m_max.z)}};
+    }
+
+    aabb_type to_aabb() const { return aabb_type{m_min, m_max}; }
+  };
+
+  static bounds inflated_bounds(const aabb_type &box, T slack) {
+    auto min = box.minimum_corner(), max = box.maximum_corner();
+    vec_type offset = {slack, slack, slack};
+    return {min + offset.neg(), max + offset};
+  }
+
+  // Children with this bit set refer to leaves, i.e. positions in the sorted
+  // array of shapes.
+  static constexpr unsigned leaf_bit = 1u << 31;
+
+  struct internal_node {
+    unsigned m_left, m_right;
+    unsigned m_first, m_last; // Range of covered leaves
+    bounds m_bounds;
+  };
+
+  std::vector<t_shape> m_stored_shapes;
+  std::vector<unsigned> m_sorted_indices; // Leaf -> index of shape
+  std::vector<bounds> m_leaf_bounds;
+  std::vector<internal_node> m_nodes;
+  unsigned m_threads;
+  bool m_built = false;
+
+public:
+  lbvh(unsigned number_hint = 0,
+       unsigned threads = std::thread::hardware_concurrency())
+      : m_threads{std::max(threads, 1u)} {
+    m_stored_shapes.reserve(number_hint);
+  }
+
+  void add_collision_shape(const shape_type &shape) {
+    m_stored_shapes.push_back(shape);
+    m_built = false;
+  }
+
+  unsigned size() const { return m_stored_shapes.size(); }
+  bool empty() const { return m_stored_shapes.empty(); }
+  shape_type &shape_at(unsigned index) { return m_stored_shapes[index]; }
+
+  void rebuild() {
+    if (m_built)
+      return;
+
+    m_built = true;
+    m_nodes.clear();
+    m_leaf_bounds.clear();
+    m_sorted_indices.clear();
+    if (empty())
+      return;
+
+    const unsigned n = m_stored_shapes.size();
+    auto keys = compute_morton_keys();
+    detail::radix_sort(keys, m_threads);
+
+    m_sorted_indices.resize(n);
+    m_leaf_bounds.resize(n);
+    T slack = compute_slack();
+    detail::parallel_for(n, m_threads, [&](unsigned begin, unsigned end, auto) {
+      for (unsigned i = begin; i < end; ++i) {
+        m_sorted_indices[i] = keys[i].index;
+        m_leaf_bounds[i] = inflated_bounds(
+            m_stored_shapes[keys[i].index].bounding_box(), slack);
+      }
+    });
+
+    if (n == 1)
+      return;
+
+    m_nodes.resize(n - 1);
+    // Parents of internal nodes are stored first, followed by leaves.
+    std::vector<unsigned> parents(2 * n - 1);
+    detail::parallel_for(n - 1, m_threads,
+                         [&](unsigned begin, unsigned end, auto) {
+                           for (unsigned i = begin; i < end; ++i)
+                             build_internal_node(keys, i, parents);
+                         });
+
+    compute_bounds(parents);
+  }
+
+  // Pairs of leaves with overlapping bounds, reported serially.
+  template <typename t_callback>
+  void for_each_candidate_pair(t_callback &&callback) {
+    rebuild();
+    if (m_nodes.empty())
+      return;
+
+    std::vector<unsigned> stack;
+    for (unsigned i = 0; i < m_sorted_indices.size(); ++i)
+      overlapping_leaves(i, stack, callback);
+  }
+
+  template <typename t_callback>
+  void for_each_colliding_pair(t_callback &&callback) {
+    rebuild();
+    if (m_nodes.empty())
+      return;
+
+    // Narrowphase runs in parallel, but the callback is invoked from the
+    // calling thread only.
+    const unsigned n = m_sorted_indices.size();
+    std::vector<std::vector<index_pair_type>> found(
+        detail::parallel_for_threads(n, m_threads));
+
+    detail::parallel_for(n, m_threads,
+                         [&](unsigned begin, unsigned end, unsigned t) {
+                           std::vector<unsigned> stack;
+                           auto collide = [&](unsigned first, unsigned second) {
+                             if (m_stored_shapes[first].collide(
+                                     m_stored_shapes[second]))
+                               found[t].emplace_back(first, second);
+                           };
+                           for (unsigned i = begin; i < end; ++i)
+                             overlapping_leaves(i, stack, collide);
+                         });
+
+    for (const auto &pairs : found)
+      for (const auto &[first, second] : pairs)
+        callback(first, second);
+  }
+
+  template <typename t_callback>
+  void query_aabb(const aabb_type &box, t_callback &&callback) {
+    rebuild();
+    auto query = inflated_bounds(box, box_slack(box));
+    traverse([&query](const bounds &b) { return b.intersect(query); },
+             [&](unsigned idx) {
+               if (m_stored_shapes[idx].bounding_box().intersect(box))
+                 callback(idx);
+             });
+  }
+
+  template <typename t_callback>
+  void query_point(const point_type &point, t_callback &&callback) {
+    rebuild();
+    traverse([&point](const bounds &b) { return b.contains(point); },
+             [&](unsigned idx) {
+               if (m_stored_shapes[idx].contains(point))
+                 callback(idx);
+             });
+  }
+
+  // Front to back traversal that prunes nodes farther than the closest hit.
+  std::optional<hit_type> raycast(const point_type &origin,
+                                  const vec_type &dir,
+                                  T tmax = std::numeric_limits<T>::max()) {
+    rebuild();
+    if (empty())
+      return std::nullopt;
+
+    std::optional<hit_type> closest;
+    auto test_leaf = [&](unsigned leaf) {
+      unsigned idx = m_sorted_indices[leaf];
+      if (auto t = m_stored_shapes[idx].ray_intersection(origin, dir, tmax)) {
+        closest = hit_type{idx, t.value()};
+        tmax = t.value();
+      }
+    };
+
+    if (m_nodes.empty()) {
+      test_leaf(0);
+      return closest;
+    }
+
+    auto entry = [&](unsigned child) {
+      return child_bounds(child).to_aabb().ray_intersection(origin, dir, tmax);
+    };
+
+    std::vector<std::pair<T, unsigned>> stack;
+    if (auto t = entry(0))
+      stack.emplace_back(t.value(), 0);
+
+    while (!stack.empty()) {
+      auto [t, node] = stack.back();
+      stack.pop_back();
+      if (t > tmax)
+        continue;
+
+      if (node & leaf_bit) {
+        test_leaf(node & ~leaf_bit);
+        continue;
+      }
+
+      auto t_left = entry(m_nodes[node].m_left),
+           t_right = entry(m_nodes[node].m_right);
+      std::array<std::pair<std::optional<T>, unsigned>, 2> children = {
+          std::make_pair(t_left, m_nodes[node].m_left),
+          std::make_pair(t_right, m_nodes[node].m_right)};
+      // Push the farther child first, so that the nearer one is popped first.
+      if (t_left && t_right && t_left.value() < t_right.value())
+        std::swap(children[0], children[1]);
+      for (const auto &[child_t, child] : children) {
+        if (child_t)
+          stack.emplace_back(child_t.value(), child);
+      }
+    }
+
+    return closest;
+  }
+
+private:
+  std::vector<detail::morton_key> compute_morton_keys() const {
+    const unsigned n = m_stored_shapes.size();
+    point_type low = m_stored_shapes.front().bounding_box().m_center,
+               high = low;
+    for (const auto &shape : m_stored_shapes) {
+      auto center = shape.bounding_box().m_center;
+      low = {vmin(low.x, center.x), vmin(low.y, center.y),
+             vmin(low.z, center.z)};
+      high = {vmax(high.x, center.x), vmax(high.y, center.y),
+              vmax(high.z, center.z)};
+    }
+
+    auto extent = high - low;
+    auto inv = [](T width) { return (width > T{0} ? T{1} / width : T{0}); };
+    vec_type scale = {inv(extent.x), inv(extent.y), inv(extent.z)};
+
+    std::vector<detail::morton_key> keys(n);
+    detail::parallel_for(n, m_threads, [&](unsigned begin, unsigned end, auto) {
+      for (unsigned i = begin; i < end; ++i) {
+        auto center = m_stored_shapes[i].bounding_box().m_center;
+        keys[i] = {detail::morton_code_63((center.x - low.x) * scale.x,
+                                          (center.y - low.y) * scale.y,
+                                          (center.z - low.z) * scale.z),
+                   i};
+      }
+    });
+
+    return keys;
+  }
+
+  // Leaf boxes are inflated, so that the tree reports every pair that
+  // axis_aligned_bb::intersect considers overlapping.
+  T compute_slack() const {
+    T magnitude = T{1};
+    for (const auto &shape : m_stored_shapes)
+      magnitude = vmax(magnitude, box_magnitude(shape.bounding_box()));
+    return default_precision<T>::m_prec * magnitude;
+  }
+
+  static T box_magnitude(const aabb_type &box) {
+    auto min = box.minimum_corner(), max = box.maximum_corner();
+    return vmax(std::abs(min.x), std::abs(min.y), std::abs(min.z),
+                std::abs(max.x), std::abs(max.y), std::abs(max.z));
+  }
+
+  static T box_slack(const aabb_type &box) {
+    return default_precision<T>::m_prec * vmax(T{1}, box_magnitude(box));
+  }
+
+  // Length of the common prefix of the keys at positions i and j. Equal codes
+  // are disambiguated by their positions.
+  static int delta(const std::vector<detail::morton_key> &keys, int i, int j) {
+    if (j < 0 || j >= int(keys.size()))
+      return -1;
+    auto a = keys[i].code, b = keys[j].code;
+    if (a == b)
+      return 64 + std::countl_zero(std::uint32_t(i ^ j));
+    return std::countl_zero(a ^ b);
+  }
+
+  void build_internal_node(const std::vector<detail::morton_key> &keys,
+                           int i, std::vector<unsigned> &parents) {
+    const unsigned n = keys.size();
+
+    // Determine the direction of the range.
+    int d = (delta(keys, i, i + 1) - delta(keys, i, i - 1) >= 0 ? 1 : -1);
+
+    // Compute upper bound for the length of the range.
+    int delta_min = delta(keys, i, i - d);
+    int l_max = 2;
+    while (delta(keys, i, i + l_max * d) > delta_min)
+      l_max *= 2;
+
+    // Find the other end using binary search.
+    int l = 0;
+    for (int t = l_max / 2; t >= 1; t /= 2) {
+      if (delta(keys, i, i + (l + t) * d) > delta_min)
+        l += t;
+    }
+    int j = i + l * d;
+
+    // Find the split position using binary search.
+    int delta_node = delta(keys, i, j);
+    int s = 0;
+    for (int t = (l + 1) / 2;; t = (t + 1) / 2) {
+      if (delta(keys, i, i + (s + t) * d) > delta_node)
+        s += t;
+      if (t == 1)
+        break;
+    }
+    int gamma = i + s * d + std::min(d, 0);
+
+    auto &node = m_nodes[i];
+    node.m_first = std::min(i, j);
+    node.m_last = std::max(i, j);
+    node.m_left = (node.m_first == unsigned(gamma) ? gamma | leaf_bit : gamma);
+    node.m_right = (node.m_last == unsigned(gamma + 1) ? (gamma + 1) | leaf_bit
+                                                        : gamma + 1);
+
+    parents[node_slot(node.m_left, n)] = i;
+    parents[node_slot(node.m_right, n)] = i;
+  }
+
+  static unsigned node_slot(unsigned child, unsigned n) {
+    return (child & leaf_bit) ? (n - 1) + (child & ~leaf_bit) : child;
+  }
+
+  const bounds &child_bounds(unsigned child) const {
+    return (child & leaf_bit) ? m_leaf_bounds[child & ~leaf_bit]
+                              : m_nodes[child].m_bounds;
+  }
+
+  // Bottom-up pass: the second thread to arrive at a node merges the bounds of
+  // its children and continues towards the root.
+  void compute_bounds(const std::vector<unsigned> &parents) {
+    const unsigned n = m_leaf_bounds.size();
+    std::vector<std::atomic<unsigned>> visits(n - 1);
+
+    detail::parallel_for(n, m_threads, [&](unsigned begin, unsigned end, auto) {
+      for (unsigned leaf = begin; leaf < end; ++leaf) {
+        unsigned node = parents[n - 1 + leaf];
+        while (visits[node].fetch_add(1, std::memory_order_acq_rel) == 1) {
+          auto &current = m_nodes[node];
+          current.m_bounds = child_bounds(current.m_left)
+                                 .merge(child_bounds(current.m_right));
+          if (node == 0)
+            break;
+          node = parents[node];
+        }
+      }
+    });
+  }
+
+  template <typename t_report>
+  void overlapping_leaves(unsigned leaf, std::vector<unsigned> &stack,
+                          t_report &report) const {
+    const auto &leaf_bounds = m_leaf_bounds[leaf];
+
+    // Only leaves to the right are tested, so that each pair is found once.
+    stack.clear();
+    stack.push_back(0);
+    while (!stack.empty()) {
+      unsigned node = stack.back();
+      stack.pop_back();
+
+      if (node & leaf_bit) {
+        unsigned other = node & ~leaf_bit;
+        if (other <= leaf || !m_leaf_bounds[other].intersect(leaf_bounds))
+          continue;
+        report(m_sorted_indices[leaf], m_sorted_indices[other]);
+        continue;
+      }
+
+      const auto &current = m_nodes[node];
+      if (current.m_last <= leaf || !current.m_bounds.intersect(leaf_bounds))
+        continue;
+      stack.push_back(current.m_right);
+      stack.push_back(current.m_left);
+    }
+  }
+
+  template <typename t_node_pred, typename t_leaf_func>
+  void traverse(t_node_pred &&node_pred, t_leaf_func &&leaf_func) const {
+    if (empty())
+      return;
+
+    std::vector<unsigned> stack = {m_nodes.empty() ? leaf_bit : 0};
+    while (!stack.empty()) {
+      unsigned node = stack.back();
+      stack.pop_back();
+      if (!node_pred(child_bounds(node)))
+        continue;
+
+      if (node & leaf_bit) {
+        leaf_func(m_sorted_indices[node & ~leaf_bit]);
+        continue;
+      }
+
+      stack.push_back(m_nodes[node].m_right);
+      stack.push_back(m_nodes[node].m_left);
+    }
+  }
+};
+
+} // namespace geometry
+} // namespace throttle
@@ -20,21 +20,32 @@
 
 #include <algorithm>
 #include <array>
-#include <queue>
-#include <set>
-#include <stack>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <type_traits>
 #include <vector>
 
 namespace throttle {
 namespace geometry {
 
+// Depth guess for an octree over number shapes, about a level per decade.
+inline unsigned approximate_optimal_depth(unsigned number) {
+  constexpr unsigned max_depth = 6;
+  if (number < 10)
+    return 0;
+  unsigned log_num = std::log10(float(number));
+  return std::min(max_depth, log_num);
+}
+
 template <typename T, typename t_shape = collision_shape<T>,
           typename =
               std::enable_if_t<std::is_base_of_v<collision_shape<T>, t_shape>>>
 class octree : public broadphase_structure<octree<T, t_shape>, t_shape> {
-  using shape_ptr = t_shape *;
   using point_type = point3<T>;
   using vec_type = vec3<T>;
+  using aabb_type = axis_aligned_bb<T>;
+  using hit_type = raycast_hit<T>;
 
 public:
   using shape_type = t_shape;
@@ -139,10 +150,9 @@ private:
   }
 
   void flush_waiting() {
-    while (!m_waiting_queue.empty()) {
-      insert_shape(m_waiting_queue.back());
-      m_waiting_queue.pop_back();
-    }
+    for (const auto &shape : m_waiting_queue)
+      insert_shape(shape);
+    m_waiting_queue.clear();
   }
 
 public:
@@ -170,14 +180,14 @@ public:
         vmax(m_max_coord.value(), max_point.x, max_point.y, max_point.z);
   }
 
-  void rebuid() {
+  void rebuild() {
     if (!m_waiting_queue.size())
       return;
 
-    // Copy shapes from stored buffer to waiting queue.
-    std::transform(m_stored_shapes.begin(), m_stored_shapes.end(),
-                   std::back_inserter(m_waiting_queue),
-                   [](const auto &elem) { return elem; });
+    // Move shapes from stored buffer to the front of the waiting queue, so
+    // that the insertion order (and thus shape indices) is preserved.
+    m_waiting_queue.insert(m_waiting_queue.begin(), m_stored_shapes.begin(),
+                           m_stored_shapes.end());
     m_stored_shapes.clear();
 
     preconstruct();
@@ -186,12 +196,13 @@ public:
   }
 
 private:
-  struct many_to_many_collider {
+  template <typename t_callback> struct many_to_many_collider {
     std::vector<unsigned> ancestor_stack;
     const octree &tree;
-    std::set<unsigned> in_collision;
+    t_callback &callback;
 
-    many_to_many_collider(const octree &p_tree) : tree{p_tree} {
+    many_to_many_collider(const octree &p_tree, t_callback &p_callback)
+        : tree{p_tree}, callback{p_callback} {
       ancestor_stack.reserve(tree.m_max_depth);
     }
 
@@ -205,11 +216,7 @@ private:
                tree.m_nodes[current_node].m_contained_shape_indexes) {
             if (i_a == i_b)
               break;
-
-            if (tree.m_stored_shapes[i_a].collide(tree.m_stored_shapes[i_b])) {
-              in_collision.insert(i_a);
-              in_collision.insert(i_b);
-            }
+            callback(i_a, i_b);
           }
         }
       }
@@ -233,22 +240,140 @@ public:
     return m_stored_shapes.empty() && m_waiting_queue.empty();
   }
 
-  std::vector<shape_ptr> many_to_many() {
+  unsigned size() const {
+    return m_stored_shapes.size() + m_waiting_queue.size();
+  }
+
+  shape_type &shape_at(unsigned index) {
+    rebuild();
+    return m_stored_shapes[index];
+  }
+
+  // Reports the pairs of shapes in the same node or in a node and one of its
+  // ancestors, i.e. the pairs that the narrowphase has to test.
+  template <typename t_callback>
+  void for_each_candidate_pair(t_callback &&callback) {
     if (empty())
-      return {};
+      return;
 
-    rebuid();
+    rebuild();
 
-    many_to_many_collider collider{*this};
+    many_to_many_collider<std::remove_reference_t<t_callback>> collider{
+        *this, callback};
     collider.collide(root_index());
+  }
+
+  template <typename t_callback>
+  void for_each_colliding_pair(t_callback &&callback) {
+    for_each_candidate_pair([&](unsigned i, unsigned j) {
+      if (m_stored_shapes[i].collide(m_stored_shapes[j]))
+        callback(i, j);
+    });
+  }
 
-    std::vector<shape_ptr> result;
-    std::transform(collider.in_collision.begin(), collider.in_collision.end(),
-                   std::back_inserter(result), [&](const auto &elem) {
-                     return std::addressof(m_stored_shapes[elem]);
-                   });
+  template <typename t_callback>
+  void query_aabb(const aabb_type &box, t_callback &&callback) {
+    if (empty())
+      return;
+
+    rebuild();
+    query_aabb_impl(root_index(), box, callback);
+  }
+
+  template <typename t_callback>
+  void query_point(const point_type &point, t_callback &&callback) {
+    if (empty())
+      return;
+
+    rebuild();
+    query_point_impl(root_index(), point, callback);
+  }
+
+  std::optional<hit_type> raycast(const point_type &origin,
+                                  const vec_type &dir,
+                                  T tmax = std::numeric_limits<T>::max()) {
+    if (empty())
+      return std::nullopt;
+
+    rebuild();
+    if (!node_box(root_index()).ray_intersection(origin, dir, tmax))
+      return std::nullopt;
+
+    std::optional<hit_type> closest;
+    raycast_impl(root_index(), origin, dir, tmax, closest);
+    return closest;
+  }
+
+private:
+  // Every shape is contained in the cell of the node it is stored in, so the
+  // queries only need to descend into the children that the query touches.
+  aabb_type node_box(unsigned node_index) const {
+    return aabb_type{m_nodes[node_index].m_center,
+                     m_nodes[node_index].m_halfwidth};
+  }
+
+  template <typename t_callback>
+  void query_aabb_impl(unsigned node_index, const aabb_type &box,
+                       t_callback &callback) const {
+    const auto &node = m_nodes[node_index];
+    for (const auto &i : node.m_contained_shape_indexes) {
+      if (m_stored_shapes[i].bounding_box().intersect(box))
+        callback(i);
+    }
+
+    for (const auto &c : node.m_children) {
+      if (c && node_box(c).intersect(box))
+        query_aabb_impl(c, box, callback);
+    }
+  }
+
+  template <typename t_callback>
+  void query_point_impl(unsigned node_index, const point_type &point,
+                        t_callback &callback) const {
+    const auto &node = m_nodes[node_index];
+    for (const auto &i : node.m_contained_shape_indexes) {
+      if (m_stored_shapes[i].contains(point))
+        callback(i);
+    }
+
+    // Only the child containing the point is visited, unless the point lies on
+    // a splitting plane.
+    for (const auto &c : node.m_children) {
+      if (c && node_box(c).contains(point))
+        query_point_impl(c, point, callback);
+    }
+  }
+
+  void raycast_impl(unsigned node_index, const point_type &origin,
+                    const vec_type &dir, T &tmax,
+                    std::optional<hit_type> &closest) const {
+    const auto &node = m_nodes[node_index];
+    for (const auto &i : node.m_contained_shape_indexes) {
+      if (auto t = m_stored_shapes[i].ray_intersection(origin, dir, tmax)) {
+        closest = hit_type{i, t.value()};
+        tmax = t.value();
+      }
+    }
+
+    // Visit children in the order the ray enters them and stop as soon as the
+    // closest hit is nearer than the next child.
+    std::array<std::pair<T, unsigned>, 8> order;
+    unsigned count = 0;
+    for (const auto &c : node.m_children) {
+      if (!c)
+        continue;
+      auto t = node_box(c).ray_intersection(origin, dir, tmax);
+      if (!t)
+        continue;
+      // Insertion sort by the entry distance.
+      unsigned pos = count++;
+      for (; pos > 0 && order[pos - 1].first > t.value(); --pos)
+        order[pos] = order[pos - 1];
+      order[pos] = std::make_pair(t.value(), c);
+    }
 
-    return result;
+    for (unsigned i = 0; i < count && order[i].first <= tmax; ++i)
+      raycast_impl(order[i].second, origin, dir, tmax, closest);
   }
 };
 
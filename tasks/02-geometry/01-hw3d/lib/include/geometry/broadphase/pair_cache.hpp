@@ -0,0 +1,270 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "broadphase_structure.hpp"
+#include "geometry/narrowphase/aabb.hpp"
+#include "geometry/narrowphase/collision_shape.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace throttle {
+namespace geometry {
+
+struct pair_cache_stats {
+  unsigned m_new = 0;        // pairs that started colliding this frame
+  unsigned m_persistent = 0; // pairs that kept colliding
+  unsigned m_removed = 0;    // pairs that stopped colliding
+};
+
+// Broadphase for scenes that are queried every frame and barely move. Every
+// shape gets a box fattened by a margin and the pairs of overlapping fat boxes
+// are kept between frames. Only shapes that leave their fat box go through the
+// broadphase again, and the narrowphase is only rerun for pairs with a shape
+// that was updated.
+template <typename T, typename t_shape = collision_shape<T>,
+          typename =
+              std::enable_if_t<std::is_base_of_v<collision_shape<T>, t_shape>>>
+class pair_cache
+    : public broadphase_structure<pair_cache<T, t_shape>, t_shape> {
+  using point_type = point3<T>;
+
+public:
+  using shape_type = t_shape;
+
+private:
+  struct bounds {
+    point_type m_min, m_max;
+
+    bool intersect(const bounds &other) const {
+      for (unsigned i = 0; i < 3; ++i) {
+        if (m_max[i] < other.m_min[i] || other.m_max[i] < m_min[i])
+          return false;
+      }
+      return true;
+    }
+
+    bool contains(const bounds &other) const {
+      for (unsigned i = 0; i < 3; ++i) {
+        if (other.m_min[i] < m_min[i] || m_max[i] < other.m_max[i])
+          return false;
+      }
+      return true;
+    }
+  };
+
+  struct proxy {
+    bounds m_fat;
+    bool m_escaped = true; // has to go through the broadphase again
+    bool m_updated = true; // has to go through the narrowphase again
+  };
+
+  struct pair_state {
+    bool m_colliding = false;
+    bool m_tested = false;
+  };
+
+  T m_margin;
+  std::vector<shape_type> m_stored_shapes;
+  std::vector<proxy> m_proxies;
+
+  // Shapes sorted by the lower x bound of their fat boxes. Only escaped boxes
+  // move, so when few of them did the order is restored with an insertion
+  // sort. New shapes are escaped too, hence the first frame, or any frame where
+  // more than 1 / c_full_sort_fraction of the boxes escaped, is fully sorted.
+  static constexpr unsigned c_full_sort_fraction = 16;
+  std::vector<unsigned> m_sorted;
+  T m_max_fat_width = T{0};
+
+  std::unordered_map<std::uint64_t, pair_state> m_pairs;
+  pair_cache_stats m_stats;
+
+  static std::uint64_t pair_key(unsigned first, unsigned second) {
+    if (first > second)
+      std::swap(first, second);
+    return (std::uint64_t{first} << 32) | second;
+  }
+
+  static std::pair<unsigned, unsigned> key_pair(std::uint64_t key) {
+    return {unsigned(key >> 32), unsigned(key & 0xffffffff)};
+  }
+
+  bounds tight_bounds(const shape_type &shape) const {
+    auto box = shape.bounding_box();
+    return {box.minimum_corner(), box.maximum_corner()};
+  }
+
+  bounds fatten(const bounds &box) const {
+    auto margin = vec3<T>{m_margin, m_margin, m_margin};
+    return {box.m_min + (-margin), box.m_max + margin};
+  }
+
+public:
+  pair_cache(T margin) : m_margin{margin} {}
+
+  unsigned add_collision_shape(const shape_type &shape) {
+    unsigned index = m_stored_shapes.size();
+    m_stored_shapes.push_back(shape);
+    m_proxies.push_back({fatten(tight_bounds(shape))});
+    m_sorted.push_back(index);
+    return index;
+  }
+
+  // Replaces the shape, but keeps its fat box if the shape still fits in it.
+  void update_collision_shape(unsigned index, const shape_type &shape) {
+    m_stored_shapes[index] = shape;
+
+    auto &proxy = m_proxies[index];
+    proxy.m_updated = true;
+
+    auto box = tight_bounds(shape);
+    if (proxy.m_fat.contains(box))
+      return;
+
+    proxy.m_fat = fatten(box);
+    proxy.m_escaped = true;
+  }
+
+  void rebuild() {
+    m_stats = {};
+
+    auto escaped = std::count_if(m_proxies.begin(), m_proxies.end(),
+                                 [](const auto &p) { return p.m_escaped; });
+    if (escaped) {
+      drop_separated_pairs();
+      sort_proxies(escaped);
+      find_new_pairs();
+    }
+
+    run_narrowphase();
+  }
+
+  unsigned size() const { return m_stored_shapes.size(); }
+  shape_type &shape_at(unsigned index) { return m_stored_shapes[index]; }
+
+  // Pair counts of the last rebuild, i.e. of the last frame.
+  pair_cache_stats stats() const { return m_stats; }
+
+  template <typename t_callback>
+  void for_each_colliding_pair(t_callback &&callback) {
+    rebuild();
+    for (const auto &[key, state] : m_pairs) {
+      if (state.m_colliding) {
+        auto [first, second] = key_pair(key);
+        callback(first, second);
+      }
+    }
+  }
+
+private:
+  void drop_separated_pairs() {
+    for (auto it = m_pairs.begin(); it != m_pairs.end();) {
+      auto [first, second] = key_pair(it->first);
+      const auto &a = m_proxies[first], &b = m_proxies[second];
+      if ((a.m_escaped || b.m_escaped) && !a.m_fat.intersect(b.m_fat)) {
+        m_stats.m_removed += it->second.m_colliding;
+        it = m_pairs.erase(it);
+        continue;
+      }
+      ++it;
+    }
+  }
+
+  void sort_proxies(std::size_t escaped) {
+    auto less = [this](unsigned a, unsigned b) {
+      return m_proxies[a].m_fat.m_min.x < m_proxies[b].m_fat.m_min.x;
+    };
+
+    // Insertion sort is quadratic in the number of boxes that moved far.
+    if (escaped * c_full_sort_fraction > m_sorted.size()) {
+      std::sort(m_sorted.begin(), m_sorted.end(), less);
+    } else {
+      for (unsigned i = 1; i < m_sorted.size(); ++i) {
+        auto value = m_sorted[i];
+        auto j = i;
+        for (; j > 0 && less(value, m_sorted[j - 1]); --j)
+          m_sorted[j] = m_sorted[j - 1];
+        m_sorted[j] = value;
+      }
+    }
+
+    m_max_fat_width = T{0};
+    for (const auto &p : m_proxies) {
+      auto width = p.m_fat.m_max.x - p.m_fat.m_min.x;
+      m_max_fat_width = vmax(m_max_fat_width, width);
+    }
+  }
+
+  // Every box that overlaps an escaped one along x starts at most the widest
+  // box width before it, so only a short range of the sorted order is tested.
+  void find_new_pairs() {
+    auto lower_x = [this](unsigned idx) {
+      return m_proxies[idx].m_fat.m_min.x;
+    };
+
+    for (unsigned idx = 0; idx < m_proxies.size(); ++idx) {
+      auto &proxy = m_proxies[idx];
+      if (!proxy.m_escaped)
+        continue;
+
+      auto first = std::lower_bound(
+          m_sorted.begin(), m_sorted.end(),
+          proxy.m_fat.m_min.x - m_max_fat_width,
+          [&](unsigned other, T value) { return lower_x(other) < value; });
+
+      for (auto it = first;
+           it != m_sorted.end() && lower_x(*it) <= proxy.m_fat.m_max.x; ++it) {
+        auto other = *it;
+        if (other == idx || !proxy.m_fat.intersect(m_proxies[other].m_fat))
+          continue;
+        // Pairs of two escaped shapes are seen twice, try_emplace keeps one.
+        m_pairs.try_emplace(pair_key(idx, other));
+      }
+
+      proxy.m_escaped = false;
+    }
+  }
+
+  void run_narrowphase() {
+    for (auto &[key, state] : m_pairs) {
+      auto [first, second] = key_pair(key);
+      bool needs_test = !state.m_tested || m_proxies[first].m_updated ||
+                        m_proxies[second].m_updated;
+
+      if (needs_test) {
+        bool colliding =
+            m_stored_shapes[first].collide(m_stored_shapes[second]);
+        if (colliding && !state.m_colliding)
+          ++m_stats.m_new;
+        else if (colliding)
+          ++m_stats.m_persistent;
+        else if (state.m_colliding)
+          ++m_stats.m_removed;
+        state = {colliding, true};
+        continue;
+      }
+
+      m_stats.m_persistent += state.m_colliding;
+    }
+
+    for (auto &p : m_proxies)
+      p.m_updated = false;
+  }
+};
+
+} // namespace geometry
+} // namespace throttle
@@ -19,10 +19,10 @@
 #include <algorithm>
 #include <array>
 #include <cmath>
-#include <list>
-#include <set>
+#include <limits>
+#include <optional>
+#include <type_traits>
 #include <unordered_map>
-#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -32,10 +32,23 @@ namespace throttle {
 namespace geometry {
 
 namespace detail {
+// Cells further from the origin than this are merged into the outermost one.
+// Clamping keeps adjacent cells adjacent, and the margin leaves room for the
+// +-1 offsets and extents computed by queries without overflowing int.
+inline constexpr int c_max_cell_coord = 1 << 29;
+
+template <typename T> int convert_to_int_coord(T coord) {
+  auto limit = static_cast<T>(c_max_cell_coord);
+  if (!(coord > -limit)) // NaN ends up here as well
+    return -c_max_cell_coord;
+  if (!(coord < limit))
+    return c_max_cell_coord;
+  return static_cast<int>(std::floor(coord));
+}
+
 template <typename T> vec3<int> convert_to_int_vector(const vec3<T> &vec) {
-  return vec3<int>{static_cast<int>(std::floor(vec.x)),
-                   static_cast<int>(std::floor(vec.y)),
-                   static_cast<int>(std::floor(vec.z))};
+  return vec3<int>{convert_to_int_coord(vec.x), convert_to_int_coord(vec.y),
+                   convert_to_int_coord(vec.z)};
 }
 } // namespace detail
 
@@ -44,13 +57,14 @@ template <typename T, typename t_shape = collision_shape<T>,
               std::enable_if_t<std::is_base_of_v<collision_shape<T>, t_shape>>>
 class uniform_grid
     : public broadphase_structure<uniform_grid<T, t_shape>, t_shape> {
-  using shape_ptr = t_shape *;
 
   using int_point_type = point3<int>;
   using int_vector_type = vec3<int>;
 
   using point_type = point3<T>;
   using vector_type = vec3<T>;
+  using aabb_type = axis_aligned_bb<T>;
+  using hit_type = raycast_hit<T>;
 
   using index_t = unsigned;
   using cell_type = int_vector_type;
@@ -121,36 +135,203 @@ public:
                      bbox_max_corner.z);
   }
 
-  std::vector<shape_ptr> many_to_many() {
+  unsigned size() const {
+    return m_stored_shapes.size() + m_waiting_queue.size();
+  }
+
+  shape_type &shape_at(index_t index) {
+    rebuild();
+    return m_stored_shapes[index].first;
+  }
+
+  template <typename t_callback>
+  void for_each_candidate_pair(t_callback &&callback) {
     rebuild();
 
-    many_to_many_collider collider(m_map, m_stored_shapes);
+    many_to_many_collider<std::remove_reference_t<t_callback>> collider(
+        m_map, m_stored_shapes, callback);
     collider.collide();
+  }
 
-    std::vector<shape_ptr> result;
-    std::transform(collider.in_collision.begin(), collider.in_collision.end(),
-                   std::back_inserter(result), [&](const auto &idx) {
-                     return std::addressof(m_stored_shapes[idx].first);
-                   });
-    return result;
+  template <typename t_callback>
+  void for_each_colliding_pair(t_callback &&callback) {
+    for_each_candidate_pair([&](index_t first, index_t second) {
+      if (m_stored_shapes[first].first.collide(m_stored_shapes[second].first))
+        callback(first, second);
+    });
   }
 
-  void flush_waiting() {
-    while (
-        !m_waiting_queue.empty()) { // insert all the new shapes into the grid
-      insert(m_waiting_queue.back());
-      m_waiting_queue.pop_back();
+  // A shape is stored in the cell of its center and is not wider than a cell,
+  // so it can only overlap its own cell and the neighbouring ones. Queries
+  // therefore look one cell further than the queried region.
+  template <typename t_callback>
+  void query_aabb(const aabb_type &box, t_callback &&callback) {
+    rebuild();
+    if (m_stored_shapes.empty())
+      return;
+
+    auto min_cell = cell_of(box.minimum_corner()) - cell_type{1, 1, 1};
+    auto max_cell = cell_of(box.maximum_corner()) + cell_type{1, 1, 1};
+
+    auto visit_bucket = [&](const shape_idx_vec_t &bucket) {
+      for (auto idx : bucket) {
+        if (m_stored_shapes[idx].first.bounding_box().intersect(box))
+          callback(idx);
+      }
+    };
+
+    // For huge boxes it is cheaper to walk the occupied cells only.
+    auto extent = max_cell - min_cell + cell_type{1, 1, 1};
+    if (double(extent.x) * extent.y * extent.z > m_map.size()) {
+      for (const auto &[cell, bucket] : m_map) {
+        if (in_range(cell, min_cell, max_cell))
+          visit_bucket(bucket);
+      }
+      return;
+    }
+
+    for (int x = min_cell.x; x <= max_cell.x; ++x)
+      for (int y = min_cell.y; y <= max_cell.y; ++y)
+        for (int z = min_cell.z; z <= max_cell.z; ++z) {
+          auto found = m_map.find(cell_type{x, y, z});
+          if (found != m_map.end())
+            visit_bucket(found->second);
+        }
+  }
+
+  template <typename t_callback>
+  void query_point(const point_type &point, t_callback &&callback) {
+    rebuild();
+    if (m_stored_shapes.empty())
+      return;
+
+    auto center = cell_of(point);
+    for (const auto &offset : neighbour_offsets()) {
+      auto found = m_map.find(center + offset);
+      if (found == m_map.end())
+        continue;
+      for (auto idx : found->second) {
+        if (m_stored_shapes[idx].first.contains(point))
+          callback(idx);
+      }
     }
   }
 
+  // Walks the cells along the ray with 3D-DDA and stops as soon as the closest
+  // hit lies inside the cells visited so far.
+  std::optional<hit_type> raycast(const point_type &origin,
+                                  const vector_type &dir,
+                                  T tmax = std::numeric_limits<T>::max()) {
+    rebuild();
+    if (m_stored_shapes.empty())
+      return std::nullopt;
+
+    auto low = point_type{m_min_val.value(), m_min_val.value(),
+                          m_min_val.value()},
+         high = point_type{m_max_val.value(), m_max_val.value(),
+                           m_max_val.value()};
+    auto entry = aabb_type{low, high}.ray_intersection(origin, dir, tmax);
+    if (!entry)
+      return std::nullopt;
+
+    auto min_cell = cell_of(low) - cell_type{1, 1, 1};
+    auto max_cell = cell_of(high) + cell_type{1, 1, 1};
+    if (is_clamped(min_cell + cell_type{1, 1, 1}) ||
+        is_clamped(max_cell - cell_type{1, 1, 1}))
+      return raycast_all(origin, dir, tmax);
+
+    auto cell = cell_of(origin + entry.value() * dir);
+
+    cell_type step;
+    vector_type t_next, t_delta;
+    for (unsigned i = 0; i < 3; ++i) {
+      if (dir[i] == T{0}) {
+        step[i] = 0;
+        t_next[i] = t_delta[i] = std::numeric_limits<T>::max();
+        continue;
+      }
+      step[i] = (dir[i] > T{0} ? 1 : -1);
+      T boundary = (cell[i] + (step[i] > 0 ? 1 : 0)) * m_cell_size;
+      t_next[i] = (boundary - origin[i]) / dir[i];
+      t_delta[i] = m_cell_size / std::abs(dir[i]);
+    }
+
+    std::optional<hit_type> closest;
+    auto test_cell = [&](const cell_type &neighbour) {
+      auto found = m_map.find(neighbour);
+      if (found == m_map.end())
+        return;
+      for (auto idx : found->second) {
+        auto t = m_stored_shapes[idx].first.ray_intersection(origin, dir, tmax);
+        if (t && (!closest || t.value() < closest->distance)) {
+          closest = hit_type{idx, t.value()};
+          tmax = t.value();
+        }
+      }
+    };
+
+    if (!in_range(cell, min_cell, max_cell))
+      return std::nullopt;
+    for (const auto &offset : neighbour_offsets())
+      test_cell(cell + offset);
+
+    // The walk is monotone along every axis, so a step only brings in the 3x3
+    // slab of neighbours in front of the new cell, none of them seen before.
+    while (true) {
+      auto axis = t_next.x < t_next.y ? (t_next.x < t_next.z ? 0 : 2)
+                                      : (t_next.y < t_next.z ? 1 : 2);
+      if (!step[axis] || t_next[axis] > tmax) // tmax shrinks to the closest hit
+        break;
+
+      cell[axis] += step[axis];
+      t_next[axis] += t_delta[axis];
+      if (!in_range(cell, min_cell, max_cell))
+        break;
+
+      auto first = (axis + 1) % 3, second = (axis + 2) % 3;
+      for (int i = -1; i <= 1; ++i) {
+        for (int j = -1; j <= 1; ++j) {
+          auto neighbour = cell;
+          neighbour[axis] += step[axis];
+          neighbour[first] += i;
+          neighbour[second] += j;
+          test_cell(neighbour);
+        }
+      }
+    }
+
+    return closest;
+  }
+
+  void flush_waiting() {
+    for (const auto &shape :
+         m_waiting_queue) // insert all the new shapes into the grid
+      insert(shape);
+    m_waiting_queue.clear();
+  }
+
   void rebuild() {
+    if (m_waiting_queue.empty())
+      return;
+
     m_map.clear();
 
+    // Put already stored shapes in front of the new ones to preserve the
+    // insertion order.
+    std::vector<t_shape> shapes;
+    shapes.reserve(size());
     std::transform(m_stored_shapes.begin(), m_stored_shapes.end(),
-                   std::back_inserter(m_waiting_queue),
+                   std::back_inserter(shapes),
                    [&](const auto &pair) { return pair.first; });
+    std::move(m_waiting_queue.begin(), m_waiting_queue.end(),
+              std::back_inserter(shapes));
+    m_waiting_queue = std::move(shapes);
     m_stored_shapes.clear();
 
+    // A scene of points only has zero width, but any cell size fits it.
+    if (m_cell_size == T{0})
+      m_cell_size = T{1};
+
     flush_waiting();
   }
 
@@ -171,13 +352,47 @@ private:
     m_map[cell].push_back(old_stored_size);
   }
 
+  cell_type cell_of(const point_type &point) const {
+    return detail::convert_to_int_vector((point - point_type::origin()) /
+                                         m_cell_size);
+  }
+
   cell_type compute_cell(const shape_type &shape) const {
-    auto bbox = shape.bounding_box();
-    auto min_corner = bbox.m_center - point_type::origin();
-    return detail::convert_to_int_vector(min_corner / m_cell_size);
+    return cell_of(shape.bounding_box().m_center);
+  }
+
+  static bool is_clamped(const cell_type &cell) {
+    for (unsigned i = 0; i < 3; ++i) {
+      if (cell[i] == detail::c_max_cell_coord ||
+          cell[i] == -detail::c_max_cell_coord)
+        return true;
+    }
+    return false;
+  }
+
+  // Cells of a scene that doesn't fit the clamped range don't match the
+  // positions 3D-DDA steps through, so such rays check every shape.
+  std::optional<hit_type> raycast_all(const point_type &origin,
+                                      const vector_type &dir, T tmax) const {
+    std::optional<hit_type> closest;
+    for (index_t idx = 0; idx < m_stored_shapes.size(); ++idx) {
+      auto t = m_stored_shapes[idx].first.ray_intersection(origin, dir, tmax);
+      if (t && (!closest || t.value() < closest->distance)) {
+        closest = hit_type{idx, t.value()};
+        tmax = t.value();
+      }
+    }
+    return closest;
+  }
+
+  static bool in_range(const cell_type &cell, const cell_type &min_cell,
+                       const cell_type &max_cell) {
+    return min_cell.x <= cell.x && cell.x <= max_cell.x &&
+           min_cell.y <= cell.y && cell.y <= max_cell.y &&
+           min_cell.z <= cell.z && cell.z <= max_cell.z;
   }
 
-  static constexpr std::array<int_vector_type, 27> offsets() {
+  static constexpr std::array<int_vector_type, 27> neighbour_offsets() {
     std::array<int_vector_type, 27> result{};
 
     std::size_t index = 0;
@@ -192,31 +407,49 @@ private:
     return result;
   }
 
-  struct many_to_many_collider {
-    std::set<index_t> in_collision;
+  // Offsets to the neighbouring cells that are lexicographically greater than
+  // the current one. Each pair of neighbouring cells is visited only once.
+  static constexpr std::array<int_vector_type, 13> forward_offsets() {
+    std::array<int_vector_type, 13> result{};
+
+    std::size_t index = 0;
+    for (int i = -1; i <= 1; ++i) {
+      for (int j = -1; j <= 1; ++j) {
+        for (int k = -1; k <= 1; ++k) {
+          if (i > 0 || (i == 0 && (j > 0 || (j == 0 && k > 0))))
+            result[index++] = {i, j, k};
+        }
+      }
+    }
+
+    return result;
+  }
+
+  template <typename t_callback> struct many_to_many_collider {
     map_t &map;
     const std::vector<stored_shapes_elem_t> &stored_shapes;
+    t_callback &callback;
 
     many_to_many_collider(
-        map_t &map_a, const std::vector<stored_shapes_elem_t> &stored_shapes_a)
-        : map(map_a), stored_shapes(stored_shapes_a) {}
+        map_t &map_a, const std::vector<stored_shapes_elem_t> &stored_shapes_a,
+        t_callback &callback_a)
+        : map(map_a), stored_shapes(stored_shapes_a), callback(callback_a) {}
 
-    void collide() { // fills "in_collision" set with all intersecting shapes in
-                     // the grid
+    void collide() { // reports every pair of shapes in neighbouring cells
+      constexpr auto offsets_a = forward_offsets();
       for (auto &bucket : map) { // For each cell we will test
-        auto offsets_a = offsets();
-        for (auto &offset : offsets_a) { // all the neighbors
+        auto &shapes = bucket.second;
+        for (index_t i = 0; i < shapes.size(); ++i) // the shapes in the cell
+          for (index_t j = i + 1; j < shapes.size(); ++j)
+            callback(shapes[i], shapes[j]);
+
+        for (auto &offset : offsets_a) { // and the neighbors
           auto bucket_to_test_with_it = map.find(bucket.first + offset);
-          if (bucket_to_test_with_it !=
-              map.end()) // for all of the shapes they containes to intersect
-            for (auto to_test_idx : bucket.second)
-              for (auto to_test_with_idx : bucket_to_test_with_it->second)
-                if (to_test_idx != to_test_with_idx &&
-                    stored_shapes[to_test_idx].first.collide(
-                        stored_shapes[to_test_with_idx].first)) {
-                  in_collision.insert(to_test_idx);
-                  in_collision.insert(to_test_with_idx);
-                }
+          if (bucket_to_test_with_it == map.end())
+            continue;
+          for (auto to_test_idx : shapes)
+            for (auto to_test_with_idx : bucket_to_test_with_it->second)
+              callback(to_test_idx, to_test_with_idx);
         }
       }
     };
@@ -0,0 +1,122 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace throttle {
+namespace geometry {
+
+// Read-only view of a whole file. Regular files are mapped into memory, while
+// pipes and terminals, which can't be mapped, are read into a buffer instead.
+class mapped_file {
+  const char *m_data = nullptr;
+  std::size_t m_size = 0;
+  bool m_mapped = false;
+  std::vector<char> m_buffer;
+
+public:
+  // The descriptor is not closed and can be closed right after construction.
+  explicit mapped_file(int fd) {
+    struct stat info;
+    if (fstat(fd, &info) == -1)
+      throw std::runtime_error{error_message("fstat")};
+
+    if (S_ISREG(info.st_mode) && info.st_size > 0) {
+      void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        madvise(data, info.st_size, MADV_SEQUENTIAL);
+        m_data = static_cast<const char *>(data);
+        m_size = info.st_size;
+        m_mapped = true;
+        return;
+      }
+    }
+
+    read_all(fd);
+  }
+
+  explicit mapped_file(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+      throw std::runtime_error{"Can't open " + path};
+    try {
+      *this = mapped_file{fd};
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+    close(fd);
+  }
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  mapped_file(mapped_file &&other) noexcept { swap(other); }
+  mapped_file &operator=(mapped_file &&other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  ~mapped_file() {
+    if (m_mapped)
+      munmap(const_cast<char *>(m_data), m_size);
+  }
+
+  std::string_view view() const { return {m_data, m_size}; }
+  bool mapped() const { return m_mapped; }
+
+private:
+  void swap(mapped_file &other) noexcept {
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+    std::swap(m_mapped, other.m_mapped);
+    std::swap(m_buffer, other.m_buffer);
+  }
+
+  void read_all(int fd) {
+    constexpr std::size_t block_size = 1 << 16;
+    std::size_t size = 0;
+    for (;;) {
+      m_buffer.resize(size + block_size);
+      auto count = read(fd, m_buffer.data() + size, block_size);
+      if (count == -1 && errno == EINTR)
+        continue;
+      if (count == -1)
+        throw std::runtime_error{error_message("read")};
+      if (count == 0)
+        break;
+      size += count;
+    }
+
+    m_buffer.resize(size);
+    m_data = m_buffer.data();
+    m_size = size;
+  }
+
+  static std::string error_message(const char *call) {
+    return std::string{call} + " failed: " + std::strerror(errno);
+  }
+};
+
+} // namespace geometry
+} // namespace throttle
@@ -0,0 +1,212 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "geometry/parallel_for.hpp"
+#include "geometry/point3.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace throttle {
+namespace geometry {
+
+// Vertex coordinates of triangles as they come from the input, nine per
+// triangle in the order a, b, c.
+template <typename T> struct triangle_soup {
+  std::vector<T> m_coords;
+
+  unsigned size() const { return m_coords.size() / 9; }
+  point3<T> vertex(unsigned tri, unsigned v) const {
+    const T *p = m_coords.data() + 9 * std::size_t{tri} + 3 * v;
+    return {p[0], p[1], p[2]};
+  }
+};
+
+namespace detail {
+
+inline bool is_space(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+inline std::size_t skip_spaces(std::string_view text, std::size_t pos) {
+  while (pos < text.size() && is_space(text[pos]))
+    ++pos;
+  return pos;
+}
+
+// Numbers of one chunk and whether the chunk ended in a malformed number.
+template <typename T> struct parsed_chunk {
+  std::vector<T> m_numbers;
+  bool m_malformed = false;
+};
+
+// Parses every number that starts in text[first, last). Both bounds have to be
+// either the ends of the text or whitespace, so that no number is split.
+template <typename T>
+void parse_numbers(std::string_view text, std::size_t first, std::size_t last,
+                   parsed_chunk<T> &result) {
+  result.m_numbers.reserve((last - first) / 8);
+  for (auto pos = skip_spaces(text, first); pos < last;
+       pos = skip_spaces(text, pos)) {
+    // from_chars doesn't accept the plus sign that operator>> allows.
+    auto begin = text.data() + pos + (text[pos] == '+');
+    T value;
+    auto [ptr, ec] = std::from_chars(begin, text.data() + last, value);
+    if (ec != std::errc{} ||
+        (ptr != text.data() + last && !is_space(*ptr))) {
+      result.m_malformed = true;
+      return;
+    }
+    result.m_numbers.push_back(value);
+    pos = ptr - text.data();
+  }
+}
+
+inline std::size_t next_space(std::string_view text, std::size_t pos) {
+  while (pos < text.size() && !is_space(text[pos]))
+    ++pos;
+  return pos;
+}
+
+inline std::runtime_error triangle_error(std::size_t index) {
+  return std::runtime_error{"Can't read i-th = " + std::to_string(index) +
+                            " triangle"};
+}
+
+} // namespace detail
+
+// Parses the text format: the number of triangles followed by their vertex
+// coordinates, separated by any whitespace. The text is cut into one chunk per
+// thread at whitespace, the chunks are parsed with std::from_chars and their
+// numbers are copied to the final array in parallel as well.
+template <typename T>
+triangle_soup<T> parse_text_triangles(std::string_view text,
+                                      unsigned threads) {
+  auto pos = detail::skip_spaces(text, 0);
+  unsigned count = 0;
+  auto [ptr, ec] =
+      std::from_chars(text.data() + pos, text.data() + text.size(), count);
+  if (ec != std::errc{})
+    throw std::runtime_error{"Can't read number of triangles"};
+
+  auto body = text.substr(ptr - text.data());
+  if (body.size() > std::numeric_limits<unsigned>::max())
+    throw std::runtime_error{"Input is too large"};
+
+  // Chunk boundaries are moved forward to the next whitespace.
+  auto adjust = [body](std::size_t bound) {
+    return bound == 0 ? bound : detail::next_space(body, bound);
+  };
+
+  std::vector<detail::parsed_chunk<T>> chunks(
+      detail::parallel_for_threads(body.size(), threads));
+  detail::parallel_for(body.size(), threads,
+                       [&](unsigned begin, unsigned end, unsigned t) {
+                         detail::parse_numbers(body, adjust(begin), adjust(end),
+                                               chunks[t]);
+                       });
+
+  std::size_t needed = 9 * std::size_t{count}, available = 0;
+  std::vector<std::size_t> offsets;
+  for (const auto &chunk : chunks) {
+    offsets.push_back(available);
+    available += chunk.m_numbers.size();
+    if (chunk.m_malformed && available < needed)
+      throw detail::triangle_error(available / 9);
+  }
+  if (available < needed)
+    throw detail::triangle_error(available / 9);
+
+  triangle_soup<T> result;
+  result.m_coords.resize(needed);
+  auto copy_chunk = [&](unsigned, unsigned, unsigned t) {
+    const auto &numbers = chunks[t].m_numbers;
+    auto first = std::min(offsets[t], needed);
+    auto last = std::min(offsets[t] + numbers.size(), needed);
+    std::copy(numbers.begin(), numbers.begin() + (last - first),
+              result.m_coords.begin() + first);
+  };
+  detail::parallel_for(body.size(), threads, copy_chunk);
+
+  return result;
+}
+
+// The binary format is a plain array of little-endian 32-bit floats, nine per
+// triangle, without any header.
+template <typename T>
+triangle_soup<T> parse_binary_triangles(std::string_view data) {
+  constexpr std::size_t triangle_size = 9 * sizeof(float);
+  static_assert(sizeof(float) == sizeof(std::uint32_t));
+
+  if (data.size() % triangle_size)
+    throw detail::triangle_error(data.size() / triangle_size);
+
+  triangle_soup<T> result;
+  result.m_coords.resize(data.size() / sizeof(float));
+  for (std::size_t i = 0; i < result.m_coords.size(); ++i) {
+    std::uint32_t bits;
+    std::memcpy(&bits, data.data() + i * sizeof(float), sizeof(float));
+    if constexpr (std::endian::native == std::endian::big)
+      bits = (bits >> 24) | ((bits >> 8) & 0xff00) | ((bits << 8) & 0xff0000) |
+             (bits << 24);
+    result.m_coords[i] = std::bit_cast<float>(bits);
+  }
+
+  return result;
+}
+
+template <typename T>
+void write_binary_triangles(std::ostream &os, const triangle_soup<T> &soup) {
+  for (auto coord : soup.m_coords) {
+    auto bits = std::bit_cast<std::uint32_t>(float(coord));
+    char bytes[4];
+    for (unsigned i = 0; i < 4; ++i)
+      bytes[i] = char((bits >> (8 * i)) & 0xff);
+    os.write(bytes, 4);
+  }
+}
+
+// Calls make(index, a, b, c) for every triangle on several threads. The shapes
+// are returned in chunks of consecutive indices, in order.
+template <typename T, typename t_make>
+auto build_shapes(const triangle_soup<T> &soup, unsigned threads,
+                  t_make &&make) {
+  using shape_type = decltype(make(0u, point3<T>{}, point3<T>{}, point3<T>{}));
+
+  std::vector<std::vector<shape_type>> chunks(
+      detail::parallel_for_threads(soup.size(), threads));
+  detail::parallel_for(soup.size(), threads,
+                       [&](unsigned begin, unsigned end, unsigned t) {
+                         auto &chunk = chunks[t];
+                         chunk.reserve(end - begin);
+                         for (unsigned i = begin; i < end; ++i)
+                           chunk.push_back(make(i, soup.vertex(i, 0),
+                                                soup.vertex(i, 1),
+                                                soup.vertex(i, 2)));
+                       });
+
+  return chunks;
+}
+
+} // namespace geometry
+} // namespace throttle
@@ -10,7 +10,10 @@
 
 #pragma once
 
+#include <array>
 #include <cmath>
+#include <optional>
+#include <stdexcept>
 #include <type_traits>
 
 #include "geometry/equal.hpp"
@@ -79,6 +82,49 @@ template <typename T> struct axis_aligned_bb {
     return true;
   }
 
+  bool contains(const point_type &point) const {
+    return is_roughly_less_eq(std::abs(point.x - m_center.x), m_halfwidth_x) &&
+           is_roughly_less_eq(std::abs(point.y - m_center.y), m_halfwidth_y) &&
+           is_roughly_less_eq(std::abs(point.z - m_center.z), m_halfwidth_z);
+  }
+
+  // Slab test. Returns the parameter t of the point origin + t * dir where the
+  // ray enters the box, if it does so for t in [0, tmax].
+  std::optional<T> ray_intersection(const point_type &origin,
+                                    const vec_type &dir, T tmax) const {
+    const std::array<T, 3> halfwidths = {m_halfwidth_x, m_halfwidth_y,
+                                         m_halfwidth_z};
+    T tmin = T{0};
+
+    for (unsigned i = 0; i < 3; ++i) {
+      // Slightly enlarge the box, so that flat boxes are not missed due to
+      // rounding errors.
+      T slack = default_precision<T>::m_prec *
+                vmax(std::abs(m_center[i]), halfwidths[i], T{1});
+      T low = m_center[i] - halfwidths[i] - slack,
+        high = m_center[i] + halfwidths[i] + slack;
+
+      if (dir[i] == T{0}) {
+        if (origin[i] < low || origin[i] > high)
+          return std::nullopt;
+        continue;
+      }
+
+      T inv_dir = T{1} / dir[i];
+      T t_low = (low - origin[i]) * inv_dir,
+        t_high = (high - origin[i]) * inv_dir;
+      if (t_low > t_high)
+        std::swap(t_low, t_high);
+
+      tmin = vmax(tmin, t_low);
+      tmax = vmin(tmax, t_high);
+      if (tmin > tmax)
+        return std::nullopt;
+    }
+
+    return tmin;
+  }
+
   bool intersect_xy(T z) const {
     return (is_roughly_greater_eq(z, m_center.z - m_halfwidth_z) &&
             is_roughly_less_eq(z, m_center.z + m_halfwidth_z));
@@ -0,0 +1,276 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "geometry/equal.hpp"
+#include "geometry/narrowphase/collision_shape.hpp"
+#include "geometry/narrowphase/narrowphase_stats.hpp"
+#include "geometry/point3.hpp"
+#include "geometry/primitives/segment3.hpp"
+#include "geometry/primitives/triangle3.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <type_traits>
+#include <vector>
+
+namespace throttle {
+namespace geometry {
+
+// Runs the narrowphase over the candidate pairs of a broadphase one primitive
+// combination at a time instead of dispatching every pair through std::visit.
+// Candidates are sorted into buckets by the types of their shapes, and each
+// full bucket is tested with a loop over a single intersect overload.
+// Triangle pairs first go through the plane rejection test of
+// triangle_triangle_intersect, evaluated for a block of pairs at once over
+// separate coordinate arrays, and only the survivors get the full test.
+template <typename T, typename t_shape = collision_shape<T>,
+          typename =
+              std::enable_if_t<std::is_base_of_v<collision_shape<T>, t_shape>>>
+class batched_narrowphase {
+public:
+  using shape_type = t_shape;
+  using point_type = point3<T>;
+  using segment_type = segment3<T>;
+  using triangle_type = triangle3<T>;
+
+  static constexpr unsigned block_size = 16;
+  static constexpr std::size_t default_flush_size = 4096;
+
+private:
+  template <typename t_first, typename t_second> struct candidate {
+    const t_first *first;
+    const t_second *second;
+    unsigned i, j; // indices as reported by the broadphase
+  };
+
+  template <typename t_first, typename t_second>
+  using bucket_type = std::vector<candidate<t_first, t_second>>;
+
+  // Mixed pairs are stored with the triangle first and the segment before the
+  // point, since the intersect overloads for them are symmetric.
+  bucket_type<triangle_type, triangle_type> m_tri_tri;
+  bucket_type<triangle_type, segment_type> m_tri_seg;
+  bucket_type<triangle_type, point_type> m_tri_point;
+  bucket_type<segment_type, segment_type> m_seg_seg;
+  bucket_type<segment_type, point_type> m_seg_point;
+  bucket_type<point_type, point_type> m_point_point;
+
+  std::size_t m_flush_size;
+
+  struct triangle_block {
+    using lane_type = std::array<T, block_size>;
+    std::array<lane_type, 3> x, y, z; // coordinates of the vertices a, b, c
+
+    void load(unsigned lane, const triangle_type &tri) {
+      const point_type *vertices[3] = {&tri.a, &tri.b, &tri.c};
+      for (unsigned v = 0; v < 3; ++v) {
+        x[v][lane] = vertices[v]->x;
+        y[v][lane] = vertices[v]->y;
+        z[v][lane] = vertices[v]->z;
+      }
+    }
+  };
+
+  using sides_type = std::array<int, block_size>;
+
+public:
+  batched_narrowphase(std::size_t flush_size = default_flush_size)
+      : m_flush_size{std::max<std::size_t>(flush_size, 1)} {}
+
+  // Calls callback(first, second) for every colliding pair of the broadphase,
+  // with the indices in the same order as for_each_colliding_pair would
+  // report them. The order of the pairs themselves is unspecified.
+  template <typename t_broad, typename t_callback>
+  void collide(t_broad &broad, t_callback &&callback) {
+    broad.for_each_candidate_pair([&](unsigned i, unsigned j) {
+      const shape_type &a = broad.shape_at(i), &b = broad.shape_at(j);
+      THROTTLE_NARROWPHASE_COUNT(candidate_pairs);
+      if (!bounding_boxes_intersect(a, b)) {
+        THROTTLE_NARROWPHASE_COUNT(aabb_rejects);
+        return;
+      }
+      with_primitive(a, [&](const auto &first) {
+        with_primitive(b, [&](const auto &second) {
+          push(first, second, i, j, callback);
+        });
+      });
+    });
+
+    flush(m_tri_tri, callback);
+    flush(m_tri_seg, callback);
+    flush(m_tri_point, callback);
+    flush(m_seg_seg, callback);
+    flush(m_seg_point, callback);
+    flush(m_point_point, callback);
+  }
+
+private:
+  static bool bounding_boxes_intersect(const shape_type &a,
+                                       const shape_type &b) {
+    THROTTLE_NARROWPHASE_STAGE(timer, aabb_stage);
+    return a.bounding_box().intersect(b.bounding_box());
+  }
+
+  template <typename t_func>
+  static void with_primitive(const shape_type &shape, t_func &&func) {
+    if (shape.template holds<triangle_type>())
+      func(shape.template as<triangle_type>());
+    else if (shape.template holds<segment_type>())
+      func(shape.template as<segment_type>());
+    else
+      func(shape.template as<point_type>());
+  }
+
+  template <typename t_prim> static constexpr unsigned rank() {
+    if constexpr (std::is_same_v<t_prim, triangle_type>)
+      return 0;
+    else if constexpr (std::is_same_v<t_prim, segment_type>)
+      return 1;
+    else
+      return 2;
+  }
+
+  template <typename t_first, typename t_second>
+  bucket_type<t_first, t_second> &bucket() {
+    if constexpr (std::is_same_v<t_first, triangle_type>) {
+      if constexpr (std::is_same_v<t_second, triangle_type>)
+        return m_tri_tri;
+      else if constexpr (std::is_same_v<t_second, segment_type>)
+        return m_tri_seg;
+      else
+        return m_tri_point;
+    } else if constexpr (std::is_same_v<t_first, segment_type>) {
+      if constexpr (std::is_same_v<t_second, segment_type>)
+        return m_seg_seg;
+      else
+        return m_seg_point;
+    } else {
+      return m_point_point;
+    }
+  }
+
+  template <typename t_first, typename t_second, typename t_callback>
+  void push(const t_first &first, const t_second &second, unsigned i,
+            unsigned j, t_callback &callback) {
+    if constexpr (rank<t_second>() < rank<t_first>()) {
+      auto &vec = bucket<t_second, t_first>();
+      vec.push_back({&second, &first, i, j});
+      if (vec.size() >= m_flush_size)
+        flush(vec, callback);
+    } else {
+      auto &vec = bucket<t_first, t_second>();
+      vec.push_back({&first, &second, i, j});
+      if (vec.size() >= m_flush_size)
+        flush(vec, callback);
+    }
+  }
+
+  template <typename t_first, typename t_second, typename t_callback>
+  static void flush(bucket_type<t_first, t_second> &vec,
+                    t_callback &callback) {
+    for (const auto &c : vec) {
+      if (!intersect(*c.first, *c.second))
+        continue;
+      THROTTLE_NARROWPHASE_COUNT(hits);
+      callback(c.i, c.j);
+    }
+    vec.clear();
+  }
+
+  template <typename t_callback>
+  static void flush(bucket_type<triangle_type, triangle_type> &vec,
+                    t_callback &callback) {
+    triangle_block firsts{}, seconds{};
+    sides_type sides{}, sides_other{};
+
+    for (std::size_t start = 0; start < vec.size(); start += block_size) {
+      auto count = std::min<std::size_t>(block_size, vec.size() - start);
+      for (unsigned lane = 0; lane < count; ++lane) {
+        firsts.load(lane, *vec[start + lane].first);
+        seconds.load(lane, *vec[start + lane].second);
+      }
+
+      // Lanes past count hold stale triangles, their results are ignored.
+      {
+        THROTTLE_NARROWPHASE_STAGE(timer, plane_stage);
+        plane_sides(firsts, seconds, sides);
+        plane_sides(seconds, firsts, sides_other);
+      }
+
+      for (unsigned lane = 0; lane < count; ++lane) {
+        if (std::abs(sides[lane]) == 3) {
+          THROTTLE_NARROWPHASE_COUNT(plane_rejects_t2);
+          continue;
+        }
+        if (std::abs(sides_other[lane]) == 3) {
+          THROTTLE_NARROWPHASE_COUNT(plane_rejects_t1);
+          continue;
+        }
+        const auto &c = vec[start + lane];
+        if (!c.first->intersect(*c.second))
+          continue;
+        THROTTLE_NARROWPHASE_COUNT(hits);
+        callback(c.i, c.j);
+      }
+    }
+
+    vec.clear();
+  }
+
+  // Steps 1-3 of triangle_triangle_intersect for a whole block: the plane of
+  // each triangle in planes and the distances to it from the vertices of the
+  // corresponding triangle in points. The arithmetic is kept in the same order
+  // as in plane and vec3 so the verdicts match the scalar code exactly. The
+  // result is the sum of the signs of the snapped distances, so the pair is
+  // rejected when it is 3 or -3. There are no branches, so the loop
+  // vectorizes.
+  static void plane_sides(const triangle_block &planes,
+                          const triangle_block &points, sides_type &result) {
+    constexpr T prec = default_precision<T>::m_prec;
+    const auto &px = planes.x, &py = planes.y, &pz = planes.z;
+
+    for (unsigned k = 0; k < block_size; ++k) {
+      T ux = px[1][k] - px[0][k], uy = py[1][k] - py[0][k],
+        uz = pz[1][k] - pz[0][k];
+      T vx = px[2][k] - px[0][k], vy = py[2][k] - py[0][k],
+        vz = pz[2][k] - pz[0][k];
+
+      T nx = uy * vz - uz * vy, ny = -(ux * vz - uz * vx),
+        nz = ux * vy - uy * vx;
+      T length = std::sqrt(nx * nx + ny * ny + nz * nz);
+      T divisor = length + T(length == T{0}); // vec3::norm keeps zero vectors
+      nx = nx / divisor;
+      ny = ny / divisor;
+      nz = nz / divisor;
+
+      T dist = px[0][k] * nx + py[0][k] * ny + pz[0][k] * nz;
+
+      // +1 or -1 for a vertex clearly on one side, 0 for one that
+      // are_all_roughly_zero would snap onto the plane. With prec below one,
+      // |d| <= prec * max(|d|, 1) holds exactly when |d| <= prec.
+      auto side = [&](unsigned v) {
+        T d = (points.x[v][k] * nx + points.y[v][k] * ny +
+               points.z[v][k] * nz) -
+              dist;
+        return int(d > prec) - int(d < -prec);
+      };
+
+      result[k] = side(0) + side(1) + side(2);
+    }
+  }
+};
+
+} // namespace geometry
+} // namespace throttle
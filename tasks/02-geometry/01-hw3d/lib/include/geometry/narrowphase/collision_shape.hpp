@@ -12,10 +12,17 @@
 
 #include "geometry/equal.hpp"
 #include "geometry/narrowphase/aabb.hpp"
+#include "geometry/narrowphase/narrowphase_stats.hpp"
 #include "geometry/point3.hpp"
 #include "geometry/primitives/segment3.hpp"
 #include "geometry/primitives/triangle3.hpp"
+#include "geometry/vec3.hpp"
 
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <optional>
+#include <utility>
 #include <variant>
 
 namespace throttle {
@@ -23,8 +30,10 @@ namespace geometry {
 
 template <typename T> class collision_shape {
 public:
+  using value_type = T;
   using segment_type = segment3<T>;
   using point_type = point3<T>;
+  using vec_type = vec3<T>;
   using triangle_type = triangle3<T>;
   using aabb_type = axis_aligned_bb<T>;
   using variant_type = std::variant<segment_type, point_type, triangle_type>;
@@ -41,16 +50,61 @@ public:
       : m_shape{tri}, m_aabb{tri.a, tri.b, tri.c} {}
 
   bool collide(const collision_shape &other) const {
-    if (!m_aabb.intersect(other.m_aabb))
+    THROTTLE_NARROWPHASE_COUNT(candidate_pairs);
+    if (!bounding_boxes_intersect(other)) {
+      THROTTLE_NARROWPHASE_COUNT(aabb_rejects);
       return false;
-    return std::visit(
+    }
+    bool result = std::visit(
         [](auto &&first, auto &&second) -> bool {
           return intersect(first, second);
         },
         m_shape, other.m_shape);
+    if (result)
+      THROTTLE_NARROWPHASE_COUNT(hits);
+    return result;
+  }
+
+  bool contains(const point_type &point) const {
+    if (!m_aabb.contains(point))
+      return false;
+    return std::visit(
+        [&point](auto &&shape) -> bool { return intersect(shape, point); },
+        m_shape);
+  }
+
+  // Returns the smallest t in [0, tmax] such that origin + t * dir lies on the
+  // shape.
+  std::optional<T>
+  ray_intersection(const point_type &origin, const vec_type &dir,
+                   T tmax = std::numeric_limits<T>::max()) const {
+    if (!m_aabb.ray_intersection(origin, dir, tmax))
+      return std::nullopt;
+    auto t = std::visit(
+        [&origin, &dir](auto &&shape) -> std::optional<T> {
+          return intersect_ray(shape, origin, dir);
+        },
+        m_shape);
+    if (!t || t.value() > tmax)
+      return std::nullopt;
+    return t;
   }
 
-  aabb_type bounding_box() const { return m_aabb; }
+  const aabb_type &bounding_box() const { return m_aabb; }
+
+  // Lets callers that sort shapes by primitive type skip std::visit.
+  template <typename t_prim> bool holds() const {
+    return std::holds_alternative<t_prim>(m_shape);
+  }
+  template <typename t_prim> const t_prim &as() const {
+    return *std::get_if<t_prim>(&m_shape);
+  }
+
+private:
+  bool bounding_boxes_intersect(const collision_shape &other) const {
+    THROTTLE_NARROWPHASE_STAGE(timer, aabb_stage);
+    return m_aabb.intersect(other.m_aabb);
+  }
 };
 
 template <typename T>
@@ -59,6 +113,35 @@ bool collide(const collision_shape<T> &shape1,
   return shape1.collide(shape2);
 }
 
+// Degenerate triangles are turned into segments or points.
+template <typename T>
+collision_shape<T> shape_from_three_points(const point3<T> &a,
+                                           const point3<T> &b,
+                                           const point3<T> &c) {
+  auto ab = b - a, ac = c - a;
+
+  if (colinear(ab, ac)) { // Either a segment or a point
+    if (is_roughly_equal(ab, vec3<T>::zero()) &&
+        is_roughly_equal(ac, vec3<T>::zero())) {
+      return barycentric_average<T>(a, b, c);
+    }
+    // This is a segment. Project the the points onto the most closely alligned
+    // axis.
+    auto max_index = ab.max_component().first;
+
+    std::array<std::pair<point3<T>, T>, 3> arr = {
+        std::make_pair(a, a[max_index]), std::make_pair(b, b[max_index]),
+        std::make_pair(c, c[max_index])};
+    std::sort(arr.begin(), arr.end(),
+              [](const auto &left, const auto &right) -> bool {
+                return left.second < right.second;
+              });
+    return segment3<T>{arr[0].first, arr[2].first};
+  }
+
+  return triangle3<T>{a, b, c};
+}
+
 // Overloads for triangles
 
 template <typename T>
@@ -102,5 +185,29 @@ template <typename T>
 bool intersect(const point3<T> &point, const segment3<T> &seg) {
   return intersect(seg, point);
 }
+
+// Overloads for rays
+
+template <typename T>
+std::optional<T> intersect_ray(const triangle3<T> &tri, const point3<T> &origin,
+                               const vec3<T> &dir) {
+  return tri.ray_intersection(origin, dir);
+}
+template <typename T>
+std::optional<T> intersect_ray(const segment3<T> &seg, const point3<T> &origin,
+                               const vec3<T> &dir) {
+  return seg.ray_intersection(origin, dir);
+}
+template <typename T>
+std::optional<T> intersect_ray(const point3<T> &point, const point3<T> &origin,
+                               const vec3<T> &dir) {
+  T t = dot(point - origin, dir) / dir.length_sq();
+  if (is_definitely_less(t, T{0}))
+    return std::nullopt;
+  t = vmax(t, T{0});
+  if (!is_roughly_equal(origin + t * dir, point))
+    return std::nullopt;
+  return t;
+}
 } // namespace geometry
 } // namespace throttle
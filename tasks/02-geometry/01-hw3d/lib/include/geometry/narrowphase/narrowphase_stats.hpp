@@ -0,0 +1,171 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace throttle {
+namespace geometry {
+
+// Counters of the narrowphase rejection funnel and cycles spent in each stage.
+// They are updated through the THROTTLE_NARROWPHASE_* macros below, which
+// expand to nothing unless NARROWPHASE_STATS__ is defined (cmake
+// -DNARROWPHASE_STATS=ON), so the hot path is untouched in normal builds.
+struct narrowphase_stats {
+  enum counter {
+    candidate_pairs,    // collide calls
+    aabb_rejects,       // pairs with disjoint bounding boxes
+    plane_rejects_t2,   // step 3: t2 entirely on one side of the plane of t1
+    plane_rejects_t1,   // step 6: t1 entirely on one side of the plane of t2
+    coplanar_fallbacks, // step 7: vertices on the plane of the other triangle
+    hits,               // pairs that collide
+    counter_count
+  };
+
+  enum stage {
+    aabb_stage,     // bounding box test
+    plane_stage,    // steps 1-6 of the triangle test
+    coplanar_stage, // step 7, 2d tests in the projected plane
+    interval_stage, // step 8, intervals on the intersection line
+    stage_count
+  };
+
+  std::array<std::uint64_t, counter_count> m_counters{};
+  std::array<std::uint64_t, stage_count> m_cycles{};
+
+  narrowphase_stats &operator+=(const narrowphase_stats &other) {
+    for (unsigned i = 0; i < counter_count; ++i)
+      m_counters[i] += other.m_counters[i];
+    for (unsigned i = 0; i < stage_count; ++i)
+      m_cycles[i] += other.m_cycles[i];
+    return *this;
+  }
+
+  static std::uint64_t timestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+  }
+
+  // Every thread counts into its own copy, which is added to the totals when
+  // the thread exits, so parallel broadphases don't contend on the counters.
+  static narrowphase_stats &local();
+
+  // Totals of the exited threads and the calling one.
+  static narrowphase_stats snapshot() {
+    std::lock_guard lock{totals_mutex()};
+    auto result = totals();
+    result += local();
+    return result;
+  }
+
+  static void reset() {
+    std::lock_guard lock{totals_mutex()};
+    totals() = {};
+    local() = {};
+  }
+
+  // Charges the cycles since construction or the last switch to the current
+  // stage.
+  class stage_timer {
+    stage m_stage;
+    std::uint64_t m_start;
+
+  public:
+    stage_timer(stage first) : m_stage{first}, m_start{timestamp()} {}
+    stage_timer(const stage_timer &) = delete;
+    stage_timer &operator=(const stage_timer &) = delete;
+    ~stage_timer() { charge(); }
+
+    void switch_to(stage next) {
+      charge();
+      m_stage = next;
+    }
+
+  private:
+    void charge() {
+      auto now = timestamp();
+      local().m_cycles[m_stage] += now - m_start;
+      m_start = now;
+    }
+  };
+
+private:
+  struct local_stats;
+
+  static narrowphase_stats &totals() {
+    static narrowphase_stats stats;
+    return stats;
+  }
+
+  static std::mutex &totals_mutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+};
+
+struct narrowphase_stats::local_stats {
+  narrowphase_stats m_stats;
+  ~local_stats() {
+    std::lock_guard lock{totals_mutex()};
+    totals() += m_stats;
+  }
+};
+
+inline narrowphase_stats &narrowphase_stats::local() {
+  thread_local local_stats stats;
+  return stats.m_stats;
+}
+
+inline std::ostream &operator<<(std::ostream &os,
+                                const narrowphase_stats &stats) {
+  const auto &c = stats.m_counters;
+  const auto &t = stats.m_cycles;
+  using s = narrowphase_stats;
+  os << "narrowphase: " << c[s::candidate_pairs] << " candidates, "
+     << c[s::aabb_rejects] << " aabb rejects, " << c[s::plane_rejects_t2]
+     << " plane rejects at step 3, " << c[s::plane_rejects_t1]
+     << " plane rejects at step 6, " << c[s::coplanar_fallbacks]
+     << " coplanar fallbacks, " << c[s::hits] << " hits\n";
+  os << "cycles: aabb " << t[s::aabb_stage] << ", plane " << t[s::plane_stage]
+     << ", coplanar " << t[s::coplanar_stage] << ", interval "
+     << t[s::interval_stage] << "\n";
+  return os;
+}
+
+} // namespace geometry
+} // namespace throttle
+
+#ifdef NARROWPHASE_STATS__
+#define THROTTLE_NARROWPHASE_COUNT(name)                                       \
+  ++::throttle::geometry::narrowphase_stats::local()                           \
+        .m_counters[::throttle::geometry::narrowphase_stats::name]
+#define THROTTLE_NARROWPHASE_STAGE(timer, name)                                \
+  ::throttle::geometry::narrowphase_stats::stage_timer timer {                 \
+    ::throttle::geometry::narrowphase_stats::name                              \
+  }
+#define THROTTLE_NARROWPHASE_SWITCH(timer, name)                               \
+  timer.switch_to(::throttle::geometry::narrowphase_stats::name)
+#else
+#define THROTTLE_NARROWPHASE_COUNT(name) ((void)0)
+#define THROTTLE_NARROWPHASE_STAGE(timer, name) ((void)0)
+#define THROTTLE_NARROWPHASE_SWITCH(timer, name) ((void)0)
+#endif
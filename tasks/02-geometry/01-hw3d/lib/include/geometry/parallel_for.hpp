@@ -0,0 +1,51 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace throttle {
+namespace geometry {
+namespace detail {
+
+// Number of chunks parallel_for splits [0, count) into.
+inline unsigned parallel_for_threads(unsigned count, unsigned threads) {
+  constexpr unsigned min_chunk_size = 4096;
+  return std::clamp(count / min_chunk_size, 1u, std::max(threads, 1u));
+}
+
+// Splits [0, count) into contiguous chunks and calls func(begin, end, chunk)
+// for each of them on a separate thread. Chunking depends only on count and
+// threads, so that consecutive calls process the same ranges.
+template <typename t_func>
+void parallel_for(unsigned count, unsigned threads, t_func &&func) {
+  threads = parallel_for_threads(count, threads);
+
+  unsigned chunk_size = (count + threads - 1) / threads;
+  std::vector<std::thread> pool;
+  pool.reserve(threads - 1);
+
+  for (unsigned t = 1; t < threads; ++t) {
+    unsigned begin = std::min(count, t * chunk_size),
+             end = std::min(count, begin + chunk_size);
+    pool.emplace_back([&func, begin, end, t]() { func(begin, end, t); });
+  }
+
+  func(0, std::min(count, chunk_size), 0);
+  for (auto &thread : pool)
+    thread.join();
+}
+
+} // namespace detail
+} // namespace geometry
+} // namespace throttle
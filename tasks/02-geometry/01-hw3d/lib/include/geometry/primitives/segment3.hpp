@@ -10,6 +10,7 @@
 #pragma once
 
 #include <cmath>
+#include <optional>
 
 #include "geometry/equal.hpp"
 #include "geometry/point3.hpp"
@@ -49,6 +50,39 @@ template <typename T> struct segment3 {
         .intersect(
             segment2{a.project_coord(max_index), b.project_coord(max_index)});
   }
+
+  // Returns the parameter t >= 0 of the first point origin + t * dir of the ray
+  // that lies on the segment.
+  std::optional<T> ray_intersection(const point_type &origin,
+                                    const vec_type &dir) const {
+    vec_type seg = b - a, w = origin - a;
+    T uu = dot(dir, dir), uv = dot(dir, seg), uw = dot(dir, w);
+
+    if (colinear(dir, seg)) {
+      if (!colinear(dir, w))
+        return std::nullopt;
+      // The ray and the segment lie on the same line.
+      T t_a = -uw / uu, t_b = dot(b - origin, dir) / uu;
+      if (!are_same_sign(t_a, t_b))
+        return T{0};
+      if (t_a < T{0})
+        return std::nullopt;
+      return vmin(t_a, t_b);
+    }
+
+    T vv = dot(seg, seg), vw = dot(seg, w);
+    T denom = uu * vv - uv * uv;
+    T t = (uv * vw - vv * uw) / denom, s = (uu * vw - uv * uw) / denom;
+
+    if (is_definitely_less(t, T{0}) || is_definitely_less(s, T{0}) ||
+        is_definitely_greater(s, T{1}))
+      return std::nullopt;
+
+    t = vmax(t, T{0});
+    if (!is_roughly_equal(origin + t * dir, a + s * seg))
+      return std::nullopt;
+    return t;
+  }
 };
 
 } // namespace geometry
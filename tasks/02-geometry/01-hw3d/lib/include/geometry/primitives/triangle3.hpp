@@ -14,8 +14,10 @@
 #include <array>
 #include <cassert>
 #include <cmath>
+#include <optional>
 #include <utility>
 
+#include "geometry/narrowphase/narrowphase_stats.hpp"
 #include "geometry/primitives/plane.hpp"
 #include "geometry/primitives/segment3.hpp"
 #include "geometry/primitives/triangle2.hpp"
@@ -83,6 +85,41 @@ template <typename T> struct triangle3 {
     return project_coord(max_index).point_in_triangle(
         point.project_coord(max_index));
   }
+
+  // Returns the parameter t >= 0 of the first point origin + t * dir of the ray
+  // that lies inside the triangle.
+  std::optional<T> ray_intersection(const point_type &origin,
+                                    const vec_type &dir) const {
+    plane_type plane = plane_of();
+    T dist = plane.signed_distance(origin);
+    T speed = dot(plane.normal(), dir); // Change of distance per unit of t
+
+    if (is_roughly_equal(speed / dir.length(), T{0})) {
+      if (!is_roughly_equal(dist, T{0}))
+        return std::nullopt;
+      // The ray lies in the plane of the triangle.
+      if (intersect(origin))
+        return T{0};
+
+      std::optional<T> result;
+      for (const auto &edge : {segment_type{a, b}, segment_type{b, c},
+                               segment_type{c, a}}) {
+        auto t = edge.ray_intersection(origin, dir);
+        if (t && (!result || t.value() < result.value()))
+          result = t;
+      }
+      return result;
+    }
+
+    T t = -dist / speed;
+    if (is_definitely_less(t, T{0}))
+      return std::nullopt;
+
+    t = vmax(t, T{0});
+    if (!intersect(origin + t * dir))
+      return std::nullopt;
+    return t;
+  }
 };
 
 namespace detail {
@@ -121,6 +158,7 @@ canonical_triangle(const triangle3<T> &p_tri, std::array<T, 3> p_dist) {
 template <typename T>
 bool triangle_triangle_intersect(const triangle3<T> &t1,
                                  const triangle3<T> &t2) {
+  THROTTLE_NARROWPHASE_STAGE(timer, plane_stage);
   // 1. Compute the plane pi1 of the first triangle
   auto pi1 = t1.plane_of();
   // 2. Compute djstances from t2 to pi1
@@ -132,8 +170,10 @@ bool triangle_triangle_intersect(const triangle3<T> &t1,
   });
   // 3. Rejection test. If none of the points lie on the plane and all distances
   // have the same sign, then triangles can't intersect.
-  if (are_same_sign(d_2[0], d_2[1], d_2[2]))
+  if (are_same_sign(d_2[0], d_2[1], d_2[2])) {
+    THROTTLE_NARROWPHASE_COUNT(plane_rejects_t2);
     return false;
+  }
 
   // 4. Same for triangle t2
   auto pi2 = t2.plane_of();
@@ -146,14 +186,18 @@ bool triangle_triangle_intersect(const triangle3<T> &t1,
   });
   // 6. Rejection test. If none of the points lie on the plane and all distances
   // have the same sign, then triangles can't intersect.
-  if (are_same_sign(d_1[0], d_1[1], d_1[2]))
+  if (are_same_sign(d_1[0], d_1[1], d_1[2])) {
+    THROTTLE_NARROWPHASE_COUNT(plane_rejects_t1);
     return false;
+  }
 
   // 7. Handle degenerate cases when one or more points lies on the plane of the
   // other triangle.
+  THROTTLE_NARROWPHASE_SWITCH(timer, coplanar_stage);
   auto num_zeros1 = std::count_if(
       d_1.begin(), d_1.end(), [](const auto &elem) { return elem == T{0}; });
   if (num_zeros1) {
+    THROTTLE_NARROWPHASE_COUNT(coplanar_fallbacks);
     using triangle_vertex_distance_pair =
         std::pair<typename triangle3<T>::point_type, T>;
     std::array<triangle_vertex_distance_pair, 3> vert_dist_arr = {
@@ -198,6 +242,7 @@ bool triangle_triangle_intersect(const triangle3<T> &t1,
   auto num_zeros2 = std::count_if(
       d_2.begin(), d_2.end(), [](const auto &elem) { return elem == T{0}; });
   if (num_zeros2) {
+    THROTTLE_NARROWPHASE_COUNT(coplanar_fallbacks);
     using triangle_vertex_distance_pair =
         std::pair<typename triangle3<T>::point_type, T>;
     std::array<triangle_vertex_distance_pair, 3> vert_dist_arr = {
@@ -241,6 +286,7 @@ bool triangle_triangle_intersect(const triangle3<T> &t1,
   // 8. If we get here than all early rejection tests failed and 2 triangles
   // intersect the plane of the other. In this case 2 distances are of one sign
   // and the other is of another sign. And none of the distances are equal to 0.
+  THROTTLE_NARROWPHASE_SWITCH(timer, interval_stage);
   auto d = cross(pi1.normal(), pi2.normal());
   auto index = d.max_component().first;
 
@@ -0,0 +1,157 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "geometry/broadphase/adaptive_octree.hpp"
+#include "geometry/broadphase/bruteforce.hpp"
+#include "geometry/broadphase/compact_octree.hpp"
+#include "geometry/broadphase/hierarchical_grid.hpp"
+#include "geometry/broadphase/lbvh.hpp"
+#include "geometry/broadphase/octree.hpp"
+#include "geometry/broadphase/uniform_grid.hpp"
+#include "geometry/narrowphase/batched_narrowphase.hpp"
+
+using namespace throttle::geometry;
+
+using shape = collision_shape<float>;
+using point = point3<float>;
+using pair_set = std::set<std::pair<unsigned, unsigned>>;
+
+namespace {
+
+// Triangles mixed with degenerate ones that turn into segments and points,
+// plus a strip of coplanar triangles that share edges.
+std::vector<shape> mixed_shapes(unsigned number, unsigned seed = 42) {
+  std::mt19937 gen{seed};
+  std::uniform_real_distribution<float> center_dist{-20, 20};
+  std::uniform_real_distribution<float> offset_dist{-2, 2};
+
+  std::vector<shape> result;
+  for (unsigned i = 0; i < number; ++i) {
+    point center{center_dist(gen), center_dist(gen), center_dist(gen)};
+    auto vertex = [&]() {
+      return center + vec3<float>{offset_dist(gen), offset_dist(gen),
+                                  offset_dist(gen)};
+    };
+
+    auto a = vertex(), b = vertex(), c = vertex();
+    if (i % 7 == 0)
+      b = c = a;
+    else if (i % 5 == 0)
+      c = a + 0.5f * (b - a);
+    result.push_back(shape_from_three_points(a, b, c));
+  }
+
+  for (unsigned i = 0; i < 32; ++i) {
+    float x = float(i);
+    result.push_back(triangle3<float>{{x, 0, 0}, {x + 1, 0, 0}, {x, 1, 0}});
+    result.push_back(
+        triangle3<float>{{x + 1, 0, 0}, {x + 1, 1, 0}, {x, 1, 0}});
+  }
+
+  return result;
+}
+
+template <typename broad> pair_set reference_pairs(broad &cont) {
+  pair_set result;
+  cont.for_each_colliding_pair([&](unsigned first, unsigned second) {
+    result.emplace(first, second);
+  });
+  return result;
+}
+
+constexpr auto default_flush_size =
+    batched_narrowphase<float>::default_flush_size;
+
+template <typename broad>
+pair_set batched_pairs(broad &cont,
+                       std::size_t flush_size = default_flush_size) {
+  pair_set result;
+  batched_narrowphase<float> narrow{flush_size};
+  narrow.collide(cont, [&](unsigned first, unsigned second) {
+    auto inserted = result.emplace(first, second);
+    EXPECT_TRUE(inserted.second); // Every pair is reported once
+  });
+  return result;
+}
+
+template <typename broad>
+void check_same_pairs(broad &cont, const std::vector<shape> &shapes) {
+  for (const auto &s : shapes)
+    cont.add_collision_shape(s);
+
+  auto expected = reference_pairs(cont);
+  EXPECT_FALSE(expected.empty());
+  EXPECT_EQ(batched_pairs(cont), expected);
+  EXPECT_EQ(batched_pairs(cont, 3), expected);
+}
+
+} // namespace
+
+TEST(test_batched_narrowphase, test_same_pairs) {
+  auto shapes = mixed_shapes(3000);
+
+  bruteforce<float> brute;
+  check_same_pairs(brute, shapes);
+  octree<float> oct{4};
+  check_same_pairs(oct, shapes);
+  compact_octree<float> compact{4};
+  check_same_pairs(compact, shapes);
+  adaptive_octree<float> adaptive;
+  check_same_pairs(adaptive, shapes);
+  uniform_grid<float> grid{3000};
+  check_same_pairs(grid, shapes);
+  hierarchical_grid<float> hgrid;
+  check_same_pairs(hgrid, shapes);
+  lbvh<float> bvh;
+  check_same_pairs(bvh, shapes);
+}
+
+TEST(test_batched_narrowphase, test_candidate_pairs) {
+  auto shapes = mixed_shapes(1000, 7);
+
+  uniform_grid<float> grid{1000};
+  for (const auto &s : shapes)
+    grid.add_collision_shape(s);
+
+  pair_set candidates;
+  grid.for_each_candidate_pair([&](unsigned first, unsigned second) {
+    EXPECT_NE(first, second);
+    auto inserted = candidates.emplace(std::min(first, second),
+                                       std::max(first, second));
+    EXPECT_TRUE(inserted.second);
+  });
+
+  for (auto [first, second] : reference_pairs(grid))
+    EXPECT_TRUE(candidates.count({std::min(first, second),
+                                  std::max(first, second)}));
+}
+
+TEST(test_batched_narrowphase, test_degenerate_pairs) {
+  bruteforce<float> brute;
+  brute.add_collision_shape(point{0, 0, 0});
+  brute.add_collision_shape(point{0, 0, 0});
+  brute.add_collision_shape(segment3<float>{{0, 0, -1}, {0, 0, 1}});
+  brute.add_collision_shape(segment3<float>{{0, -1, 0}, {0, 1, 0}});
+  brute.add_collision_shape(
+      triangle3<float>{{-1, -1, 0}, {1, -1, 0}, {0, 1, 0}});
+  brute.add_collision_shape(point{5, 5, 5});
+
+  pair_set expected = {{0, 1}, {0, 2}, {0, 3}, {0, 4}, {1, 2},
+                       {1, 3}, {1, 4}, {2, 3}, {2, 4}, {3, 4}};
+  EXPECT_EQ(reference_pairs(brute), expected);
+  EXPECT_EQ(batched_pairs(brute), expected);
+}
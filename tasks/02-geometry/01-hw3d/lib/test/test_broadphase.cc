@@ -0,0 +1,484 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <gtest/gtest.h>
+#include <numeric>
+
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "geometry/broadphase/adaptive_octree.hpp"
+#include "geometry/broadphase/bruteforce.hpp"
+#include "geometry/broadphase/compact_octree.hpp"
+#include "geometry/broadphase/hierarchical_grid.hpp"
+#include "geometry/broadphase/lbvh.hpp"
+#include "geometry/broadphase/octree.hpp"
+#include "geometry/broadphase/uniform_grid.hpp"
+
+using namespace throttle::geometry;
+
+using shape = collision_shape<float>;
+using triangle = triangle3<float>;
+using pair_set = std::set<std::pair<unsigned, unsigned>>;
+
+namespace {
+
+std::vector<triangle> random_triangles(unsigned number, float half,
+                                       float size, unsigned seed = 42) {
+  std::mt19937 gen{seed};
+  std::uniform_real_distribution<float> center_dist{-half, half};
+  std::uniform_real_distribution<float> offset_dist{-size, size};
+
+  std::vector<triangle> result;
+  for (unsigned i = 0; i < number; ++i) {
+    point3<float> center{center_dist(gen), center_dist(gen), center_dist(gen)};
+    auto vertex = [&]() {
+      return center + vec3<float>{offset_dist(gen), offset_dist(gen),
+                                  offset_dist(gen)};
+    };
+    result.push_back(triangle{vertex(), vertex(), vertex()});
+  }
+
+  return result;
+}
+
+std::vector<shape> random_shapes(unsigned number, float half, float size,
+                                 unsigned seed = 42) {
+  auto triangles = random_triangles(number, half, size, seed);
+  return {triangles.begin(), triangles.end()};
+}
+
+template <typename broad, typename t_shape>
+pair_set normalized_pairs(broad &cont, const std::vector<t_shape> &shapes) {
+  for (const auto &s : shapes)
+    cont.add_collision_shape(s);
+
+  pair_set result;
+  for (auto [first, second] : cont.colliding_pairs()) {
+    EXPECT_NE(first, second);
+    auto inserted = result.emplace(std::min(first, second),
+                                   std::max(first, second));
+    EXPECT_TRUE(inserted.second); // Every pair is reported once
+  }
+
+  return result;
+}
+
+} // namespace
+
+TEST(test_broadphase, test_colliding_pairs_simple) {
+  bruteforce<float> cont;
+  cont.add_collision_shape(triangle{{0, 0, 0}, {1, 0, 0}, {0, 1, 0}});
+  cont.add_collision_shape(triangle{{10, 10, 10}, {11, 10, 10}, {10, 11, 10}});
+  cont.add_collision_shape(
+      triangle{{-1, 0.25, -1}, {2, 0.25, -1}, {0.5, 0.25, 1}});
+
+  auto pairs = cont.colliding_pairs();
+  ASSERT_EQ(pairs.size(), 1);
+  EXPECT_EQ(pairs[0], std::make_pair(0u, 2u));
+}
+
+TEST(test_broadphase, test_same_pairs) {
+  auto shapes = random_shapes(2000, 100, 3);
+
+  bruteforce<float> brute;
+  octree<float> oct{3};
+  uniform_grid<float> grid{2000};
+
+  auto expected = normalized_pairs(brute, shapes);
+  EXPECT_FALSE(expected.empty());
+  EXPECT_EQ(normalized_pairs(oct, shapes), expected);
+  EXPECT_EQ(normalized_pairs(grid, shapes), expected);
+}
+
+TEST(test_broadphase, test_compact_octree_same_pairs) {
+  auto shapes = random_shapes(2000, 100, 3, 7);
+
+  octree<float> oct{6};
+  compact_octree<float> compact{6};
+
+  auto expected = normalized_pairs(oct, shapes);
+  EXPECT_FALSE(expected.empty());
+  EXPECT_EQ(normalized_pairs(compact, shapes), expected);
+
+  // Nodes are only created where shapes land.
+  const auto &nodes = compact.nodes();
+  EXPECT_LT(nodes.size(), shapes.size());
+  unsigned stored = 0;
+  for (const auto &n : nodes) {
+    stored += n.m_shape_count;
+    EXPECT_LE(n.m_subtree_end, nodes.size());
+  }
+  EXPECT_EQ(stored, shapes.size());
+}
+
+TEST(test_broadphase, test_adaptive_octree_same_pairs) {
+  // A dense cluster inside a sparse scene, plus long shapes that straddle the
+  // split planes near the root.
+  auto shapes = random_shapes(1500, 100, 3, 5);
+  auto cluster = random_shapes(1500, 5, 1, 6);
+  auto slivers = random_shapes(100, 100, 20, 8);
+  shapes.insert(shapes.end(), cluster.begin(), cluster.end());
+  shapes.insert(shapes.end(), slivers.begin(), slivers.end());
+
+  bruteforce<float> brute;
+  adaptive_octree<float> cloning, pinning{8, false}, coarse{64};
+
+  auto expected = normalized_pairs(brute, shapes);
+  EXPECT_FALSE(expected.empty());
+  EXPECT_EQ(normalized_pairs(cloning, shapes), expected);
+  EXPECT_EQ(normalized_pairs(pinning, shapes), expected);
+  EXPECT_EQ(normalized_pairs(coarse, shapes), expected);
+
+  // The cluster is subdivided deeper than a fixed depth octree would go.
+  EXPECT_GT(cloning.depth(), 6);
+  EXPECT_LT(coarse.node_count(), cloning.node_count());
+}
+
+TEST(test_broadphase, test_adaptive_octree_duplicates) {
+  // Identical shapes can't be separated, the depth limit stops splitting.
+  std::vector<shape> shapes(100, triangle{{0, 0, 0}, {1, 0, 0}, {0, 1, 0}});
+  adaptive_octree<float> cont{4};
+  EXPECT_EQ(normalized_pairs(cont, shapes).size(), 100 * 99 / 2);
+  EXPECT_LE(cont.depth(), adaptive_octree<float>::default_max_depth);
+}
+
+TEST(test_broadphase, test_hierarchical_grid_mixed_scale) {
+  // Shape sizes span six orders of magnitude.
+  std::mt19937 gen{13};
+  std::uniform_real_distribution<float> exponent_dist{-3, 3};
+
+  std::vector<shape> shapes;
+  for (unsigned i = 0; i < 2000; ++i) {
+    auto size = std::pow(10.0f, exponent_dist(gen));
+    auto triangles = random_triangles(1, 100, size, gen());
+    shapes.push_back(triangles.front());
+  }
+  shapes.push_back(point3<float>{0, 0, 0});
+  shapes.push_back(point3<float>{0, 0, 0});
+
+  bruteforce<float> brute;
+  hierarchical_grid<float> hgrid{2000};
+
+  auto expected = normalized_pairs(brute, shapes);
+  EXPECT_FALSE(expected.empty());
+  EXPECT_EQ(normalized_pairs(hgrid, shapes), expected);
+  EXPECT_GT(hgrid.levels(), 15);
+  EXPECT_EQ(hgrid.size(), shapes.size());
+}
+
+TEST(test_broadphase, test_hierarchical_grid_far_tiny_shapes) {
+  // Cells of the finest level are so small that coordinates of far shapes
+  // divided by the cell size don't fit into int.
+  std::mt19937 gen{17};
+  std::uniform_real_distribution<double> center_dist{-1e6, 1e6};
+  std::uniform_real_distribution<double> offset_dist{-1e-6, 1e-6};
+
+  std::vector<collision_shape<double>> shapes;
+  for (unsigned i = 0; i < 500; ++i) {
+    point3<double> center{center_dist(gen), center_dist(gen),
+                          center_dist(gen)};
+    auto vertex = [&]() {
+      return center + vec3<double>{offset_dist(gen), offset_dist(gen),
+                                   offset_dist(gen)};
+    };
+    // Every triangle gets a twin through its first vertex
+    auto first = vertex();
+    shapes.push_back(triangle3<double>{first, vertex(), vertex()});
+    shapes.push_back(triangle3<double>{first, vertex(), vertex()});
+  }
+
+  bruteforce<double> brute;
+  hierarchical_grid<double> hgrid{1000};
+  uniform_grid<double> grid{1000};
+
+  auto expected = normalized_pairs(brute, shapes);
+  EXPECT_GE(expected.size(), 500);
+  EXPECT_EQ(normalized_pairs(hgrid, shapes), expected);
+  EXPECT_EQ(normalized_pairs(grid, shapes), expected);
+
+  const auto &target = shapes.front().bounding_box().m_center;
+  point3<double> origin{0, 0, 0};
+  auto expected_hit = brute.raycast(origin, target - origin);
+  auto hit = hgrid.raycast(origin, target - origin);
+  ASSERT_TRUE(expected_hit);
+  ASSERT_TRUE(hit);
+  EXPECT_DOUBLE_EQ(hit->distance, expected_hit->distance);
+}
+
+TEST(test_broadphase, test_lbvh_same_pairs) {
+  // Enough shapes to split the build across several threads.
+  auto shapes = random_shapes(20000, 300, 3, 11);
+
+  bruteforce<float> brute;
+  lbvh<float> serial{0, 1}, parallel{0, 4};
+
+  auto expected = normalized_pairs(brute, shapes);
+  EXPECT_FALSE(expected.empty());
+  EXPECT_EQ(normalized_pairs(serial, shapes), expected);
+  EXPECT_EQ(normalized_pairs(parallel, shapes), expected);
+}
+
+TEST(test_broadphase, test_lbvh_duplicate_codes) {
+  // Identical shapes produce identical Morton codes.
+  std::vector<shape> shapes(100, triangle{{0, 0, 0}, {1, 0, 0}, {0, 1, 0}});
+  lbvh<float> cont;
+  EXPECT_EQ(normalized_pairs(cont, shapes).size(), 100 * 99 / 2);
+}
+
+TEST(test_broadphase, test_radix_sort) {
+  std::mt19937_64 gen{5};
+  std::vector<detail::morton_key> keys(50000);
+  for (unsigned i = 0; i < keys.size(); ++i)
+    keys[i] = {gen() >> 1, i};
+
+  auto expected = keys;
+  std::stable_sort(expected.begin(), expected.end(),
+                   [](auto a, auto b) { return a.code < b.code; });
+  detail::radix_sort(keys, 4);
+
+  for (unsigned i = 0; i < keys.size(); ++i) {
+    EXPECT_EQ(keys[i].code, expected[i].code);
+    EXPECT_EQ(keys[i].index, expected[i].index);
+  }
+}
+
+TEST(test_broadphase, test_many_to_many_adapter) {
+  auto shapes = random_shapes(500, 20, 2);
+  octree<float> oct{2};
+  auto pairs = normalized_pairs(oct, shapes);
+
+  std::set<unsigned> expected;
+  for (auto [first, second] : pairs) {
+    expected.insert(first);
+    expected.insert(second);
+  }
+
+  auto result = oct.many_to_many();
+  EXPECT_EQ(result.size(), expected.size());
+  for (auto *ptr : result)
+    EXPECT_TRUE(expected.count(ptr - std::addressof(oct.shape_at(0))));
+}
+
+TEST(test_broadphase, test_incremental_insertion_order) {
+  auto shapes = random_shapes(300, 15, 2, 7);
+  bruteforce<float> brute;
+  auto expected = normalized_pairs(brute, shapes);
+
+  uniform_grid<float> grid{300};
+  std::vector<shape> first_half{shapes.begin(), shapes.begin() + 150},
+      second_half{shapes.begin() + 150, shapes.end()};
+  normalized_pairs(grid, first_half);
+  EXPECT_EQ(normalized_pairs(grid, second_half), expected);
+}
+
+namespace {
+
+template <typename broad>
+std::set<unsigned> aabb_query(broad &cont, const axis_aligned_bb<float> &box) {
+  std::set<unsigned> result;
+  cont.query_aabb(box, [&result](unsigned idx) {
+    EXPECT_TRUE(result.insert(idx).second);
+  });
+  return result;
+}
+
+template <typename broad>
+std::set<unsigned> point_query(broad &cont, const point3<float> &point) {
+  std::set<unsigned> result;
+  cont.query_point(point, [&result](unsigned idx) {
+    EXPECT_TRUE(result.insert(idx).second);
+  });
+  return result;
+}
+
+} // namespace
+
+TEST(test_broadphase, test_query_aabb) {
+  auto shapes = random_shapes(2000, 100, 3, 1);
+  bruteforce<float> brute;
+  octree<float> oct{3};
+  uniform_grid<float> grid{2000};
+  lbvh<float> bvh{2000};
+  hierarchical_grid<float> hgrid{2000};
+  compact_octree<float> compact{3};
+  adaptive_octree<float> adaptive;
+  for (const auto &s : shapes) {
+    brute.add_collision_shape(s);
+    oct.add_collision_shape(s);
+    grid.add_collision_shape(s);
+    bvh.add_collision_shape(s);
+    hgrid.add_collision_shape(s);
+    compact.add_collision_shape(s);
+    adaptive.add_collision_shape(s);
+  }
+
+  for (const auto &box : {axis_aligned_bb<float>{{0, 0, 0}, 10},
+                          axis_aligned_bb<float>{{50, -20, 3}, 1, 30, 2},
+                          axis_aligned_bb<float>{{0, 0, 0}, 1000}}) {
+    auto expected = aabb_query(brute, box);
+    EXPECT_EQ(aabb_query(oct, box), expected);
+    EXPECT_EQ(aabb_query(grid, box), expected);
+    EXPECT_EQ(aabb_query(bvh, box), expected);
+    EXPECT_EQ(aabb_query(hgrid, box), expected);
+    EXPECT_EQ(aabb_query(compact, box), expected);
+    EXPECT_EQ(aabb_query(adaptive, box), expected);
+  }
+}
+
+TEST(test_broadphase, test_query_point) {
+  auto triangles = random_triangles(2000, 50, 3, 2);
+  bruteforce<float> brute;
+  octree<float> oct{3};
+  uniform_grid<float> grid{2000};
+  lbvh<float> bvh{2000};
+  hierarchical_grid<float> hgrid{2000};
+  compact_octree<float> compact{3};
+  adaptive_octree<float> adaptive;
+  for (const auto &t : triangles) {
+    brute.add_collision_shape(t);
+    oct.add_collision_shape(t);
+    grid.add_collision_shape(t);
+    bvh.add_collision_shape(t);
+    hgrid.add_collision_shape(t);
+    compact.add_collision_shape(t);
+    adaptive.add_collision_shape(t);
+  }
+
+  unsigned found = 0;
+  for (unsigned i = 0; i < 100; ++i) {
+    auto point = barycentric_average<float>(triangles[i].a, triangles[i].b,
+                                            triangles[i].c);
+    auto expected = point_query(brute, point);
+    found += !expected.empty();
+    EXPECT_EQ(point_query(oct, point), expected);
+    EXPECT_EQ(point_query(grid, point), expected);
+    EXPECT_EQ(point_query(bvh, point), expected);
+    EXPECT_EQ(point_query(hgrid, point), expected);
+    EXPECT_EQ(point_query(compact, point), expected);
+    EXPECT_EQ(point_query(adaptive, point), expected);
+  }
+
+  EXPECT_GT(found, 0);
+}
+
+TEST(test_broadphase, test_raycast_simple) {
+  octree<float> oct{2};
+  oct.add_collision_shape(triangle{{-1, -1, 5}, {1, -1, 5}, {0, 1, 5}});
+  oct.add_collision_shape(triangle{{-1, -1, 2}, {1, -1, 2}, {0, 1, 2}});
+  oct.add_collision_shape(triangle{{-1, -1, -2}, {1, -1, -2}, {0, 1, -2}});
+
+  auto hit = oct.raycast({0, 0, 0}, {0, 0, 1});
+  ASSERT_TRUE(hit);
+  EXPECT_EQ(hit->index, 1);
+  EXPECT_FLOAT_EQ(hit->distance, 2);
+
+  EXPECT_FALSE(oct.raycast({0, 0, 0}, {0, 0, 1}, 1.5f));
+  EXPECT_FALSE(oct.raycast({0, 0, 0}, {1, 0, 0}));
+}
+
+TEST(test_broadphase, test_raycast) {
+  auto shapes = random_shapes(2000, 50, 3, 3);
+  bruteforce<float> brute;
+  octree<float> oct{3};
+  uniform_grid<float> grid{2000};
+  lbvh<float> bvh{2000};
+  hierarchical_grid<float> hgrid{2000};
+  compact_octree<float> compact{3};
+  adaptive_octree<float> adaptive;
+  for (const auto &s : shapes) {
+    brute.add_collision_shape(s);
+    oct.add_collision_shape(s);
+    grid.add_collision_shape(s);
+    bvh.add_collision_shape(s);
+    hgrid.add_collision_shape(s);
+    compact.add_collision_shape(s);
+    adaptive.add_collision_shape(s);
+  }
+
+  std::mt19937 gen{3};
+  std::uniform_real_distribution<float> dist{-60, 60};
+  unsigned hits = 0;
+  for (unsigned i = 0; i < 200; ++i) {
+    point3<float> origin{dist(gen), dist(gen), dist(gen)};
+    vec3<float> dir = point3<float>{dist(gen), dist(gen), dist(gen)} - origin;
+
+    auto expected = brute.raycast(origin, dir);
+    auto oct_hit = oct.raycast(origin, dir);
+    auto grid_hit = grid.raycast(origin, dir);
+    auto bvh_hit = bvh.raycast(origin, dir);
+    auto hgrid_hit = hgrid.raycast(origin, dir);
+    auto compact_hit = compact.raycast(origin, dir);
+    auto adaptive_hit = adaptive.raycast(origin, dir);
+    ASSERT_EQ(bool(oct_hit), bool(expected));
+    ASSERT_EQ(bool(grid_hit), bool(expected));
+    ASSERT_EQ(bool(bvh_hit), bool(expected));
+    ASSERT_EQ(bool(hgrid_hit), bool(expected));
+    ASSERT_EQ(bool(compact_hit), bool(expected));
+    ASSERT_EQ(bool(adaptive_hit), bool(expected));
+    if (!expected)
+      continue;
+
+    ++hits;
+    EXPECT_FLOAT_EQ(oct_hit->distance, expected->distance);
+    EXPECT_FLOAT_EQ(grid_hit->distance, expected->distance);
+    EXPECT_FLOAT_EQ(bvh_hit->distance, expected->distance);
+    EXPECT_FLOAT_EQ(hgrid_hit->distance, expected->distance);
+    EXPECT_FLOAT_EQ(compact_hit->distance, expected->distance);
+    EXPECT_FLOAT_EQ(adaptive_hit->distance, expected->distance);
+  }
+
+  EXPECT_GT(hits, 0);
+}
+
+// Long rays through a sparse grid, aimed at shapes from far away and along
+// the axes, so the walk steps in every direction and over many empty cells.
+TEST(test_broadphase, test_raycast_sparse_grid) {
+  auto shapes = random_shapes(300, 500, 3, 5);
+  bruteforce<float> brute;
+  uniform_grid<float> grid{300};
+  for (const auto &s : shapes) {
+    brute.add_collision_shape(s);
+    grid.add_collision_shape(s);
+  }
+
+  std::mt19937 gen{5};
+  std::uniform_real_distribution<float> dist{-600, 600};
+  std::uniform_int_distribution<std::size_t> pick{0, shapes.size() - 1};
+  unsigned hits = 0;
+  for (unsigned i = 0; i < 300; ++i) {
+    auto target = shapes[pick(gen)].bounding_box().m_center;
+    point3<float> origin{dist(gen), dist(gen), dist(gen)};
+    if (i % 2) { // Move the origin away from the target along one axis only
+      auto axis = i % 3;
+      auto from = target;
+      from[axis] = origin[axis];
+      origin = from;
+    }
+
+    auto expected = brute.raycast(origin, target - origin);
+    auto hit = grid.raycast(origin, target - origin);
+    ASSERT_EQ(bool(hit), bool(expected));
+    if (!expected)
+      continue;
+
+    ++hits;
+    EXPECT_FLOAT_EQ(hit->distance, expected->distance);
+  }
+
+  EXPECT_GT(hits, 50);
+}
@@ -0,0 +1,127 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include <algorithm>
+#include <gtest/gtest.h>
+
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "geometry/broadphase/bruteforce.hpp"
+#include "geometry/broadphase/compact_scene.hpp"
+
+using namespace throttle::geometry;
+
+using point = point3<float>;
+using pair_set = std::set<std::pair<unsigned, unsigned>>;
+
+namespace {
+
+pair_set normalized(const std::vector<std::pair<unsigned, unsigned>> &pairs) {
+  pair_set result;
+  for (auto [first, second] : pairs) {
+    EXPECT_NE(first, second);
+    auto inserted =
+        result.emplace(std::min(first, second), std::max(first, second));
+    EXPECT_TRUE(inserted.second); // Every pair is reported once
+  }
+  return result;
+}
+
+// Compares the scene against the bruteforce over the same decoded shapes.
+pair_set expected_pairs(const std::vector<std::array<point, 3>> &triangles) {
+  bruteforce<float> brute;
+  for (const auto &[a, b, c] : triangles)
+    brute.add_collision_shape(shape_from_three_points(a, b, c));
+  return normalized(brute.colliding_pairs());
+}
+
+compact_scene<float>
+make_scene(const std::vector<std::array<point, 3>> &triangles) {
+  compact_scene<float> scene;
+  for (const auto &[a, b, c] : triangles)
+    scene.add_triangle(a, b, c);
+  return scene;
+}
+
+} // namespace
+
+TEST(test_compact_scene, test_random_triangles) {
+  std::mt19937 gen{17};
+  std::uniform_real_distribution<float> center_dist{-100, 100}, offset_dist{-3,
+                                                                            3};
+
+  std::vector<std::array<point, 3>> triangles;
+  for (unsigned i = 0; i < 3000; ++i) {
+    point center{center_dist(gen), center_dist(gen), center_dist(gen)};
+    auto vertex = [&]() {
+      return center +
+             vec3<float>{offset_dist(gen), offset_dist(gen), offset_dist(gen)};
+    };
+    triangles.push_back({vertex(), vertex(), vertex()});
+  }
+
+  auto scene = make_scene(triangles);
+  auto expected = expected_pairs(triangles);
+  EXPECT_FALSE(expected.empty());
+  EXPECT_EQ(normalized(scene.colliding_pairs()), expected);
+}
+
+TEST(test_compact_scene, test_shared_vertices) {
+  // A height field mesh, neighbouring triangles touch along shared edges.
+  constexpr unsigned side = 40;
+  auto vertex = [](unsigned i, unsigned j) {
+    return point{float(i), float(j), float((i * 7 + j * 3) % 5) / 4};
+  };
+
+  std::vector<std::array<point, 3>> triangles;
+  for (unsigned i = 0; i < side; ++i) {
+    for (unsigned j = 0; j < side; ++j) {
+      triangles.push_back({vertex(i, j), vertex(i + 1, j), vertex(i, j + 1)});
+      triangles.push_back(
+          {vertex(i + 1, j), vertex(i + 1, j + 1), vertex(i, j + 1)});
+    }
+  }
+
+  auto scene = make_scene(triangles);
+  auto pairs = normalized(scene.colliding_pairs());
+  EXPECT_EQ(scene.vertex_count(), (side + 1) * (side + 1));
+  EXPECT_EQ(pairs, expected_pairs(triangles));
+
+  // Shared vertices make the scene much smaller than the plain shapes.
+  EXPECT_LT(3 * scene.memory_usage(),
+            2 * triangles.size() * sizeof(collision_shape<float>));
+}
+
+TEST(test_compact_scene, test_degenerate) {
+  std::vector<std::array<point, 3>> triangles = {
+      {point{0, 0, 0}, point{0, 0, 0}, point{0, 0, 0}},
+      {point{-1, 0, 0}, point{1, 0, 0}, point{0, 0, 0}},
+      {point{0, -1, -1}, point{0, 1, -1}, point{0, 0, 1}},
+      {point{5, 5, 5}, point{5, 5, 5}, point{5, 5, 5}},
+      {point{5, 5, 5}, point{5, 5, 5}, point{5, 5, 5}}};
+
+  auto scene = make_scene(triangles);
+  EXPECT_EQ(normalized(scene.colliding_pairs()), expected_pairs(triangles));
+  EXPECT_EQ(scene.size(), triangles.size());
+}
+
+TEST(test_compact_scene, test_incremental) {
+  compact_scene<float> scene;
+  scene.add_triangle({0, 0, 0}, {1, 0, 0}, {0, 1, 0});
+  EXPECT_TRUE(scene.colliding_pairs().empty());
+
+  scene.add_triangle({0.25, 0.25, -1}, {0.25, 0.25, 1}, {2, 2, 0});
+  auto pairs = scene.colliding_pairs();
+  ASSERT_EQ(pairs.size(), 1);
+  EXPECT_EQ(normalized(pairs), (pair_set{{0, 1}}));
+}
@@ -0,0 +1,97 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "geometry/broadphase/bruteforce.hpp"
+#include "geometry/narrowphase/batched_narrowphase.hpp"
+#include "geometry/narrowphase/collision_shape.hpp"
+#include "geometry/narrowphase/narrowphase_stats.hpp"
+
+using namespace throttle::geometry;
+
+using stats = narrowphase_stats;
+using shape = collision_shape<float>;
+using triangle = triangle3<float>;
+
+TEST(test_narrowphase_stats, test_threads_are_summed) {
+  stats::reset();
+  ++stats::local().m_counters[stats::hits];
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < 4; ++t)
+    threads.emplace_back([]() {
+      stats::local().m_counters[stats::candidate_pairs] += 10;
+      stats::stage_timer timer{stats::aabb_stage};
+      timer.switch_to(stats::plane_stage);
+    });
+  for (auto &thread : threads)
+    thread.join();
+
+  auto total = stats::snapshot();
+  EXPECT_EQ(total.m_counters[stats::hits], 1);
+  EXPECT_EQ(total.m_counters[stats::candidate_pairs], 40);
+  EXPECT_EQ(total.m_counters[stats::aabb_rejects], 0);
+
+  stats::reset();
+  EXPECT_EQ(stats::snapshot().m_counters[stats::candidate_pairs], 0);
+}
+
+TEST(test_narrowphase_stats, test_rejection_funnel) {
+#ifndef NARROWPHASE_STATS__
+  GTEST_SKIP() << "Configure with -DNARROWPHASE_STATS=ON";
+#endif
+  // The base lies in the plane z = y / 2, so its bounding box isn't flat.
+  triangle base{{0, 0, 0}, {4, 0, 0}, {0, 4, 2}};
+  std::vector<shape> shapes = {
+      base,
+      triangle{{10, 10, 10}, {11, 10, 10}, {10, 11, 10}},    // far away
+      triangle{{3, 3, 1.8f}, {3.5f, 3, 1.8f}, {3, 3.5f, 2}}, // above the plane
+      triangle{{1, 1, -1}, {1, 1, 1}, {2, 1, 1}},            // crosses it
+      triangle{{1, 1, 0.5f}, {2, 1, 0.5f}, {1, 2, 1}},       // coplanar
+  };
+
+  stats::reset();
+  for (unsigned i = 1; i < shapes.size(); ++i)
+    shapes[0].collide(shapes[i]);
+
+  auto total = stats::snapshot();
+  EXPECT_EQ(total.m_counters[stats::candidate_pairs], 4);
+  EXPECT_EQ(total.m_counters[stats::aabb_rejects], 1);
+  EXPECT_EQ(total.m_counters[stats::plane_rejects_t2], 1);
+  EXPECT_EQ(total.m_counters[stats::plane_rejects_t1], 0);
+  EXPECT_EQ(total.m_counters[stats::coplanar_fallbacks], 1);
+  EXPECT_EQ(total.m_counters[stats::hits], 2);
+
+  // The batched narrowphase goes through the same funnel.
+  bruteforce<float> brute;
+  for (const auto &s : shapes)
+    brute.add_collision_shape(s);
+
+  stats::reset();
+  brute.for_each_colliding_pair([](unsigned, unsigned) {});
+  auto reference = stats::snapshot();
+
+  stats::reset();
+  batched_narrowphase<float> narrow;
+  narrow.collide(brute, [](unsigned, unsigned) {});
+  auto batched = stats::snapshot();
+
+  for (auto counter : {stats::candidate_pairs, stats::aabb_rejects,
+                       stats::hits})
+    EXPECT_EQ(batched.m_counters[counter], reference.m_counters[counter]);
+  EXPECT_EQ(batched.m_counters[stats::plane_rejects_t2] +
+                batched.m_counters[stats::plane_rejects_t1],
+            reference.m_counters[stats::plane_rejects_t2] +
+                reference.m_counters[stats::plane_rejects_t1]);
+}
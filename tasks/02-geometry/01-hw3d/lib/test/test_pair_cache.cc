@@ -0,0 +1,158 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include <algorithm>
+#include <gtest/gtest.h>
+
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "geometry/broadphase/bruteforce.hpp"
+#include "geometry/broadphase/pair_cache.hpp"
+
+using namespace throttle::geometry;
+
+using triangle = triangle3<float>;
+using pair_set = std::set<std::pair<unsigned, unsigned>>;
+
+namespace {
+
+template <typename broad> pair_set normalized_pairs(broad &cont) {
+  pair_set result;
+  for (auto [first, second] : cont.colliding_pairs())
+    result.emplace(std::min(first, second), std::max(first, second));
+  return result;
+}
+
+triangle shifted(const triangle &tri, const vec3<float> &offset) {
+  return {tri.a + offset, tri.b + offset, tri.c + offset};
+}
+
+} // namespace
+
+TEST(test_pair_cache, test_stats) {
+  pair_cache<float> cache{0.5f};
+  triangle base{{-1, 0, -1}, {1, 0, -1}, {0, 0, 1}};
+  triangle crossing{{0, -1, 0}, {0, 1, 0}, {0, 0, 2}};
+
+  cache.add_collision_shape(base);
+  cache.add_collision_shape(crossing);
+  EXPECT_EQ(normalized_pairs(cache), (pair_set{{0, 1}}));
+  EXPECT_EQ(cache.stats().m_new, 1);
+
+  // Nothing moved.
+  EXPECT_EQ(normalized_pairs(cache), (pair_set{{0, 1}}));
+  EXPECT_EQ(cache.stats().m_new, 0);
+  EXPECT_EQ(cache.stats().m_persistent, 1);
+  EXPECT_EQ(cache.stats().m_removed, 0);
+
+  // Moves inside of the margin, the narrowphase is rerun.
+  cache.update_collision_shape(1, shifted(crossing, {0.1f, 0, 0}));
+  EXPECT_EQ(normalized_pairs(cache), (pair_set{{0, 1}}));
+  EXPECT_EQ(cache.stats().m_persistent, 1);
+
+  // Moves far away.
+  cache.update_collision_shape(1, shifted(crossing, {10, 0, 0}));
+  EXPECT_TRUE(normalized_pairs(cache).empty());
+  EXPECT_EQ(cache.stats().m_removed, 1);
+  EXPECT_EQ(cache.stats().m_persistent, 0);
+
+  // And back.
+  cache.update_collision_shape(1, crossing);
+  EXPECT_EQ(normalized_pairs(cache), (pair_set{{0, 1}}));
+  EXPECT_EQ(cache.stats().m_new, 1);
+}
+
+TEST(test_pair_cache, test_moving_scene) {
+  std::mt19937 gen{21};
+  std::uniform_real_distribution<float> center_dist{-30, 30}, size_dist{-2, 2},
+      step_dist{-0.3f, 0.3f};
+
+  std::vector<triangle> triangles;
+  for (unsigned i = 0; i < 1000; ++i) {
+    point3<float> center{center_dist(gen), center_dist(gen), center_dist(gen)};
+    auto vertex = [&]() {
+      return center +
+             vec3<float>{size_dist(gen), size_dist(gen), size_dist(gen)};
+    };
+    triangles.push_back({vertex(), vertex(), vertex()});
+  }
+
+  pair_cache<float> cache{0.5f};
+  for (const auto &tri : triangles)
+    cache.add_collision_shape(tri);
+
+  pair_set previous;
+  for (unsigned frame = 0; frame < 20; ++frame) {
+    // Move every tenth shape a little.
+    for (unsigned i = frame % 10; i < triangles.size(); i += 10) {
+      triangles[i] = shifted(
+          triangles[i], vec3<float>{step_dist(gen), step_dist(gen), 0});
+      cache.update_collision_shape(i, triangles[i]);
+    }
+
+    bruteforce<float> brute;
+    for (const auto &tri : triangles)
+      brute.add_collision_shape(tri);
+
+    auto expected = normalized_pairs(brute);
+    EXPECT_EQ(normalized_pairs(cache), expected);
+
+    // The counts agree with the difference between two frames.
+    pair_set added, removed;
+    std::set_difference(expected.begin(), expected.end(), previous.begin(),
+                        previous.end(), std::inserter(added, added.end()));
+    std::set_difference(previous.begin(), previous.end(), expected.begin(),
+                        expected.end(), std::inserter(removed, removed.end()));
+    auto stats = cache.stats();
+    EXPECT_EQ(stats.m_new, added.size());
+    EXPECT_EQ(stats.m_removed, removed.size());
+    EXPECT_EQ(stats.m_persistent, expected.size() - added.size());
+
+    previous = std::move(expected);
+  }
+}
+
+TEST(test_pair_cache, test_mass_escape) {
+  std::mt19937 gen{23};
+  std::uniform_real_distribution<float> center_dist{-30, 30}, size_dist{-2, 2},
+      jump_dist{-20, 20};
+
+  std::vector<triangle> triangles;
+  for (unsigned i = 0; i < 500; ++i) {
+    point3<float> center{center_dist(gen), center_dist(gen), center_dist(gen)};
+    auto vertex = [&]() {
+      return center +
+             vec3<float>{size_dist(gen), size_dist(gen), size_dist(gen)};
+    };
+    triangles.push_back({vertex(), vertex(), vertex()});
+  }
+
+  pair_cache<float> cache{0.5f};
+  for (const auto &tri : triangles)
+    cache.add_collision_shape(tri);
+
+  // Alternates frames where every shape jumps out of its fat box with frames
+  // where only a few of them do.
+  for (unsigned frame = 0; frame < 6; ++frame) {
+    unsigned step = (frame % 2 ? 50 : 1);
+    for (unsigned i = frame % step; i < triangles.size(); i += step) {
+      triangles[i] = shifted(triangles[i], vec3<float>{jump_dist(gen), 0, 0});
+      cache.update_collision_shape(i, triangles[i]);
+    }
+
+    bruteforce<float> brute;
+    for (const auto &tri : triangles)
+      brute.add_collision_shape(tri);
+    EXPECT_EQ(normalized_pairs(cache), normalized_pairs(brute));
+  }
+}
@@ -125,3 +125,23 @@ TEST(test_segment3, test_intersect_9) {
   std::swap(a.a, a.b);
   EXPECT_TRUE(a.intersect(b));
 }
+
+TEST(test_segment3, test_ray_intersection_1) {
+  segment_type a{{-1, 2, 0}, {1, 2, 0}};
+  auto t = a.ray_intersection({0, 0, 0}, {0, 1, 0});
+  ASSERT_TRUE(t);
+  EXPECT_FLOAT_EQ(t.value(), 2);
+  EXPECT_FALSE(a.ray_intersection({0, 0, 0}, {0, -1, 0}));
+  EXPECT_FALSE(a.ray_intersection({0, 0, 1}, {0, 1, 0}));
+}
+
+TEST(test_segment3, test_ray_intersection_2) {
+  segment_type a{{0, 2, 0}, {0, 4, 0}};
+  auto t = a.ray_intersection({0, 0, 0}, {0, 2, 0});
+  ASSERT_TRUE(t);
+  EXPECT_FLOAT_EQ(t.value(), 1);
+  t = a.ray_intersection({0, 3, 0}, {0, -1, 0});
+  ASSERT_TRUE(t);
+  EXPECT_FLOAT_EQ(t.value(), 0);
+  EXPECT_FALSE(a.ray_intersection({0, 5, 0}, {0, 1, 0}));
+}
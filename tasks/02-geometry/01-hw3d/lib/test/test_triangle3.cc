@@ -109,3 +109,22 @@ TEST(test_triangle3, test_intersect_9) {
   triangle3 b{{0, 0, 0}, {0, 5, 0}, {0, 0, 5}};
   EXPECT_TRUE(a.intersect(b));
 }
+
+TEST(test_triangle3, test_ray_intersection_1) {
+  triangle3 a{{-1, -1, 3}, {1, -1, 3}, {0, 1, 3}};
+  auto t = a.ray_intersection({0, 0, 0}, {0, 0, 2});
+  ASSERT_TRUE(t);
+  EXPECT_FLOAT_EQ(t.value(), 1.5);
+  EXPECT_FALSE(a.ray_intersection({0, 0, 0}, {0, 0, -1}));
+  EXPECT_FALSE(a.ray_intersection({5, 0, 0}, {0, 0, 1}));
+}
+
+TEST(test_triangle3, test_ray_intersection_2) {
+  triangle3 a{{0, 0, 0}, {2, 0, 0}, {0, 2, 0}};
+  auto t = a.ray_intersection({-2, 0.5, 0}, {1, 0, 0});
+  ASSERT_TRUE(t);
+  EXPECT_FLOAT_EQ(t.value(), 2);
+  t = a.ray_intersection({0.5, 0.5, 0}, {1, 0, 0});
+  ASSERT_TRUE(t);
+  EXPECT_FLOAT_EQ(t.value(), 0);
+}
@@ -0,0 +1,146 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "geometry/io/mapped_file.hpp"
+#include "geometry/io/triangle_loader.hpp"
+#include "geometry/narrowphase/collision_shape.hpp"
+
+using namespace throttle::geometry;
+
+namespace {
+
+// Text input with random whitespace between the numbers, along with the
+// values operator>> reads from it.
+std::pair<std::string, std::vector<float>> random_input(unsigned number,
+                                                        unsigned seed = 42) {
+  std::mt19937 gen{seed};
+  std::uniform_real_distribution<float> coord_dist{-1000, 1000};
+  const char *separators[] = {" ", "\n", "  ", "\t", " \r\n"};
+
+  std::ostringstream os;
+  os << number << "\n";
+  for (unsigned i = 0; i < 9 * number; ++i)
+    os << std::setprecision(i % 10) << coord_dist(gen)
+       << separators[gen() % std::size(separators)];
+
+  std::istringstream is{os.str()};
+  unsigned count;
+  is >> count;
+  std::vector<float> expected(9 * number);
+  for (auto &coord : expected)
+    is >> coord;
+
+  return {os.str(), expected};
+}
+
+} // namespace
+
+TEST(test_triangle_loader, test_text_simple) {
+  auto soup = parse_text_triangles<float>(
+      "2 0 0 0 1 0 0 0 1 0\n+1 2 3 -4 5.5 6 7e1 8 9\n", 4);
+  ASSERT_EQ(soup.size(), 2);
+  EXPECT_EQ(soup.vertex(0, 2), (point3<float>{0, 1, 0}));
+  EXPECT_EQ(soup.vertex(1, 0), (point3<float>{1, 2, 3}));
+  EXPECT_EQ(soup.vertex(1, 1), (point3<float>{-4, 5.5, 6}));
+  EXPECT_EQ(soup.vertex(1, 2), (point3<float>{70, 8, 9}));
+}
+
+TEST(test_triangle_loader, test_text_same_as_stream) {
+  auto [text, expected] = random_input(20000);
+  for (unsigned threads : {1, 3, 8}) {
+    auto soup = parse_text_triangles<float>(text, threads);
+    EXPECT_EQ(soup.m_coords, expected);
+  }
+}
+
+TEST(test_triangle_loader, test_text_errors) {
+  EXPECT_THROW(parse_text_triangles<float>("", 1), std::runtime_error);
+  EXPECT_THROW(parse_text_triangles<float>("abc", 1), std::runtime_error);
+
+  try {
+    parse_text_triangles<float>("2 0 0 0 1 0 0 0 1 0 1 2 3 x 5 6 7 8 9", 2);
+    FAIL();
+  } catch (std::runtime_error &e) {
+    EXPECT_EQ(std::string{e.what()}, "Can't read i-th = 1 triangle");
+  }
+
+  EXPECT_THROW(parse_text_triangles<float>("1 0 0 0 1 0 0 0 1", 1),
+               std::runtime_error);
+  // Extra numbers after the last triangle are ignored, like with operator>>.
+  EXPECT_EQ(parse_text_triangles<float>("1 0 0 0 1 0 0 0 1 0 5", 1).size(), 1);
+}
+
+TEST(test_triangle_loader, test_binary_round_trip) {
+  auto [text, expected] = random_input(1000, 7);
+  auto soup = parse_text_triangles<float>(text, 2);
+
+  std::ostringstream os;
+  write_binary_triangles(os, soup);
+  auto data = os.str();
+  EXPECT_EQ(data.size(), 1000 * 9 * sizeof(float));
+  EXPECT_EQ(parse_binary_triangles<float>(data).m_coords, expected);
+
+  // 1.0f is 0x3f800000, stored least significant byte first.
+  triangle_soup<float> one{{1, 0, 0, 0, 0, 0, 0, 0, 0}};
+  std::ostringstream one_os;
+  write_binary_triangles(one_os, one);
+  EXPECT_EQ(one_os.str().substr(0, 4), std::string("\x00\x00\x80\x3f", 4));
+
+  EXPECT_THROW(parse_binary_triangles<float>(data.substr(1)),
+               std::runtime_error);
+}
+
+TEST(test_triangle_loader, test_mapped_file) {
+  auto [text, expected] = random_input(500, 3);
+  std::string path = testing::TempDir() + "test_triangle_loader.dat";
+  std::ofstream{path} << text;
+
+  mapped_file file{path};
+  EXPECT_TRUE(file.mapped());
+  EXPECT_EQ(file.view(), text);
+  EXPECT_EQ(parse_text_triangles<float>(file.view(), 2).m_coords, expected);
+  std::remove(path.c_str());
+
+  EXPECT_THROW(mapped_file{path}, std::runtime_error);
+}
+
+TEST(test_triangle_loader, test_build_shapes) {
+  auto [text, expected] = random_input(10000, 5);
+  auto soup = parse_text_triangles<float>(text, 4);
+
+  auto chunks = build_shapes(soup, 4, [](unsigned, auto a, auto b, auto c) {
+    return shape_from_three_points(a, b, c);
+  });
+
+  unsigned index = 0;
+  for (const auto &chunk : chunks) {
+    for (const auto &shape : chunk) {
+      auto expected_box =
+          shape_from_three_points(soup.vertex(index, 0), soup.vertex(index, 1),
+                                  soup.vertex(index, 2))
+              .bounding_box();
+      EXPECT_EQ(shape.bounding_box().minimum_corner(),
+                expected_box.minimum_corner());
+      ++index;
+    }
+  }
+  EXPECT_EQ(index, soup.size());
+}
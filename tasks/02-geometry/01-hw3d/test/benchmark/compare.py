@@ -0,0 +1,108 @@
+##
+# ----------------------------------------------------------------------------
+# "THE BEER-WARE LICENSE" (Revision 42):
+# <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+# retain this notice you can do whatever you want with this stuff. If we meet
+# some day, and you think this stuff is worth it, you can buy us a beer in
+# return.
+# ----------------------------------------------------------------------------
+##
+
+import argparse
+import json
+import sys
+
+# Counters that don't depend on timing. Any change in them means that a
+# broadphase started reporting different pairs, not that it got slower.
+EXACT_COUNTERS = ["narrowphase_calls", "colliding"]
+
+TIME_UNITS = {"ns": 1e-9, "us": 1e-6, "ms": 1e-3, "s": 1.0}
+
+
+def load_results(path: str) -> dict:
+    with open(path) as json_file:
+        report = json.load(json_file)
+
+    # With --benchmark_repetitions only the mean of the repetitions is used.
+    results = {}
+    for entry in report["benchmarks"]:
+        if entry.get("run_type") == "aggregate":
+            if entry.get("aggregate_name") != "mean":
+                continue
+            results[entry["run_name"]] = entry
+        elif entry["name"] not in results:
+            results[entry["name"]] = entry
+    return results
+
+
+def seconds(entry: dict, metric: str) -> float:
+    return entry[metric] * TIME_UNITS[entry.get("time_unit", "ns")]
+
+
+def compare(baseline: dict, current: dict, threshold: float, metric: str) -> int:
+    failures = 0
+    for name, base in baseline.items():
+        if name not in current:
+            print("MISSING     {}".format(name))
+            continue
+
+        cur = current[name]
+        ratio = seconds(cur, metric) / seconds(base, metric)
+        status = "ok"
+        if ratio > 1 + threshold:
+            status = "REGRESSION"
+            failures += 1
+        elif ratio < 1 - threshold:
+            status = "improved"
+
+        for counter in EXACT_COUNTERS:
+            if counter in base and base[counter] != cur.get(counter):
+                print(
+                    "CHANGED     {}: {} {} -> {}".format(
+                        name, counter, base[counter], cur.get(counter)
+                    )
+                )
+                failures += 1
+
+        print("{:<11} {} {:+.1f}%".format(status, name, (ratio - 1) * 100))
+
+    for name in current.keys() - baseline.keys():
+        print("NEW         {}".format(name))
+
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Compare two Google Benchmark JSON reports."
+    )
+    parser.add_argument("baseline", type=str, help="Report of the baseline run.")
+    parser.add_argument("current", type=str, help="Report of the new run.")
+    parser.add_argument(
+        "--threshold",
+        type=float,
+        default=0.1,
+        help="Relative slowdown reported as a regression (0.1 by default).",
+    )
+    parser.add_argument(
+        "--metric",
+        type=str,
+        default="real_time",
+        choices=["real_time", "cpu_time"],
+        help="Time to compare (real_time by default).",
+    )
+    args = parser.parse_args()
+
+    failures = compare(
+        load_results(args.baseline),
+        load_results(args.current),
+        args.threshold,
+        args.metric,
+    )
+    if failures:
+        print("{} regressions found".format(failures))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,366 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "geometry/broadphase/adaptive_octree.hpp"
+#include "geometry/broadphase/bruteforce.hpp"
+#include "geometry/broadphase/compact_octree.hpp"
+#include "geometry/broadphase/compact_scene.hpp"
+#include "geometry/broadphase/hierarchical_grid.hpp"
+#include "geometry/broadphase/lbvh.hpp"
+#include "geometry/broadphase/octree.hpp"
+#include "geometry/broadphase/uniform_grid.hpp"
+#include "geometry/narrowphase/collision_shape.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace throttle::geometry;
+
+namespace {
+
+using point_type = point3<float>;
+using vec_type = vec3<float>;
+using triangle_points = std::array<point_type, 3>;
+
+// Collision shape that counts how many times the narrowphase runs.
+struct counting_shape : public collision_shape<float> {
+  static inline std::atomic<std::uint64_t> calls{0};
+
+  counting_shape(const collision_shape<float> &shape)
+      : collision_shape{shape} {}
+
+  bool collide(const counting_shape &other) const {
+    calls.fetch_add(1, std::memory_order_relaxed);
+    return collision_shape::collide(other);
+  }
+};
+
+enum class scene_kind { uniform, clustered, slivers, sheet, mixed_scale };
+
+const std::array<std::pair<scene_kind, const char *>, 5> scene_names = {
+    {{scene_kind::uniform, "uniform"},
+     {scene_kind::clustered, "clustered"},
+     {scene_kind::slivers, "slivers"},
+     {scene_kind::sheet, "sheet"},
+     {scene_kind::mixed_scale, "mixed-scale"}}};
+
+// Scenes keep roughly the same number of overlaps per triangle at every size:
+// the volume (or the area for the sheet) grows with the number of triangles.
+std::vector<triangle_points> generate_scene(scene_kind kind, unsigned number,
+                                            unsigned seed = 42) {
+  std::mt19937 gen{seed};
+  auto uniform = [&gen](float lo, float hi) {
+    return std::uniform_real_distribution<float>{lo, hi}(gen);
+  };
+  auto random_vec = [&](float half) {
+    return vec_type{uniform(-half, half), uniform(-half, half),
+                    uniform(-half, half)};
+  };
+
+  const float half = 2 * std::cbrt(float(number));
+  std::vector<triangle_points> result;
+  result.reserve(number);
+
+  auto small_triangle = [&](point_type center, float size) {
+    return triangle_points{center + random_vec(size), center + random_vec(size),
+                           center + random_vec(size)};
+  };
+
+  switch (kind) {
+  case scene_kind::uniform:
+    for (unsigned i = 0; i < number; ++i)
+      result.push_back(small_triangle(point_type{} + random_vec(half), 1));
+    break;
+
+  case scene_kind::clustered: { // Gaussian blobs around a few centers
+    std::vector<point_type> centers;
+    for (unsigned i = 0; i < 16; ++i)
+      centers.push_back(point_type{} + random_vec(half));
+    std::normal_distribution<float> spread{0, half / 8};
+    for (unsigned i = 0; i < number; ++i) {
+      auto center = centers[gen() % centers.size()] +
+                    vec_type{spread(gen), spread(gen), spread(gen)};
+      result.push_back(small_triangle(center, 1));
+    }
+    break;
+  }
+
+  case scene_kind::slivers: // long and thin, with large bounding boxes
+    for (unsigned i = 0; i < number; ++i) {
+      auto center = point_type{} + random_vec(half);
+      auto dir = random_vec(1).norm() * 8.0f;
+      auto a = center + (-dir), b = center + dir;
+      result.push_back({a, b, a + random_vec(0.01f)});
+    }
+    break;
+
+  case scene_kind::sheet: { // everything lies in z = 0
+    const float side = 2 * std::sqrt(float(number));
+    for (unsigned i = 0; i < number; ++i) {
+      auto center = point_type{uniform(-side, side), uniform(-side, side), 0};
+      triangle_points tri;
+      for (auto &v : tri)
+        v = center + vec_type{uniform(-1, 1), uniform(-1, 1), 0};
+      result.push_back(tri);
+    }
+    break;
+  }
+
+  case scene_kind::mixed_scale: // sizes are log-uniform over three decades
+    for (unsigned i = 0; i < number; ++i) {
+      float size = std::pow(10.0f, uniform(-2, 1));
+      result.push_back(small_triangle(point_type{} + random_vec(half), size));
+    }
+    break;
+  }
+
+  return result;
+}
+
+// Scenes are generated once and shared by all the benchmarks.
+const std::vector<triangle_points> &scene(scene_kind kind, unsigned number) {
+  static std::map<std::pair<scene_kind, unsigned>,
+                  std::vector<triangle_points>>
+      cache;
+  auto [it, inserted] = cache.try_emplace({kind, number});
+  if (inserted)
+    it->second = generate_scene(kind, number);
+  return it->second;
+}
+
+template <typename t_shape>
+std::vector<t_shape> scene_shapes(scene_kind kind, unsigned number) {
+  std::vector<t_shape> result;
+  for (const auto &[a, b, c] : scene(kind, number))
+    result.push_back(t_shape{shape_from_three_points(a, b, c)});
+  return result;
+}
+
+template <typename t_shape> struct octree_factory {
+  auto operator()(unsigned number, unsigned depth = 0) const {
+    return octree<float, t_shape>{depth ? depth
+                                        : approximate_optimal_depth(number)};
+  }
+};
+
+template <typename t_shape> struct compact_octree_factory {
+  auto operator()(unsigned number, unsigned depth = 0) const {
+    return compact_octree<float, t_shape>{
+        depth ? depth : approximate_optimal_depth(number)};
+  }
+};
+
+template <typename t_shape> struct adaptive_octree_factory {
+  auto operator()(unsigned, unsigned = 0) const {
+    return adaptive_octree<float, t_shape>{};
+  }
+};
+
+template <typename t_shape> struct pinning_adaptive_octree_factory {
+  auto operator()(unsigned, unsigned = 0) const {
+    using octree_type = adaptive_octree<float, t_shape>;
+    return octree_type{octree_type::default_split_threshold, false};
+  }
+};
+
+template <typename t_shape> struct bruteforce_factory {
+  auto operator()(unsigned number, unsigned = 0) const {
+    return bruteforce<float, t_shape>{number};
+  }
+};
+
+template <typename t_shape> struct uniform_grid_factory {
+  auto operator()(unsigned number, unsigned = 0) const {
+    return uniform_grid<float, t_shape>{number};
+  }
+};
+
+template <typename t_shape> struct hierarchical_grid_factory {
+  auto operator()(unsigned number, unsigned = 0) const {
+    return hierarchical_grid<float, t_shape>{number};
+  }
+};
+
+template <typename t_shape> struct lbvh_factory {
+  auto operator()(unsigned number, unsigned = 0) const {
+    return lbvh<float, t_shape>{number};
+  }
+};
+
+// Narrowphase calls and colliding shapes of one many_to_many, which do not
+// depend on timing and catch changes in behaviour.
+template <template <typename> typename t_factory>
+void count_narrowphase(benchmark::State &state, scene_kind kind,
+                       unsigned number, unsigned depth) {
+  auto broad = t_factory<counting_shape>{}(number, depth);
+  for (const auto &shape : scene_shapes<counting_shape>(kind, number))
+    broad.add_collision_shape(shape);
+  broad.rebuild();
+
+  counting_shape::calls = 0;
+  auto colliding = broad.many_to_many().size();
+  state.counters["narrowphase_calls"] = double(counting_shape::calls);
+  state.counters["colliding"] = double(colliding);
+}
+
+template <template <typename> typename t_factory>
+void bm_build(benchmark::State &state, scene_kind kind) {
+  unsigned number = state.range(0);
+  auto shapes = scene_shapes<collision_shape<float>>(kind, number);
+
+  for (auto _ : state) {
+    auto broad = t_factory<collision_shape<float>>{}(number);
+    for (const auto &shape : shapes)
+      broad.add_collision_shape(shape);
+    broad.rebuild();
+    benchmark::ClobberMemory();
+  }
+
+  state.SetItemsProcessed(state.iterations() * number);
+}
+
+template <template <typename> typename t_factory>
+void bm_many_to_many(benchmark::State &state, scene_kind kind) {
+  unsigned number = state.range(0);
+  unsigned depth = state.range(1);
+
+  auto broad = t_factory<collision_shape<float>>{}(number, depth);
+  for (const auto &shape : scene_shapes<collision_shape<float>>(kind, number))
+    broad.add_collision_shape(shape);
+  broad.rebuild();
+
+  for (auto _ : state)
+    benchmark::DoNotOptimize(broad.many_to_many());
+
+  count_narrowphase<t_factory>(state, kind, number, depth);
+  if (depth)
+    state.counters["heuristic_depth"] = approximate_optimal_depth(number);
+}
+
+void bm_compact_scene_build(benchmark::State &state, scene_kind kind) {
+  unsigned number = state.range(0);
+  const auto &triangles = scene(kind, number);
+
+  for (auto _ : state) {
+    compact_scene<float> compact{number};
+    for (const auto &[a, b, c] : triangles)
+      compact.add_triangle(a, b, c);
+    compact.rebuild();
+    benchmark::ClobberMemory();
+  }
+
+  state.SetItemsProcessed(state.iterations() * number);
+}
+
+void bm_compact_scene_many_to_many(benchmark::State &state, scene_kind kind) {
+  unsigned number = state.range(0);
+  compact_scene<float> compact{number};
+  for (const auto &[a, b, c] : scene(kind, number))
+    compact.add_triangle(a, b, c);
+  compact.rebuild();
+
+  std::vector<bool> colliding(number);
+  for (auto _ : state) {
+    std::fill(colliding.begin(), colliding.end(), false);
+    compact.for_each_colliding_pair([&colliding](unsigned i, unsigned j) {
+      colliding[i] = colliding[j] = true;
+    });
+    benchmark::DoNotOptimize(colliding);
+  }
+
+  state.counters["colliding"] =
+      double(std::count(colliding.begin(), colliding.end(), true));
+}
+
+constexpr unsigned min_size = 1000, max_size = 1000000;
+
+template <template <typename> typename t_factory>
+void register_broadphase(const std::string &name, unsigned max_number) {
+  for (auto [kind, scene_name] : scene_names) {
+    auto suffix = name + "/" + scene_name;
+    benchmark::RegisterBenchmark(("build/" + suffix).c_str(),
+                                 bm_build<t_factory>, kind)
+        ->RangeMultiplier(10)
+        ->Range(min_size, max_number)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("many_to_many/" + suffix).c_str(),
+                                 bm_many_to_many<t_factory>, kind)
+        ->ArgNames({"n", "depth"})
+        ->ArgsProduct({benchmark::CreateRange(min_size, max_number, 10), {0}})
+        ->Unit(benchmark::kMillisecond);
+  }
+}
+
+// Octree depth sweep that backs the depth heuristic. Very shallow trees on the
+// largest scenes degrade into bruteforce, so the sweep stops at 1e5.
+template <template <typename> typename t_factory>
+void register_depth_sweep(const std::string &name) {
+  for (auto [kind, scene_name] : scene_names) {
+    benchmark::RegisterBenchmark(
+        ("depth_sweep/" + name + "/" + scene_name).c_str(),
+        bm_many_to_many<t_factory>, kind)
+        ->ArgNames({"n", "depth"})
+        ->ArgsProduct({benchmark::CreateRange(min_size, max_size / 10, 10),
+                       benchmark::CreateDenseRange(1, 8, 1)})
+        ->Unit(benchmark::kMillisecond);
+  }
+}
+
+void register_compact_scene() {
+  for (auto [kind, scene_name] : scene_names) {
+    auto suffix = std::string{"compact-scene/"} + scene_name;
+    benchmark::RegisterBenchmark(("build/" + suffix).c_str(),
+                                 bm_compact_scene_build, kind)
+        ->RangeMultiplier(10)
+        ->Range(min_size, max_size)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("many_to_many/" + suffix).c_str(),
+                                 bm_compact_scene_many_to_many, kind)
+        ->RangeMultiplier(10)
+        ->Range(min_size, max_size)
+        ->Unit(benchmark::kMillisecond);
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  // Bruteforce is quadratic, anything past 1e4 takes minutes per iteration.
+  register_broadphase<bruteforce_factory>("bruteforce", 10000);
+  register_broadphase<octree_factory>("octree", max_size);
+  register_broadphase<compact_octree_factory>("compact-octree", max_size);
+  register_broadphase<adaptive_octree_factory>("adaptive-octree", max_size);
+  register_broadphase<pinning_adaptive_octree_factory>(
+      "adaptive-octree-pinned", max_size);
+  register_broadphase<uniform_grid_factory>("uniform-grid", max_size);
+  register_broadphase<hierarchical_grid_factory>("hierarchical-grid",
+                                                 max_size);
+  register_broadphase<lbvh_factory>("lbvh", max_size);
+  register_compact_scene();
+
+  register_depth_sweep<octree_factory>("octree");
+  register_depth_sweep<compact_octree_factory>("compact-octree");
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+}
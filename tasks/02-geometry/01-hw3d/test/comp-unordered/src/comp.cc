@@ -8,10 +8,14 @@
  * ----------------------------------------------------------------------------
  */
 
-#include <fstream>
+#include <algorithm>
 #include <iostream>
-#include <set>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <vector>
+
+#include "geometry/io/mapped_file.hpp"
 
 #ifdef BOOST_FOUND__
 #include <boost/program_options.hpp>
@@ -19,33 +23,39 @@
 namespace po = boost::program_options;
 #endif
 
-bool contain_same(std::string name_a, std::string name_b) {
-  std::ifstream file_a, file_b;
-  file_a.open(name_a);
-  file_b.open(name_b);
-
-  if (!file_a.is_open()) {
-    std::cout << "Can't open " << name_a << " \n";
-    return false;
-  }
-
-  if (!file_b.is_open()) {
-    std::cout << "Can't open " << name_b << " \n";
-    return false;
+// Whitespace separated tokens of the text, sorted and without duplicates.
+static std::vector<std::string_view> unique_tokens(std::string_view text) {
+  std::vector<std::string_view> result;
+  auto is_space = [](char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+           c == '\f';
+  };
+
+  for (std::size_t pos = 0; pos < text.size();) {
+    if (is_space(text[pos])) {
+      ++pos;
+      continue;
+    }
+    auto end = pos;
+    while (end < text.size() && !is_space(text[end]))
+      ++end;
+    result.push_back(text.substr(pos, end - pos));
+    pos = end;
   }
 
-  std::set<std::string> set_a;
-  std::string temp;
-  while ((file_a >> temp)) {
-    set_a.insert(temp);
-  }
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
+  return result;
+}
 
-  std::set<std::string> set_b;
-  while ((file_b >> temp)) {
-    set_b.insert(temp);
+bool contain_same(std::string name_a, std::string name_b) {
+  try {
+    throttle::geometry::mapped_file file_a{name_a}, file_b{name_b};
+    return unique_tokens(file_a.view()) == unique_tokens(file_b.view());
+  } catch (std::runtime_error &e) {
+    std::cout << e.what() << " \n";
+    return false;
   }
-
-  return set_a == set_b;
 }
 
 int main(int argc, char *argv[]) {
@@ -1,20 +1,33 @@
 #include <chrono>
 #include <iostream>
 
+#include "geometry/broadphase/adaptive_octree.hpp"
 #include "geometry/broadphase/broadphase_structure.hpp"
 #include "geometry/broadphase/bruteforce.hpp"
+#include "geometry/broadphase/compact_octree.hpp"
+#include "geometry/broadphase/compact_scene.hpp"
+#include "geometry/broadphase/hierarchical_grid.hpp"
+#include "geometry/broadphase/lbvh.hpp"
 #include "geometry/broadphase/octree.hpp"
 #include "geometry/broadphase/uniform_grid.hpp"
+#include "geometry/io/mapped_file.hpp"
+#include "geometry/io/triangle_loader.hpp"
+#include "geometry/narrowphase/batched_narrowphase.hpp"
 
 #include "geometry/narrowphase/collision_shape.hpp"
+#include "geometry/narrowphase/narrowphase_stats.hpp"
 #include "geometry/primitives/plane.hpp"
 #include "geometry/primitives/triangle3.hpp"
 #include "geometry/vec3.hpp"
 
 #include <chrono>
 #include <cmath>
+#include <fstream>
 #include <set>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
 #ifdef BOOST_FOUND__
@@ -30,83 +43,109 @@ struct indexed_geom : public throttle::geometry::collision_shape<float> {
 };
 
 using throttle::geometry::collision_shape;
-using throttle::geometry::is_roughly_equal;
 using throttle::geometry::point3;
-using throttle::geometry::segment3;
-using throttle::geometry::triangle3;
-using throttle::geometry::vec3;
-
-template <typename T>
-throttle::geometry::collision_shape<T>
-shape_from_three_points(const point3<T> &a, const point3<T> &b,
-                        const point3<T> &c) {
-  auto ab = b - a, ac = c - a;
-
-  if (throttle::geometry::colinear(ab, ac)) { // Either a segment or a point
-    if (is_roughly_equal(ab, vec3<T>::zero()) &&
-        is_roughly_equal(ac, vec3<T>::zero())) {
-      return throttle::geometry::barycentric_average<T>(a, b, c);
-    }
-    // This is a segment. Project the the points onto the most closely alligned
-    // axis.
-    auto max_index = ab.max_component().first;
-
-    std::array<std::pair<point3<T>, T>, 3> arr = {
-        std::make_pair(a, a[max_index]), std::make_pair(b, b[max_index]),
-        std::make_pair(c, c[max_index])};
-    std::sort(arr.begin(), arr.end(),
-              [](const auto &left, const auto &right) -> bool {
-                return left.second < right.second;
-              });
-    return segment3<T>{arr[0].first, arr[2].first};
-  }
+using throttle::geometry::shape_from_three_points;
+
+using soup_type = throttle::geometry::triangle_soup<float>;
+using shape_chunks = std::vector<std::vector<indexed_geom>>;
+
+// Reads the whole input at once, from standard input if no path is given.
+static soup_type load_triangles(const std::string &path, bool binary,
+                                unsigned threads) {
+  auto file = path.empty() ? throttle::geometry::mapped_file{STDIN_FILENO}
+                           : throttle::geometry::mapped_file{path};
+  if (binary)
+    return throttle::geometry::parse_binary_triangles<float>(file.view());
+  return throttle::geometry::parse_text_triangles<float>(file.view(), threads);
+}
 
-  return triangle3<T>{a, b, c};
+static shape_chunks build_indexed_shapes(const soup_type &soup,
+                                         unsigned threads) {
+  return throttle::geometry::build_shapes(
+      soup, threads, [](unsigned i, const auto &a, const auto &b,
+                        const auto &c) -> indexed_geom {
+        return {i, shape_from_three_points(a, b, c)};
+      });
 }
 
-static unsigned apporoximate_optimal_depth(unsigned number) {
-  constexpr unsigned max_depth = 6;
-  unsigned log_num = std::log10(float(number));
-  return std::min(max_depth, log_num);
+static void print_colliding(const std::vector<bool> &colliding) {
+  for (unsigned i = 0; i < colliding.size(); ++i)
+    if (colliding[i])
+      std::cout << i << " ";
+
+  std::cout << "\n";
 }
 
 template <typename broad>
-bool application_loop(
+void application_loop(
     throttle::geometry::broadphase_structure<broad, indexed_geom> &cont,
-    unsigned n, bool hide = false) {
-  using point_type = throttle::geometry::point3<float>;
-
-  for (unsigned i = 0; i < n; ++i) {
-    point_type a, b, c;
-    if (!(std::cin >> a[0] >> a[1] >> a[2] >> b[0] >> b[1] >> b[2] >> c[0] >>
-          c[1] >> c[2])) {
-      std::cout << "Can't read i-th = " << i << " triangle\n";
-      return false;
-    }
-    cont.add_collision_shape({i, shape_from_three_points(a, b, c)});
+    const shape_chunks &shapes, unsigned n, bool hide = false,
+    bool batched = false) {
+  for (const auto &chunk : shapes)
+    for (const auto &shape : chunk)
+      cont.add_collision_shape(shape);
+
+  if (batched) {
+    std::vector<bool> colliding(n);
+    throttle::geometry::batched_narrowphase<float, indexed_geom> narrow;
+    narrow.collide(cont.impl(), [&colliding](unsigned first, unsigned second) {
+      colliding[first] = colliding[second] = true;
+    });
+    if (!hide)
+      print_colliding(colliding);
+    return;
   }
 
   auto result = cont.many_to_many();
   if (hide)
-    return true;
+    return;
 
   for (const auto v : result)
     std::cout << v->index << " ";
 
   std::cout << "\n";
-  return true;
+}
+
+void compact_application_loop(const soup_type &soup, bool hide = false) {
+  unsigned n = soup.size();
+  throttle::geometry::compact_scene<float> scene{n};
+  for (unsigned i = 0; i < n; ++i)
+    scene.add_triangle(soup.vertex(i, 0), soup.vertex(i, 1), soup.vertex(i, 2));
+
+  std::vector<bool> colliding(n);
+  scene.for_each_colliding_pair([&colliding](unsigned first, unsigned second) {
+    colliding[first] = colliding[second] = true;
+  });
+  if (!hide)
+    print_colliding(colliding);
 }
 
 int main(int argc, char *argv[]) {
-  bool hide = false;
+  bool hide = false, binary = false;
+  std::string input;
+  unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
 
 #ifdef BOOST_FOUND__
-  std::string opt;
+  std::string opt, convert;
   po::options_description desc("Available options");
   desc.add_options()("help,h", "Print this help message")(
       "measure,m", "Print perfomance metrics")("hide", "Hide output")(
+      "batched", "Run the narrowphase in batches grouped by primitive type "
+                 "(not supported by compact-scene)")(
+      "pin-straddling", "Keep shapes that straddle a split plane in the "
+                        "parent node instead of cloning them (adaptive-octree "
+                        "only)")(
+      "input,i", po::value<std::string>(&input),
+      "Input file (standard input by default)")(
+      "binary", "Input is an array of little-endian floats, 9 per triangle")(
+      "convert", po::value<std::string>(&convert),
+      "Write the input to this file in the binary format and exit")(
+      "threads,j", po::value<unsigned>(&threads)->default_value(threads),
+      "Number of threads used to parse the input")(
       "broad", po::value<std::string>(&opt)->default_value("octree"),
-      "Algorithm for broad phase (bruteforce, octree, uniform-grid)");
+      "Algorithm for broad phase (bruteforce, octree, compact-octree, "
+      "adaptive-octree, uniform-grid, hierarchical-grid, lbvh, "
+      "compact-scene)");
 
   po::variables_map vm;
   po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -119,42 +158,86 @@ int main(int argc, char *argv[]) {
 
   bool measure = vm.count("measure");
   hide = vm.count("hide");
+  binary = vm.count("binary");
+  bool batched = vm.count("batched");
+  bool pin_straddling = vm.count("pin-straddling");
+
+  if (batched && opt == "compact-scene") {
+    std::cout << "compact-scene does not support --batched\n";
+    return 1;
+  }
 #endif
 
-  unsigned n;
-  if (!(std::cin >> n)) {
-    std::cout << "Can't read number of triangles\n";
+  auto start = std::chrono::high_resolution_clock::now();
+
+  soup_type soup;
+  try {
+    soup = load_triangles(input, binary, threads);
+  } catch (std::runtime_error &e) {
+    std::cout << e.what() << "\n";
     return 1;
   }
+  unsigned n = soup.size();
 
 #ifdef BOOST_FOUND__
-  auto start = std::chrono::high_resolution_clock::now();
+  if (!convert.empty()) {
+    std::ofstream os{convert, std::ios::binary};
+    throttle::geometry::write_binary_triangles(os, soup);
+    return os ? 0 : 1;
+  }
+
+  shape_chunks shapes;
+  if (opt != "compact-scene")
+    shapes = build_indexed_shapes(soup, threads);
+
+  auto parsed = std::chrono::high_resolution_clock::now();
 
   if (opt == "octree") {
     throttle::geometry::octree<float, indexed_geom> octree{
-        apporoximate_optimal_depth(n)};
-    if (!application_loop(octree, n, hide))
-      return 1;
+        throttle::geometry::approximate_optimal_depth(n)};
+    application_loop(octree, shapes, n, hide, batched);
+  } else if (opt == "compact-octree") {
+    throttle::geometry::compact_octree<float, indexed_geom> compact{
+        throttle::geometry::approximate_optimal_depth(n)};
+    application_loop(compact, shapes, n, hide, batched);
+  } else if (opt == "adaptive-octree") {
+    using adaptive_type =
+        throttle::geometry::adaptive_octree<float, indexed_geom>;
+    adaptive_type adaptive{adaptive_type::default_split_threshold,
+                           !pin_straddling};
+    application_loop(adaptive, shapes, n, hide, batched);
   } else if (opt == "bruteforce") {
     throttle::geometry::bruteforce<float, indexed_geom> bruteforce{n};
-    if (!application_loop(bruteforce, n, hide))
-      return 1;
+    application_loop(bruteforce, shapes, n, hide, batched);
   } else if (opt == "uniform-grid") {
     throttle::geometry::uniform_grid<float, indexed_geom> uniform{n};
-    if (!application_loop(uniform, n, hide))
-      return 1;
+    application_loop(uniform, shapes, n, hide, batched);
+  } else if (opt == "hierarchical-grid") {
+    throttle::geometry::hierarchical_grid<float, indexed_geom> hgrid{n};
+    application_loop(hgrid, shapes, n, hide, batched);
+  } else if (opt == "lbvh") {
+    throttle::geometry::lbvh<float, indexed_geom> lbvh{n};
+    application_loop(lbvh, shapes, n, hide, batched);
+  } else if (opt == "compact-scene") {
+    compact_application_loop(soup, hide);
   }
 
   auto finish = std::chrono::high_resolution_clock::now();
-  auto elapsed = std::chrono::duration<double, std::milli>(finish - start);
+  using milliseconds = std::chrono::duration<double, std::milli>;
 
   if (measure) {
-    std::cout << opt << " took " << elapsed.count() << "ms to run\n";
+    std::cout << opt << " parse took " << milliseconds(parsed - start).count()
+              << "ms, collide took " << milliseconds(finish - parsed).count()
+              << "ms\n";
+#ifdef NARROWPHASE_STATS__
+    std::cout << throttle::geometry::narrowphase_stats::snapshot();
+#endif
   }
 
 #else
+  auto shapes = build_indexed_shapes(soup, threads);
   throttle::geometry::octree<float, indexed_geom> octree{
-      apporoximate_optimal_depth(n)};
-  application_loop(octree, n, hide);
+      throttle::geometry::approximate_optimal_depth(n)};
+  application_loop(octree, shapes, n, hide);
 #endif
 }
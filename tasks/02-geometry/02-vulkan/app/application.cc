@@ -86,41 +86,6 @@ application::application(applicaton_platform platform)
   initialize_imgui();                // Initialize GUI specific objects
 }
 
-static constexpr auto c_global_descriptor_pool_sizes =
-    std::to_array<vk::DescriptorPoolSize>(
-        {{vk::DescriptorType::eUniformBuffer, 16}});
-
-// We use two pipelines with the same descriptor set, so we should allocate a
-// descriptor set with 2 binding points for a uniform buffer.
-static constexpr auto c_descriptor_set_bindings =
-    std::to_array<ezvk::descriptor_set::binding_description>(
-        {{vk::DescriptorType::eUniformBuffer, 1,
-          vk::ShaderStageFlagBits::eAllGraphics},
-         {vk::DescriptorType::eUniformBuffer, 1,
-          vk::ShaderStageFlagBits::eAllGraphics}});
-
-static constexpr vk::PipelineRasterizationStateCreateInfo
-    triangle_rasterization_state_create_info = {
-        .depthClampEnable = VK_FALSE,
-        .rasterizerDiscardEnable = VK_FALSE,
-        .polygonMode = vk::PolygonMode::eFill,
-        .cullMode = vk::CullModeFlagBits::eFront,
-        .frontFace = vk::FrontFace::eClockwise,
-        .depthBiasEnable = VK_FALSE,
-        .lineWidth = 1.0f,
-};
-
-static constexpr vk::PipelineRasterizationStateCreateInfo
-    wireframe_rasterization_state_create_info = {
-        .depthClampEnable = VK_FALSE,
-        .rasterizerDiscardEnable = VK_FALSE,
-        .polygonMode = vk::PolygonMode::eLine,
-        .cullMode = vk::CullModeFlagBits::eNone,
-        .frontFace = vk::FrontFace::eClockwise,
-        .depthBiasEnable = VK_FALSE,
-        .lineWidth = 1.0f,
-};
-
 void application::initialize_primitives_pipeline() {
   m_descriptor_pool = ezvk::create_descriptor_pool(
       m_l_device(), c_global_descriptor_pool_sizes);
@@ -131,6 +96,9 @@ void application::initialize_primitives_pipeline() {
 
   m_descriptor_set = {m_l_device(), m_uniform_buffers, m_descriptor_pool,
                       c_descriptor_set_bindings};
+  m_scene = std::make_unique<scene_renderer>(
+      m_platform.p_device(), m_l_device(), m_descriptor_pool,
+      c_max_frames_in_flight);
 
   // clang-format off
   constexpr vk::AttachmentReference 
@@ -155,7 +123,9 @@ void application::initialize_primitives_pipeline() {
       ezvk::render_pass{m_l_device(), subpass, attachments};
   m_depth_buffer = {m_platform.m_p_device, m_l_device(), depth_format,
                     m_swapchain.extent()};
-  m_primitives_pipeline_layout = {m_l_device(), m_descriptor_set.m_layout};
+  const auto set_layouts =
+      std::array{*m_descriptor_set.m_layout, *m_scene->color_set_layout()};
+  m_primitives_pipeline_layout = {m_l_device(), set_layouts};
 
   m_triangle_pipeline = {m_l_device(),
                          "shaders/triangles_vert.spv",
@@ -251,7 +221,7 @@ void application::initialize_logical_device_queues() {
 
   const auto extensions = config::required_physical_device_extensions();
   m_l_device = {m_platform.p_device(), reqs, extensions.begin(),
-                extensions.end()};
+                extensions.end(), config::required_physical_device_features()};
 
   m_graphics_present = ezvk::make_graphics_present_queues(
       m_l_device(), chosen_graphics, c_graphics_queue_index, chosen_present,
@@ -356,17 +326,7 @@ void application::fill_command_buffer(vk::raii::CommandBuffer &cmd,
   cmd.reset();
   cmd.begin({.flags = vk::CommandBufferUsageFlagBits::eSimultaneousUse});
 
-  const auto submit_copy = [&](auto &info) -> void {
-    if (!info.in_staging)
-      return;
-    copy_to_device_memory(cmd, info);
-    info.in_staging = false;
-    info.loaded = true;
-  };
-
-  submit_copy(m_triangle_draw_info);
-  submit_copy(m_wireframe_bbox_draw_info);
-  submit_copy(m_wireframe_broad_draw_info);
+  m_scene->upload(cmd);
 
   std::array<vk::ClearValue, 2> clear_values;
   clear_values[0].color = gui_type::params.clear_color;
@@ -395,25 +355,15 @@ void application::fill_command_buffer(vk::raii::CommandBuffer &cmd,
                          *m_primitives_pipeline_layout(), 0,
                          {*m_descriptor_set.m_descriptor_set}, nullptr);
 
-  cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *m_triangle_pipeline());
+  const auto draw_options = scene_renderer::draw_options{
+      .frustum_culling = gui_type::params.frustum_culling,
+      .draw_broad_phase = gui_type::params.draw_broad_phase,
+      .draw_bbox = gui_type::params.draw_bbox};
 
-  const auto submit_draw_info = [&cmd](const auto &info) -> void {
-    if (!info)
-      return;
-    cmd.bindVertexBuffers(0, *info.buf.buffer(), {0});
-    cmd.draw(info.count, 1, 0, 0);
-  };
-
-  submit_draw_info(m_triangle_draw_info);
-  cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *m_wireframe_pipeline());
-
-  if (gui_type::params.draw_broad_phase) {
-    submit_draw_info(m_wireframe_broad_draw_info);
-  }
-
-  if (gui_type::params.draw_bbox) {
-    submit_draw_info(m_wireframe_bbox_draw_info);
-  }
+  m_scene->draw(cmd, m_curr_frame,
+                m_camera.get_vp_matrix(extent.width, extent.height),
+                m_primitives_pipeline_layout(), m_triangle_pipeline(),
+                m_wireframe_pipeline(), draw_options);
 
   m_imgui_data.fill_command_buffer(cmd);
 
@@ -446,17 +396,8 @@ void application::render_frame() {
                       m_swapchain.extent());
 
   const auto cmds = std::array{*m_primitives_command_buffers[m_curr_frame]};
-  ubo uniform_buffer = {m_camera.get_vp_matrix(m_swapchain.extent().width,
-                                               m_swapchain.extent().height),
-                        {},
-                        glm_vec_from_array(gui_type::params.light_color),
-                        gui_type::params.light_dir,
-                        gui_type::params.ambient_strength};
-
-  std::transform(gui_type::params.colors.begin(), gui_type::params.colors.end(),
-                 uniform_buffer.colors.begin(),
-                 [](auto a) { return glm_vec_from_array(a); });
-
+  const auto uniform_buffer = gui_type::params.to_ubo(m_camera.get_vp_matrix(
+      m_swapchain.extent().width, m_swapchain.extent().height));
   m_uniform_buffers[m_curr_frame].copy_to_device(uniform_buffer);
 
   vk::PipelineStageFlags wait_stages =
@@ -476,6 +417,7 @@ void application::render_frame() {
   m_l_device().resetFences(*current_frame_data.in_flight_fence);
   m_graphics_present->graphics().queue().submit(
       submit_info, *current_frame_data.in_flight_fence);
+  m_scene->commit(*current_frame_data.in_flight_fence);
 
   vk::PresentInfoKHR present_info = {
       .waitSemaphoreCount = 1,
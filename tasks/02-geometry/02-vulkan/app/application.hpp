@@ -22,6 +22,7 @@
 #include "misc/vertex.hpp"
 #include "pipeline.hpp"
 #include "platform.hpp"
+#include "scene_renderer.hpp"
 
 #include "ezvk/debug.hpp"
 #include "ezvk/window.hpp"
@@ -47,20 +48,14 @@
 #include <algorithm>
 #include <atomic>
 #include <memory>
-#include <mutex>
-#include <span>
 #include <stdexcept>
+#include <vector>
 
 #if defined(VK_VALIDATION_LAYER) || !defined(NDEBUG)
 #define USE_DEBUG_EXTENSION
 #endif
 
 namespace triangles {
-struct input_data {
-  std::span<const triangles::triangle_vertex_type> tr_vert;
-  std::span<const triangles::wireframe_vertex_type> broad_vert, bbox_vert;
-};
-
 class application final {
 private:
   static constexpr uint32_t c_max_frames_in_flight = 2; // Double buffering
@@ -82,6 +77,7 @@ private:
 
   ezvk::descriptor_set m_descriptor_set;
   ezvk::device_buffers m_uniform_buffers;
+  std::unique_ptr<scene_renderer> m_scene;
 
   ezvk::render_pass m_primitives_render_pass;
   ezvk::pipeline_layout m_primitives_pipeline_layout;
@@ -92,23 +88,6 @@ private:
   pipeline<wireframe_vertex_type> m_wireframe_pipeline;
 
   ezvk::framebuffers m_framebuffers;
-  std::atomic_bool m_data_loaded = false;
-
-  struct vertex_draw_info {
-    ezvk::device_buffer buf;
-
-    std::atomic_bool loaded = false, in_staging = false;
-    uint32_t count = 0, size = 0;
-
-    ezvk::device_buffer staging_buffer;
-
-  public:
-    operator bool() const { return loaded; }
-  };
-
-  vertex_draw_info m_triangle_draw_info;
-  vertex_draw_info m_wireframe_broad_draw_info;
-  vertex_draw_info m_wireframe_bbox_draw_info;
 
   struct frame_rendering_info {
     vk::raii::Semaphore image_availible_semaphore, render_finished_semaphore;
@@ -189,71 +168,12 @@ public:
 
   auto *window() const { return m_platform.window()(); }
 
-  void load_input_data(const input_data &data) {
-    if (m_data_loaded)
-      throw std::invalid_argument{
-          "For now you can't load vertex data more than once"};
-
-    if (!data.tr_vert.empty())
-      load_draw_info(data.tr_vert, m_triangle_draw_info);
-    if (!data.broad_vert.empty())
-      load_draw_info(data.broad_vert, m_wireframe_broad_draw_info);
-    if (!data.bbox_vert.empty())
-      load_draw_info(data.bbox_vert, m_wireframe_bbox_draw_info);
-
-    m_data_loaded = true;
-  }
+  // The loading thread hands the scene over through it
+  scene_renderer &scene() { return *m_scene; }
 
   void shutdown() { m_l_device().waitIdle(); }
 
 private:
-  ezvk::device_buffer copy_to_staging_memory(const auto &container) {
-    assert(!container.empty());
-
-    auto staging_buffer = ezvk::device_buffer{
-        m_platform.p_device(), m_l_device(),
-        vk::BufferUsageFlagBits::eTransferSrc, std::span{container},
-        vk::MemoryPropertyFlagBits::eHostVisible |
-            vk::MemoryPropertyFlagBits::eHostCoherent};
-
-    return staging_buffer;
-  }
-
-  void copy_to_device_memory(vk::raii::CommandBuffer &cmd,
-                             vertex_draw_info &info) {
-    const auto size = info.size;
-
-    info.buf = {m_platform.p_device(), m_l_device(), size,
-                vk::BufferUsageFlagBits::eVertexBuffer |
-                    vk::BufferUsageFlagBits::eTransferDst,
-                vk::MemoryPropertyFlagBits::eDeviceLocal};
-
-    auto &src_buffer = info.staging_buffer.buffer();
-    auto &dst_buffer = info.buf.buffer();
-
-    vk::BufferCopy copy = {0, 0, size};
-    cmd.copyBuffer(*src_buffer, *dst_buffer, copy);
-
-    const auto barrier = vk::BufferMemoryBarrier{
-        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
-        .dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead,
-        .buffer = *dst_buffer,
-        .offset = 0,
-        .size = info.size};
-
-    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
-                        vk::PipelineStageFlagBits::eVertexInput, {}, nullptr,
-                        barrier, nullptr);
-  }
-
-  void load_draw_info(const auto &vertices, vertex_draw_info &info) {
-    assert(!vertices.empty());
-    info.count = vertices.size();
-    info.size = ezvk::utils::sizeof_container(vertices);
-    info.staging_buffer = copy_to_staging_memory(vertices);
-    info.in_staging = true;
-  }
-
   void physics_loop(float delta);
   void initialize_primitives_pipeline();
   void initialize_input_hanlder();
@@ -15,6 +15,8 @@
 
 #include "ezvk/window.hpp"
 #include <array>
+#include <cstddef>
+#include <cstring>
 
 namespace triangles::config {
 
@@ -27,6 +29,12 @@ inline auto required_vk_extensions() {
   return glfw_extensions;
 }
 
+// Without a window there is no surface, so the offscreen renderer only needs
+// the debug messenger.
+inline std::vector<std::string> required_headless_vk_extensions() {
+  return {VK_EXT_DEBUG_UTILS_EXTENSION_NAME};
+}
+
 inline std::vector<std::string> required_vk_layers(bool validation = false) {
   if (validation)
     return {"VK_LAYER_KHRONOS_validation"};
@@ -37,4 +45,35 @@ inline std::vector<std::string> required_physical_device_extensions() {
   return {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 }
 
+// gl_PrimitiveID in the fragment shader needs the geometry shader feature even
+// though there is no geometry stage. The visible triangles are drawn with a
+// single indirect multi-draw that passes the first triangle in firstInstance.
+inline vk::PhysicalDeviceFeatures required_physical_device_features() {
+  return {.geometryShader = VK_TRUE,
+          .multiDrawIndirect = VK_TRUE,
+          .drawIndirectFirstInstance = VK_TRUE,
+          .fillModeNonSolid = VK_TRUE};
+}
+
+// vk::PhysicalDeviceFeatures is nothing but a sequence of flags, so every flag
+// of required_physical_device_features() is checked without listing them.
+inline bool supports_required_features(const vk::raii::PhysicalDevice &device) {
+  constexpr auto count =
+      sizeof(vk::PhysicalDeviceFeatures) / sizeof(vk::Bool32);
+  static_assert(sizeof(vk::PhysicalDeviceFeatures) ==
+                count * sizeof(vk::Bool32));
+
+  const auto supported_features = device.getFeatures();
+  const auto required_features = required_physical_device_features();
+  std::array<vk::Bool32, count> supported, required;
+  std::memcpy(supported.data(), &supported_features, sizeof(supported));
+  std::memcpy(required.data(), &required_features, sizeof(required));
+
+  for (std::size_t i = 0; i < count; ++i) {
+    if (required[i] && !supported[i])
+      return false;
+  }
+  return true;
+}
+
 } // namespace triangles::config
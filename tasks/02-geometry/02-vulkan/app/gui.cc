@@ -122,6 +122,7 @@ void app_gui::draw() {
 
     ImGui::Checkbox("Visualize broad phase", &params.draw_broad_phase);
     ImGui::Checkbox("Draw bounding boxes", &params.draw_bbox);
+    ImGui::Checkbox("Frustum culling", &params.frustum_culling);
 
     ImGui::BulletText("Color configuration");
 
@@ -35,6 +35,7 @@
 #include "ezvk/wrappers/shaders.hpp"
 #include "ezvk/wrappers/swapchain.hpp"
 
+#include <algorithm>
 #include <string>
 
 namespace triangles::gui {
@@ -114,7 +115,7 @@ struct app_gui {
     float light_dir_yaw = 0.0f, light_dir_pitch = 0.0f;
     float ambient_strength = 0.1f;
 
-    glm::vec4 light_dir;
+    glm::vec4 light_dir = {0, 0, 1, 0};
 
     array_color4 light_color = hex_to_rgba(0xffffffff);
     array_color4 clear_color = hex_to_rgba(0x181818ff);
@@ -124,6 +125,15 @@ struct app_gui {
         hex_to_rgba(0x2f363aff), hex_to_rgba(0x338568ff)};
 
     bool draw_broad_phase = false, draw_bbox = false;
+    bool frustum_culling = true;
+
+    ubo to_ubo(const glm::mat4 &vp) const {
+      ubo result = {vp, {}, glm_vec_from_array(light_color), light_dir,
+                    ambient_strength};
+      std::transform(colors.begin(), colors.end(), result.colors.begin(),
+                     [](auto a) { return glm_vec_from_array(a); });
+      return result;
+    }
   };
 
   static parameters_type params;
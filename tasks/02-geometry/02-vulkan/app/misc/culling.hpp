@@ -0,0 +1,116 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long
+ * as you retain this notice you can do whatever you want with this stuff. If we
+ * meet some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "unified_includes/glm_inlcude.hpp"
+#include "unified_includes/vulkan_hpp_include.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace triangles {
+
+// A node of the culling hierarchy. Nodes are stored in depth-first order and
+// the triangles are drawn in the same order: the triangles of a node come
+// first, then those of its children. So every subtree is a contiguous range of
+// triangles in the index buffer.
+struct cull_node {
+  glm::vec3 center;
+  float halfwidth;
+
+  uint32_t first;         // First triangle of the subtree
+  uint32_t own_count;     // Triangles stored in the node itself
+  uint32_t subtree_count; // Triangles in the whole subtree
+  uint32_t next;          // Index of the first node after the subtree
+};
+
+class frustum {
+  std::array<glm::vec4, 6> m_planes;
+
+public:
+  enum class overlap { outside, intersects, inside };
+
+  // Planes of the clip volume with depth in [0, 1], pointing inwards
+  explicit frustum(const glm::mat4 &vp) {
+    const auto row = [&vp](int i) {
+      return glm::vec4{vp[0][i], vp[1][i], vp[2][i], vp[3][i]};
+    };
+
+    m_planes = {row(3) + row(0), row(3) - row(0), row(3) + row(1),
+                row(3) - row(1), row(2),          row(3) - row(2)};
+  }
+
+  overlap classify(const glm::vec3 &center, float halfwidth) const {
+    auto result = overlap::inside;
+
+    for (const auto &plane : m_planes) {
+      const auto normal = glm::vec3{plane};
+      const auto distance = glm::dot(normal, center) + plane.w;
+      const auto radius = halfwidth * (std::abs(normal.x) +
+                                       std::abs(normal.y) + std::abs(normal.z));
+      if (distance < -radius)
+        return overlap::outside;
+      if (distance < radius)
+        result = overlap::intersects;
+    }
+
+    return result;
+  }
+};
+
+// Appends the draws of the triangles in the nodes that aren't outside of the
+// frustum. Adjacent ranges are merged, so a fully visible subtree is a single
+// draw. firstInstance is the first triangle of the draw, which the shaders add
+// to gl_PrimitiveID to find the color of a triangle.
+inline void cull(std::span<const cull_node> nodes, const frustum &view,
+                 std::vector<vk::DrawIndexedIndirectCommand> &commands) {
+  const auto emit = [&commands](uint32_t first, uint32_t count) {
+    if (!count)
+      return;
+
+    if (!commands.empty()) {
+      auto &last = commands.back();
+      if (last.firstInstance + last.indexCount / 3 == first) {
+        last.indexCount += 3 * count;
+        return;
+      }
+    }
+
+    commands.push_back({.indexCount = 3 * count,
+                        .instanceCount = 1,
+                        .firstIndex = 3 * first,
+                        .vertexOffset = 0,
+                        .firstInstance = first});
+  };
+
+  for (uint32_t i = 0; i < nodes.size();) {
+    const auto &node = nodes[i];
+
+    switch (view.classify(node.center, node.halfwidth)) {
+    case frustum::overlap::outside:
+      i = node.next;
+      break;
+    case frustum::overlap::inside:
+      emit(node.first, node.subtree_count);
+      i = node.next;
+      break;
+    case frustum::overlap::intersects:
+      emit(node.first, node.own_count);
+      ++i;
+      break;
+    }
+  }
+}
+
+} // namespace triangles
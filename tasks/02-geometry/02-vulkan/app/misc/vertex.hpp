@@ -14,13 +14,15 @@
 #include "unified_includes/vulkan_hpp_include.hpp"
 
 #include <array>
+#include <cstdint>
 
 namespace triangles {
 
+// Triangles are drawn from an index buffer over deduplicated positions. The
+// normal is reconstructed in the fragment shader and the color index lives in a
+// separate per-primitive stream, so a vertex is just its position.
 struct triangle_vertex_type {
   glm::vec3 pos;
-  glm::vec3 norm;
-  uint32_t color_index;
 
 public:
   static constexpr auto get_binding_description() {
@@ -37,22 +39,13 @@ public:
         .format = vk::Format::eR32G32B32Sfloat,
         .offset = offsetof(triangle_vertex_type, pos)};
 
-    const auto second = vk::VertexInputAttributeDescription{
-        .location = 1,
-        .binding = 0,
-        .format = vk::Format::eR32G32B32Sfloat,
-        .offset = offsetof(triangle_vertex_type, norm)};
-
-    const auto third = vk::VertexInputAttributeDescription{
-        .location = 2,
-        .binding = 0,
-        .format = vk::Format::eR32Uint,
-        .offset = offsetof(triangle_vertex_type, color_index)};
-
-    return std::to_array({first, second, third});
+    return std::to_array({first});
   }
 };
 
+using triangle_index_type = uint32_t;
+using triangle_color_type = uint8_t;
+
 struct wireframe_vertex_type {
   glm::vec3 pos;
   uint32_t color_index;
@@ -0,0 +1,308 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long
+ * as you retain this notice you can do whatever you want with this stuff. If we
+ * meet some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "offscreen.hpp"
+#include "config.hpp"
+#include "gui.hpp"
+#include "misc/ubo.hpp"
+#include "pipeline.hpp"
+
+#include "ezvk/error.hpp"
+#include "ezvk/wrappers/depth_buffer.hpp"
+#include "ezvk/wrappers/device.hpp"
+#include "ezvk/wrappers/queues.hpp"
+
+#include "unified_includes/vulkan_hpp_include.hpp"
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace triangles {
+
+// Nobody presents the image, so it stays in the attachment layout
+static constexpr vk::AttachmentDescription offscreen_attachment_description = {
+    .flags = vk::AttachmentDescriptionFlags{},
+    .format = vk::Format::eB8G8R8A8Unorm,
+    .samples = vk::SampleCountFlagBits::e1,
+    .loadOp = vk::AttachmentLoadOp::eClear,
+    .storeOp = vk::AttachmentStoreOp::eStore,
+    .stencilLoadOp = vk::AttachmentLoadOp::eDontCare,
+    .stencilStoreOp = vk::AttachmentStoreOp::eDontCare,
+    .initialLayout = vk::ImageLayout::eUndefined,
+    .finalLayout = vk::ImageLayout::eColorAttachmentOptimal};
+
+// All the frames in flight render into the same attachments, so a frame has to
+// wait for the writes of the previous one.
+static constexpr vk::SubpassDependency offscreen_subpass_dependency = {
+    .srcSubpass = VK_SUBPASS_EXTERNAL,
+    .dstSubpass = 0,
+    .srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput |
+                    vk::PipelineStageFlagBits::eLateFragmentTests,
+    .dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput |
+                    vk::PipelineStageFlagBits::eEarlyFragmentTests,
+    .srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite |
+                     vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+    .dstAccessMask = vk::AccessFlagBits::eColorAttachmentWrite |
+                     vk::AccessFlagBits::eDepthStencilAttachmentWrite};
+
+vk::raii::PhysicalDevice
+offscreen_renderer::pick_physical_device(const vk::raii::Instance &instance) {
+  for (auto &device : instance.enumeratePhysicalDevices()) {
+    if (!ezvk::find_graphics_family_indices(device).empty() &&
+        config::supports_required_features(device))
+      return std::move(device);
+  }
+
+  throw ezvk::vk_error{"No suitable physical devices found"};
+}
+
+offscreen_renderer::offscreen_renderer(vk::raii::PhysicalDevice p_device,
+                                       vk::Extent2D extent)
+    : m_p_device{std::move(p_device)}, m_extent{extent} {
+  const auto family = ezvk::find_graphics_family_indices(m_p_device).front();
+  const auto default_priority = 1.0f;
+  const auto reqs = std::vector<vk::DeviceQueueCreateInfo>{
+      {.queueFamilyIndex = family,
+       .queueCount = 1,
+       .pQueuePriorities = &default_priority}};
+
+  // No presentation, so no device extensions either
+  const auto extensions = std::vector<std::string>{};
+  m_l_device = {m_p_device, reqs, extensions.begin(), extensions.end(),
+                config::required_physical_device_features()};
+  m_graphics = {m_l_device(), family, 0};
+
+  m_command_pool = ezvk::create_command_pool(m_l_device(), family, true);
+
+  // Timestamps are optional, frames are still timed on the CPU without them
+  const auto valid_bits =
+      m_p_device.getQueueFamilyProperties().at(family).timestampValidBits;
+  const auto limits = m_p_device.getProperties().limits;
+  m_timestamps = valid_bits && limits.timestampComputeAndGraphics;
+
+  if (m_timestamps) {
+    m_timestamp_period = limits.timestampPeriod;
+    m_timestamp_mask =
+        (valid_bits >= 64 ? ~uint64_t{0} : (uint64_t{1} << valid_bits) - 1);
+    m_query_pool = m_l_device().createQueryPool(
+        {.queryType = vk::QueryType::eTimestamp,
+         .queryCount = 2 * c_max_frames_in_flight});
+  }
+
+  initialize_pipelines();
+  initialize_frames();
+}
+
+void offscreen_renderer::initialize_pipelines() {
+  m_descriptor_pool = ezvk::create_descriptor_pool(
+      m_l_device(), c_global_descriptor_pool_sizes);
+
+  m_uniform_buffers = {c_max_frames_in_flight, sizeof(triangles::ubo),
+                       m_p_device, m_l_device(),
+                       vk::BufferUsageFlagBits::eUniformBuffer};
+
+  m_descriptor_set = {m_l_device(), m_uniform_buffers, m_descriptor_pool,
+                      c_descriptor_set_bindings};
+  m_scene = std::make_unique<scene_renderer>(
+      m_p_device, m_l_device(), m_descriptor_pool, c_max_frames_in_flight);
+
+  // clang-format off
+  constexpr vk::AttachmentReference
+    color_attachment_ref = {.attachment = 0, .layout = vk::ImageLayout::eColorAttachmentOptimal},
+    depth_attachment_ref = {.attachment = 1, .layout = vk::ImageLayout::eDepthStencilAttachmentOptimal};
+  // clang-format on
+
+  const auto subpass = vk::SubpassDescription{
+      .pipelineBindPoint = vk::PipelineBindPoint::eGraphics,
+      .colorAttachmentCount = 1,
+      .pColorAttachments = &color_attachment_ref,
+      .pDepthStencilAttachment = &depth_attachment_ref};
+
+  const auto depth_format = ezvk::find_depth_format(m_p_device).at(0);
+  const auto attachments = std::array{
+      offscreen_attachment_description,
+      ezvk::create_depth_attachment(depth_format)};
+  const auto dependencies = std::array{offscreen_subpass_dependency};
+
+  m_render_pass =
+      ezvk::render_pass{m_l_device(), subpass, attachments, dependencies};
+
+  const auto set_layouts =
+      std::array{*m_descriptor_set.m_layout, *m_scene->color_set_layout()};
+  m_pipeline_layout = {m_l_device(), set_layouts};
+
+  m_triangle_pipeline = {m_l_device(),
+                         "shaders/triangles_vert.spv",
+                         "shaders/triangles_frag.spv",
+                         m_pipeline_layout(),
+                         m_render_pass(),
+                         triangle_rasterization_state_create_info,
+                         vk::PrimitiveTopology::eTriangleList};
+
+  m_wireframe_pipeline = {m_l_device(),
+                          "shaders/wireframe_vert.spv",
+                          "shaders/wireframe_frag.spv",
+                          m_pipeline_layout(),
+                          m_render_pass(),
+                          wireframe_rasterization_state_create_info,
+                          vk::PrimitiveTopology::eLineList};
+
+  const auto extent3d = vk::Extent3D{
+      .width = m_extent.width, .height = m_extent.height, .depth = 1};
+  m_color_image = {m_p_device,
+                   m_l_device(),
+                   extent3d,
+                   c_color_format,
+                   vk::ImageTiling::eOptimal,
+                   vk::ImageUsageFlagBits::eColorAttachment |
+                       vk::ImageUsageFlagBits::eTransferSrc,
+                   vk::MemoryPropertyFlagBits::eDeviceLocal};
+  m_color_image_view = {m_l_device(), m_color_image(), c_color_format,
+                        vk::ImageAspectFlagBits::eColor};
+  m_depth_buffer = {m_p_device, m_l_device(), depth_format, m_extent};
+
+  const auto views =
+      std::array{*m_color_image_view(), *m_depth_buffer.m_image_view()};
+  m_framebuffer = m_l_device().createFramebuffer(
+      {.renderPass = *m_render_pass(),
+       .attachmentCount = static_cast<uint32_t>(views.size()),
+       .pAttachments = views.data(),
+       .width = m_extent.width,
+       .height = m_extent.height,
+       .layers = 1});
+}
+
+void offscreen_renderer::initialize_frames() {
+  for (uint32_t i = 0; i < c_max_frames_in_flight; ++i)
+    m_fences.push_back(m_l_device().createFence(
+        {.flags = vk::FenceCreateFlagBits::eSignaled}));
+  m_submitted.assign(c_max_frames_in_flight, false);
+
+  const auto alloc_info = vk::CommandBufferAllocateInfo{
+      .commandPool = *m_command_pool,
+      .level = vk::CommandBufferLevel::ePrimary,
+      .commandBufferCount = c_max_frames_in_flight};
+
+  m_command_buffers = vk::raii::CommandBuffers{m_l_device(), alloc_info};
+}
+
+void offscreen_renderer::collect_timestamps(std::size_t frame) {
+  if (!m_submitted[frame])
+    return;
+  m_submitted[frame] = false;
+
+  if (!m_timestamps)
+    return;
+
+  const auto first = static_cast<uint32_t>(2 * frame);
+  const auto [result, ticks] = m_query_pool.getResults<uint64_t>(
+      first, 2, 2 * sizeof(uint64_t), sizeof(uint64_t),
+      vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+  static_cast<void>(result);
+
+  const auto elapsed = (ticks[1] - ticks[0]) & m_timestamp_mask;
+  m_gpu_times.push_back(elapsed * double{m_timestamp_period} / 1e6);
+}
+
+double
+offscreen_renderer::render_frame(const glm::mat4 &vp,
+                                 const scene_renderer::draw_options &options) {
+  using clock = std::chrono::steady_clock;
+
+  const auto frame = m_curr_frame;
+  const auto &fence = m_fences[frame];
+  static_cast<void>(
+      m_l_device().waitForFences({*fence}, VK_TRUE, UINT64_MAX));
+  collect_timestamps(frame);
+
+  const auto start = clock::now();
+
+  auto &cmd = m_command_buffers[frame];
+  cmd.reset();
+  cmd.begin({.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+
+  const auto first_query = static_cast<uint32_t>(2 * frame);
+  if (m_timestamps) {
+    cmd.resetQueryPool(*m_query_pool, first_query, 2);
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, *m_query_pool,
+                       first_query);
+  }
+
+  m_scene->upload(cmd);
+
+  std::array<vk::ClearValue, 2> clear_values;
+  clear_values[0].color = gui::app_gui::params.clear_color;
+  clear_values[1].depthStencil = vk::ClearDepthStencilValue{1.0f, 0};
+
+  cmd.beginRenderPass(
+      vk::RenderPassBeginInfo{
+          .renderPass = *m_render_pass(),
+          .framebuffer = *m_framebuffer,
+          .renderArea = {vk::Offset2D{0, 0}, m_extent},
+          .clearValueCount = static_cast<uint32_t>(clear_values.size()),
+          .pClearValues = clear_values.data()},
+      vk::SubpassContents::eInline);
+
+  const auto viewport = vk::Viewport{0.0f,
+                                     static_cast<float>(m_extent.height),
+                                     static_cast<float>(m_extent.width),
+                                     -static_cast<float>(m_extent.height),
+                                     0.0f,
+                                     1.0f};
+
+  cmd.setViewport(0, {viewport});
+  cmd.setScissor(0, {{vk::Offset2D{0, 0}, m_extent}});
+
+  cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+                         *m_pipeline_layout(), 0,
+                         {*m_descriptor_set.m_descriptor_set}, nullptr);
+
+  m_scene->draw(cmd, frame, vp, m_pipeline_layout(), m_triangle_pipeline(),
+                m_wireframe_pipeline(), options);
+
+  cmd.endRenderPass();
+
+  if (m_timestamps)
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, *m_query_pool,
+                       first_query + 1);
+  cmd.end();
+
+  m_uniform_buffers[frame].copy_to_device(gui::app_gui::params.to_ubo(vp));
+
+  const auto cmds = std::array{*cmd};
+  const auto submit_info =
+      vk::SubmitInfo{.commandBufferCount = static_cast<uint32_t>(cmds.size()),
+                     .pCommandBuffers = cmds.data()};
+
+  m_l_device().resetFences(*fence);
+  m_graphics.queue().submit(submit_info, *fence);
+  m_scene->commit(*fence);
+
+  const auto finish = clock::now();
+
+  m_submitted[frame] = true;
+  m_curr_frame = (m_curr_frame + 1) % c_max_frames_in_flight;
+  return std::chrono::duration<double, std::milli>{finish - start}.count();
+}
+
+void offscreen_renderer::finish() {
+  m_l_device().waitIdle();
+  for (std::size_t frame = 0; frame < c_max_frames_in_flight; ++frame)
+    collect_timestamps(frame);
+}
+
+void offscreen_renderer::reset_timings() {
+  finish();
+  m_gpu_times.clear();
+}
+
+} // namespace triangles
@@ -0,0 +1,117 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long
+ * as you retain this notice you can do whatever you want with this stuff. If we
+ * meet some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "pipeline.hpp"
+#include "scene_renderer.hpp"
+
+#include "ezvk/wrappers/depth_buffer.hpp"
+#include "ezvk/wrappers/descriptor_set.hpp"
+#include "ezvk/wrappers/device.hpp"
+#include "ezvk/wrappers/image.hpp"
+#include "ezvk/wrappers/memory.hpp"
+#include "ezvk/wrappers/queues.hpp"
+#include "ezvk/wrappers/renderpass.hpp"
+
+#include "unified_includes/glm_inlcude.hpp"
+#include "unified_includes/vulkan_hpp_include.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace triangles {
+
+// Renders the scene into an image without a window, surface or swapchain, so
+// that it runs on software implementations such as lavapipe. Every frame is
+// recorded the same way as in the application, without the GUI, and is timed
+// on the CPU and, when the queue supports it, with GPU timestamps.
+class offscreen_renderer final {
+  static constexpr uint32_t c_max_frames_in_flight = 2;
+  static constexpr auto c_color_format = vk::Format::eB8G8R8A8Unorm;
+
+  vk::raii::PhysicalDevice m_p_device = nullptr;
+  ezvk::logical_device m_l_device;
+  ezvk::device_queue m_graphics;
+  vk::raii::CommandPool m_command_pool = nullptr;
+  vk::Extent2D m_extent;
+
+  vk::raii::DescriptorPool m_descriptor_pool = nullptr;
+  ezvk::device_buffers m_uniform_buffers;
+  ezvk::descriptor_set m_descriptor_set;
+  std::unique_ptr<scene_renderer> m_scene;
+
+  ezvk::render_pass m_render_pass;
+  ezvk::pipeline_layout m_pipeline_layout;
+  pipeline<triangle_vertex_type> m_triangle_pipeline;
+  pipeline<wireframe_vertex_type> m_wireframe_pipeline;
+
+  ezvk::image m_color_image;
+  ezvk::image_view m_color_image_view;
+  ezvk::depth_buffer m_depth_buffer;
+  vk::raii::Framebuffer m_framebuffer = nullptr;
+
+  vk::raii::CommandBuffers m_command_buffers = nullptr;
+  std::vector<vk::raii::Fence> m_fences;
+  std::vector<bool> m_submitted; // Frames whose timestamps aren't read yet
+  std::size_t m_curr_frame = 0;
+
+  // Two timestamps per frame in flight: at the start and at the end of it
+  vk::raii::QueryPool m_query_pool = nullptr;
+  bool m_timestamps = false;
+  float m_timestamp_period = 1.0f; // Nanoseconds per tick
+  uint64_t m_timestamp_mask = 0;
+  std::vector<double> m_gpu_times; // In milliseconds
+
+public:
+  // The first device with a graphics queue and the features the shaders need
+  static vk::raii::PhysicalDevice
+  pick_physical_device(const vk::raii::Instance &instance);
+
+  // The instance the device comes from has to outlive the renderer
+  offscreen_renderer(vk::raii::PhysicalDevice p_device, vk::Extent2D extent);
+
+  offscreen_renderer(const offscreen_renderer &) = delete;
+  offscreen_renderer &operator=(const offscreen_renderer &) = delete;
+
+  // The frames in flight are waited for, nothing can be destroyed before that
+  ~offscreen_renderer() {
+    try {
+      m_l_device().waitIdle();
+    } catch (...) {
+    }
+  }
+
+  scene_renderer &scene() { return *m_scene; }
+  const auto &p_device() const & { return m_p_device; }
+  bool has_timestamps() const { return m_timestamps; }
+
+  // Records and submits a frame and returns the time it took in milliseconds.
+  // Waiting for the frame that used the same resources before isn't counted.
+  double render_frame(const glm::mat4 &vp,
+                      const scene_renderer::draw_options &options);
+
+  // Waits for the submitted frames and collects their GPU times
+  void finish();
+
+  // Waits for the submitted frames and forgets the GPU times collected so far
+  void reset_timings();
+
+  // GPU times of the finished frames in milliseconds
+  const std::vector<double> &gpu_times() const & { return m_gpu_times; }
+
+private:
+  void initialize_pipelines();
+  void initialize_frames();
+  void collect_timestamps(std::size_t frame);
+};
+
+} // namespace triangles
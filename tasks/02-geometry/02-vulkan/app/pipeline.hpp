@@ -12,6 +12,7 @@
 
 #include "unified_includes/vulkan_hpp_include.hpp"
 
+#include <array>
 #include <numeric>
 #include <tuple>
 #include <vector>
@@ -24,6 +25,44 @@
 
 namespace triangles {
 
+inline constexpr auto c_global_descriptor_pool_sizes =
+    std::to_array<vk::DescriptorPoolSize>(
+        {{vk::DescriptorType::eUniformBuffer, 16},
+         {vk::DescriptorType::eStorageBuffer, 1}});
+
+// We use two pipelines with the same descriptor set, so we should allocate a
+// descriptor set with 2 binding points for a uniform buffer.
+inline constexpr auto c_descriptor_set_bindings =
+    std::to_array<ezvk::descriptor_set::binding_description>(
+        {{vk::DescriptorType::eUniformBuffer, 1,
+          vk::ShaderStageFlagBits::eAllGraphics},
+         {vk::DescriptorType::eUniformBuffer, 1,
+          vk::ShaderStageFlagBits::eAllGraphics}});
+
+// Both sides of a triangle are drawn, the fragment shader turns the normal
+// towards the camera.
+inline constexpr vk::PipelineRasterizationStateCreateInfo
+    triangle_rasterization_state_create_info = {
+        .depthClampEnable = VK_FALSE,
+        .rasterizerDiscardEnable = VK_FALSE,
+        .polygonMode = vk::PolygonMode::eFill,
+        .cullMode = vk::CullModeFlagBits::eNone,
+        .frontFace = vk::FrontFace::eClockwise,
+        .depthBiasEnable = VK_FALSE,
+        .lineWidth = 1.0f,
+};
+
+inline constexpr vk::PipelineRasterizationStateCreateInfo
+    wireframe_rasterization_state_create_info = {
+        .depthClampEnable = VK_FALSE,
+        .rasterizerDiscardEnable = VK_FALSE,
+        .polygonMode = vk::PolygonMode::eLine,
+        .cullMode = vk::CullModeFlagBits::eNone,
+        .frontFace = vk::FrontFace::eClockwise,
+        .depthBiasEnable = VK_FALSE,
+        .lineWidth = 1.0f,
+};
+
 template <typename t_vertex_type> class pipeline final {
   vk::raii::Pipeline m_pipeline = nullptr;
   vk::raii::ShaderModule m_vertex_shader = nullptr, m_fragment_shader = nullptr;
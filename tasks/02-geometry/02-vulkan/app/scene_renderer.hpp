@@ -0,0 +1,422 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long
+ * as you retain this notice you can do whatever you want with this stuff. If we
+ * meet some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "misc/culling.hpp"
+#include "misc/vertex.hpp"
+
+#include "ezvk/wrappers/descriptor_set.hpp"
+#include "ezvk/wrappers/memory.hpp"
+
+#include "unified_includes/glm_inlcude.hpp"
+#include "unified_includes/vulkan_hpp_include.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace triangles {
+
+struct input_data {
+  std::span<const triangles::triangle_vertex_type> tr_vert;
+  // Indices into all the vertices loaded so far, not just into tr_vert
+  std::span<const triangles::triangle_index_type> tr_index;
+  std::span<const triangles::triangle_color_type> tr_color; // One per triangle
+  std::span<const triangles::wireframe_vertex_type> broad_vert, bbox_vert;
+};
+
+// Device copies of the scene and the commands that draw it. The loading thread
+// hands the scene over through append_input_data(), update_triangle_colors()
+// and reorder_triangles(), the rendering thread records upload() and draw()
+// into the command buffer of every frame and commits the staging memory it
+// used with the fence of the submission.
+class scene_renderer final {
+  const vk::raii::PhysicalDevice &m_p_device;
+  const vk::raii::Device &m_l_device;
+
+  static constexpr vk::DeviceSize c_staging_ring_size = 32 * 1024 * 1024;
+  ezvk::staging_ring m_staging;
+  uint32_t m_frames_in_flight;
+
+  // Set 1 holds the per-triangle color stream. It's written once, when the
+  // colors reach device memory, and is never bound before that.
+  ezvk::descriptor_set m_color_descriptor_set;
+
+  // How a buffer is used after the upload: the usage flags it's created with
+  // and the access and stage the transfer has to be made visible to.
+  struct buffer_usage {
+    vk::BufferUsageFlags usage;
+    vk::AccessFlags access;
+    vk::PipelineStageFlags stage;
+  };
+
+  static constexpr buffer_usage c_vertex_usage = {
+      vk::BufferUsageFlagBits::eVertexBuffer,
+      vk::AccessFlagBits::eVertexAttributeRead,
+      vk::PipelineStageFlagBits::eVertexInput};
+  static constexpr buffer_usage c_index_usage = {
+      vk::BufferUsageFlagBits::eIndexBuffer, vk::AccessFlagBits::eIndexRead,
+      vk::PipelineStageFlagBits::eVertexInput};
+  static constexpr buffer_usage c_storage_usage = {
+      vk::BufferUsageFlagBits::eStorageBuffer, vk::AccessFlagBits::eShaderRead,
+      vk::PipelineStageFlagBits::eFragmentShader};
+
+  struct byte_range {
+    vk::DeviceSize offset, size;
+  };
+
+  struct vertex_draw_info {
+    buffer_usage usage = c_vertex_usage;
+    ezvk::device_buffer buf;
+    vk::DeviceSize capacity = 0;
+    bool reallocated = false;
+
+    // Number of elements that have reached device memory. Only the rendering
+    // thread touches the fields above.
+    uint32_t count = 0;
+
+    // Host copy of the contents and the ranges of it that haven't been
+    // uploaded yet. The loading thread writes them, the rendering thread
+    // drains them through the staging ring.
+    std::mutex mutex;
+    std::vector<std::byte> host;
+    uint32_t host_count = 0;
+    std::vector<byte_range> dirty;
+
+  public:
+    operator bool() const { return count; }
+  };
+
+  vertex_draw_info m_triangle_draw_info;
+  vertex_draw_info m_triangle_index_info = {.usage = c_index_usage};
+  vertex_draw_info m_triangle_color_info = {.usage = c_storage_usage};
+  vertex_draw_info m_wireframe_broad_draw_info;
+  vertex_draw_info m_wireframe_bbox_draw_info;
+
+  // The culling hierarchy of the triangles. The loading thread hands it over
+  // through m_pending_cull_nodes, the rendering thread keeps it in
+  // m_next_cull_nodes until the reordered indices reach device memory.
+  std::mutex m_cull_mutex;
+  std::optional<std::vector<cull_node>> m_pending_cull_nodes;
+  std::optional<std::vector<cull_node>> m_next_cull_nodes;
+  std::vector<cull_node> m_cull_nodes;
+
+  // Draws of the visible triangles, written anew every frame. Each frame in
+  // flight has its own buffer, which is free once the fence of the frame is.
+  struct indirect_draw_info {
+    ezvk::device_buffer buf;
+    std::size_t capacity = 0; // In commands
+  };
+
+  std::vector<vk::DrawIndexedIndirectCommand> m_draw_commands;
+  std::vector<indirect_draw_info> m_indirect_draws;
+  uint32_t m_max_draw_indirect_count = 1;
+
+public:
+  static constexpr auto c_color_descriptor_set_bindings =
+      std::to_array<ezvk::descriptor_set::binding_description>(
+          {{vk::DescriptorType::eStorageBuffer, 1,
+            vk::ShaderStageFlagBits::eFragment}});
+
+  struct draw_options {
+    bool frustum_culling = true;
+    bool draw_broad_phase = false, draw_bbox = false;
+  };
+
+  // The pool has to have room for a storage buffer descriptor
+  scene_renderer(const vk::raii::PhysicalDevice &p_device,
+                 const vk::raii::Device &l_device,
+                 const vk::raii::DescriptorPool &pool,
+                 uint32_t frames_in_flight)
+      : m_p_device{p_device}, m_l_device{l_device},
+        m_staging{p_device, l_device, c_staging_ring_size},
+        m_frames_in_flight{frames_in_flight},
+        m_color_descriptor_set{l_device, pool,
+                               c_color_descriptor_set_bindings},
+        m_indirect_draws(frames_in_flight),
+        m_max_draw_indirect_count{
+            p_device.getProperties().limits.maxDrawIndirectCount} {}
+
+  scene_renderer(const scene_renderer &) = delete;
+  scene_renderer &operator=(const scene_renderer &) = delete;
+
+  const auto &color_set_layout() const & {
+    return m_color_descriptor_set.m_layout;
+  }
+
+  // Adds a part of the scene after everything loaded before. It's shown as
+  // soon as it reaches device memory.
+  void append_input_data(const input_data &data) {
+    write_draw_info(m_triangle_draw_info, c_append, data.tr_vert);
+    write_draw_info(m_triangle_index_info, c_append, data.tr_index);
+    write_draw_info(m_triangle_color_info, c_append, data.tr_color);
+    write_draw_info(m_wireframe_broad_draw_info, c_append, data.broad_vert);
+    write_draw_info(m_wireframe_bbox_draw_info, c_append, data.bbox_vert);
+  }
+
+  // Recolors triangles [first, first + colors.size()). Only these bytes are
+  // copied to the device.
+  void update_triangle_colors(std::size_t first,
+                              std::span<const triangle_color_type> colors) {
+    write_draw_info(m_triangle_color_info, first, colors);
+  }
+
+  // Rewrites the whole scene in the order of the culling hierarchy: indices
+  // and colors of every triangle, which has to be loaded already. The nodes are
+  // used for culling as soon as the new order reaches device memory.
+  void reorder_triangles(std::span<const triangle_index_type> indices,
+                         std::span<const triangle_color_type> colors,
+                         std::vector<cull_node> nodes) {
+    write_draw_info(m_triangle_index_info, 0, indices);
+    write_draw_info(m_triangle_color_info, 0, colors);
+
+    std::lock_guard lock{m_cull_mutex};
+    m_pending_cull_nodes = std::move(nodes);
+  }
+
+  // Whether everything handed over so far is in device memory and in use
+  bool up_to_date() {
+    for (auto *info :
+         {&m_triangle_draw_info, &m_triangle_index_info, &m_triangle_color_info,
+          &m_wireframe_broad_draw_info, &m_wireframe_bbox_draw_info}) {
+      std::lock_guard lock{info->mutex};
+      if (!info->dirty.empty())
+        return false;
+    }
+
+    std::lock_guard lock{m_cull_mutex};
+    return !m_pending_cull_nodes && !m_next_cull_nodes;
+  }
+
+  // Records the copies of the dirty parts of the scene. Has to be recorded
+  // outside of a render pass.
+  void upload(vk::raii::CommandBuffer &cmd) {
+    m_staging.reclaim();
+
+    // Taken before the uploads, so that they include the reordered triangles
+    {
+      std::lock_guard lock{m_cull_mutex};
+      if (m_pending_cull_nodes) {
+        m_next_cull_nodes = std::move(m_pending_cull_nodes);
+        m_pending_cull_nodes.reset();
+      }
+    }
+
+    // Indices may only refer to vertices that are already on the device
+    const bool vertices_uploaded = upload_draw_info(cmd, m_triangle_draw_info);
+    const bool colors_uploaded = upload_draw_info(cmd, m_triangle_color_info);
+    const bool indices_uploaded = vertices_uploaded && colors_uploaded &&
+                                  upload_draw_info(cmd, m_triangle_index_info);
+
+    if (indices_uploaded && m_next_cull_nodes) {
+      m_cull_nodes = std::move(*m_next_cull_nodes);
+      m_next_cull_nodes.reset();
+    }
+
+    if (m_triangle_color_info.reallocated) {
+      m_color_descriptor_set.update(
+          m_l_device, {{vk::DescriptorType::eStorageBuffer, VK_WHOLE_SIZE,
+                        m_triangle_color_info.buf.buffer()}});
+      m_triangle_color_info.reallocated = false;
+    }
+
+    upload_draw_info(cmd, m_wireframe_bbox_draw_info);
+    upload_draw_info(cmd, m_wireframe_broad_draw_info);
+  }
+
+  // Staging memory used by the uploads recorded since the last commit is
+  // reused once the fence of their submission is signaled.
+  void commit(vk::Fence fence) { m_staging.commit(fence); }
+
+  // Records the draws of the scene inside of a render pass. The descriptor set
+  // 0 is expected to be bound already.
+  void draw(vk::raii::CommandBuffer &cmd, uint32_t frame, const glm::mat4 &vp,
+            const vk::raii::PipelineLayout &layout,
+            const vk::raii::Pipeline &triangle_pipeline,
+            const vk::raii::Pipeline &wireframe_pipeline,
+            const draw_options &options) {
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *triangle_pipeline);
+
+    if (m_triangle_draw_info && m_triangle_index_info &&
+        m_triangle_color_info) {
+      cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *layout, 1,
+                             {*m_color_descriptor_set.m_descriptor_set},
+                             nullptr);
+      cmd.bindVertexBuffers(0, *m_triangle_draw_info.buf.buffer(), {0});
+      cmd.bindIndexBuffer(*m_triangle_index_info.buf.buffer(), 0,
+                          vk::IndexType::eUint32);
+      draw_triangles(cmd, frame, vp, options.frustum_culling);
+    }
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *wireframe_pipeline);
+
+    const auto submit_draw_info = [&cmd](const auto &info) -> void {
+      if (!info)
+        return;
+      cmd.bindVertexBuffers(0, *info.buf.buffer(), {0});
+      cmd.draw(info.count, 1, 0, 0);
+    };
+
+    if (options.draw_broad_phase)
+      submit_draw_info(m_wireframe_broad_draw_info);
+    if (options.draw_bbox)
+      submit_draw_info(m_wireframe_bbox_draw_info);
+  }
+
+private:
+  void draw_triangles(vk::raii::CommandBuffer &cmd, uint32_t frame,
+                      const glm::mat4 &vp, bool frustum_culling) {
+    m_draw_commands.clear();
+    if (frustum_culling && !m_cull_nodes.empty()) {
+      cull(m_cull_nodes, frustum{vp}, m_draw_commands);
+    } else {
+      m_draw_commands.push_back({.indexCount = m_triangle_index_info.count,
+                                 .instanceCount = 1,
+                                 .firstIndex = 0,
+                                 .vertexOffset = 0,
+                                 .firstInstance = 0});
+    }
+
+    auto &indirect = m_indirect_draws.at(frame);
+    if (indirect.capacity < m_draw_commands.size()) {
+      indirect.capacity =
+          std::max(m_draw_commands.size(), 2 * indirect.capacity);
+      indirect.buf = {m_p_device, m_l_device,
+                      indirect.capacity *
+                          sizeof(vk::DrawIndexedIndirectCommand),
+                      vk::BufferUsageFlagBits::eIndirectBuffer};
+    }
+
+    indirect.buf.copy_to_device(
+        std::span<const vk::DrawIndexedIndirectCommand>{m_draw_commands});
+
+    constexpr auto stride = sizeof(vk::DrawIndexedIndirectCommand);
+    for (std::size_t first = 0; first < m_draw_commands.size();
+         first += m_max_draw_indirect_count) {
+      const auto count = std::min<std::size_t>(
+          m_draw_commands.size() - first, m_max_draw_indirect_count);
+      cmd.drawIndexedIndirect(*indirect.buf.buffer(), first * stride,
+                              static_cast<uint32_t>(count), stride);
+    }
+  }
+
+  static constexpr auto c_append = std::numeric_limits<std::size_t>::max();
+
+  // Writes the elements starting at the index first, or after the last one
+  // with c_append.
+  template <typename T>
+  void write_draw_info(vertex_draw_info &info, std::size_t first,
+                       std::span<const T> elements) {
+    if (elements.empty())
+      return;
+
+    std::lock_guard lock{info.mutex};
+    if (first == c_append)
+      first = info.host_count;
+    const auto offset = first * sizeof(T), size = elements.size_bytes();
+
+    if (info.host.size() < offset + size)
+      info.host.resize(offset + size);
+    std::memcpy(info.host.data() + offset, elements.data(), size);
+    info.host_count =
+        std::max<uint32_t>(info.host_count, first + elements.size());
+
+    // Consecutive writes are usually adjacent, so only the last range is
+    // checked for merging.
+    auto &dirty = info.dirty;
+    if (!dirty.empty() && dirty.back().offset <= offset &&
+        offset <= dirty.back().offset + dirty.back().size) {
+      auto &last = dirty.back();
+      last.size = std::max(last.size, offset + size - last.offset);
+    } else {
+      dirty.push_back({offset, size});
+    }
+  }
+
+  // Records copies of as many dirty bytes as fit into the staging ring and
+  // returns whether the device copy is up to date. The rest is left for the
+  // following frames.
+  bool upload_draw_info(vk::raii::CommandBuffer &cmd, vertex_draw_info &info) {
+    std::lock_guard lock{info.mutex};
+    if (info.dirty.empty())
+      return true;
+
+    if (info.host.size() > info.capacity) {
+      // The old buffer may be used by the frames in flight. Growing happens
+      // a logarithmic number of times, so just wait for them.
+      m_l_device.waitIdle();
+      // Rounded to whole words, which is how the shaders read the colors
+      info.capacity = std::max<vk::DeviceSize>((info.host.size() + 3) / 4 * 4,
+                                               2 * info.capacity);
+      info.buf = {m_p_device, m_l_device, info.capacity,
+                  info.usage.usage | vk::BufferUsageFlagBits::eTransferDst,
+                  vk::MemoryPropertyFlagBits::eDeviceLocal};
+      info.dirty = {{0, info.host.size()}};
+      info.count = 0;
+      info.reallocated = true;
+    }
+
+    // Each frame takes at most its share of the ring, so that a large upload
+    // doesn't stall on the frames in flight.
+    const auto max_chunk = m_staging.capacity() / m_frames_in_flight;
+    std::vector<vk::BufferCopy> regions;
+
+    while (!info.dirty.empty()) {
+      auto &range = info.dirty.front();
+      const auto chunk =
+          std::min({range.size, max_chunk, m_staging.max_allocation()});
+      const auto allocation = m_staging.try_allocate(chunk);
+      if (!allocation)
+        break;
+
+      std::memcpy(allocation->memory.data(), info.host.data() + range.offset,
+                  chunk);
+      regions.push_back({allocation->offset, range.offset, chunk});
+
+      range.offset += chunk;
+      range.size -= chunk;
+      if (!range.size)
+        info.dirty.erase(info.dirty.begin());
+    }
+
+    if (!regions.empty()) {
+      auto &dst_buffer = info.buf.buffer();
+
+      // Previous frames may still be reading the bytes that get overwritten
+      cmd.pipelineBarrier(info.usage.stage,
+                          vk::PipelineStageFlagBits::eTransfer, {}, nullptr,
+                          nullptr, nullptr);
+      cmd.copyBuffer(*m_staging.buffer(), *dst_buffer, regions);
+
+      const auto barrier = vk::BufferMemoryBarrier{
+          .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+          .dstAccessMask = info.usage.access,
+          .buffer = *dst_buffer,
+          .offset = 0,
+          .size = VK_WHOLE_SIZE};
+
+      cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                          info.usage.stage, {}, nullptr, barrier, nullptr);
+    }
+
+    if (!info.dirty.empty())
+      return false;
+    info.count = info.host_count;
+    return true;
+  }
+};
+
+} // namespace triangles
@@ -18,7 +18,10 @@
 
 #include "application.hpp"
 #include "config.hpp"
+#include "misc/culling.hpp"
 #include "misc/vertex.hpp"
+#include "offscreen.hpp"
+#include "scene_renderer.hpp"
 
 #include "geometry/broadphase/broadphase_structure.hpp"
 #include "geometry/broadphase/bruteforce.hpp"
@@ -32,18 +35,31 @@
 
 #include <algorithm>
 #include <atomic>
+#include <bit>
+#include <cassert>
 #include <chrono>
 #include <cmath>
+#include <cstdint>
 #include <concepts>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
 #include <exception>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <iterator>
+#include <limits>
+#include <map>
 #include <mutex>
+#include <numbers>
+#include <optional>
 #include <set>
+#include <span>
 #include <string>
+#include <string_view>
 #include <thread>
-#include <unordered_set>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/program_options.hpp>
@@ -66,40 +82,13 @@ using throttle::geometry::collision_shape;
 using throttle::geometry::is_roughly_equal;
 using throttle::geometry::point3;
 using throttle::geometry::segment3;
+using throttle::geometry::shape_from_three_points;
 using throttle::geometry::triangle3;
 using throttle::geometry::vec3;
 
 using point_type = typename throttle::geometry::point3<float>;
 using triangle_type = typename throttle::geometry::triangle3<float>;
 
-template <typename T>
-throttle::geometry::collision_shape<T>
-shape_from_three_points(const point3<T> &a, const point3<T> &b,
-                        const point3<T> &c) {
-  auto ab = b - a, ac = c - a;
-
-  if (throttle::geometry::colinear(ab, ac)) { // Either a segment or a point
-    if (is_roughly_equal(ab, vec3<T>::zero()) &&
-        is_roughly_equal(ac, vec3<T>::zero())) {
-      return throttle::geometry::barycentric_average<T>(a, b, c);
-    }
-    // This is a segment. Project the the points onto the most closely alligned
-    // axis.
-    auto max_index = ab.max_component().first;
-
-    std::array<std::pair<point3<T>, T>, 3> arr = {
-        std::make_pair(a, a[max_index]), std::make_pair(b, b[max_index]),
-        std::make_pair(c, c[max_index])};
-    std::sort(arr.begin(), arr.end(),
-              [](const auto &left, const auto &right) -> bool {
-                return left.second < right.second;
-              });
-    return segment3<T>{arr[0].first, arr[2].first};
-  }
-
-  return triangle3<T>{a, b, c};
-}
-
 static unsigned apporoximate_optimal_depth(unsigned number) {
   constexpr unsigned max_depth = 6;
   unsigned log_num = std::log10(float(number));
@@ -107,6 +96,8 @@ static unsigned apporoximate_optimal_depth(unsigned number) {
 }
 
 using triangles_vertices_type = std::vector<triangles::triangle_vertex_type>;
+using triangles_indices_type = std::vector<triangles::triangle_index_type>;
+using triangles_colors_type = std::vector<triangles::triangle_color_type>;
 using wireframe_vertices_type = std::vector<triangles::wireframe_vertex_type>;
 
 template <typename T>
@@ -226,76 +217,671 @@ fill_bounding_box_vertices(std::span<const triangle_type> triangles) {
   return vertices;
 }
 
-struct input_result {
-  bool success = false;
-  std::vector<triangles::triangle_vertex_type> tr_vert;
-  std::vector<triangles::wireframe_vertex_type> broad_vert, bbox_vert;
+// Positions are deduplicated by their exact bits, so that the hash and the
+// equality agree on -0.0 and NaNs.
+struct position_bits_hash {
+  std::size_t operator()(const glm::vec3 &pos) const {
+    std::size_t seed = 0;
+    for (unsigned i = 0; i < 3; ++i)
+      seed = seed * 0x9e3779b97f4a7c15ull ^ std::bit_cast<uint32_t>(pos[i]);
+    return seed;
+  }
+};
+
+struct position_bits_equal {
+  bool operator()(const glm::vec3 &lhs, const glm::vec3 &rhs) const {
+    for (unsigned i = 0; i < 3; ++i)
+      if (std::bit_cast<uint32_t>(lhs[i]) != std::bit_cast<uint32_t>(rhs[i]))
+        return false;
+    return true;
+  }
+};
+
+// Holds at most m_capacity elements, so a producer that is faster than its
+// consumer waits instead of buffering the whole input.
+template <typename T> class blocking_queue {
+  std::mutex m_mutex;
+  std::condition_variable m_not_empty, m_not_full;
+  std::deque<T> m_queue;
+  std::size_t m_capacity;
+  bool m_closed = false;
+
+public:
+  explicit blocking_queue(std::size_t capacity) : m_capacity{capacity} {
+    assert(capacity > 0);
+  }
+
+  // Blocks while the queue is full. Returns false and drops the value if the
+  // queue is closed meanwhile.
+  bool push(T value) {
+    {
+      std::unique_lock lock{m_mutex};
+      m_not_full.wait(
+          lock, [this]() { return m_closed || m_queue.size() < m_capacity; });
+      if (m_closed)
+        return false;
+      m_queue.push_back(std::move(value));
+    }
+    m_not_empty.notify_one();
+    return true;
+  }
+
+  // Nothing is pushed after this, pop() returns nullopt once the queue drains.
+  // A consumer that gives up closes the queue to release blocked producers.
+  void close() {
+    {
+      std::lock_guard lock{m_mutex};
+      m_closed = true;
+    }
+    m_not_empty.notify_all();
+    m_not_full.notify_all();
+  }
+
+  std::optional<T> pop() {
+    std::optional<T> value;
+    {
+      std::unique_lock lock{m_mutex};
+      m_not_empty.wait(lock,
+                       [this]() { return m_closed || !m_queue.empty(); });
+      if (m_queue.empty())
+        return std::nullopt;
+      value = std::move(m_queue.front());
+      m_queue.pop_front();
+    }
+    m_not_full.notify_one();
+    return value;
+  }
+};
+
+struct triangle_chunk {
+  unsigned first; // Index of the first triangle in the whole input
+  std::vector<triangle_type> triangles;
+};
+
+struct chunk_mesh {
+  unsigned first;
+  triangles_vertices_type vertices;
+  triangles_indices_type indices; // Into vertices of this chunk
+  triangles_colors_type colors;
+  wireframe_vertices_type bbox_vertices;
+};
+
+bool parse_chunks(std::istream &is, unsigned n, unsigned chunk_size,
+                  blocking_queue<triangle_chunk> &parsed) {
+  for (unsigned first = 0; first < n; first += chunk_size) {
+    const auto count = std::min(chunk_size, n - first);
+    auto chunk = triangle_chunk{first, {}};
+    chunk.triangles.reserve(count);
+
+    for (unsigned i = first; i < first + count; ++i) {
+      point_type a, b, c;
+      if (!(is >> a[0] >> a[1] >> a[2] >> b[0] >> b[1] >> b[2] >> c[0] >>
+            c[1] >> c[2])) {
+        spdlog::error("Can't read i-th = {} triangle out of {}", i, n);
+        return false;
+      }
+      chunk.triangles.push_back({a, b, c});
+    }
+
+    if (!parsed.push(std::move(chunk)))
+      return false; // Ingestion was aborted
+  }
+
+  return true;
+}
+
+// Every triangle gets three indices into the deduplicated positions of its
+// chunk and a byte of color index. Colors start out regular, the intersecting
+// triangles are recolored once the broadphase is done.
+chunk_mesh build_chunk_mesh(const triangle_chunk &chunk) {
+  chunk_mesh mesh;
+  mesh.first = chunk.first;
+  std::unordered_map<glm::vec3, triangles::triangle_index_type,
+                     position_bits_hash, position_bits_equal>
+      position_indices;
+
+  mesh.indices.reserve(3 * chunk.triangles.size());
+  for (const auto &triangle : chunk.triangles) {
+    for (const auto &point : {triangle.a, triangle.b, triangle.c}) {
+      const auto pos = glm::vec3{point[0], point[1], point[2]};
+      auto [found, inserted] =
+          position_indices.try_emplace(pos, mesh.vertices.size());
+      if (inserted)
+        mesh.vertices.push_back({pos});
+      mesh.indices.push_back(found->second);
+    }
+  }
+
+  mesh.colors.assign(chunk.triangles.size(), triangles::config::regular_index);
+  mesh.bbox_vertices = fill_bounding_box_vertices(chunk.triangles);
+  return mesh;
+}
+
+// Meshes are built out of order by the workers, but have to reach the sink in
+// the order of their triangles, so that indices can be rebased onto the
+// vertices of the preceding chunks.
+template <typename t_sink> class ordered_handoff {
+  std::mutex m_mutex;
+  t_sink &m_sink;
+
+  unsigned m_next = 0; // First triangle of the next chunk to hand off
+  triangles::triangle_index_type m_vertex_base = 0;
+  std::map<unsigned, chunk_mesh> m_pending;
+  triangles_indices_type m_indices; // Rebased indices of the handed off chunks
+
+public:
+  ordered_handoff(t_sink &sink) : m_sink{sink} {}
+
+  // Only safe once all the chunks are submitted
+  std::span<const triangles::triangle_index_type> indices() const {
+    return m_indices;
+  }
+
+  void submit(chunk_mesh mesh) {
+    std::lock_guard lock{m_mutex};
+    m_pending.emplace(mesh.first, std::move(mesh));
+
+    for (auto found = m_pending.find(m_next); found != m_pending.end();
+         found = m_pending.find(m_next)) {
+      auto &ready = found->second;
+      for (auto &index : ready.indices)
+        index += m_vertex_base;
+
+      m_sink.append_input_data({ready.vertices, ready.indices, ready.colors,
+                                {}, ready.bbox_vertices});
+      m_indices.insert(m_indices.end(), ready.indices.begin(),
+                       ready.indices.end());
+
+      m_vertex_base += ready.vertices.size();
+      m_next += ready.colors.size();
+      m_pending.erase(found);
+    }
+  }
+};
+
+// Recolors the intersecting triangles. Triangles that are close to each other
+// are sent as one range, so the update is a few ranged copies instead of one
+// per triangle.
+template <typename t_sink>
+void patch_intersection_colors(t_sink &sink,
+                               std::vector<unsigned> intersecting) {
+  constexpr unsigned max_gap = 64;
+  std::sort(intersecting.begin(), intersecting.end());
+
+  triangles_colors_type run;
+  for (unsigned i = 0; i < intersecting.size();) {
+    const auto first = intersecting[i];
+    run.assign(1, triangles::config::intersect_index);
+
+    for (++i; i < intersecting.size() &&
+              intersecting[i] - first - (run.size() - 1) <= max_gap;
+         ++i) {
+      run.resize(intersecting[i] - first, triangles::config::regular_index);
+      run.push_back(triangles::config::intersect_index);
+    }
+
+    sink.update_triangle_colors(first, run);
+  }
+}
+
+// The order to draw the triangles in and the culling hierarchy over it. Only
+// the octree has a hierarchy, with the other broadphases the triangles are
+// drawn in the input order and aren't culled.
+struct scene_layout {
+  std::vector<unsigned> order; // Input indices of the triangles in draw order
+  std::vector<triangles::cull_node> nodes;
+};
+
+template <typename T>
+std::optional<scene_layout>
+build_scene_layout(throttle::geometry::bruteforce<T, indexed_geom> &) {
+  return std::nullopt;
+}
+
+template <typename T>
+std::optional<scene_layout>
+build_scene_layout(throttle::geometry::uniform_grid<T, indexed_geom> &) {
+  return std::nullopt;
+}
+
+// Lays out the nodes of the octree in depth-first order. A triangle is stored
+// in the node whose cube contains it, so the cube of every node bounds the
+// triangles of the whole subtree. Subtrees without triangles are left out.
+template <typename T>
+std::optional<scene_layout>
+build_scene_layout(throttle::geometry::octree<T, indexed_geom> &octree) {
+  const auto nodes = std::span{octree.begin(), octree.end()};
+  if (nodes.size() < 2) // Only the sentinel, the octree is empty
+    return std::nullopt;
+
+  scene_layout layout;
+  const auto visit = [&](const auto &self, unsigned index) -> void {
+    const auto &node = nodes[index];
+    const auto position = layout.nodes.size();
+    const auto first = static_cast<uint32_t>(layout.order.size());
+
+    layout.nodes.push_back(
+        {.center = {node.m_center[0], node.m_center[1], node.m_center[2]},
+         .halfwidth = node.m_halfwidth,
+         .first = first,
+         .own_count =
+             static_cast<uint32_t>(node.m_contained_shape_indexes.size()),
+         .subtree_count = 0,
+         .next = 0});
+
+    for (const auto &i : node.m_contained_shape_indexes)
+      layout.order.push_back(octree.shape_at(i).index);
+    for (const auto &child : node.m_children)
+      if (child)
+        self(self, child);
+
+    const auto count = static_cast<uint32_t>(layout.order.size()) - first;
+    if (!count) {
+      layout.nodes.resize(position);
+      return;
+    }
+
+    auto &added = layout.nodes[position];
+    added.subtree_count = count;
+    added.next = layout.nodes.size();
+  };
+
+  visit(visit, 1); // The root follows the sentinel
+  return layout;
+}
+
+// Sends the indices and colors of all the triangles again, in the order of the
+// layout, along with its hierarchy. The intersecting triangles are recolored
+// on the way, so there's nothing to patch afterwards.
+template <typename t_sink>
+void reorder_triangles(t_sink &sink,
+                       std::span<const triangles::triangle_index_type> indices,
+                       scene_layout layout,
+                       const std::vector<unsigned> &intersecting) {
+  std::vector<bool> is_intersecting(indices.size() / 3);
+  for (auto i : intersecting)
+    is_intersecting[i] = true;
+
+  triangles_indices_type reordered;
+  triangles_colors_type colors;
+  reordered.reserve(indices.size());
+  colors.reserve(layout.order.size());
+
+  for (auto i : layout.order) {
+    const auto triangle = indices.subspan(3 * i, 3);
+    reordered.insert(reordered.end(), triangle.begin(), triangle.end());
+    colors.push_back(is_intersecting[i] ? triangles::config::intersect_index
+                                        : triangles::config::regular_index);
+  }
+
+  sink.reorder_triangles(reordered, colors, std::move(layout.nodes));
+}
+
+struct ingest_options {
+  unsigned chunk_size;
+  unsigned workers;
 };
 
-template <typename broad>
-input_result application_loop(
+// Chunks that may wait between two stages of ingestion, per consumer thread
+inline constexpr std::size_t c_queued_chunks = 4;
+
+// Streams the scene into the sink while it's being read: the parser thread
+// reads chunks of triangles, this thread inserts them into the broadphase as
+// they come, and the workers build the meshes of the chunks in parallel and
+// hand them off. The pairs are searched for once the whole input is in, and
+// the intersecting triangles of the already shown chunks are recolored. With
+// the octree the whole scene is then reordered for culling instead.
+template <typename broad, typename t_sink>
+bool ingest_scene(
     std::istream &is,
     throttle::geometry::broadphase_structure<broad, indexed_geom> &cont,
-    unsigned n) {
-  triangles_vertices_type vertices;
-  std::vector<triangle_type> triangles;
+    unsigned n, t_sink &sink, const ingest_options &options) {
+  blocking_queue<triangle_chunk> parsed{c_queued_chunks},
+      to_build{c_queued_chunks * options.workers};
+  ordered_handoff<t_sink> handoff{sink};
 
-  triangles.reserve(n);
-  for (unsigned i = 0; i < n; ++i) {
-    point_type a, b, c;
-    if (!(is >> a[0] >> a[1] >> a[2] >> b[0] >> b[1] >> b[2] >> c[0] >> c[1] >>
-          c[2])) {
-      spdlog::error("Can't read i-th = {} triangle out of {}", i, n);
-      return {};
+  auto parser = std::async(std::launch::async, [&]() {
+    try {
+      const bool success = parse_chunks(is, n, options.chunk_size, parsed);
+      parsed.close();
+      return success;
+    } catch (...) {
+      parsed.close();
+      throw;
+    }
+  });
+
+  std::vector<std::future<void>> workers;
+  for (unsigned i = 0; i < options.workers; ++i) {
+    workers.push_back(std::async(std::launch::async, [&]() {
+      try {
+        while (auto chunk = to_build.pop())
+          handoff.submit(build_chunk_mesh(*chunk));
+      } catch (...) {
+        to_build.close(); // Otherwise this thread would block on a full queue
+        throw;
+      }
+    }));
+  }
+
+  bool interrupted = false;
+  try {
+    while (auto chunk = parsed.pop()) {
+      for (unsigned i = 0; i < chunk->triangles.size(); ++i) {
+        const auto &tr = chunk->triangles[i];
+        cont.add_collision_shape(
+            {chunk->first + i, shape_from_three_points(tr.a, tr.b, tr.c)});
+      }
+      if (!to_build.push(std::move(*chunk))) {
+        interrupted = true;
+        break;
+      }
     }
-    cont.add_collision_shape({i, shape_from_three_points(a, b, c)});
-    triangles.push_back({a, b, c});
+  } catch (...) {
+    parsed.close();
+    to_build.close();
+    throw;
+  }
+
+  to_build.close();
+  if (interrupted) {
+    // A worker has failed, the parser is stopped and the failure rethrown
+    parsed.close();
+    for (auto &worker : workers)
+      worker.get();
   }
 
+  if (!parser.get())
+    return false;
+
+  // Meanwhile the workers finish the last chunks
   auto result = cont.many_to_many();
+  for (auto &worker : workers)
+    worker.get();
+
+  std::vector<unsigned> intersecting;
+  intersecting.reserve(result.size());
+  for (const auto &v : result)
+    intersecting.push_back(v->index);
+
+  if (auto layout = build_scene_layout(cont.impl()))
+    reorder_triangles(sink, handoff.indices(), std::move(*layout),
+                      intersecting);
+  else
+    patch_intersection_colors(sink, std::move(intersecting));
+
+  const auto mesh_vertices = fill_wireframe_vertices(cont.impl());
+  sink.append_input_data({{}, {}, {}, mesh_vertices, {}});
+  return true;
+}
+
+template <typename t_func>
+bool with_broadphase(const std::string &opt, unsigned n, t_func func) {
+  if (opt == "octree") {
+    throttle::geometry::octree<float, indexed_geom> octree{
+        apporoximate_optimal_depth(n)};
+    return func(octree);
+  } else if (opt == "bruteforce") {
+    throttle::geometry::bruteforce<float, indexed_geom> bruteforce{n};
+    return func(bruteforce);
+  } else if (opt == "uniform-grid") {
+    throttle::geometry::uniform_grid<float, indexed_geom> uniform{n};
+    return func(uniform);
+  }
+
+  throw std::runtime_error{"Unknown broad option"};
+}
 
-  std::unordered_set<unsigned> intersecting;
-  for (const auto &v : result) {
-    intersecting.insert(v->index);
-  }
-
-  vertices.reserve(6 * n);
-  std::for_each(triangles.begin(), triangles.end(),
-                [i = 0, &intersecting, &vertices](auto triangle) mutable {
-                  triangles::triangle_vertex_type vertex;
-
-                  auto norm = triangle.norm();
-                  vertex.color_index = (intersecting.contains(i)
-                                            ? triangles::config::intersect_index
-                                            : triangles::config::regular_index);
-                  vertex.norm = {norm[0], norm[1], norm[2]};
-
-                  vertex.pos = {triangle.a[0], triangle.a[1], triangle.a[2]};
-                  vertices.push_back(vertex);
-                  vertex.pos = {triangle.b[0], triangle.b[1], triangle.b[2]};
-                  vertices.push_back(vertex);
-                  vertex.pos = {triangle.c[0], triangle.c[1], triangle.c[2]};
-                  vertices.push_back(vertex);
-
-                  ++i;
-                });
-
-  // Here we add triangles oriented in the opposite direction to light them
-  // differently
-  auto sz = vertices.size();
-  for (unsigned i = 0; i < sz; i += 3) {
-    const auto offsets = std::array{0, 2, 1};
-    for (const auto &o : offsets) {
-      auto new_vertex = vertices[i + o];
-      new_vertex.norm *= -1;
-      vertices.push_back(new_vertex);
+// Takes the place of the renderer in --ingest-only mode and only keeps count of
+// what would have been uploaded.
+struct counting_sink {
+  using clock = std::chrono::steady_clock;
+
+  clock::time_point m_first_chunk;
+  std::size_t m_chunks = 0, m_triangles = 0, m_bytes = 0, m_patched_bytes = 0,
+              m_reordered_bytes = 0, m_cull_nodes = 0;
+
+  void append_input_data(const triangles::input_data &data) {
+    if (!data.tr_color.empty() && !m_chunks++)
+      m_first_chunk = clock::now();
+    m_triangles += data.tr_color.size();
+    m_bytes += data.tr_vert.size_bytes() + data.tr_index.size_bytes() +
+               data.tr_color.size_bytes() + data.broad_vert.size_bytes() +
+               data.bbox_vert.size_bytes();
+  }
+
+  void update_triangle_colors(
+      std::size_t, std::span<const triangles::triangle_color_type> colors) {
+    m_patched_bytes += colors.size_bytes();
+  }
+
+  void reorder_triangles(
+      std::span<const triangles::triangle_index_type> indices,
+      std::span<const triangles::triangle_color_type> colors,
+      std::vector<triangles::cull_node> nodes) {
+    m_reordered_bytes += indices.size_bytes() + colors.size_bytes();
+    m_cull_nodes = nodes.size();
+  }
+};
+
+bool run_ingest_only(std::istream &is, const std::string &opt,
+                     const ingest_options &options) {
+  using clock = counting_sink::clock;
+  using milliseconds = std::chrono::duration<double, std::milli>;
+
+  unsigned n;
+  if (!(is >> n)) {
+    spdlog::error("Can't read number of triangles");
+    return false;
+  }
+
+  counting_sink sink;
+  const auto start = clock::now();
+  const bool success = with_broadphase(opt, n, [&](auto &cont) {
+    return ingest_scene(is, cont, n, sink, options);
+  });
+  const auto finish = clock::now();
+
+  if (!success)
+    return false;
+
+  std::cout << "triangles: " << sink.m_triangles << " in " << sink.m_chunks
+            << " chunks\n"
+            << "first chunk: "
+            << milliseconds{sink.m_first_chunk - start}.count() << " ms\n"
+            << "total: " << milliseconds{finish - start}.count() << " ms\n"
+            << "uploaded: " << sink.m_bytes << " bytes, recolored "
+            << sink.m_patched_bytes << " bytes, reordered "
+            << sink.m_reordered_bytes << " bytes\n"
+            << "cull nodes: " << sink.m_cull_nodes << "\n";
+  return true;
+}
+
+ezvk::generic_instance
+create_instance(const vk::raii::Context &ctx,
+                const std::vector<std::string> &extensions) {
+  static constexpr auto app_info =
+      vk::ApplicationInfo{.pApplicationName = "Hello, World!",
+                          .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
+                          .pEngineName = "Junk Inc.",
+                          .engineVersion = VK_MAKE_VERSION(1, 0, 0),
+                          .apiVersion = VK_MAKE_VERSION(1, 1, 0)};
+
+#ifdef USE_DEBUG_EXTENSION
+  const auto layers = triangles::config::required_vk_layers(true);
+#else
+  const auto layers = triangles::config::required_vk_layers();
+#endif
+
+  ezvk::instance raw_instance = {ctx,
+                                 app_info,
+                                 extensions.begin(),
+                                 extensions.end(),
+                                 layers.begin(),
+                                 layers.end()};
+
+#ifdef USE_DEBUG_EXTENSION
+  return ezvk::debugged_instance{std::move(raw_instance)};
+#else
+  return ezvk::generic_instance{std::move(raw_instance)};
+#endif
+}
+
+// Passes the scene on to the renderer and keeps track of its bounding box,
+// which the camera of the benchmark circles around.
+struct bounding_sink {
+  triangles::scene_renderer &m_scene;
+  glm::vec3 m_min{std::numeric_limits<float>::max()},
+      m_max{std::numeric_limits<float>::lowest()};
+
+  void append_input_data(const triangles::input_data &data) {
+    for (const auto &vertex : data.tr_vert) {
+      m_min = glm::min(m_min, vertex.pos);
+      m_max = glm::max(m_max, vertex.pos);
     }
+    m_scene.append_input_data(data);
   }
 
-  const auto mesh_vertices = fill_wireframe_vertices(cont.impl());
-  const auto bboxes_vertices = fill_bounding_box_vertices(triangles);
+  void update_triangle_colors(
+      std::size_t first,
+      std::span<const triangles::triangle_color_type> colors) {
+    m_scene.update_triangle_colors(first, colors);
+  }
+
+  void reorder_triangles(
+      std::span<const triangles::triangle_index_type> indices,
+      std::span<const triangles::triangle_color_type> colors,
+      std::vector<triangles::cull_node> nodes) {
+    m_scene.reorder_triangles(indices, colors, std::move(nodes));
+  }
+};
+
+struct benchmark_options {
+  unsigned frames;
+  vk::Extent2D extent;
+  bool frustum_culling;
+};
+
+// The camera makes one turn around the scene over the run. It also moves in
+// and out of it and up and down, so that every run sees the scene from both
+// outside and inside, with a varying part of it culled.
+utils3d::camera benchmark_camera(const glm::vec3 &min, const glm::vec3 &max,
+                                 float t) {
+  constexpr auto two_pi = 2 * std::numbers::pi_v<float>;
+
+  const auto center = (min + max) / 2.0f;
+  const auto radius = std::max(glm::length(max - min) / 2.0f, 1.0f);
+
+  const auto distance = radius * (1.5f + std::cos(two_pi * t));
+  const auto yaw = two_pi * t, pitch = 0.4f * std::sin(2 * two_pi * t);
+  const auto offset = glm::vec3{std::cos(yaw) * std::cos(pitch),
+                                std::sin(pitch),
+                                std::sin(yaw) * std::cos(pitch)};
+
+  const auto position = center + distance * offset;
+  auto camera = utils3d::camera{position, center - position};
+  camera.set_far_z_clip(4 * radius);
+  return camera;
+}
+
+// Nearest rank percentile
+double percentile(std::vector<double> values, double fraction) {
+  if (values.empty())
+    return 0;
+
+  std::sort(values.begin(), values.end());
+  const auto rank = static_cast<std::size_t>(
+      std::ceil(fraction * static_cast<double>(values.size())));
+  return values[std::clamp<std::size_t>(rank, 1, values.size()) - 1];
+}
+
+std::string json_string(std::string_view str) {
+  std::string result = "\"";
+  for (auto c : str) {
+    if (c == '"' || c == '\\')
+      result += '\\';
+    result += c;
+  }
+  return result + '"';
+}
 
-  return {true, vertices, mesh_vertices, bboxes_vertices};
+// Loads the scene, renders frames offscreen until all of it is on the device,
+// then times the requested number of frames along the scripted camera path and
+// prints the percentiles as JSON.
+bool run_benchmark(std::istream &is, const std::string &opt,
+                   const ingest_options &options,
+                   const benchmark_options &bench) {
+  unsigned n;
+  if (!(is >> n)) {
+    spdlog::error("Can't read number of triangles");
+    return false;
+  }
+
+  vk::raii::Context ctx;
+  const auto instance = create_instance(
+      ctx, triangles::config::required_headless_vk_extensions());
+  triangles::offscreen_renderer renderer{
+      triangles::offscreen_renderer::pick_physical_device(instance()),
+      bench.extent};
+
+  bounding_sink sink{renderer.scene()};
+  const bool success = with_broadphase(opt, n, [&](auto &cont) {
+    return ingest_scene(is, cont, n, sink, options);
+  });
+
+  if (!success)
+    return false;
+
+  const auto draw_options = triangles::scene_renderer::draw_options{
+      .frustum_culling = bench.frustum_culling};
+  const auto vp_at = [&](float t) {
+    return benchmark_camera(sink.m_min, sink.m_max, t)
+        .get_vp_matrix(bench.extent.width, bench.extent.height);
+  };
+
+  // Uploads go through the staging ring a few megabytes per frame, so frames
+  // are rendered until the whole scene is on the device
+  unsigned warmup_frames = 0;
+  while (!renderer.scene().up_to_date()) {
+    renderer.render_frame(vp_at(0), draw_options);
+    ++warmup_frames;
+  }
+  renderer.reset_timings();
+
+  std::vector<double> cpu_times;
+  cpu_times.reserve(bench.frames);
+  for (unsigned i = 0; i < bench.frames; ++i) {
+    const auto t = static_cast<float>(i) / bench.frames;
+    cpu_times.push_back(renderer.render_frame(vp_at(t), draw_options));
+  }
+  renderer.finish();
+
+  const auto &gpu_times = renderer.gpu_times();
+  const auto device = renderer.p_device().getProperties();
+
+  std::cout << "{\n"
+            << "  \"device\": " << json_string(device.deviceName.data())
+            << ",\n"
+            << "  \"broad\": " << json_string(opt) << ",\n"
+            << "  \"triangles\": " << n << ",\n"
+            << "  \"width\": " << bench.extent.width << ",\n"
+            << "  \"height\": " << bench.extent.height << ",\n"
+            << "  \"frustum_culling\": "
+            << (bench.frustum_culling ? "true" : "false") << ",\n"
+            << "  \"warmup_frames\": " << warmup_frames << ",\n"
+            << "  \"frames\": " << bench.frames << ",\n"
+            << "  \"cpu_ms\": {\"p50\": " << percentile(cpu_times, 0.5)
+            << ", \"p99\": " << percentile(cpu_times, 0.99) << "},\n"
+            << "  \"gpu_ms\": ";
+
+  if (renderer.has_timestamps())
+    std::cout << "{\"p50\": " << percentile(gpu_times, 0.5)
+              << ", \"p99\": " << percentile(gpu_times, 0.99) << "}\n";
+  else
+    std::cout << "null\n";
+
+  std::cout << "}\n";
+  return true;
 }
 
 } // namespace
@@ -313,12 +899,34 @@ int main(int argc, char *argv[]) try {
   std::istream *isp = &std::cin;
 
   std::string opt, input;
+  ingest_options options;
+  benchmark_options bench;
+  const auto default_workers =
+      std::max(1u, std::thread::hardware_concurrency() / 2);
+
   po::options_description desc("Available options");
   desc.add_options()("help,h", "Print this help message")(
       "broad", po::value<std::string>(&opt)->default_value("octree"),
       "Algorithm for broad phase (bruteforce, octree, uniform-grid)")(
       "input,i", po::value<std::string>(&input),
-      "Optional input file to use instead of stdin");
+      "Optional input file to use instead of stdin")(
+      "chunk-size",
+      po::value<unsigned>(&options.chunk_size)->default_value(16384),
+      "Number of triangles that are read and shown at once")(
+      "workers",
+      po::value<unsigned>(&options.workers)->default_value(default_workers),
+      "Number of threads building the meshes of the chunks")(
+      "ingest-only", "Only run the loading pipeline without a window and "
+                     "print how long it takes")(
+      "headless", "Render offscreen without a window along a scripted camera "
+                  "path and print frame times as JSON")(
+      "frames", po::value<unsigned>(&bench.frames)->default_value(600),
+      "Number of frames timed in --headless mode")(
+      "width", po::value<uint32_t>(&bench.extent.width)->default_value(1280),
+      "Width of the offscreen image in --headless mode")(
+      "height", po::value<uint32_t>(&bench.extent.height)->default_value(720),
+      "Height of the offscreen image in --headless mode")(
+      "no-culling", "Draw the whole scene every frame in --headless mode");
 
   po::variables_map vm;
   po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -337,39 +945,27 @@ int main(int argc, char *argv[]) try {
     isp = &ifs;
   }
 
+  if (!options.chunk_size || !options.workers)
+    throw std::invalid_argument{"Chunk size and workers can't be 0"};
+
+  if (vm.count("ingest-only"))
+    return (run_ingest_only(*isp, opt, options) ? 0 : 1);
+
+  if (vm.count("headless")) {
+    if (!bench.frames || !bench.extent.width || !bench.extent.height)
+      throw std::invalid_argument{"Frames, width and height can't be 0"};
+    bench.frustum_culling = !vm.count("no-culling");
+    return (run_benchmark(*isp, opt, options, bench) ? 0 : 1);
+  }
+
   glfwInit();
 
   constexpr float glfw_timeout = 0.25f;
   glfwWaitEventsTimeout(glfw_timeout);
-  static constexpr auto app_info =
-      vk::ApplicationInfo{.pApplicationName = "Hello, World!",
-                          .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
-                          .pEngineName = "Junk Inc.",
-                          .engineVersion = VK_MAKE_VERSION(1, 0, 0),
-                          .apiVersion = VK_MAKE_VERSION(1, 1, 0)};
 
   vk::raii::Context ctx;
-  const auto extensions = triangles::config::required_vk_extensions();
-
-#ifdef USE_DEBUG_EXTENSION
-  const auto layers = triangles::config::required_vk_layers(true);
-#else
-  const auto layers = triangles::config::required_vk_layers();
-#endif
-
-  ezvk::instance raw_instance = {ctx,
-                                 app_info,
-                                 extensions.begin(),
-                                 extensions.end(),
-                                 layers.begin(),
-                                 layers.end()};
-
-#ifdef USE_DEBUG_EXTENSION
-  ezvk::generic_instance instance =
-      ezvk::debugged_instance{std::move(raw_instance)};
-#else
-  ezvk::generic_instance instance = std::move(raw_instance);
-#endif
+  auto instance =
+      create_instance(ctx, triangles::config::required_vk_extensions());
   const auto physical_device_extensions =
       triangles::config::required_physical_device_extensions();
   auto suitable_physical_devices =
@@ -377,11 +973,17 @@ int main(int argc, char *argv[]) try {
           instance(), physical_device_extensions.begin(),
           physical_device_extensions.end());
 
-  if (suitable_physical_devices.empty()) {
+  // The culled indirect draw needs the same features as the offscreen path
+  auto suitable = std::find_if(
+      suitable_physical_devices.begin(), suitable_physical_devices.end(),
+      [](const auto &device) {
+        return triangles::config::supports_required_features(device);
+      });
+  if (suitable == suitable_physical_devices.end()) {
     throw ezvk::vk_error{"No suitable physical devices found"};
   }
 
-  auto p_device = std::move(suitable_physical_devices.front());
+  auto p_device = std::move(*suitable);
   auto window = ezvk::unique_glfw_window{"Triangles intersection",
                                          vk::Extent2D{800, 600}, true};
   auto surface = ezvk::surface{instance(), window};
@@ -414,55 +1016,38 @@ int main(int argc, char *argv[]) try {
     should_kill = true;
   }};
 
-  auto intersecting_thread = std::thread{[&app, opt, isp, &should_kill]() {
-    assert(isp);
-
-    const auto read_input = [&]() -> bool {
-      unsigned n;
-      if (!(*isp >> n)) {
-        spdlog::error("Can't read number of triangles");
-        return false;
-      }
-
-      input_result res;
-      if (opt == "octree") {
-        throttle::geometry::octree<float, indexed_geom> octree{
-            apporoximate_optimal_depth(n)};
-        if (!(res = application_loop(*isp, octree, n)).success)
-          return false;
-      } else if (opt == "bruteforce") {
-        throttle::geometry::bruteforce<float, indexed_geom> bruteforce{n};
-        if (!(res = application_loop(*isp, bruteforce, n)).success)
-          return false;
-      } else if (opt == "uniform-grid") {
-        throttle::geometry::uniform_grid<float, indexed_geom> uniform{n};
-        if (!(res = application_loop(*isp, uniform, n)).success)
-          return false;
-      } else
-        throw std::runtime_error{"Unknown broad option"};
-
-      triangles::input_data data = {res.tr_vert, res.broad_vert, res.bbox_vert};
-      app.load_input_data(data);
-
-      return true;
-    };
+  auto intersecting_thread =
+      std::thread{[&app, opt, isp, options, &should_kill]() {
+        assert(isp);
+
+        const auto read_input = [&]() -> bool {
+          unsigned n;
+          if (!(*isp >> n)) {
+            spdlog::error("Can't read number of triangles");
+            return false;
+          }
+
+          return with_broadphase(opt, n, [&](auto &cont) {
+            return ingest_scene(*isp, cont, n, app.scene(), options);
+          });
+        };
+
+        try {
+          if (!read_input())
+            should_kill = true;
+          return;
+        } catch (ezvk::error &e) {
+          spdlog::error("Application encountered an error: {}", e.what());
+        } catch (vk::SystemError &e) {
+          spdlog::error("Vulkan error: {}", e.what());
+        } catch (std::exception &e) {
+          spdlog::error("Other error: {}", e.what());
+        } catch (...) {
+          spdlog::error("Unknown error, bailing out...");
+        }
 
-    try {
-      if (!read_input())
         should_kill = true;
-      return;
-    } catch (ezvk::error &e) {
-      spdlog::error("Application encountered an error: {}", e.what());
-    } catch (vk::SystemError &e) {
-      spdlog::error("Vulkan error: {}", e.what());
-    } catch (std::exception &e) {
-      spdlog::error("Other error: {}", e.what());
-    } catch (...) {
-      spdlog::error("Unknown error, bailing out...");
-    }
-
-    should_kill = true;
-  }};
+      }};
 
   while (!glfwWindowShouldClose(app.window())) {
     if (should_kill)
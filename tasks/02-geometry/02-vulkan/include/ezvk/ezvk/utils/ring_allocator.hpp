@@ -0,0 +1,110 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long
+ * as you retain this notice you can do whatever you want with this stuff. If we
+ * meet some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+
+namespace ezvk::utils {
+
+// Offset bookkeeping of a ring buffer that is carved up in FIFO order.
+// Allocations made before commit() are tagged with a fence and are handed out
+// again only after reclaim() has seen that fence signaled. It knows nothing
+// about Vulkan, so t_fence can be anything the caller can ask about.
+template <typename t_fence> class ring_allocator final {
+public:
+  using size_type = std::uint64_t;
+
+  static constexpr size_type default_alignment = 16;
+
+private:
+  // Bytes [m_tail, m_head) are in use, wrapping around the end. m_head never
+  // catches up with m_tail from below, so m_head == m_tail means empty.
+  size_type m_capacity = 0, m_head = 0, m_tail = 0, m_committed = 0;
+
+  struct submission {
+    t_fence fence;
+    size_type end;
+  };
+
+  std::deque<submission> m_in_flight;
+
+public:
+  ring_allocator() = default;
+  explicit ring_allocator(size_type capacity) : m_capacity{capacity} {}
+
+  size_type capacity() const { return m_capacity; }
+  bool empty() const { return m_head == m_tail; }
+  std::size_t in_flight() const { return m_in_flight.size(); }
+
+  // Largest block try_allocate() can currently return.
+  size_type max_allocation(size_type alignment = default_alignment) const {
+    const auto head = align_up(m_head, alignment);
+    if (m_head < m_tail)
+      return (head < m_tail ? m_tail - head - 1 : 0);
+    const auto at_end = (head < m_capacity ? m_capacity - head : 0);
+    const auto at_start = (m_tail ? m_tail - 1 : 0);
+    return std::max(at_end, at_start);
+  }
+
+  // Offset of a block of size bytes, or nothing if it doesn't fit until more
+  // memory is reclaimed. Requests larger than the ring never fit, callers
+  // split them into chunks of at most max_allocation() bytes.
+  std::optional<size_type>
+  try_allocate(size_type size, size_type alignment = default_alignment) {
+    if (!size)
+      return std::nullopt;
+
+    auto offset = align_up(m_head, alignment);
+    if (m_head < m_tail) {
+      if (offset + size >= m_tail)
+        return std::nullopt;
+    } else if (offset + size > m_capacity) {
+      if (size >= m_tail) // Wrap around to the start
+        return std::nullopt;
+      offset = 0;
+    }
+
+    m_head = offset + size;
+    return offset;
+  }
+
+  // Tags everything allocated since the previous commit with the fence that
+  // the submission reading it signals. Call this after the submission.
+  void commit(t_fence fence) {
+    if (m_head == m_committed)
+      return;
+    m_in_flight.push_back({fence, m_head});
+    m_committed = m_head;
+  }
+
+  // Releases the allocations of the submissions whose fences is_signaled()
+  // reports as signaled, oldest first.
+  template <typename t_pred> void reclaim(t_pred is_signaled) {
+    while (!m_in_flight.empty() && is_signaled(m_in_flight.front().fence)) {
+      m_tail = m_in_flight.front().end;
+      m_in_flight.pop_front();
+    }
+
+    if (m_in_flight.empty() && m_head == m_committed)
+      m_head = m_tail = m_committed = 0;
+  }
+
+private:
+  static size_type align_up(size_type offset, size_type alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+  }
+};
+
+} // namespace ezvk::utils
@@ -43,7 +43,7 @@ struct descriptor_set {
   vk::raii::DescriptorSetLayout m_layout = nullptr;
   vk::raii::DescriptorSet m_descriptor_set = nullptr;
 
-private:
+public:
   struct buffer_description {
     vk::DescriptorType type;
     vk::DeviceSize size;
@@ -52,7 +52,6 @@ private:
     const vk::raii::BufferView *buf_view = nullptr;
   };
 
-public:
   struct binding_description {
     vk::DescriptorType type;
     uint32_t count;
@@ -61,8 +60,9 @@ public:
 
   descriptor_set() = default;
 
+  // Allocates the set without writing it, the buffers are bound with update()
+  // once they exist.
   descriptor_set(const vk::raii::Device &l_device,
-                 const ezvk::device_buffers &uniform_buffers,
                  const vk::raii::DescriptorPool &pool,
                  std::span<const binding_description> bindings) {
     m_layout = create_decriptor_set_layout(l_device, bindings);
@@ -74,7 +74,13 @@ public:
 
     m_descriptor_set =
         std::move((vk::raii::DescriptorSets{l_device, set_alloc_info}).front());
+  }
 
+  descriptor_set(const vk::raii::Device &l_device,
+                 const ezvk::device_buffers &uniform_buffers,
+                 const vk::raii::DescriptorPool &pool,
+                 std::span<const binding_description> bindings)
+      : descriptor_set{l_device, pool, bindings} {
     std::vector<buffer_description> buffer_data;
     buffer_data.reserve(uniform_buffers.size());
 
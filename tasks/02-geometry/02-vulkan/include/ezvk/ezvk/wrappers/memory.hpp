@@ -15,14 +15,17 @@
 #include "ezvk/error.hpp"
 #include "memory.hpp"
 
+#include "ezvk/utils/ring_allocator.hpp"
 #include "ezvk/utils/utility.hpp"
 #include "queues.hpp"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdlib>
 #include <functional>
 #include <iterator>
 #include <memory>
+#include <optional>
 #include <span>
 #include <string>
 #include <vector>
@@ -177,6 +180,68 @@ public:
   }
 };
 
+// A persistently mapped host-visible buffer that staging memory is carved out
+// of in FIFO order. Allocations made before commit() are tagged with the fence
+// of the submission that reads them and are handed out again only after that
+// fence has been signaled. The offsets are managed by utils::ring_allocator.
+class staging_ring final {
+  device_buffer m_buffer;
+  std::byte *m_mapped = nullptr;
+  vk::Device m_device;
+  utils::ring_allocator<vk::Fence> m_ring;
+
+public:
+  static constexpr vk::DeviceSize default_alignment =
+      utils::ring_allocator<vk::Fence>::default_alignment;
+
+  struct allocation {
+    vk::DeviceSize offset; // Offset into buffer(), the source of the copy
+    std::span<std::byte> memory;
+  };
+
+  staging_ring() = default;
+
+  staging_ring(const vk::raii::PhysicalDevice &p_device,
+               const vk::raii::Device &l_device, vk::DeviceSize capacity)
+      : m_buffer{p_device, l_device, capacity,
+                 vk::BufferUsageFlagBits::eTransferSrc},
+        m_device{*l_device}, m_ring{capacity} {
+    // The memory is coherent, so it stays mapped until it's freed and writes
+    // don't have to be flushed.
+    m_mapped = static_cast<std::byte *>(
+        m_buffer.memory().mapMemory(0, VK_WHOLE_SIZE));
+  }
+
+  const auto &buffer() const & { return m_buffer.buffer(); }
+  vk::DeviceSize capacity() const { return m_ring.capacity(); }
+
+  // Largest block try_allocate() can currently return.
+  vk::DeviceSize max_allocation(
+      vk::DeviceSize alignment = default_alignment) const {
+    return m_ring.max_allocation(alignment);
+  }
+
+  std::optional<allocation>
+  try_allocate(vk::DeviceSize size,
+               vk::DeviceSize alignment = default_alignment) {
+    auto offset = m_ring.try_allocate(size, alignment);
+    if (!offset)
+      return std::nullopt;
+    return allocation{*offset, {m_mapped + *offset, size}};
+  }
+
+  // Tags everything allocated since the previous commit with the fence that
+  // the submission reading it signals. Call this after the submission.
+  void commit(vk::Fence fence) { m_ring.commit(fence); }
+
+  // Releases the allocations of the submissions that have completed.
+  void reclaim() {
+    m_ring.reclaim([this](vk::Fence fence) {
+      return m_device.getFenceStatus(fence) == vk::Result::eSuccess;
+    });
+  }
+};
+
 struct device_buffers final : private std::vector<device_buffer> {
   device_buffers() = default;
 
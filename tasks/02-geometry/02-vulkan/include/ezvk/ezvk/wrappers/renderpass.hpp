@@ -16,6 +16,7 @@
 #include "ezvk/error.hpp"
 #include "queues.hpp"
 
+#include <array>
 #include <cstddef>
 #include <cstdlib>
 #include <functional>
@@ -59,11 +60,16 @@ public:
   pipeline_layout() = default;
 
   pipeline_layout(const vk::raii::Device &device,
-                  const vk::raii::DescriptorSetLayout &descriptor_set_layout) {
+                  const vk::raii::DescriptorSetLayout &descriptor_set_layout)
+      : pipeline_layout{device, std::array{*descriptor_set_layout}} {}
+
+  // Set layouts in the order of their set numbers
+  pipeline_layout(const vk::raii::Device &device,
+                  std::span<const vk::DescriptorSetLayout> set_layouts) {
     const auto layout_info = vk::PipelineLayoutCreateInfo{
         .flags = vk::PipelineLayoutCreateFlags{},
-        .setLayoutCount = 1,
-        .pSetLayouts = std::addressof(*descriptor_set_layout),
+        .setLayoutCount = static_cast<uint32_t>(set_layouts.size()),
+        .pSetLayouts = set_layouts.data(),
         .pushConstantRangeCount = 0};
     m_layout = vk::raii::PipelineLayout{device, layout_info};
   }
@@ -1,4 +1,4 @@
-#version 400
+#version 450
 
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
@@ -13,17 +13,29 @@ layout (std140, binding = 0) uniform buffer {
   float ambient_strength;
 } uniform_buffer;
 
-layout (location = 0) flat in vec3 in_color;
-layout (location = 1) in vec3 in_normal;
+// One byte of color index per triangle, four to a word.
+layout (std430, set = 1, binding = 0) readonly buffer color_buffer {
+  uint color_indices[];
+};
+
+layout (location = 0) in vec3 in_pos;
+layout (location = 1) flat in uint in_first_triangle;
 
 layout (location = 0) out vec4 out_color;
 
 void main() {
-  vec3 object_color = in_color;
+  uint primitive = in_first_triangle + uint(gl_PrimitiveID);
+  uint word = color_indices[primitive >> 2];
+  uint color_index = (word >> (8 * (primitive & 3))) & 0xffu;
+  vec3 object_color = uniform_buffer.colors[color_index].xyz;
   vec3 light_color = uniform_buffer.light_color.xyz;
 
+  // Framebuffer y points down, so this is the face normal turned towards the
+  // camera whichever side of the triangle is visible. That is the two-sided
+  // lighting that used to need a reversed copy of every triangle.
+  vec3 norm = normalize(cross(dFdy(in_pos), dFdx(in_pos)));
+
   vec3 ambient = uniform_buffer.ambient_strength * light_color;
-  vec3 norm = normalize(in_normal);
   vec3 light_dir = uniform_buffer.light_direction.xyz;
 
   float diffuse_strength = max(dot(light_dir, norm), 0.0);
@@ -14,14 +14,13 @@ layout (std140, binding = 0) uniform buffer {
 } uniform_buffer;
 
 layout (location = 0) in vec3 in_pos;
-layout (location = 1) in vec3 in_normal;
-layout (location = 2) in uint in_color_index;
 
-layout (location = 0) flat out vec3 out_color;
-layout (location = 1) out vec3 out_normal;
+layout (location = 0) out vec3 out_pos;
+// The draw of a range of triangles starts its instances at the first one
+layout (location = 1) flat out uint out_first_triangle;
 
 void main() {
-  out_color = uniform_buffer.colors[in_color_index].xyz;
   gl_Position = uniform_buffer.vp * vec4(in_pos, 1.0);
-  out_normal = in_normal;
+  out_pos = in_pos;
+  out_first_triangle = uint(gl_InstanceIndex);
 }
\ No newline at end of file
@@ -0,0 +1,209 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long
+ * as you retain this notice you can do whatever you want with this stuff. If we
+ * meet some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "ezvk/utils/ring_allocator.hpp"
+
+using ring = ezvk::utils::ring_allocator<unsigned>;
+using size_type = ring::size_type;
+
+namespace {
+
+// Fences are plain numbers here, a fence is signaled once it's in the set.
+struct fence_model {
+  std::set<unsigned> signaled;
+
+  auto checker() const {
+    return [this](unsigned fence) { return signaled.count(fence) != 0; };
+  }
+};
+
+} // namespace
+
+TEST(test_ring_allocator, test_allocation) {
+  ring r{1024};
+  EXPECT_TRUE(r.empty());
+  EXPECT_EQ(r.max_allocation(), 1024);
+  EXPECT_FALSE(r.try_allocate(0));
+
+  EXPECT_EQ(r.try_allocate(10), 0);
+  EXPECT_EQ(r.try_allocate(10), 16); // Aligned to 16 bytes
+  EXPECT_EQ(r.try_allocate(3, 4), 28);
+  EXPECT_EQ(r.try_allocate(1, 1), 31);
+  EXPECT_FALSE(r.empty());
+  EXPECT_EQ(r.max_allocation(), 1024 - 32);
+
+  EXPECT_EQ(r.try_allocate(1024 - 32), 32);
+  EXPECT_EQ(r.max_allocation(), 0);
+  EXPECT_FALSE(r.try_allocate(1));
+}
+
+TEST(test_ring_allocator, test_fence_reclaim) {
+  fence_model fences;
+  ring r{256};
+
+  ASSERT_EQ(r.try_allocate(100), 0);
+  r.commit(1);
+  ASSERT_EQ(r.try_allocate(100), 112);
+  r.commit(2);
+  r.commit(3); // Nothing was allocated since the previous commit
+  EXPECT_EQ(r.in_flight(), 2);
+
+  // Nothing is released until the first fence is signaled, even if the
+  // second one already is
+  fences.signaled.insert(2);
+  r.reclaim(fences.checker());
+  EXPECT_EQ(r.in_flight(), 2);
+  EXPECT_FALSE(r.try_allocate(100));
+
+  fences.signaled.insert(1);
+  r.reclaim(fences.checker());
+  EXPECT_TRUE(r.empty());
+  EXPECT_EQ(r.in_flight(), 0);
+  EXPECT_EQ(r.max_allocation(), 256); // An empty ring starts over
+  EXPECT_EQ(r.try_allocate(256), 0);
+}
+
+TEST(test_ring_allocator, test_wrap_around) {
+  fence_model fences;
+  ring r{256};
+
+  ASSERT_EQ(r.try_allocate(96), 0);
+  r.commit(1);
+  ASSERT_EQ(r.try_allocate(96), 96);
+  r.commit(2);
+
+  fences.signaled.insert(1);
+  r.reclaim(fences.checker());
+  EXPECT_EQ(r.in_flight(), 1);
+
+  // 64 bytes are left at the end, 95 at the start
+  EXPECT_EQ(r.max_allocation(), 95);
+  EXPECT_EQ(r.try_allocate(64), 192);
+  EXPECT_EQ(r.try_allocate(80), 0); // Wraps around
+  EXPECT_EQ(r.max_allocation(), 15); // The byte before the tail stays free
+  EXPECT_FALSE(r.try_allocate(16));
+  EXPECT_EQ(r.try_allocate(15, 1), 80);
+  r.commit(3);
+
+  // The wrapped allocation keeps the one in front of it alive
+  EXPECT_FALSE(r.try_allocate(1, 1));
+  fences.signaled.insert(2);
+  r.reclaim(fences.checker());
+  EXPECT_EQ(r.max_allocation(), 192 - 96 - 1); // From 96 up to frame 3
+  fences.signaled.insert(3);
+  r.reclaim(fences.checker());
+  EXPECT_TRUE(r.empty());
+}
+
+TEST(test_ring_allocator, test_larger_than_ring) {
+  fence_model fences;
+  ring r{1000};
+
+  EXPECT_FALSE(r.try_allocate(1001));
+  EXPECT_FALSE(r.try_allocate(5000));
+  EXPECT_TRUE(r.empty());
+
+  // A large upload goes through in chunks of at most half the ring per
+  // frame, with two frames in flight. This is how the scene renderer uses it.
+  const size_type upload = 10'000, max_chunk = r.capacity() / 2;
+  size_type uploaded = 0;
+  unsigned frame = 0;
+  while (uploaded < upload) {
+    ASSERT_LT(frame, 100);
+    ++frame;
+    if (frame > 2)
+      fences.signaled.insert(frame - 2); // The frame before the last is done
+    r.reclaim(fences.checker());
+
+    size_type this_frame = 0;
+    while (uploaded < upload && this_frame < max_chunk) {
+      auto chunk = std::min({upload - uploaded, max_chunk - this_frame,
+                             r.max_allocation()});
+      auto offset = r.try_allocate(chunk);
+      if (!offset)
+        break;
+      ASSERT_LE(*offset + chunk, r.capacity());
+      uploaded += chunk;
+      this_frame += chunk;
+    }
+
+    EXPECT_LE(this_frame, max_chunk);
+    r.commit(frame);
+  }
+
+  EXPECT_EQ(uploaded, upload);
+  EXPECT_GE(frame, upload / max_chunk);
+}
+
+// Frames allocate random blocks and the device finishes them in order after
+// a random delay. Blocks of frames that haven't finished must never overlap.
+TEST(test_ring_allocator, test_random_frames) {
+  std::mt19937 gen{7};
+  std::uniform_int_distribution<size_type> size_dist{1, 300};
+  std::uniform_int_distribution<unsigned> count_dist{0, 6}, align_dist{0, 5};
+
+  fence_model fences;
+  ring r{2048};
+  // Offset of each live block -> its size and frame
+  std::map<size_type, std::pair<size_type, unsigned>> live;
+  unsigned completed = 0, failed = 0;
+
+  for (unsigned frame = 1; frame <= 5000; ++frame) {
+    while (completed + 1 < frame && (gen() % 3 || completed + 4 < frame))
+      fences.signaled.insert(++completed);
+    r.reclaim(fences.checker());
+
+    // Everything up to the first unfinished frame is free again
+    std::erase_if(live, [&](const auto &block) {
+      return block.second.second <= completed;
+    });
+    if (live.empty()) {
+      EXPECT_TRUE(r.empty());
+    }
+
+    for (unsigned i = count_dist(gen); i; --i) {
+      auto size = size_dist(gen);
+      size_type alignment = size_type{1} << align_dist(gen);
+      auto max = r.max_allocation(alignment);
+      auto offset = r.try_allocate(size, alignment);
+      ASSERT_EQ(bool(offset), size <= max);
+      if (!offset) {
+        ++failed;
+        continue;
+      }
+
+      ASSERT_EQ(*offset % alignment, 0);
+      ASSERT_LE(*offset + size, r.capacity());
+      auto next = live.lower_bound(*offset);
+      if (next != live.end()) {
+        ASSERT_LE(*offset + size, next->first);
+      }
+      if (next != live.begin()) {
+        auto prev = std::prev(next);
+        ASSERT_LE(prev->first + prev->second.first, *offset);
+      }
+      live[*offset] = {size, frame};
+    }
+
+    r.commit(frame);
+  }
+
+  EXPECT_GT(failed, 0); // The ring did fill up sometimes
+}
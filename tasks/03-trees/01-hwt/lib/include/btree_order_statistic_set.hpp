@@ -0,0 +1,48 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "detail/assign_range.hpp"
+#include "detail/btree_order_tree.hpp"
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+
+namespace throttle {
+// Drop-in replacement for order_statistic_set that keeps the keys in a B+ tree
+template <typename T, typename t_comp = std::less<T>,
+          typename t_alloc = std::allocator<T>>
+class btree_order_statistic_set
+    : public detail::btree_order_tree_<T, t_comp, t_alloc> {
+  using base_tree = detail::btree_order_tree_<T, t_comp, t_alloc>;
+
+public:
+  using allocator_type = t_alloc;
+
+  btree_order_statistic_set() : base_tree{} {}
+  explicit btree_order_statistic_set(const t_alloc &p_alloc)
+      : base_tree{p_alloc} {}
+
+  // Builds the set in O(n) when the range is strictly ascending. Otherwise a
+  // copy of the range is sorted first. Duplicates throw just like insert does.
+  template <std::input_iterator t_iter>
+  btree_order_statistic_set(t_iter p_start, t_iter p_finish,
+                            const t_alloc &p_alloc = t_alloc{})
+      : base_tree{p_alloc} {
+    detail::assign_range(*this, p_start, p_finish);
+  }
+
+  btree_order_statistic_set(std::initializer_list<T> p_list,
+                            const t_alloc &p_alloc = t_alloc{})
+      : btree_order_statistic_set(p_list.begin(), p_list.end(), p_alloc) {}
+};
+} // namespace throttle
@@ -0,0 +1,53 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "parallel_sort.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+namespace throttle {
+namespace detail {
+template <typename t_comp, std::forward_iterator t_iter>
+bool is_strictly_ascending(t_iter p_start, t_iter p_finish) {
+  return std::adjacent_find(p_start, p_finish,
+                            [](const auto &p_a, const auto &p_b) {
+                              return !t_comp{}(p_a, p_b);
+                            }) == p_finish;
+}
+
+// Fills a set that supports assign_sorted from an arbitrary range. A strictly
+// ascending range is used as is, anything else is copied and sorted first.
+// Duplicates throw just like insert does.
+template <typename t_set, std::input_iterator t_iter>
+void assign_range(t_set &p_set, t_iter p_start, t_iter p_finish) {
+  using value_type = typename t_set::value_type;
+  using comp = typename t_set::comp;
+
+  if constexpr (std::forward_iterator<t_iter>) {
+    if (is_strictly_ascending<comp>(p_start, p_finish)) {
+      p_set.assign_sorted(p_start, p_finish);
+      return;
+    }
+  }
+
+  std::vector<value_type> sorted(p_start, p_finish);
+  parallel_sort(sorted.begin(), sorted.end(), comp{});
+  if (!is_strictly_ascending<comp>(sorted.begin(), sorted.end()))
+    throw std::out_of_range("Double insert");
+
+  p_set.assign_sorted(sorted.begin(), sorted.end());
+}
+} // namespace detail
+} // namespace throttle
@@ -0,0 +1,936 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "rb_tree_ranged.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// This file implements an order statistic B+ tree. Keys live only in the
+// leaves, inner nodes hold separators and the number of keys under each of
+// their children. Nodes span several cache lines, so a lookup in a tree of
+// 100M keys touches 5-6 nodes instead of ~30 in a red-black tree, and ranks
+// are prefix sums over the child counts of the nodes on the way down.
+
+namespace throttle {
+namespace detail {
+struct btree_node_base_ {
+  using size_type = std::size_t;
+
+  size_type m_count_; // Keys in a leaf or children of an inner node
+  bool m_leaf_;
+};
+
+template <typename t_value_type, std::size_t t_capacity>
+struct alignas(64) btree_leaf_ : public btree_node_base_ {
+  t_value_type m_keys_[t_capacity]{};
+
+  btree_leaf_() : btree_node_base_{0, true} {}
+};
+
+template <typename t_value_type, std::size_t t_fanout>
+struct alignas(64) btree_inner_ : public btree_node_base_ {
+  size_type m_sizes_[t_fanout]{}; // Number of keys under every child
+  btree_node_base_ *m_children_[t_fanout]{};
+  // Keys of child i are less than m_keys_[i], keys of child i + 1 are not
+  t_value_type m_keys_[t_fanout - 1]{};
+
+  btree_inner_() : btree_node_base_{0, false} {}
+};
+
+template <typename t_value_type, typename t_comp,
+          typename t_alloc = std::allocator<t_value_type>>
+class btree_order_tree_ {
+public:
+  using value_type = t_value_type;
+  using comp = t_comp;
+  using size_type = btree_node_base_::size_type;
+
+  // A leaf holds four cache lines of keys, an inner node has 32 children
+  static constexpr size_type c_leaf_capacity =
+      std::max<size_type>(16, 256 / sizeof(t_value_type));
+  static constexpr size_type c_fanout = 32;
+
+private:
+  static constexpr size_type c_leaf_min = c_leaf_capacity / 2;
+  static constexpr size_type c_inner_min = c_fanout / 2;
+
+  // Arithmetic keys are looked up by comparing the key with every slot of a
+  // node and counting the results. The loop has a fixed trip count and no
+  // branches, so the compiler turns it into vector compares. Other keys use
+  // binary search.
+  static constexpr bool c_vector_search =
+      std::is_arithmetic_v<t_value_type> &&
+      (std::is_same_v<t_comp, std::less<t_value_type>> ||
+       std::is_same_v<t_comp, std::less<>>);
+
+  using base_ptr_ = btree_node_base_ *;
+  using const_base_ptr_ = const btree_node_base_ *;
+  using leaf_type_ = btree_leaf_<t_value_type, c_leaf_capacity>;
+  using leaf_ptr_ = leaf_type_ *;
+  using const_leaf_ptr_ = const leaf_type_ *;
+  using inner_type_ = btree_inner_<t_value_type, c_fanout>;
+  using inner_ptr_ = inner_type_ *;
+  using const_inner_ptr_ = const inner_type_ *;
+
+  using self_type_ = btree_order_tree_<t_value_type, t_comp, t_alloc>;
+  using const_self_type_ = const self_type_;
+
+  using leaf_allocator_ = typename std::allocator_traits<
+      t_alloc>::template rebind_alloc<leaf_type_>;
+  using inner_allocator_ = typename std::allocator_traits<
+      t_alloc>::template rebind_alloc<inner_type_>;
+  using leaf_traits_ = std::allocator_traits<leaf_allocator_>;
+  using inner_traits_ = std::allocator_traits<inner_allocator_>;
+
+  base_ptr_ m_root_;
+  size_type m_size_;
+  [[no_unique_address]] leaf_allocator_ m_leaf_alloc_;
+  [[no_unique_address]] inner_allocator_ m_inner_alloc_;
+
+  // A new right sibling of a node that has been split and the smallest key
+  // under it.
+  struct split_ {
+    base_ptr_ m_node = nullptr;
+    t_value_type m_key{};
+  };
+
+  static leaf_ptr_ as_leaf(base_ptr_ p_n) noexcept {
+    return static_cast<leaf_ptr_>(p_n);
+  }
+
+  static const_leaf_ptr_ as_leaf(const_base_ptr_ p_n) noexcept {
+    return static_cast<const_leaf_ptr_>(p_n);
+  }
+
+  static inner_ptr_ as_inner(base_ptr_ p_n) noexcept {
+    return static_cast<inner_ptr_>(p_n);
+  }
+
+  static const_inner_ptr_ as_inner(const_base_ptr_ p_n) noexcept {
+    return static_cast<const_inner_ptr_>(p_n);
+  }
+
+  // Number of the first p_count keys not greater than p_key. In an inner node
+  // it's the index of the child p_key belongs to.
+  template <std::size_t N>
+  static size_type count_not_greater(const t_value_type (&p_keys)[N],
+                                     size_type p_count,
+                                     const t_value_type &p_key) noexcept {
+    if constexpr (c_vector_search) {
+      size_type count = 0;
+      for (size_type i = 0; i < N; ++i) {
+        count += (i < p_count) & !(p_key < p_keys[i]);
+      }
+      return count;
+    } else {
+      return std::upper_bound(p_keys, p_keys + p_count, p_key, t_comp{}) -
+             p_keys;
+    }
+  }
+
+  // Number of the first p_count keys less than p_key
+  template <std::size_t N>
+  static size_type count_less_than(const t_value_type (&p_keys)[N],
+                                   size_type p_count,
+                                   const t_value_type &p_key) noexcept {
+    if constexpr (c_vector_search) {
+      size_type count = 0;
+      for (size_type i = 0; i < N; ++i) {
+        count += (i < p_count) & (p_keys[i] < p_key);
+      }
+      return count;
+    } else {
+      return std::lower_bound(p_keys, p_keys + p_count, p_key, t_comp{}) -
+             p_keys;
+    }
+  }
+
+  static size_type child_index(const_inner_ptr_ p_n,
+                               const t_value_type &p_key) noexcept {
+    return count_not_greater(p_n->m_keys_, p_n->m_count_ - 1, p_key);
+  }
+
+  static size_type subtree_size(const_base_ptr_ p_n) noexcept {
+    if (p_n->m_leaf_)
+      return p_n->m_count_;
+    const_inner_ptr_ inner = as_inner(p_n);
+    return std::accumulate(inner->m_sizes_, inner->m_sizes_ + inner->m_count_,
+                           size_type{0});
+  }
+
+  static bool is_underfull(const_base_ptr_ p_n) noexcept {
+    return p_n->m_count_ < (p_n->m_leaf_ ? c_leaf_min : c_inner_min);
+  }
+
+  static bool can_lend(const_base_ptr_ p_n) noexcept {
+    return p_n->m_count_ > (p_n->m_leaf_ ? c_leaf_min : c_inner_min);
+  }
+
+  // Shifts [p_pos, p_count) of an array one slot to the right and puts p_val
+  // into the hole.
+  template <typename U>
+  static void insert_at(U *p_arr, size_type p_count, size_type p_pos,
+                        U p_val) {
+    std::move_backward(p_arr + p_pos, p_arr + p_count, p_arr + p_count + 1);
+    p_arr[p_pos] = std::move(p_val);
+  }
+
+  template <typename U>
+  static void erase_at(U *p_arr, size_type p_count, size_type p_pos) {
+    std::move(p_arr + p_pos + 1, p_arr + p_count, p_arr + p_pos);
+  }
+
+  leaf_ptr_ create_leaf() {
+    leaf_ptr_ node = leaf_traits_::allocate(m_leaf_alloc_, 1);
+    try {
+      leaf_traits_::construct(m_leaf_alloc_, node);
+    } catch (...) {
+      leaf_traits_::deallocate(m_leaf_alloc_, node, 1);
+      throw;
+    }
+    return node;
+  }
+
+  inner_ptr_ create_inner() {
+    inner_ptr_ node = inner_traits_::allocate(m_inner_alloc_, 1);
+    try {
+      inner_traits_::construct(m_inner_alloc_, node);
+    } catch (...) {
+      inner_traits_::deallocate(m_inner_alloc_, node, 1);
+      throw;
+    }
+    return node;
+  }
+
+  void destroy_node(base_ptr_ p_n) noexcept {
+    if (p_n->m_leaf_) {
+      leaf_traits_::destroy(m_leaf_alloc_, as_leaf(p_n));
+      leaf_traits_::deallocate(m_leaf_alloc_, as_leaf(p_n), 1);
+    } else {
+      inner_traits_::destroy(m_inner_alloc_, as_inner(p_n));
+      inner_traits_::deallocate(m_inner_alloc_, as_inner(p_n), 1);
+    }
+  }
+
+  void destroy_subtree(base_ptr_ p_n) noexcept {
+    if (!p_n)
+      return;
+    if (!p_n->m_leaf_) {
+      inner_ptr_ inner = as_inner(p_n);
+      for (size_type i = 0; i < inner->m_count_; ++i) {
+        destroy_subtree(inner->m_children_[i]);
+      }
+    }
+    destroy_node(p_n);
+  }
+
+  base_ptr_ clone_subtree(const_base_ptr_ p_n) {
+    if (p_n->m_leaf_) {
+      leaf_ptr_ leaf = create_leaf();
+      std::copy_n(as_leaf(p_n)->m_keys_, p_n->m_count_, leaf->m_keys_);
+      leaf->m_count_ = p_n->m_count_;
+      return leaf;
+    }
+
+    const_inner_ptr_ other = as_inner(p_n);
+    inner_ptr_ inner = create_inner();
+    std::copy_n(other->m_keys_, other->m_count_ - 1, inner->m_keys_);
+    std::copy_n(other->m_sizes_, other->m_count_, inner->m_sizes_);
+
+    try {
+      for (size_type i = 0; i < other->m_count_; ++i) {
+        inner->m_children_[i] = clone_subtree(other->m_children_[i]);
+        inner->m_count_ = i + 1;
+      }
+    } catch (...) {
+      destroy_subtree(inner);
+      throw;
+    }
+
+    return inner;
+  }
+
+private: // Insertion
+  split_ insert_into_leaf(leaf_ptr_ p_leaf, const t_value_type &p_key) {
+    size_type pos = count_less_than(p_leaf->m_keys_, p_leaf->m_count_, p_key);
+    if (pos < p_leaf->m_count_ && !t_comp{}(p_key, p_leaf->m_keys_[pos]))
+      throw std::out_of_range("Double insert");
+
+    if (p_leaf->m_count_ < c_leaf_capacity) {
+      insert_at(p_leaf->m_keys_, p_leaf->m_count_++, pos, p_key);
+      return {};
+    }
+
+    // The upper half moves to a new leaf and the key goes into its half
+    leaf_ptr_ right = create_leaf();
+    constexpr size_type half = c_leaf_capacity / 2;
+    std::move(p_leaf->m_keys_ + half, p_leaf->m_keys_ + c_leaf_capacity,
+              right->m_keys_);
+    right->m_count_ = c_leaf_capacity - half;
+    p_leaf->m_count_ = half;
+
+    if (pos <= half) {
+      insert_at(p_leaf->m_keys_, p_leaf->m_count_++, pos, p_key);
+    } else {
+      insert_at(right->m_keys_, right->m_count_++, pos - half, p_key);
+    }
+
+    return {right, right->m_keys_[0]};
+  }
+
+  // Puts a child with p_size keys and its separator at index p_pos > 0
+  static void insert_child(inner_ptr_ p_n, size_type p_pos, base_ptr_ p_child,
+                           const t_value_type &p_key, size_type p_size) {
+    insert_at(p_n->m_children_, p_n->m_count_, p_pos, p_child);
+    insert_at(p_n->m_sizes_, p_n->m_count_, p_pos, p_size);
+    insert_at(p_n->m_keys_, p_n->m_count_ - 1, p_pos - 1, p_key);
+    ++p_n->m_count_;
+  }
+
+  split_ insert_into_inner(inner_ptr_ p_n, const t_value_type &p_key) {
+    size_type idx = child_index(p_n, p_key);
+
+    // A full node splits if its child does. The memory is taken before
+    // anything changes, so that running out of it leaves the tree intact.
+    inner_ptr_ spare = (p_n->m_count_ == c_fanout ? create_inner() : nullptr);
+    split_ child_split;
+    try {
+      child_split = insert_helper(p_n->m_children_[idx], p_key);
+    } catch (...) {
+      if (spare)
+        destroy_node(spare);
+      throw;
+    }
+
+    ++p_n->m_sizes_[idx];
+    if (!child_split.m_node) {
+      if (spare)
+        destroy_node(spare);
+      return {};
+    }
+
+    size_type new_size = subtree_size(child_split.m_node);
+    p_n->m_sizes_[idx] -= new_size;
+
+    if (!spare) {
+      insert_child(p_n, idx + 1, child_split.m_node, child_split.m_key,
+                   new_size);
+      return {};
+    }
+
+    // Children [half, c_fanout) move to the spare node, and the separator
+    // between the halves goes up to the parent.
+    constexpr size_type half = c_fanout / 2;
+    t_value_type up_key = std::move(p_n->m_keys_[half - 1]);
+    std::move(p_n->m_children_ + half, p_n->m_children_ + c_fanout,
+              spare->m_children_);
+    std::move(p_n->m_sizes_ + half, p_n->m_sizes_ + c_fanout,
+              spare->m_sizes_);
+    std::move(p_n->m_keys_ + half, p_n->m_keys_ + c_fanout - 1,
+              spare->m_keys_);
+    spare->m_count_ = c_fanout - half;
+    p_n->m_count_ = half;
+
+    if (idx + 1 <= half) {
+      insert_child(p_n, idx + 1, child_split.m_node, child_split.m_key,
+                   new_size);
+    } else {
+      insert_child(spare, idx + 1 - half, child_split.m_node,
+                   child_split.m_key, new_size);
+    }
+
+    return {spare, std::move(up_key)};
+  }
+
+  split_ insert_helper(base_ptr_ p_n, const t_value_type &p_key) {
+    if (p_n->m_leaf_)
+      return insert_into_leaf(as_leaf(p_n), p_key);
+    return insert_into_inner(as_inner(p_n), p_key);
+  }
+
+private: // Erasure
+  static void borrow_from_left(inner_ptr_ p_parent, size_type p_idx) {
+    base_ptr_ left = p_parent->m_children_[p_idx - 1];
+    base_ptr_ child = p_parent->m_children_[p_idx];
+    size_type moved = 1;
+
+    if (child->m_leaf_) {
+      leaf_ptr_ l = as_leaf(left), c = as_leaf(child);
+      insert_at(c->m_keys_, c->m_count_++, 0, l->m_keys_[--l->m_count_]);
+      p_parent->m_keys_[p_idx - 1] = c->m_keys_[0];
+    } else {
+      inner_ptr_ l = as_inner(left), c = as_inner(child);
+      size_type last = --l->m_count_;
+      moved = l->m_sizes_[last];
+      insert_at(c->m_children_, c->m_count_, 0, l->m_children_[last]);
+      insert_at(c->m_sizes_, c->m_count_, 0, moved);
+      insert_at(c->m_keys_, c->m_count_ - 1, 0,
+                std::move(p_parent->m_keys_[p_idx - 1]));
+      ++c->m_count_;
+      p_parent->m_keys_[p_idx - 1] = std::move(l->m_keys_[last - 1]);
+    }
+
+    p_parent->m_sizes_[p_idx - 1] -= moved;
+    p_parent->m_sizes_[p_idx] += moved;
+  }
+
+  static void borrow_from_right(inner_ptr_ p_parent, size_type p_idx) {
+    base_ptr_ child = p_parent->m_children_[p_idx];
+    base_ptr_ right = p_parent->m_children_[p_idx + 1];
+    size_type moved = 1;
+
+    if (child->m_leaf_) {
+      leaf_ptr_ c = as_leaf(child), r = as_leaf(right);
+      c->m_keys_[c->m_count_++] = std::move(r->m_keys_[0]);
+      erase_at(r->m_keys_, r->m_count_--, 0);
+      p_parent->m_keys_[p_idx] = r->m_keys_[0];
+    } else {
+      inner_ptr_ c = as_inner(child), r = as_inner(right);
+      moved = r->m_sizes_[0];
+      c->m_keys_[c->m_count_ - 1] = std::move(p_parent->m_keys_[p_idx]);
+      c->m_children_[c->m_count_] = r->m_children_[0];
+      c->m_sizes_[c->m_count_] = moved;
+      ++c->m_count_;
+      p_parent->m_keys_[p_idx] = std::move(r->m_keys_[0]);
+      erase_at(r->m_children_, r->m_count_, 0);
+      erase_at(r->m_sizes_, r->m_count_, 0);
+      erase_at(r->m_keys_, r->m_count_ - 1, 0);
+      --r->m_count_;
+    }
+
+    p_parent->m_sizes_[p_idx] += moved;
+    p_parent->m_sizes_[p_idx + 1] -= moved;
+  }
+
+  // Moves everything from child p_idx + 1 to child p_idx and frees it
+  void merge_children(inner_ptr_ p_parent, size_type p_idx) noexcept {
+    base_ptr_ left = p_parent->m_children_[p_idx];
+    base_ptr_ right = p_parent->m_children_[p_idx + 1];
+
+    if (left->m_leaf_) {
+      leaf_ptr_ l = as_leaf(left), r = as_leaf(right);
+      std::move(r->m_keys_, r->m_keys_ + r->m_count_, l->m_keys_ + l->m_count_);
+      l->m_count_ += r->m_count_;
+    } else {
+      inner_ptr_ l = as_inner(left), r = as_inner(right);
+      l->m_keys_[l->m_count_ - 1] = std::move(p_parent->m_keys_[p_idx]);
+      std::move(r->m_keys_, r->m_keys_ + r->m_count_ - 1,
+                l->m_keys_ + l->m_count_);
+      std::copy_n(r->m_children_, r->m_count_, l->m_children_ + l->m_count_);
+      std::copy_n(r->m_sizes_, r->m_count_, l->m_sizes_ + l->m_count_);
+      l->m_count_ += r->m_count_;
+    }
+
+    p_parent->m_sizes_[p_idx] += p_parent->m_sizes_[p_idx + 1];
+    erase_at(p_parent->m_children_, p_parent->m_count_, p_idx + 1);
+    erase_at(p_parent->m_sizes_, p_parent->m_count_, p_idx + 1);
+    erase_at(p_parent->m_keys_, p_parent->m_count_ - 1, p_idx);
+    --p_parent->m_count_;
+
+    destroy_node(right);
+  }
+
+  void fix_underflow(inner_ptr_ p_parent, size_type p_idx) {
+    if (p_idx > 0 && can_lend(p_parent->m_children_[p_idx - 1])) {
+      borrow_from_left(p_parent, p_idx);
+    } else if (p_idx + 1 < p_parent->m_count_ &&
+               can_lend(p_parent->m_children_[p_idx + 1])) {
+      borrow_from_right(p_parent, p_idx);
+    } else if (p_idx > 0) {
+      merge_children(p_parent, p_idx - 1);
+    } else {
+      merge_children(p_parent, p_idx);
+    }
+  }
+
+  // Nothing is changed before the key is found, so a missing key leaves the
+  // tree as it was.
+  void erase_helper(base_ptr_ p_n, const t_value_type &p_key) {
+    if (p_n->m_leaf_) {
+      leaf_ptr_ leaf = as_leaf(p_n);
+      size_type pos = count_less_than(leaf->m_keys_, leaf->m_count_, p_key);
+      if (pos == leaf->m_count_ || t_comp{}(p_key, leaf->m_keys_[pos]))
+        throw std::out_of_range("Can't erase element a non-present element");
+      erase_at(leaf->m_keys_, leaf->m_count_--, pos);
+      return;
+    }
+
+    inner_ptr_ inner = as_inner(p_n);
+    size_type idx = child_index(inner, p_key);
+    erase_helper(inner->m_children_[idx], p_key);
+    --inner->m_sizes_[idx];
+
+    if (is_underfull(inner->m_children_[idx]))
+      fix_underflow(inner, idx);
+  }
+
+private: // Queries
+  // Number of keys under p_n that are less than p_key, or not greater than it
+  // if t_inclusive is set.
+  template <bool t_inclusive>
+  static size_type count_under(const_base_ptr_ p_n,
+                               const t_value_type &p_key) noexcept {
+    size_type count = 0;
+    while (!p_n->m_leaf_) {
+      const_inner_ptr_ inner = as_inner(p_n);
+      size_type idx = child_index(inner, p_key);
+      count = std::accumulate(inner->m_sizes_, inner->m_sizes_ + idx, count);
+      p_n = inner->m_children_[idx];
+    }
+
+    const_leaf_ptr_ leaf = as_leaf(p_n);
+    if constexpr (t_inclusive) {
+      return count + count_not_greater(leaf->m_keys_, leaf->m_count_, p_key);
+    } else {
+      return count + count_less_than(leaf->m_keys_, leaf->m_count_, p_key);
+    }
+  }
+
+  static void batch_rank_helper(const_base_ptr_ p_n,
+                                std::span<const t_value_type> p_keys,
+                                size_type p_offset, size_type *p_ranks) {
+    if (p_keys.empty()) {
+      return;
+    }
+
+    if (p_n->m_leaf_) {
+      const_leaf_ptr_ leaf = as_leaf(p_n);
+      for (const auto &key : p_keys) {
+        *p_ranks++ =
+            p_offset + count_less_than(leaf->m_keys_, leaf->m_count_, key);
+      }
+      return;
+    }
+
+    // Child i gets the keys less than separator i that went to none of the
+    // children before it.
+    const_inner_ptr_ inner = as_inner(p_n);
+    size_type start = 0;
+    for (size_type i = 0; i < inner->m_count_ && start < p_keys.size(); ++i) {
+      size_type finish = p_keys.size();
+      if (i + 1 < inner->m_count_) {
+        const t_value_type &separator = inner->m_keys_[i];
+        finish = std::partition_point(p_keys.begin() + start, p_keys.end(),
+                                      [&](const t_value_type &p_key) {
+                                        return t_comp{}(p_key, separator);
+                                      }) -
+                 p_keys.begin();
+      }
+
+      batch_rank_helper(inner->m_children_[i],
+                        p_keys.subspan(start, finish - start), p_offset,
+                        p_ranks + start);
+      p_offset += inner->m_sizes_[i];
+      start = finish;
+    }
+  }
+
+public:
+  bool empty() const noexcept { return !m_size_; }
+  size_type size() const noexcept { return m_size_; }
+
+  bool contains(const t_value_type &p_key) const noexcept {
+    if (!m_root_)
+      return false;
+
+    const_base_ptr_ curr = m_root_;
+    while (!curr->m_leaf_) {
+      curr = as_inner(curr)->m_children_[child_index(as_inner(curr), p_key)];
+    }
+
+    const_leaf_ptr_ leaf = as_leaf(curr);
+    size_type pos = count_less_than(leaf->m_keys_, leaf->m_count_, p_key);
+    return pos < leaf->m_count_ && !t_comp{}(p_key, leaf->m_keys_[pos]);
+  }
+
+  void insert(const t_value_type &p_key) {
+    if (!m_root_) {
+      leaf_ptr_ leaf = create_leaf();
+      leaf->m_keys_[0] = p_key;
+      leaf->m_count_ = 1;
+      m_root_ = leaf;
+      m_size_ = 1;
+      return;
+    }
+
+    // The tree grows a level when the root splits
+    bool root_full = (m_root_->m_count_ ==
+                      (m_root_->m_leaf_ ? c_leaf_capacity : c_fanout));
+    inner_ptr_ new_root = (root_full ? create_inner() : nullptr);
+
+    split_ split;
+    try {
+      split = insert_helper(m_root_, p_key);
+    } catch (...) {
+      if (new_root)
+        destroy_node(new_root);
+      throw;
+    }
+
+    ++m_size_;
+    if (!split.m_node) {
+      if (new_root)
+        destroy_node(new_root);
+      return;
+    }
+
+    size_type right_size = subtree_size(split.m_node);
+    new_root->m_children_[0] = m_root_;
+    new_root->m_children_[1] = split.m_node;
+    new_root->m_sizes_[0] = m_size_ - right_size;
+    new_root->m_sizes_[1] = right_size;
+    new_root->m_keys_[0] = std::move(split.m_key);
+    new_root->m_count_ = 2;
+    m_root_ = new_root;
+  }
+
+  template <typename t_iter>
+  void insert_range(t_iter p_start, t_iter p_finish) {
+    for (t_iter its = p_start, ite = p_finish; its != ite; ++its) {
+      insert(*its);
+    }
+  }
+
+  void erase(const t_value_type &p_key) {
+    if (!m_root_)
+      throw std::out_of_range("Can't erase element a non-present element");
+
+    erase_helper(m_root_, p_key);
+    --m_size_;
+
+    // The tree loses a level when the root is left with a single child
+    if (m_root_->m_leaf_ && !m_root_->m_count_) {
+      destroy_node(m_root_);
+      m_root_ = nullptr;
+    } else if (!m_root_->m_leaf_ && m_root_->m_count_ == 1) {
+      base_ptr_ child = as_inner(m_root_)->m_children_[0];
+      destroy_node(m_root_);
+      m_root_ = child;
+    }
+  }
+
+  void clear() noexcept {
+    if constexpr (releasable_allocator_<leaf_allocator_> &&
+                  releasable_allocator_<inner_allocator_> &&
+                  std::is_trivially_destructible_v<t_value_type>) {
+      // Releasing only one of the arenas would leave the walk below with
+      // freed nodes, so both have to be releasable
+      if (m_leaf_alloc_.can_release() && m_inner_alloc_.can_release()) {
+        m_leaf_alloc_.release();
+        m_inner_alloc_.release();
+        m_root_ = nullptr;
+        m_size_ = 0;
+        return;
+      }
+    }
+
+    destroy_subtree(m_root_);
+    m_root_ = nullptr;
+    m_size_ = 0;
+  }
+
+  // Replaces the contents with the elements of [p_start, p_finish). Leaves of
+  // a strictly ascending range are filled evenly level by level, which takes
+  // O(n). Anything else is sorted first and duplicates throw, just like in the
+  // range constructor. Provides strong exception guarantee.
+  template <std::forward_iterator t_iter>
+  void assign_sorted(t_iter p_start, t_iter p_finish) {
+    // The check is O(n) like the build, so it's done in release builds too
+    if (!is_strictly_ascending<t_comp>(p_start, p_finish)) {
+      assign_range(*this, p_start, p_finish);
+      return;
+    }
+
+    size_type count = std::distance(p_start, p_finish);
+    std::vector<base_ptr_> level, next;
+    std::vector<t_value_type> level_min, next_min;
+    std::vector<size_type> level_sizes, next_sizes;
+    size_type consumed = 0; // Nodes of the level already under a parent
+
+    try {
+      size_type leaves = (count + c_leaf_capacity - 1) / c_leaf_capacity;
+      level.reserve(leaves);
+      level_min.reserve(leaves);
+      level_sizes.reserve(leaves);
+      for (size_type i = 0; i < leaves; ++i) {
+        size_type keys = count / leaves + (i < count % leaves);
+        leaf_ptr_ leaf = create_leaf();
+        level.push_back(leaf);
+        for (size_type j = 0; j < keys; ++j, ++p_start) {
+          leaf->m_keys_[j] = *p_start;
+        }
+        leaf->m_count_ = keys;
+        level_min.push_back(leaf->m_keys_[0]);
+        level_sizes.push_back(keys);
+      }
+
+      while (level.size() > 1) {
+        size_type nodes = (level.size() + c_fanout - 1) / c_fanout;
+        next.clear();
+        next_min.clear();
+        next_sizes.clear();
+        consumed = 0;
+
+        for (size_type i = 0; i < nodes; ++i) {
+          size_type children =
+              level.size() / nodes + (i < level.size() % nodes);
+          inner_ptr_ inner = create_inner();
+          next.push_back(inner);
+          next_min.push_back(level_min[consumed]);
+          next_sizes.push_back(0);
+
+          for (size_type j = 0; j < children; ++j, ++consumed) {
+            inner->m_children_[j] = level[consumed];
+            inner->m_sizes_[j] = level_sizes[consumed];
+            if (j)
+              inner->m_keys_[j - 1] = level_min[consumed];
+            inner->m_count_ = j + 1;
+            next_sizes.back() += level_sizes[consumed];
+          }
+        }
+
+        level.swap(next);
+        level_min.swap(next_min);
+        level_sizes.swap(next_sizes);
+        next.clear();
+        consumed = 0;
+      }
+    } catch (...) {
+      for (base_ptr_ node : next) {
+        destroy_subtree(node);
+      }
+      for (size_type i = consumed; i < level.size(); ++i) {
+        destroy_subtree(level[i]);
+      }
+      throw;
+    }
+
+    base_ptr_ root = (level.empty() ? nullptr : level.front());
+    destroy_subtree(std::exchange(m_root_, root));
+    m_size_ = count;
+  }
+
+  const t_value_type &closest_left(const t_value_type &p_key) const {
+    // The subtree to the left of the path holds the answer if the leaf at the
+    // end of the path doesn't.
+    const_base_ptr_ curr = m_root_, fallback = nullptr;
+    while (curr && !curr->m_leaf_) {
+      const_inner_ptr_ inner = as_inner(curr);
+      size_type idx = child_index(inner, p_key);
+      if (idx)
+        fallback = inner->m_children_[idx - 1];
+      curr = inner->m_children_[idx];
+    }
+
+    if (curr) {
+      const_leaf_ptr_ leaf = as_leaf(curr);
+      size_type pos = count_not_greater(leaf->m_keys_, leaf->m_count_, p_key);
+      if (pos)
+        return leaf->m_keys_[pos - 1];
+    }
+
+    if (!fallback)
+      throw std::out_of_range("Leftmost element has no predecessor");
+    return max_under(fallback);
+  }
+
+  const t_value_type &closest_right(const t_value_type &p_key) const {
+    const_base_ptr_ curr = m_root_, fallback = nullptr;
+    while (curr && !curr->m_leaf_) {
+      const_inner_ptr_ inner = as_inner(curr);
+      size_type idx = child_index(inner, p_key);
+      if (idx + 1 < inner->m_count_)
+        fallback = inner->m_children_[idx + 1];
+      curr = inner->m_children_[idx];
+    }
+
+    if (curr) {
+      const_leaf_ptr_ leaf = as_leaf(curr);
+      size_type pos = count_not_greater(leaf->m_keys_, leaf->m_count_, p_key);
+      if (pos < leaf->m_count_)
+        return leaf->m_keys_[pos];
+    }
+
+    if (!fallback)
+      throw std::out_of_range("Rightmost element has no successor");
+    return min_under(fallback);
+  }
+
+  const t_value_type &select_rank(size_type p_rank) const {
+    if (p_rank > size() || !(p_rank > 0))
+      throw std::out_of_range("Rank is greater than size or is zero");
+
+    const_base_ptr_ curr = m_root_;
+    while (!curr->m_leaf_) {
+      const_inner_ptr_ inner = as_inner(curr);
+      size_type idx = 0;
+      while (p_rank > inner->m_sizes_[idx]) {
+        p_rank -= inner->m_sizes_[idx++];
+      }
+      curr = inner->m_children_[idx];
+    }
+
+    return as_leaf(curr)->m_keys_[p_rank - 1];
+  }
+
+  size_type get_rank_of(const t_value_type &p_elem) const {
+    if (!contains(p_elem))
+      throw std::out_of_range("Element not present");
+    return count_less(p_elem) + 1;
+  }
+
+  size_type count_less(const t_value_type &p_key) const noexcept {
+    return (m_root_ ? count_under<false>(m_root_, p_key) : 0);
+  }
+
+  // Number of elements in [p_low, p_high]. Both bounds follow the same path
+  // down to the first node where they go to different children.
+  size_type count_in_range(const t_value_type &p_low,
+                           const t_value_type &p_high) const noexcept {
+    if (!m_root_ || t_comp{}(p_high, p_low))
+      return 0;
+
+    const_base_ptr_ curr = m_root_;
+    while (!curr->m_leaf_) {
+      const_inner_ptr_ inner = as_inner(curr);
+      size_type low = child_index(inner, p_low);
+      size_type high = child_index(inner, p_high);
+
+      if (low != high) {
+        size_type count = std::accumulate(
+            inner->m_sizes_ + low, inner->m_sizes_ + high, size_type{0});
+        return count + count_under<true>(inner->m_children_[high], p_high) -
+               count_under<false>(inner->m_children_[low], p_low);
+      }
+
+      curr = inner->m_children_[low];
+    }
+
+    const_leaf_ptr_ leaf = as_leaf(curr);
+    return count_not_greater(leaf->m_keys_, leaf->m_count_, p_high) -
+           count_less_than(leaf->m_keys_, leaf->m_count_, p_low);
+  }
+
+  // count_less for every key of an ascending sequence in one descent
+  std::vector<size_type>
+  batch_rank(std::span<const t_value_type> p_keys) const {
+    // Unsorted keys would get wrong ranks silently, and the check is cheaper
+    // than the descent
+    if (!std::is_sorted(p_keys.begin(), p_keys.end(), t_comp{}))
+      throw std::invalid_argument("Batch keys are not sorted");
+
+    std::vector<size_type> ranks(p_keys.size());
+    if (m_root_)
+      batch_rank_helper(m_root_, p_keys, 0, ranks.data());
+    return ranks;
+  }
+
+  const t_value_type &min() const {
+    if (!m_root_)
+      throw std::out_of_range("Container is empty");
+    return min_under(m_root_);
+  }
+
+  const t_value_type &max() const {
+    if (!m_root_)
+      throw std::out_of_range("Container is empty");
+    return max_under(m_root_);
+  }
+
+private:
+  static const t_value_type &min_under(const_base_ptr_ p_n) noexcept {
+    while (!p_n->m_leaf_) {
+      p_n = as_inner(p_n)->m_children_[0];
+    }
+    return as_leaf(p_n)->m_keys_[0];
+  }
+
+  static const t_value_type &max_under(const_base_ptr_ p_n) noexcept {
+    while (!p_n->m_leaf_) {
+      p_n = as_inner(p_n)->m_children_[p_n->m_count_ - 1];
+    }
+    return as_leaf(p_n)->m_keys_[p_n->m_count_ - 1];
+  }
+
+public:
+  btree_order_tree_()
+      : m_root_{}, m_size_{}, m_leaf_alloc_{}, m_inner_alloc_{} {}
+  explicit btree_order_tree_(const t_alloc &p_alloc)
+      : m_root_{}, m_size_{}, m_leaf_alloc_{p_alloc}, m_inner_alloc_{p_alloc} {}
+  ~btree_order_tree_() { clear(); }
+
+  btree_order_tree_(const_self_type_ &p_rhs)
+      : m_root_{}, m_size_{},
+        m_leaf_alloc_{leaf_traits_::select_on_container_copy_construction(
+            p_rhs.m_leaf_alloc_)},
+        m_inner_alloc_{inner_traits_::select_on_container_copy_construction(
+            p_rhs.m_inner_alloc_)} {
+    if (p_rhs.m_root_)
+      m_root_ = clone_subtree(p_rhs.m_root_);
+    m_size_ = p_rhs.m_size_;
+  }
+
+  self_type_ &operator=(const_self_type_ &p_rhs) {
+    if (this != &p_rhs) {
+      self_type_ temp{p_rhs};
+      *this = std::move(temp);
+    }
+    return *this;
+  }
+
+  btree_order_tree_(self_type_ &&p_rhs) noexcept
+      : m_root_{std::exchange(p_rhs.m_root_, nullptr)},
+        m_size_{std::exchange(p_rhs.m_size_, 0)},
+        m_leaf_alloc_{std::move(p_rhs.m_leaf_alloc_)},
+        m_inner_alloc_{std::move(p_rhs.m_inner_alloc_)} {}
+
+  self_type_ &operator=(self_type_ &&p_rhs) noexcept(
+      leaf_traits_::propagate_on_container_move_assignment::value &&
+      inner_traits_::propagate_on_container_move_assignment::value) {
+    if (this == &p_rhs) {
+      return *this;
+    }
+
+    // Nodes can only change hands together with the allocators that own them
+    if constexpr (leaf_traits_::propagate_on_container_move_assignment::
+                      value &&
+                  inner_traits_::propagate_on_container_move_assignment::
+                      value) {
+      std::swap(m_leaf_alloc_, p_rhs.m_leaf_alloc_);
+      std::swap(m_inner_alloc_, p_rhs.m_inner_alloc_);
+    } else if (m_leaf_alloc_ != p_rhs.m_leaf_alloc_ ||
+               m_inner_alloc_ != p_rhs.m_inner_alloc_) {
+      clear();
+      if (p_rhs.m_root_)
+        m_root_ = clone_subtree(p_rhs.m_root_);
+      m_size_ = p_rhs.m_size_;
+      return *this;
+    }
+
+    std::swap(m_root_, p_rhs.m_root_);
+    std::swap(m_size_, p_rhs.m_size_);
+    return *this;
+  }
+};
+
+} // namespace detail
+} // namespace throttle
@@ -0,0 +1,45 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <future>
+#include <iterator>
+#include <thread>
+
+namespace throttle {
+namespace detail {
+// Ranges shorter than this are sorted by a single thread
+inline constexpr std::size_t c_parallel_sort_threshold = 1 << 16;
+
+// Merge sort that sorts the halves on separate threads down to
+// c_parallel_sort_threshold elements and std::sort below that.
+template <std::random_access_iterator t_iter, typename t_comp>
+void parallel_sort(t_iter p_start, t_iter p_finish, t_comp p_comp,
+                   unsigned p_threads = std::thread::hardware_concurrency()) {
+  auto count = static_cast<std::size_t>(p_finish - p_start);
+  if (p_threads < 2 || count < c_parallel_sort_threshold) {
+    std::sort(p_start, p_finish, p_comp);
+    return;
+  }
+
+  t_iter middle = p_start + (p_finish - p_start) / 2;
+  auto left_future = std::async(std::launch::async, [=]() {
+    parallel_sort(p_start, middle, p_comp, p_threads / 2);
+  });
+  parallel_sort(middle, p_finish, p_comp, p_threads - p_threads / 2);
+  left_future.get();
+
+  std::inplace_merge(p_start, middle, p_finish, p_comp);
+}
+} // namespace detail
+} // namespace throttle
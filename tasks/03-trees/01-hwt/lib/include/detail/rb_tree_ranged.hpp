@@ -10,13 +10,26 @@
 
 #pragma once
 
+#include "assign_range.hpp"
+
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <concepts>
 #include <cstddef>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
 #include <optional>
+#include <span>
 #include <stdexcept>
+#include <thread>
 #include <tuple>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace throttle {
 namespace detail {
@@ -129,7 +142,21 @@ protected:
   rb_tree_ranged_impl_() : m_root_{} {}
 };
 
-template <typename t_value_type, typename t_comp>
+// Allocators that can free all of their memory in one go, such as
+// throttle::pool_allocator. can_release() tells beforehand whether release()
+// would succeed, so containers with several allocators can release all of
+// them or none.
+template <typename t_alloc>
+concept releasable_allocator_ = requires(t_alloc &p_alloc) {
+  { p_alloc.release() } -> std::convertible_to<bool>;
+  { std::as_const(p_alloc).can_release() } -> std::convertible_to<bool>;
+};
+
+// Subtrees smaller than this are built by a single thread
+inline constexpr std::size_t c_parallel_build_threshold = 1 << 15;
+
+template <typename t_value_type, typename t_comp,
+          typename t_alloc = std::allocator<t_value_type>>
 class rb_tree_ranged_ : public rb_tree_ranged_impl_ {
 private:
   static_assert(std::is_swappable_v<t_value_type>,
@@ -139,9 +166,15 @@ private:
   using node_ptr_ = typename node_type_::node_ptr_;
   using const_node_ptr_ = typename node_type_::const_node_ptr_;
 
-  using self_type_ = rb_tree_ranged_<t_value_type, t_comp>;
+  using self_type_ = rb_tree_ranged_<t_value_type, t_comp, t_alloc>;
   using const_self_type_ = const self_type_;
 
+  using node_allocator_ = typename std::allocator_traits<
+      t_alloc>::template rebind_alloc<node_type_>;
+  using alloc_traits_ = std::allocator_traits<node_allocator_>;
+
+  [[no_unique_address]] node_allocator_ m_alloc_;
+
 public:
   bool empty() const noexcept { return !m_root_; }
   size_type size() const noexcept { return (m_root_ ? m_root_->m_size_ : 0); }
@@ -150,6 +183,23 @@ public:
   }
 
 private:
+  node_ptr_ create_node(const t_value_type &p_key) {
+    node_ptr_ node = alloc_traits_::allocate(m_alloc_, 1);
+    try {
+      alloc_traits_::construct(m_alloc_, node, p_key);
+    } catch (...) {
+      alloc_traits_::deallocate(m_alloc_, node, 1);
+      throw;
+    }
+    return node;
+  }
+
+  void destroy_node(base_ptr_ p_n) noexcept {
+    node_ptr_ node = static_cast<node_ptr_>(p_n);
+    alloc_traits_::destroy(m_alloc_, node);
+    alloc_traits_::deallocate(m_alloc_, node, 1);
+  }
+
   void prune_leaf(node_ptr_ p_n) {
     if (!p_n->m_parent_) {
       m_root_ = nullptr;
@@ -159,7 +209,7 @@ private:
       p_n->m_parent_->m_right_ = nullptr;
     }
 
-    delete p_n;
+    destroy_node(p_n);
   }
 
   template <typename F>
@@ -299,23 +349,24 @@ private:
   }
 
   node_ptr_ bst_insert(const t_value_type &p_key) {
-    node_ptr_ to_insert = new node_type_{p_key};
-
     if (empty()) {
+      node_ptr_ to_insert = create_node(p_key);
       to_insert->m_color_ = k_black_;
       m_root_ = to_insert;
       return to_insert;
     }
 
-    auto [found, prev, is_prev_less] =
-        traverse_binary_search(static_cast<node_ptr_>(m_root_), p_key,
-                               [](node_type_ &p_node) { p_node.m_size_++; });
+    // Look for a duplicate before allocating anything, and only touch the
+    // sizes once the node exists, so that a failed insert leaves no trace.
+    auto [found, prev, is_prev_less] = traverse_binary_search(
+        static_cast<node_ptr_>(m_root_), p_key, [](node_type_ &) {});
 
-    if (found) {
-      traverse_binary_search(static_cast<node_ptr_>(m_root_), p_key,
-                             [](node_type_ &p_node) { p_node.m_size_--; });
-      delete to_insert;
+    if (found)
       throw std::out_of_range("Double insert");
+
+    node_ptr_ to_insert = create_node(p_key);
+    for (base_ptr_ curr = prev; curr; curr = curr->m_parent_) {
+      curr->m_size_++;
     }
 
     to_insert->m_parent_ = prev;
@@ -343,13 +394,6 @@ private:
     return node;
   }
 
-  template <typename t_iter>
-  void insert_range(t_iter p_start, t_iter p_finish) {
-    for (t_iter its = p_start, ite = p_finish; its != ite; ++its) {
-      insert(*its);
-    }
-  }
-
 public:
   using value_type = t_value_type;
   using comp = t_comp;
@@ -360,6 +404,13 @@ public:
     rebalance_after_insert_(leaf);
   }
 
+  template <typename t_iter>
+  void insert_range(t_iter p_start, t_iter p_finish) {
+    for (t_iter its = p_start, ite = p_finish; its != ite; ++its) {
+      insert(*its);
+    }
+  }
+
   void erase(const t_value_type &p_key) {
     auto [node, prev, pred] =
         traverse_binary_search(static_cast<node_ptr_>(m_root_), p_key,
@@ -378,10 +429,55 @@ public:
   }
 
   void clear() noexcept {
-    // A more optimized version of iterative approach for postorder traversal.
-    // In this case node pointers can be used to indicate which nodes have
-    // already been visited.
-    base_ptr_ curr = m_root_;
+    // Nodes that need no destructor don't have to be visited at all if the
+    // allocator can drop them together.
+    if constexpr (releasable_allocator_<node_allocator_> &&
+                  std::is_trivially_destructible_v<node_type_>) {
+      if (m_alloc_.release()) {
+        m_root_ = nullptr;
+        return;
+      }
+    }
+
+    destroy_subtree(m_root_);
+    m_root_ = nullptr;
+  }
+
+  // Replaces the contents with the elements of [p_start, p_finish). A
+  // strictly ascending range is built into a tree directly in O(n) instead of
+  // being inserted one element at a time. Anything else is sorted first and
+  // duplicates throw, just like in the range constructor. Provides strong
+  // exception guarantee.
+  template <std::forward_iterator t_iter>
+  void assign_sorted(t_iter p_start, t_iter p_finish) {
+    // The check is O(n) like the build, so it's done in release builds too
+    if (!is_strictly_ascending<t_comp>(p_start, p_finish)) {
+      assign_range(*this, p_start, p_finish);
+      return;
+    }
+
+    size_type count = std::distance(p_start, p_finish);
+    // Allocators with state, such as pool_allocator, can't be used by
+    // several threads at once.
+    unsigned threads = 1;
+    if constexpr (alloc_traits_::is_always_equal::value &&
+                  std::random_access_iterator<t_iter>) {
+      threads = std::thread::hardware_concurrency();
+    }
+
+    base_ptr_ root =
+        build_balanced(p_start, count, 0, red_depth(count), threads);
+    // The arena can't be released, the new nodes live in it as well
+    std::swap(m_root_, root);
+    destroy_subtree(root);
+  }
+
+private:
+  // A more optimized version of iterative approach for postorder traversal.
+  // In this case node pointers can be used to indicate which nodes have
+  // already been visited. The subtree must be detached from its parent.
+  void destroy_subtree(base_ptr_ p_root) noexcept {
+    base_ptr_ curr = p_root;
     while (curr) {
       if (curr->m_left_)
         curr = curr->m_left_;
@@ -396,13 +492,96 @@ public:
           else
             parent->m_right_ = nullptr;
         }
-        delete curr;
+        destroy_node(curr);
         curr = parent;
       }
     }
-    m_root_ = nullptr;
   }
 
+  // A tree where the sizes of the subtrees of every node differ by at most one
+  // has all its leaves on the last two levels. Painting the nodes on the last
+  // level red and the rest black satisfies red-black invariants.
+  static size_type red_depth(size_type p_count) noexcept {
+    return (p_count > 1 ? std::bit_width(p_count) - 1
+                        : std::numeric_limits<size_type>::max());
+  }
+
+  // Builds a subtree from the next p_count elements in order and advances
+  // p_it past them. The left subtree is handed to another thread while
+  // there are threads left to spare.
+  template <typename t_iter>
+  base_ptr_ build_balanced(t_iter &p_it, size_type p_count, size_type p_depth,
+                           size_type p_red_depth, unsigned p_threads) {
+    if (!p_count) {
+      return nullptr;
+    }
+
+    size_type left_count = p_count / 2, right_count = p_count - left_count - 1;
+    base_ptr_ left = nullptr, right = nullptr;
+    node_ptr_ node = nullptr;
+
+    try {
+      if constexpr (std::random_access_iterator<t_iter>) {
+        if (p_threads > 1 && p_count >= c_parallel_build_threshold) {
+          auto left_future =
+              std::async(std::launch::async, [&, it = p_it]() mutable {
+                return build_balanced(it, left_count, p_depth + 1,
+                                      p_red_depth, p_threads / 2);
+              });
+
+          try {
+            p_it += left_count;
+            node = create_node(*p_it++);
+            right = build_balanced(p_it, right_count, p_depth + 1,
+                                   p_red_depth, p_threads - p_threads / 2);
+          } catch (...) {
+            try {
+              destroy_subtree(left_future.get());
+            } catch (...) {
+            }
+            throw;
+          }
+
+          left = left_future.get();
+          return link_built(node, left, right, p_count, p_depth, p_red_depth);
+        }
+      }
+
+      left = build_balanced(p_it, left_count, p_depth + 1, p_red_depth, 1);
+      node = create_node(*p_it++);
+      right = build_balanced(p_it, right_count, p_depth + 1, p_red_depth, 1);
+    } catch (...) {
+      destroy_subtree(left);
+      destroy_subtree(right);
+      if (node) {
+        destroy_node(node);
+      }
+      throw;
+    }
+
+    return link_built(node, left, right, p_count, p_depth, p_red_depth);
+  }
+
+  static base_ptr_ link_built(base_ptr_ p_node, base_ptr_ p_left,
+                              base_ptr_ p_right, size_type p_count,
+                              size_type p_depth,
+                              size_type p_red_depth) noexcept {
+    p_node->m_left_ = p_left;
+    p_node->m_right_ = p_right;
+    if (p_left) {
+      p_left->m_parent_ = p_node;
+    }
+    if (p_right) {
+      p_right->m_parent_ = p_node;
+    }
+
+    p_node->m_size_ = p_count;
+    p_node->m_color_ = (p_depth == p_red_depth ? k_red_ : k_black_);
+    return p_node;
+  }
+
+public:
+
   const t_value_type &closest_left(const t_value_type &p_key) const {
     base_ptr_ curr = m_root_, bound = nullptr;
 
@@ -476,6 +655,109 @@ public:
     return rank;
   }
 
+  // Number of elements less than p_key. Unlike get_rank_of the key doesn't
+  // have to be present, and it takes a single descent.
+  size_type count_less(const t_value_type &p_key) const noexcept {
+    const_base_ptr_ curr = m_root_;
+    size_type count = 0;
+
+    while (curr) {
+      if (t_comp{}(static_cast<const_node_ptr_>(curr)->m_value_, p_key)) {
+        count += link_type_::size(curr->m_left_) + 1;
+        curr = curr->m_right_;
+      } else {
+        curr = curr->m_left_;
+      }
+    }
+
+    return count;
+  }
+
+  // Number of elements in [p_low, p_high]. Both bounds follow the same path
+  // down to the first node between them, and only there the descent forks.
+  size_type count_in_range(const t_value_type &p_low,
+                           const t_value_type &p_high) const noexcept {
+    const_base_ptr_ split = m_root_;
+    while (split) {
+      const t_value_type &value = static_cast<const_node_ptr_>(split)->m_value_;
+      if (t_comp{}(value, p_low)) {
+        split = split->m_right_;
+      } else if (t_comp{}(p_high, value)) {
+        split = split->m_left_;
+      } else {
+        break;
+      }
+    }
+
+    if (!split)
+      return 0;
+
+    size_type count = 1;
+    // Elements not less than p_low in the left subtree
+    for (const_base_ptr_ curr = split->m_left_; curr;) {
+      if (t_comp{}(static_cast<const_node_ptr_>(curr)->m_value_, p_low)) {
+        curr = curr->m_right_;
+      } else {
+        count += link_type_::size(curr->m_right_) + 1;
+        curr = curr->m_left_;
+      }
+    }
+
+    // Elements not greater than p_high in the right subtree
+    for (const_base_ptr_ curr = split->m_right_; curr;) {
+      if (t_comp{}(p_high, static_cast<const_node_ptr_>(curr)->m_value_)) {
+        curr = curr->m_left_;
+      } else {
+        count += link_type_::size(curr->m_left_) + 1;
+        curr = curr->m_right_;
+      }
+    }
+
+    return count;
+  }
+
+  // count_less for every key of an ascending sequence. All the keys descend
+  // together and split up at nodes that fall between them, so the upper
+  // levels of the tree are visited once for the whole batch.
+  std::vector<size_type>
+  batch_rank(std::span<const t_value_type> p_keys) const {
+    // Unsorted keys would get wrong ranks silently, and the check is cheaper
+    // than the descent
+    if (!std::is_sorted(p_keys.begin(), p_keys.end(), t_comp{}))
+      throw std::invalid_argument("Batch keys are not sorted");
+
+    std::vector<size_type> ranks(p_keys.size());
+    batch_rank_helper(m_root_, p_keys, 0, ranks.data());
+    return ranks;
+  }
+
+private:
+  static void batch_rank_helper(const_base_ptr_ p_node,
+                                std::span<const t_value_type> p_keys,
+                                size_type p_offset, size_type *p_ranks) {
+    if (p_keys.empty()) {
+      return;
+    }
+
+    if (!p_node) {
+      std::fill_n(p_ranks, p_keys.size(), p_offset);
+      return;
+    }
+
+    const t_value_type &value = static_cast<const_node_ptr_>(p_node)->m_value_;
+    auto split = std::partition_point(
+        p_keys.begin(), p_keys.end(),
+        [&](const t_value_type &p_key) { return !t_comp{}(value, p_key); });
+    size_type left_count = split - p_keys.begin();
+
+    batch_rank_helper(p_node->m_left_, p_keys.first(left_count), p_offset,
+                      p_ranks);
+    batch_rank_helper(p_node->m_right_, p_keys.subspan(left_count),
+                      p_offset + link_type_::size(p_node->m_left_) + 1,
+                      p_ranks + left_count);
+  }
+
+public:
   const t_value_type &min() const {
     if (!m_root_)
       throw std::out_of_range("Container is empty");
@@ -488,16 +770,23 @@ public:
     return static_cast<node_ptr_>(m_root_->maximum_())->m_value_;
   }
 
-  rb_tree_ranged_() : rb_tree_ranged_impl_{} {}
+  rb_tree_ranged_() : rb_tree_ranged_impl_{}, m_alloc_{} {}
+  explicit rb_tree_ranged_(const t_alloc &p_alloc)
+      : rb_tree_ranged_impl_{}, m_alloc_{p_alloc} {}
   ~rb_tree_ranged_() { clear(); }
 
-  rb_tree_ranged_(const_self_type_ &p_rhs) {
-    self_type_ temp{};
-    traverse_postorder(
-        static_cast<const_node_ptr_>(p_rhs.m_root_), [&](const_base_ptr_ p_n) {
-          temp.insert(static_cast<const_node_ptr_>(p_n)->m_value_);
-        });
-    *this = std::move(temp);
+  rb_tree_ranged_(const_self_type_ &p_rhs)
+      : m_alloc_{alloc_traits_::select_on_container_copy_construction(
+            p_rhs.m_alloc_)} {
+    try {
+      traverse_postorder(static_cast<const_node_ptr_>(p_rhs.m_root_),
+                         [&](const_base_ptr_ p_n) {
+                           insert(static_cast<const_node_ptr_>(p_n)->m_value_);
+                         });
+    } catch (...) {
+      clear();
+      throw;
+    }
   }
 
   self_type_ &operator=(const_self_type_ &p_rhs) {
@@ -508,15 +797,33 @@ public:
     return *this;
   }
 
-  rb_tree_ranged_(self_type_ &&p_rhs) noexcept {
+  rb_tree_ranged_(self_type_ &&p_rhs) noexcept
+      : m_alloc_{std::move(p_rhs.m_alloc_)} {
     m_root_ = p_rhs.m_root_;
     p_rhs.m_root_ = nullptr;
   }
 
-  self_type_ &operator=(self_type_ &&p_rhs) noexcept {
-    if (this != &p_rhs) {
-      std::swap(m_root_, p_rhs.m_root_);
+  self_type_ &operator=(self_type_ &&p_rhs) noexcept(
+      alloc_traits_::propagate_on_container_move_assignment::value ||
+      alloc_traits_::is_always_equal::value) {
+    if (this == &p_rhs) {
+      return *this;
     }
+
+    // Nodes can only change hands together with the allocator that owns them
+    if constexpr (alloc_traits_::propagate_on_container_move_assignment::
+                      value) {
+      std::swap(m_alloc_, p_rhs.m_alloc_);
+    } else if (m_alloc_ != p_rhs.m_alloc_) {
+      clear();
+      traverse_postorder(static_cast<const_base_ptr_>(p_rhs.m_root_),
+                         [&](const_base_ptr_ p_n) {
+                           insert(static_cast<const_node_ptr_>(p_n)->m_value_);
+                         });
+      return *this;
+    }
+
+    std::swap(m_root_, p_rhs.m_root_);
     return *this;
   }
 };
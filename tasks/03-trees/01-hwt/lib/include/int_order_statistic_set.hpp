@@ -0,0 +1,302 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace throttle {
+// Order statistic set for 32-bit integer keys. Instead of comparing keys it
+// walks a trie over their bits. The lower 9 bits select a bit in a leaf of
+// 512 bits, and every 4 bits above them select one of 16 children of an inner
+// node, which keeps the number of keys under each of its children. Both kinds
+// of nodes are a single cache line of bits or counts, so every operation
+// touches the same number of cache lines regardless of the size of the set:
+// two per inner level and one for the leaf. Nodes are allocated when a key
+// first needs them and are kept until the set is cleared.
+template <std::integral T = int> class int_order_statistic_set {
+  static_assert(sizeof(T) == 4, "Keys have to be 32-bit integers");
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+
+private:
+  using key_type_ = std::uint32_t;
+  using index_type_ = std::uint32_t;
+  using word_type_ = std::uint64_t;
+
+  static constexpr unsigned c_leaf_bits = 9;
+  static constexpr unsigned c_inner_bits = 4;
+  static constexpr unsigned c_fanout = 1u << c_inner_bits;
+  static constexpr unsigned c_depth =
+      (32 - c_leaf_bits + c_inner_bits - 1) / c_inner_bits; // Inner levels
+  static constexpr unsigned c_word_bits = 64;
+  static constexpr unsigned c_leaf_words = (1u << c_leaf_bits) / c_word_bits;
+
+  // Children of the last inner level are leaves, the rest are inner nodes.
+  // Index 0 means there's no child: it's the root for inner nodes, and the
+  // first leaf is never used.
+  struct alignas(64) inner_ {
+    std::uint32_t m_counts[c_fanout];
+    index_type_ m_children[c_fanout];
+  };
+
+  struct alignas(64) leaf_ {
+    word_type_ m_words[c_leaf_words];
+  };
+
+  std::vector<inner_> m_inner;
+  std::vector<leaf_> m_leaves;
+  size_type m_size;
+
+  // Signed keys are biased so that their order matches unsigned order
+  static key_type_ to_key(T p_val) noexcept {
+    if constexpr (std::is_signed_v<T>) {
+      return static_cast<key_type_>(p_val) ^ (key_type_{1} << 31);
+    } else {
+      return p_val;
+    }
+  }
+
+  static T from_key(key_type_ p_key) noexcept {
+    if constexpr (std::is_signed_v<T>) {
+      return static_cast<T>(p_key ^ (key_type_{1} << 31));
+    } else {
+      return p_key;
+    }
+  }
+
+  static constexpr unsigned shift(unsigned p_level) noexcept {
+    return c_leaf_bits + c_inner_bits * (c_depth - 1 - p_level);
+  }
+
+  static unsigned digit(key_type_ p_key, unsigned p_level) noexcept {
+    return (p_key >> shift(p_level)) & (c_fanout - 1);
+  }
+
+  static unsigned leaf_offset(key_type_ p_key) noexcept {
+    return p_key & ((1u << c_leaf_bits) - 1);
+  }
+
+  static word_type_ bit_of(unsigned p_offset) noexcept {
+    return word_type_{1} << (p_offset % c_word_bits);
+  }
+
+  // Sum of the first p_count counts of a node. The loop has a fixed trip
+  // count, so it compiles to vector adds over the whole cache line.
+  static size_type sum_before(const inner_ &p_node, unsigned p_count) noexcept {
+    size_type sum = 0;
+    for (unsigned i = 0; i < c_fanout; ++i) {
+      sum += (i < p_count ? p_node.m_counts[i] : 0);
+    }
+    return sum;
+  }
+
+  // Position of the p_rank-th set bit of p_word, 1-based. Halves of the word
+  // are skipped or entered depending on their popcount.
+  static unsigned select_bit(word_type_ p_word, size_type p_rank) noexcept {
+    unsigned offset = 0;
+    for (unsigned width = c_word_bits / 2; width; width /= 2) {
+      word_type_ low = p_word & ((word_type_{1} << width) - 1);
+      size_type count = std::popcount(low);
+      if (count < p_rank) {
+        p_rank -= count;
+        p_word >>= width;
+        offset += width;
+      } else {
+        p_word = low;
+      }
+    }
+    return offset;
+  }
+
+  // Inner nodes on the way to the leaf of p_key. Returns the leaf or 0 if
+  // p_create is not set and part of the path is missing.
+  index_type_ find_path(key_type_ p_key, index_type_ (&p_path)[c_depth],
+                        bool p_create) {
+    index_type_ node = 0;
+    for (unsigned level = 0; level < c_depth; ++level) {
+      p_path[level] = node;
+      unsigned d = digit(p_key, level);
+      index_type_ child = m_inner[node].m_children[d];
+
+      if (!child) {
+        if (!p_create)
+          return 0;
+        bool is_last = (level + 1 == c_depth);
+        // Indices stay valid when the pools grow, references wouldn't
+        child = static_cast<index_type_>(is_last ? m_leaves.size()
+                                                 : m_inner.size());
+        if (is_last) {
+          m_leaves.emplace_back();
+        } else {
+          m_inner.emplace_back();
+        }
+        m_inner[node].m_children[d] = child;
+      }
+
+      node = child;
+    }
+    return node;
+  }
+
+  // Number of keys less than p_key and whether p_key itself is present
+  std::pair<size_type, bool> locate(key_type_ p_key) const noexcept {
+    size_type count = 0;
+    index_type_ node = 0;
+    for (unsigned level = 0; level < c_depth; ++level) {
+      const inner_ &inner = m_inner[node];
+      unsigned d = digit(p_key, level);
+      count += sum_before(inner, d);
+      node = inner.m_children[d];
+      if (!node)
+        return {count, false};
+    }
+
+    const leaf_ &leaf = m_leaves[node];
+    unsigned offset = leaf_offset(p_key), word = offset / c_word_bits;
+    for (unsigned i = 0; i < word; ++i) {
+      count += std::popcount(leaf.m_words[i]);
+    }
+    count += std::popcount(leaf.m_words[word] & (bit_of(offset) - 1));
+    return {count, (leaf.m_words[word] & bit_of(offset)) != 0};
+  }
+
+public:
+  bool empty() const noexcept { return !m_size; }
+  size_type size() const noexcept { return m_size; }
+
+  bool contains(T p_val) const noexcept { return locate(to_key(p_val)).second; }
+
+  void insert(T p_val) {
+    key_type_ key = to_key(p_val);
+    index_type_ path[c_depth];
+    leaf_ &leaf = m_leaves[find_path(key, path, true)];
+
+    unsigned offset = leaf_offset(key);
+    word_type_ &word = leaf.m_words[offset / c_word_bits];
+    if (word & bit_of(offset))
+      throw std::out_of_range("Double insert");
+
+    word |= bit_of(offset);
+    for (unsigned level = 0; level < c_depth; ++level) {
+      ++m_inner[path[level]].m_counts[digit(key, level)];
+    }
+    ++m_size;
+  }
+
+  template <typename t_iter>
+  void insert_range(t_iter p_start, t_iter p_finish) {
+    for (t_iter its = p_start, ite = p_finish; its != ite; ++its) {
+      insert(*its);
+    }
+  }
+
+  void erase(T p_val) {
+    key_type_ key = to_key(p_val);
+    index_type_ path[c_depth];
+    index_type_ node = find_path(key, path, false);
+
+    unsigned offset = leaf_offset(key);
+    word_type_ &word = m_leaves[node].m_words[offset / c_word_bits];
+    if (!node || !(word & bit_of(offset)))
+      throw std::out_of_range("Can't erase element a non-present element");
+
+    word &= ~bit_of(offset);
+    for (unsigned level = 0; level < c_depth; ++level) {
+      --m_inner[path[level]].m_counts[digit(key, level)];
+    }
+    --m_size;
+  }
+
+  void clear() {
+    m_inner.assign(1, inner_{});
+    m_leaves.assign(1, leaf_{});
+    m_size = 0;
+  }
+
+  // Each level subtracts the counts of the children to the left of the one
+  // holding the element, and the leaf is searched by popcount.
+  T select_rank(size_type p_rank) const {
+    if (p_rank > size() || !(p_rank > 0))
+      throw std::out_of_range("Rank is greater than size or is zero");
+
+    key_type_ key = 0;
+    index_type_ node = 0;
+    for (unsigned level = 0; level < c_depth; ++level) {
+      const inner_ &inner = m_inner[node];
+      unsigned d = 0;
+      while (p_rank > inner.m_counts[d]) {
+        p_rank -= inner.m_counts[d++];
+      }
+      key |= key_type_{d} << shift(level);
+      node = inner.m_children[d];
+    }
+
+    const leaf_ &leaf = m_leaves[node];
+    unsigned word = 0;
+    while (p_rank > static_cast<size_type>(std::popcount(leaf.m_words[word]))) {
+      p_rank -= std::popcount(leaf.m_words[word++]);
+    }
+
+    key |= word * c_word_bits + select_bit(leaf.m_words[word], p_rank);
+    return from_key(key);
+  }
+
+  size_type get_rank_of(T p_val) const {
+    auto [count, present] = locate(to_key(p_val));
+    if (!present)
+      throw std::out_of_range("Element not present");
+    return count + 1;
+  }
+
+  size_type count_less(T p_val) const noexcept {
+    return locate(to_key(p_val)).first;
+  }
+
+  // Number of elements in [p_low, p_high]
+  size_type count_in_range(T p_low, T p_high) const noexcept {
+    if (p_high < p_low)
+      return 0;
+
+    auto [high, present] = locate(to_key(p_high));
+    return high + present - count_less(p_low);
+  }
+
+  T min() const {
+    if (empty())
+      throw std::out_of_range("Container is empty");
+    return select_rank(1);
+  }
+
+  T max() const {
+    if (empty())
+      throw std::out_of_range("Container is empty");
+    return select_rank(size());
+  }
+
+public:
+  int_order_statistic_set() : m_inner(1), m_leaves(1), m_size{} {}
+
+  int_order_statistic_set(std::initializer_list<T> p_list)
+      : int_order_statistic_set{} {
+    insert_range(p_list.begin(), p_list.end());
+  }
+};
+} // namespace throttle
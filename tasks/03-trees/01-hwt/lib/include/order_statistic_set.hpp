@@ -8,19 +8,39 @@
  * ----------------------------------------------------------------------------
  */
 
+#pragma once
+
+#include "detail/assign_range.hpp"
 #include "detail/rb_tree_ranged.hpp"
 #include <functional>
 #include <initializer_list>
+#include <iterator>
+#include <memory>
 
 namespace throttle {
-template <typename T, typename t_comp = std::less<T>>
-class order_statistic_set : public detail::rb_tree_ranged_<T, t_comp> {
+template <typename T, typename t_comp = std::less<T>,
+          typename t_alloc = std::allocator<T>>
+class order_statistic_set
+    : public detail::rb_tree_ranged_<T, t_comp, t_alloc> {
+  using base_tree = detail::rb_tree_ranged_<T, t_comp, t_alloc>;
+
 public:
-  order_statistic_set() : detail::rb_tree_ranged_<T, t_comp>{} {}
+  using allocator_type = t_alloc;
 
-  order_statistic_set(std::initializer_list<T> p_list)
-      : detail::rb_tree_ranged_<T, t_comp>{} {
-    this->insert_range(p_list.begin(), p_list.end());
+  order_statistic_set() : base_tree{} {}
+  explicit order_statistic_set(const t_alloc &p_alloc) : base_tree{p_alloc} {}
+
+  // Builds the set in O(n) when the range is strictly ascending. Otherwise a
+  // copy of the range is sorted first. Duplicates throw just like insert does.
+  template <std::input_iterator t_iter>
+  order_statistic_set(t_iter p_start, t_iter p_finish,
+                      const t_alloc &p_alloc = t_alloc{})
+      : base_tree{p_alloc} {
+    detail::assign_range(*this, p_start, p_finish);
   }
+
+  order_statistic_set(std::initializer_list<T> p_list,
+                      const t_alloc &p_alloc = t_alloc{})
+      : order_statistic_set(p_list.begin(), p_list.end(), p_alloc) {}
 };
 } // namespace throttle
@@ -0,0 +1,136 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace throttle {
+// An allocator for tree nodes. Single objects are carved out of slabs of
+// t_slab_size slots and deallocated slots go to a free list to be reused, so
+// inserts and erases don't go through malloc every time. Copies of the
+// allocator share one arena that is freed when the last of them is destroyed.
+// Arrays are forwarded to std::allocator.
+//
+// Rebinding to another type starts a new arena, because slots of different
+// sizes can't share a free list. Containers rebind once when they are
+// constructed, so every container gets its own arena.
+//
+// Moving hands the arena over instead of sharing it, so a container that was
+// moved from doesn't keep the arena of the one it was moved to alive and
+// release() keeps working for both. The allocator left behind owns nothing
+// and starts a new arena on its next allocation, which makes it unequal to
+// the one it was moved to.
+template <typename T, std::size_t t_slab_size = 4096> class pool_allocator {
+private:
+  static_assert(t_slab_size > 0, "Slab must hold at least one object");
+
+  union slot_ {
+    slot_ *m_next;
+    alignas(T) std::byte m_storage[sizeof(T)];
+  };
+
+  struct arena_ {
+    std::vector<std::unique_ptr<slot_[]>> m_slabs;
+    slot_ *m_free = nullptr;          // Head of the list of deallocated slots
+    std::size_t m_used = t_slab_size; // Slots handed out from the last slab
+  };
+
+  std::shared_ptr<arena_> m_arena;
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using propagate_on_container_copy_assignment = std::false_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  template <typename U> struct rebind {
+    using other = pool_allocator<U, t_slab_size>;
+  };
+
+  pool_allocator() : m_arena{std::make_shared<arena_>()} {}
+
+  template <typename U>
+  pool_allocator(const pool_allocator<U, t_slab_size> &) : pool_allocator{} {}
+
+  pool_allocator(const pool_allocator &) = default;
+  pool_allocator &operator=(const pool_allocator &) = default;
+  pool_allocator(pool_allocator &&) noexcept = default;
+  pool_allocator &operator=(pool_allocator &&) noexcept = default;
+
+  // A copy of a container gets a fresh arena instead of sharing this one
+  pool_allocator select_on_container_copy_construction() const {
+    return pool_allocator{};
+  }
+
+  T *allocate(size_type p_n) {
+    if (p_n != 1)
+      return std::allocator<T>{}.allocate(p_n);
+
+    if (!m_arena) // Moved from
+      m_arena = std::make_shared<arena_>();
+
+    arena_ &arena = *m_arena;
+    slot_ *slot = arena.m_free;
+    if (slot) {
+      arena.m_free = slot->m_next;
+      return reinterpret_cast<T *>(slot);
+    }
+
+    if (arena.m_used == t_slab_size) {
+      std::unique_ptr<slot_[]> slab{new slot_[t_slab_size]};
+      arena.m_slabs.push_back(std::move(slab));
+      arena.m_used = 0;
+    }
+
+    slot = &arena.m_slabs.back()[arena.m_used++];
+    return reinterpret_cast<T *>(slot);
+  }
+
+  void deallocate(T *p_ptr, size_type p_n) noexcept {
+    if (p_n != 1)
+      return std::allocator<T>{}.deallocate(p_ptr, p_n);
+
+    slot_ *slot = reinterpret_cast<slot_ *>(p_ptr);
+    slot->m_next = m_arena->m_free;
+    m_arena->m_free = slot;
+  }
+
+  // Whether release() would free the slabs, i.e. no other copy shares them.
+  bool can_release() const noexcept {
+    return !m_arena || m_arena.use_count() == 1;
+  }
+
+  // Frees all slabs at once. Every object allocated from the arena must be
+  // dead already, its destructor won't be called. Nothing happens if other
+  // copies share the arena, because they can't have agreed to that, and false
+  // is returned.
+  bool release() noexcept {
+    if (!can_release())
+      return false;
+    if (!m_arena) // Moved from, nothing was allocated since
+      return true;
+
+    m_arena->m_slabs.clear();
+    m_arena->m_free = nullptr;
+    m_arena->m_used = t_slab_size;
+    return true;
+  }
+
+  bool operator==(const pool_allocator &p_rhs) const noexcept {
+    return m_arena == p_rhs.m_arena;
+  }
+};
+} // namespace throttle
@@ -129,9 +129,11 @@ void rb_tree_ranged_impl_::rebalance_after_erase_(base_ptr_ p_leaf) noexcept {
       continue;
     }
 
-    // Nephew is the right child of a sibling
-    // Niece is the left child of a sibling
-    base_ptr_ nephew = (sibling ? sibling->m_right_ : nullptr);
+    // Nephew is the child of a sibling farther from the leaf
+    // Niece is the child of a sibling closer to the leaf
+    bool is_left = p_leaf->is_left_child_();
+    base_ptr_ nephew =
+        (sibling ? (is_left ? sibling->m_right_ : sibling->m_left_) : nullptr);
     if (link_type_::get_color_(nephew) == k_red_) {
       sibling->m_color_ = p_leaf->m_parent_->m_color_;
       p_leaf->m_parent_->m_color_ = k_black_;
@@ -141,7 +143,8 @@ void rb_tree_ranged_impl_::rebalance_after_erase_(base_ptr_ p_leaf) noexcept {
       break;
     }
 
-    base_ptr_ niece = (sibling ? sibling->m_left_ : nullptr);
+    base_ptr_ niece =
+        (sibling ? (is_left ? sibling->m_left_ : sibling->m_right_) : nullptr);
     if (link_type_::get_color_(niece) == k_red_) {
       niece->m_color_ = k_black_;
       sibling->m_color_ = k_red_;
@@ -0,0 +1,312 @@
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <gtest/gtest.h>
+#include <numeric>
+#include <set>
+#include <string>
+#include <vector>
+
+#define private public
+#define protected public
+#include "btree_order_statistic_set.hpp"
+#include "pool_allocator.hpp"
+#undef private
+#undef protected
+
+// Implicit instantiation for testing puproses
+template class throttle::detail::btree_order_tree_<int, std::less<int>>;
+template class throttle::detail::btree_order_tree_<std::string,
+                                                   std::less<std::string>>;
+template class throttle::detail::btree_order_tree_<
+    int, std::less<int>, throttle::pool_allocator<int>>;
+
+using namespace throttle::detail;
+
+namespace {
+using base_node = btree_node_base_;
+
+// Checks that every leaf is at p_depth, that nodes other than the root are at
+// least half full, that child counts are right and that keys lie in
+// [p_low, p_high). Returns the number of keys under p_node.
+template <typename t_tree, typename T>
+std::size_t validate_btree_helper(const base_node *p_node, std::size_t p_depth,
+                                  bool p_root, const T *p_low,
+                                  const T *p_high) {
+  if (!p_depth) {
+    EXPECT_TRUE(p_node->m_leaf_);
+    EXPECT_TRUE(p_root || p_node->m_count_ >= t_tree::c_leaf_capacity / 2);
+    EXPECT_LE(p_node->m_count_, t_tree::c_leaf_capacity);
+
+    auto leaf = t_tree::as_leaf(p_node);
+    for (std::size_t i = 0; i < leaf->m_count_; ++i) {
+      EXPECT_TRUE(!i || leaf->m_keys_[i - 1] < leaf->m_keys_[i]);
+      EXPECT_TRUE(!p_low || !(leaf->m_keys_[i] < *p_low));
+      EXPECT_TRUE(!p_high || leaf->m_keys_[i] < *p_high);
+    }
+    return leaf->m_count_;
+  }
+
+  EXPECT_FALSE(p_node->m_leaf_);
+  EXPECT_GE(p_node->m_count_, (p_root ? 2 : t_tree::c_fanout / 2));
+  EXPECT_LE(p_node->m_count_, t_tree::c_fanout);
+
+  auto inner = t_tree::as_inner(p_node);
+  std::size_t total = 0;
+  for (std::size_t i = 0; i < inner->m_count_; ++i) {
+    const T *low = (i ? &inner->m_keys_[i - 1] : p_low);
+    const T *high = (i + 1 < inner->m_count_ ? &inner->m_keys_[i] : p_high);
+    std::size_t size = validate_btree_helper<t_tree>(
+        inner->m_children_[i], p_depth - 1, false, low, high);
+    EXPECT_EQ(size, inner->m_sizes_[i]);
+    total += size;
+  }
+  return total;
+}
+
+template <typename t_tree> void validate_btree(const t_tree &p_tree) {
+  if (!p_tree.m_root_) {
+    EXPECT_EQ(p_tree.size(), 0);
+    return;
+  }
+
+  std::size_t depth = 0;
+  for (const base_node *curr = p_tree.m_root_; !curr->m_leaf_; ++depth) {
+    curr = t_tree::as_inner(curr)->m_children_[0];
+  }
+
+  using value_type = typename t_tree::value_type;
+  EXPECT_EQ(validate_btree_helper<t_tree>(p_tree.m_root_, depth, true,
+                                          static_cast<value_type *>(nullptr),
+                                          static_cast<value_type *>(nullptr)),
+            p_tree.size());
+}
+} // namespace
+
+TEST(test_btree, test_1) {
+  throttle::btree_order_statistic_set<int> t{};
+  EXPECT_TRUE(t.empty());
+  EXPECT_THROW(t.erase(1), std::out_of_range);
+  EXPECT_THROW(t.min(), std::out_of_range);
+  EXPECT_EQ(t.count_less(5), 0);
+
+  t.insert(1);
+  t.insert(2);
+  EXPECT_THROW(t.insert(1), std::out_of_range);
+  EXPECT_EQ(t.size(), 2);
+  EXPECT_EQ(t.select_rank(2), 2);
+  EXPECT_EQ(t.get_rank_of(1), 1);
+  EXPECT_THROW(t.select_rank(3), std::out_of_range);
+  EXPECT_THROW(t.closest_left(0), std::out_of_range);
+  EXPECT_EQ(t.closest_left(1), 1);
+  EXPECT_THROW(t.closest_right(2), std::out_of_range);
+}
+
+TEST(test_btree, test_2) {
+  // Random inserts and erases against std::set
+  std::srand(42);
+  throttle::btree_order_statistic_set<int, std::less<int>,
+                                      throttle::pool_allocator<int>>
+      t{};
+  std::set<int> s{};
+
+  for (int i = 0; i < 60000; ++i) {
+    int key = std::rand() % 20000;
+    if (std::rand() % 3 && !s.count(key)) {
+      t.insert(key);
+      s.insert(key);
+    } else if (s.count(key)) {
+      t.erase(key);
+      s.erase(key);
+    } else {
+      EXPECT_THROW(t.erase(key), std::out_of_range);
+    }
+
+    if (i % 5000 == 0) {
+      validate_btree(t);
+    }
+  }
+
+  validate_btree(t);
+  ASSERT_EQ(t.size(), s.size());
+
+  std::size_t rank = 1;
+  for (int key : s) {
+    ASSERT_EQ(t.select_rank(rank), key);
+    ASSERT_EQ(t.get_rank_of(key), rank);
+    ++rank;
+  }
+
+  for (int key = -1; key <= 20001; key += 7) {
+    auto below = s.lower_bound(key);
+    auto above = s.upper_bound(key);
+    ASSERT_EQ(t.count_less(key), std::distance(s.begin(), below));
+    ASSERT_EQ(t.contains(key), s.count(key) == 1);
+    if (above != s.begin()) {
+      ASSERT_EQ(t.closest_left(key), *std::prev(above));
+    }
+    if (above != s.end()) {
+      ASSERT_EQ(t.closest_right(key), *above);
+    }
+    ASSERT_EQ(t.count_in_range(key, key + 500),
+              std::distance(below, s.upper_bound(key + 500)));
+  }
+
+  EXPECT_EQ(t.min(), *s.begin());
+  EXPECT_EQ(t.max(), *s.rbegin());
+
+  std::vector<int> keys{-5, 0, 1, 100, 5000, 5001, 19999, 30000};
+  auto ranks = t.batch_rank(keys);
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    EXPECT_EQ(ranks[i], t.count_less(keys[i]));
+  }
+
+  // Erase everything so the tree collapses back to nothing
+  for (int key : s) {
+    t.erase(key);
+  }
+  EXPECT_TRUE(t.empty());
+  EXPECT_EQ(t.m_root_, nullptr);
+}
+
+TEST(test_btree, test_3) {
+  // Bulk build gives the same tree as inserts for every size around a level
+  for (int n = 0; n < 1200; n += 37) {
+    std::vector<int> v(n);
+    std::iota(v.begin(), v.end(), 1);
+
+    throttle::btree_order_statistic_set<int> t(v.rbegin(), v.rend());
+    ASSERT_EQ(t.size(), n);
+    validate_btree(t);
+    for (int i = 1; i <= n; i++) {
+      ASSERT_EQ(t.select_rank(i), i);
+    }
+
+    // Copies are deep
+    auto copy = t;
+    copy.insert(0);
+    ASSERT_EQ(t.size() + 1, copy.size());
+    validate_btree(copy);
+
+    auto moved = std::move(copy);
+    ASSERT_EQ(moved.size(), n + 1);
+    validate_btree(moved);
+  }
+
+  std::vector<int> v{3, 1, 3};
+  EXPECT_THROW(throttle::btree_order_statistic_set<int>(v.begin(), v.end()),
+               std::out_of_range);
+}
+
+TEST(test_btree, test_4) {
+  // Keys that are not searched by the vectorized loop
+  throttle::btree_order_statistic_set<std::string> t{};
+  for (int i = 0; i < 2000; ++i) {
+    t.insert(std::to_string(i));
+  }
+  validate_btree(t);
+
+  std::set<std::string> s{};
+  for (int i = 0; i < 2000; ++i) {
+    s.insert(std::to_string(i));
+  }
+
+  std::size_t rank = 1;
+  for (const auto &key : s) {
+    ASSERT_EQ(t.select_rank(rank++), key);
+  }
+
+  for (int i = 0; i < 2000; i += 2) {
+    t.erase(std::to_string(i));
+  }
+  validate_btree(t);
+  EXPECT_EQ(t.size(), 1000);
+  EXPECT_EQ(t.count_in_range("1", "2"), 556);
+}
+
+TEST(test_btree, test_5) {
+  using pool_btree =
+      btree_order_tree_<int, std::less<int>, throttle::pool_allocator<int>>;
+  pool_btree t{};
+  for (int i = 0; i < 5000; ++i) {
+    t.insert(i);
+  }
+
+  // Both arenas go with the nodes, so clear() can still release them
+  pool_btree m{std::move(t)};
+  EXPECT_EQ(m.m_leaf_alloc_.m_arena.use_count(), 1);
+  EXPECT_EQ(m.m_inner_alloc_.m_arena.use_count(), 1);
+  m.clear();
+  EXPECT_TRUE(m.m_leaf_alloc_.m_arena->m_slabs.empty());
+  EXPECT_TRUE(m.m_inner_alloc_.m_arena->m_slabs.empty());
+
+  t.insert(3);
+  EXPECT_EQ(t.size(), 1);
+  EXPECT_EQ(t.m_leaf_alloc_.m_arena.use_count(), 1);
+  EXPECT_EQ(t.select_rank(1), 3);
+}
+
+TEST(test_btree, test_6) {
+  btree_order_tree_<int, std::less<int>> t;
+  t.insert(-1);
+
+  // Not ascending after all, the range is sorted instead of trusted
+  std::vector<int> v(1000);
+  for (std::size_t i = 0; i < v.size(); ++i) {
+    v[i] = static_cast<int>((i * 7919) % v.size());
+  }
+  t.assign_sorted(v.begin(), v.end());
+  validate_btree(t);
+  EXPECT_EQ(t.size(), 1000);
+  EXPECT_FALSE(t.contains(-1));
+  for (int i = 1; i <= 1000; i += 37) {
+    ASSERT_EQ(t.select_rank(i), i - 1);
+  }
+
+  // Duplicates throw and leave the tree as it was
+  std::vector<int> dup{4, 2, 4};
+  EXPECT_THROW(t.assign_sorted(dup.begin(), dup.end()), std::out_of_range);
+  EXPECT_EQ(t.size(), 1000);
+  validate_btree(t);
+}
+
+TEST(test_btree, test_7) {
+  using pool_btree =
+      btree_order_tree_<int, std::less<int>, throttle::pool_allocator<int>>;
+  pool_btree t{};
+  for (int i = 0; i < 5000; ++i) {
+    t.insert(i);
+  }
+
+  // Only the leaf arena could be released, so neither is and the nodes are
+  // destroyed one by one instead
+  auto shared_inner = t.m_inner_alloc_;
+  EXPECT_TRUE(t.m_leaf_alloc_.can_release());
+  EXPECT_FALSE(t.m_inner_alloc_.can_release());
+  t.clear();
+  EXPECT_EQ(t.size(), 0);
+  EXPECT_FALSE(t.m_leaf_alloc_.m_arena->m_slabs.empty());
+  EXPECT_FALSE(shared_inner.m_arena->m_slabs.empty());
+
+  // Freed nodes are reused by the next inserts
+  for (int i = 0; i < 5000; ++i) {
+    t.insert(-i);
+  }
+  validate_btree(t);
+  EXPECT_EQ(t.select_rank(1), -4999);
+}
+
+TEST(test_btree, test_8) {
+  btree_order_tree_<int, std::less<int>> t;
+  for (int i = 0; i < 1000; ++i) {
+    t.insert(2 * i);
+  }
+
+  // Unsorted keys are rejected in release builds too
+  std::vector<int> keys{10, 500, 300};
+  EXPECT_THROW(t.batch_rank(keys), std::invalid_argument);
+
+  std::vector<int> sorted{10, 300, 300, 500};
+  std::vector<std::size_t> expected{5, 150, 150, 250};
+  EXPECT_EQ(t.batch_rank(sorted), expected);
+}
@@ -1,13 +1,21 @@
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <functional>
 #include <gtest/gtest.h>
+#include <list>
+#include <numeric>
 #include <set>
+#include <sstream>
 #include <string>
+#include <vector>
 
 #define private public
 #define protected public
+#include "int_order_statistic_set.hpp"
+#include "offline_order_statistic_set.hpp"
 #include "order_statistic_set.hpp"
+#include "pool_allocator.hpp"
 #undef private
 #undef protected
 
@@ -15,6 +23,10 @@
 template class throttle::detail::rb_tree_ranged_<int, std::less<int>>;
 template class throttle::detail::rb_tree_ranged_<std::string,
                                                  std::less<std::string>>;
+template class throttle::detail::rb_tree_ranged_<
+    int, std::less<int>, throttle::pool_allocator<int>>;
+template class throttle::detail::rb_tree_ranged_<
+    std::string, std::less<std::string>, throttle::pool_allocator<std::string>>;
 
 using namespace throttle::detail;
 
@@ -61,6 +73,22 @@ bool validate_size_helper(base_node_ptr p_base) {
 
   return valid_left && valid_right;
 }
+
+std::size_t allocations = 0;
+
+template <typename T> struct counting_allocator : std::allocator<T> {
+  template <typename U> struct rebind {
+    using other = counting_allocator<U>;
+  };
+
+  counting_allocator() = default;
+  template <typename U> counting_allocator(const counting_allocator<U> &) {}
+
+  T *allocate(std::size_t p_n) {
+    ++allocations;
+    return std::allocator<T>::allocate(p_n);
+  }
+};
 } // namespace
 
 TEST(test_rb_tree_private, test_1) {
@@ -296,6 +324,395 @@ TEST(test_rb_tree_private, test_12) {
   }
 }
 
+TEST(test_rb_tree_private, test_13) {
+  using pool_tree =
+      rb_tree_ranged_<int, std::less<int>, throttle::pool_allocator<int, 64>>;
+  pool_tree t;
+
+  for (int i = 0; i < 10000; i++) {
+    t.insert(i);
+  }
+  for (int i = 0; i < 10000; i += 2) {
+    t.erase(i);
+  }
+  EXPECT_EQ(t.size(), 5000);
+  EXPECT_EQ(validate_red_black_helper(t.m_root_).second, true);
+  EXPECT_EQ(validate_size_helper(t.m_root_), true);
+
+  // Erased slots are reused before new slabs are requested
+  std::size_t slabs = t.m_alloc_.m_arena->m_slabs.size();
+  for (int i = 0; i < 10000; i += 2) {
+    t.insert(i);
+  }
+  EXPECT_EQ(t.m_alloc_.m_arena->m_slabs.size(), slabs);
+
+  t.clear();
+  EXPECT_TRUE(t.empty());
+  EXPECT_TRUE(t.m_alloc_.m_arena->m_slabs.empty());
+
+  for (int i = 0; i < 128; i++) {
+    t.insert(i);
+  }
+  EXPECT_EQ(t.select_rank(128), 127);
+}
+
+TEST(test_rb_tree_private, test_14) {
+  rb_tree_ranged_<int, std::less<int>, counting_allocator<int>> t;
+  for (int i = 0; i < 16; i++) {
+    t.insert(i);
+  }
+
+  allocations = 0;
+  EXPECT_THROW(t.insert(8), std::out_of_range);
+  EXPECT_EQ(allocations, 0);
+  EXPECT_EQ(t.size(), 16);
+  EXPECT_EQ(validate_size_helper(t.m_root_), true);
+}
+
+TEST(test_rb_tree_private, test_15) {
+  using pool_set = throttle::order_statistic_set<int, std::less<int>,
+                                                 throttle::pool_allocator<int>>;
+  pool_set t{5, 4, 3, 2, 1};
+
+  // Copies get an arena of their own and outlive the original
+  pool_set c{t};
+  EXPECT_NE(c.m_alloc_, t.m_alloc_);
+  t.clear();
+  EXPECT_EQ(c.size(), 5);
+  EXPECT_EQ(c.select_rank(2), 2);
+
+  pool_set m{std::move(c)};
+  c.insert(42);
+  EXPECT_EQ(c.size(), 1);
+  EXPECT_EQ(m.size(), 5);
+
+  t = std::move(m);
+  EXPECT_EQ(t.size(), 5);
+  EXPECT_EQ(t.get_rank_of(5), 5);
+}
+
+TEST(test_rb_tree_private, test_16) {
+  throttle::order_statistic_set<std::string, std::less<std::string>,
+                                throttle::pool_allocator<std::string>>
+      t;
+  for (int i = 0; i < 1000; i++) {
+    t.insert(std::to_string(i));
+  }
+
+  // Strings have to be destroyed, so the tree is walked instead of released
+  t.clear();
+  EXPECT_TRUE(t.empty());
+  t.insert("a");
+  EXPECT_EQ(t.min(), "a");
+}
+
+TEST(test_rb_tree_private, test_17) {
+  for (int n = 0; n < 300; n++) {
+    std::vector<int> v(n);
+    std::iota(v.begin(), v.end(), 1);
+
+    rb_tree_ranged_<int, std::less<int>> t;
+    t.insert(-5);
+    t.assign_sorted(v.begin(), v.end());
+
+    ASSERT_EQ(t.size(), n);
+    ASSERT_FALSE(t.contains(-5));
+    ASSERT_EQ(base_node::get_color_(t.m_root_), k_black_);
+    ASSERT_EQ(validate_red_black_helper(t.m_root_).second, true);
+    ASSERT_EQ(validate_size_helper(t.m_root_), true);
+    for (int i = 1; i <= n; i++) {
+      ASSERT_EQ(t.select_rank(i), i);
+    }
+
+    // The tree has to stay valid for the rebalancing code
+    t.insert(0);
+    t.erase(n / 2);
+    ASSERT_EQ(validate_red_black_helper(t.m_root_).second, true);
+    ASSERT_EQ(validate_size_helper(t.m_root_), true);
+  }
+}
+
+TEST(test_rb_tree_private, test_18) {
+  std::list<int> l{1, 3, 5, 7};
+  throttle::order_statistic_set<int> t(l.begin(), l.end());
+  EXPECT_EQ(t.size(), 4);
+  EXPECT_EQ(t.get_rank_of(7), 4);
+
+  std::vector<int> v(200000);
+  for (std::size_t i = 0; i < v.size(); i++) {
+    v[i] = static_cast<int>((i * 7919) % v.size());
+  }
+  throttle::order_statistic_set<int, std::less<int>,
+                                throttle::pool_allocator<int>>
+      p(v.begin(), v.end());
+  EXPECT_EQ(p.size(), v.size());
+  EXPECT_EQ(validate_red_black_helper(p.m_root_).second, true);
+  for (int i = 1; i <= 200000; i += 997) {
+    ASSERT_EQ(p.select_rank(i), i - 1);
+  }
+
+  std::vector<int> dup{4, 2, 4};
+  EXPECT_THROW(throttle::order_statistic_set<int>(dup.begin(), dup.end()),
+               std::out_of_range);
+
+  std::istringstream is{"3 1 2"};
+  throttle::order_statistic_set<int> s(std::istream_iterator<int>{is},
+                                       std::istream_iterator<int>{});
+  EXPECT_EQ(s.min(), 1);
+  EXPECT_EQ(s.max(), 3);
+}
+
+TEST(test_rb_tree_private, test_19) {
+  std::vector<int> v(3 * c_parallel_build_threshold + 17);
+  std::iota(v.begin(), v.end(), 0);
+
+  // Force several threads regardless of the machine
+  rb_tree_ranged_<int, std::less<int>> t;
+  auto it = v.begin();
+  t.m_root_ = t.build_balanced(it, v.size(), 0, t.red_depth(v.size()), 4);
+
+  EXPECT_EQ(it, v.end());
+  EXPECT_EQ(t.size(), v.size());
+  EXPECT_EQ(validate_red_black_helper(t.m_root_).second, true);
+  EXPECT_EQ(validate_size_helper(t.m_root_), true);
+  EXPECT_EQ(t.get_rank_of(12345), 12346);
+
+  std::vector<int> u(v.rbegin(), v.rend());
+  throttle::detail::parallel_sort(u.begin(), u.end(), std::less<int>{}, 4);
+  EXPECT_EQ(u, v);
+}
+
+TEST(test_rb_tree_private, test_20) {
+  std::set<int> s;
+  throttle::order_statistic_set<int> t;
+  EXPECT_EQ(t.count_less(0), 0);
+  EXPECT_EQ(t.count_in_range(-10, 10), 0);
+
+  for (int i = 0; i < 2000; i++) {
+    int temp = std::rand() % 10000;
+    if (s.insert(temp).second) {
+      t.insert(temp);
+    }
+  }
+
+  for (int key = -5; key < 10005; key += 7) {
+    auto expected = std::distance(s.begin(), s.lower_bound(key));
+    ASSERT_EQ(t.count_less(key), expected);
+  }
+
+  for (int i = 0; i < 2000; i++) {
+    int low = std::rand() % 10100 - 50, high = std::rand() % 10100 - 50;
+    auto expected =
+        (low > high ? 0
+                    : std::distance(s.lower_bound(low), s.upper_bound(high)));
+    ASSERT_EQ(t.count_in_range(low, high), expected);
+  }
+
+  std::vector<int> keys;
+  for (int key = -100; key < 10100; key += std::rand() % 50) {
+    keys.push_back(key);
+    keys.push_back(key);
+  }
+
+  auto ranks = t.batch_rank(keys);
+  ASSERT_EQ(ranks.size(), keys.size());
+  for (std::size_t i = 0; i < keys.size(); i++) {
+    ASSERT_EQ(ranks[i], t.count_less(keys[i]));
+  }
+}
+
+TEST(test_rb_tree_private, test_21) {
+  std::vector<int> universe;
+  for (int i = 0; i < 5000; i++) {
+    universe.push_back(std::rand() % 20000 - 10000);
+  }
+
+  throttle::offline_order_statistic_set<int> t{universe.begin(),
+                                               universe.end()};
+  std::set<int> s;
+  EXPECT_THROW(t.select_rank(1), std::out_of_range);
+  EXPECT_THROW(t.insert(20000), std::out_of_range);
+  EXPECT_EQ(t.count_less(0), 0);
+
+  for (int i = 0; i < 20000; i++) {
+    int key = universe[std::rand() % universe.size()];
+    if (std::rand() % 3) {
+      if (s.insert(key).second) {
+        t.insert(key);
+      } else {
+        ASSERT_THROW(t.insert(key), std::out_of_range);
+      }
+    } else if (s.erase(key)) {
+      t.erase(key);
+    } else {
+      ASSERT_THROW(t.erase(key), std::out_of_range);
+    }
+  }
+
+  ASSERT_EQ(t.size(), s.size());
+  std::size_t rank = 1;
+  for (int key : s) {
+    ASSERT_EQ(t.select_rank(rank), key);
+    ASSERT_EQ(t.get_rank_of(key), rank);
+    rank++;
+  }
+
+  for (int key = -10005; key < 10005; key += 3) {
+    ASSERT_EQ(t.contains(key), s.count(key) == 1);
+    ASSERT_EQ(t.count_less(key),
+              std::distance(s.begin(), s.lower_bound(key)));
+    ASSERT_EQ(t.count_in_range(key, key + 100),
+              std::distance(s.lower_bound(key), s.upper_bound(key + 100)));
+  }
+}
+
+TEST(test_rb_tree_private, test_22) {
+  throttle::int_order_statistic_set<int> t;
+  std::set<int> s;
+  EXPECT_THROW(t.min(), std::out_of_range);
+  EXPECT_THROW(t.select_rank(1), std::out_of_range);
+  EXPECT_THROW(t.erase(7), std::out_of_range);
+  EXPECT_EQ(t.count_less(0), 0);
+
+  // Dense keys around zero share leaves, sparse ones take a path each
+  auto random_key = []() {
+    if (std::rand() % 2)
+      return std::rand() % 4000 - 2000;
+    auto bits = static_cast<std::uint32_t>(std::rand()) * 2654435761u;
+    return static_cast<int>(bits);
+  };
+
+  for (int key : {INT32_MIN, INT32_MAX, -1, 0}) {
+    s.insert(key);
+    t.insert(key);
+  }
+  EXPECT_THROW(t.insert(INT32_MIN), std::out_of_range);
+
+  std::vector<int> keys;
+  for (int i = 0; i < 30000; i++) {
+    bool repeat = !keys.empty() && std::rand() % 2;
+    int key = repeat ? keys[std::rand() % keys.size()] : random_key();
+    keys.push_back(key);
+    if (std::rand() % 3) {
+      if (s.insert(key).second) {
+        t.insert(key);
+      } else {
+        ASSERT_THROW(t.insert(key), std::out_of_range);
+      }
+    } else if (s.erase(key)) {
+      t.erase(key);
+    } else {
+      ASSERT_THROW(t.erase(key), std::out_of_range);
+    }
+  }
+
+  ASSERT_EQ(t.size(), s.size());
+  EXPECT_EQ(t.min(), INT32_MIN);
+  EXPECT_EQ(t.max(), INT32_MAX);
+  std::size_t rank = 1;
+  for (int key : s) {
+    ASSERT_EQ(t.select_rank(rank), key);
+    ASSERT_EQ(t.get_rank_of(key), rank);
+    rank++;
+  }
+
+  keys.push_back(INT32_MIN);
+  keys.push_back(INT32_MAX);
+  for (int key : keys) {
+    ASSERT_EQ(t.contains(key), s.count(key) == 1);
+    ASSERT_EQ(t.count_less(key),
+              std::distance(s.begin(), s.lower_bound(key)));
+    int high = key / 2 + 1000;
+    ASSERT_EQ(t.count_in_range(key, high),
+              high < key ? 0
+                         : std::distance(s.lower_bound(key),
+                                         s.upper_bound(high)));
+  }
+
+  t.clear();
+  EXPECT_TRUE(t.empty());
+  EXPECT_FALSE(t.contains(0));
+
+  throttle::int_order_statistic_set<std::uint32_t> u{0, 5, 0xffffffffu};
+  EXPECT_EQ(u.select_rank(3), 0xffffffffu);
+  EXPECT_EQ(u.count_less(0x80000000u), 2);
+}
+
+TEST(test_rb_tree_private, test_23) {
+  using pool_tree =
+      rb_tree_ranged_<int, std::less<int>, throttle::pool_allocator<int, 64>>;
+  pool_tree t;
+  for (int i = 0; i < 1000; i++) {
+    t.insert(i);
+  }
+
+  // The arena goes with the nodes, so it can still be released at once
+  pool_tree m{std::move(t)};
+  EXPECT_EQ(m.m_alloc_.m_arena.use_count(), 1);
+  EXPECT_NE(m.m_alloc_, t.m_alloc_);
+  m.clear();
+  EXPECT_TRUE(m.m_alloc_.m_arena->m_slabs.empty());
+
+  // The tree left behind gets an arena of its own once it's used again
+  t.insert(5);
+  t.insert(7);
+  EXPECT_EQ(t.size(), 2);
+  EXPECT_EQ(t.m_alloc_.m_arena.use_count(), 1);
+  t.clear();
+  EXPECT_TRUE(t.m_alloc_.m_arena->m_slabs.empty());
+
+  // Move assignment swaps arenas along with the nodes
+  for (int i = 0; i < 100; i++) {
+    m.insert(i);
+  }
+  t.insert(1);
+  t = std::move(m);
+  EXPECT_EQ(t.size(), 100);
+  EXPECT_EQ(t.m_alloc_.m_arena.use_count(), 1);
+  EXPECT_EQ(m.m_alloc_.m_arena.use_count(), 1);
+  t.clear();
+  EXPECT_TRUE(t.m_alloc_.m_arena->m_slabs.empty());
+  EXPECT_EQ(m.size(), 1);
+  EXPECT_TRUE(m.contains(1));
+}
+
+TEST(test_rb_tree_private, test_24) {
+  rb_tree_ranged_<int, std::less<int>> t;
+  t.insert(100);
+
+  // Not ascending after all, the range is sorted instead of trusted
+  std::vector<int> v{5, 3, 9, 1, 7};
+  t.assign_sorted(v.begin(), v.end());
+  EXPECT_EQ(t.size(), 5);
+  EXPECT_FALSE(t.contains(100));
+  EXPECT_EQ(validate_red_black_helper(t.m_root_).second, true);
+  EXPECT_EQ(validate_size_helper(t.m_root_), true);
+  for (int i = 1; i <= 5; i++) {
+    EXPECT_EQ(t.select_rank(i), 2 * i - 1);
+  }
+
+  // Duplicates throw and leave the tree as it was
+  std::vector<int> dup{1, 2, 2, 3};
+  EXPECT_THROW(t.assign_sorted(dup.begin(), dup.end()), std::out_of_range);
+  EXPECT_EQ(t.size(), 5);
+  EXPECT_EQ(t.get_rank_of(9), 5);
+}
+
+TEST(test_rb_tree_private, test_25) {
+  rb_tree_ranged_<int, std::less<int>> t;
+  for (int i = 0; i < 100; i++) {
+    t.insert(2 * i);
+  }
+
+  // Unsorted keys are rejected in release builds too
+  std::vector<int> keys{10, 50, 30};
+  EXPECT_THROW(t.batch_rank(keys), std::invalid_argument);
+
+  std::vector<int> sorted{10, 30, 30, 50};
+  std::vector<std::size_t> expected{5, 15, 15, 25};
+  EXPECT_EQ(t.batch_rank(sorted), expected);
+}
+
 int main(int argc, char *argv[]) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
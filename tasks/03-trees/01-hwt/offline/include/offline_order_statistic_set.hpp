@@ -0,0 +1,242 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+namespace throttle {
+// Order statistic set over a universe of keys known in advance. Keys are
+// identified by their position in the sorted universe. Positions are grouped
+// into blocks of 64 with a bitmap of the present keys each, and a Fenwick tree
+// over the blocks counts them. The bitmaps and the tree share one flat array,
+// which is 16 bytes per 64 keys of the universe and stays in cache even for
+// millions of keys.
+//
+// Keys outside of the universe can't be inserted, but can be queried. Callers
+// that know positions of their keys already, e.g. from coordinate compression
+// of a whole batch, can use the position based overloads and skip the binary
+// search.
+template <typename T, typename t_comp = std::less<T>>
+class offline_order_statistic_set {
+public:
+  using value_type = T;
+  using comp = t_comp;
+  using size_type = std::size_t;
+
+private:
+  using word_type = std::uint64_t;
+  static constexpr size_type c_block_bits = 64;
+
+  // Block i holds the bitmap of positions [64 * (i - 1), 64 * i) and the
+  // number of present keys in blocks (i - lowbit(i), i]. Block 0 is unused, so
+  // that indices are 1-based.
+  struct block_ {
+    word_type m_bits;
+    size_type m_count;
+  };
+
+  std::vector<T> m_keys;
+  std::vector<block_> m_blocks;
+  size_type m_size;
+  size_type m_top_step; // Largest power of two not greater than block count
+
+  size_type block_count() const noexcept { return m_blocks.size() - 1; }
+
+  static size_type lowbit(size_type p_i) noexcept { return p_i & (~p_i + 1); }
+
+  static word_type bit_of(size_type p_pos) noexcept {
+    return word_type{1} << (p_pos % c_block_bits);
+  }
+
+  block_ &block_of(size_type p_pos) noexcept {
+    return m_blocks[p_pos / c_block_bits + 1];
+  }
+
+  const block_ &block_of(size_type p_pos) const noexcept {
+    return m_blocks[p_pos / c_block_bits + 1];
+  }
+
+  void add(size_type p_pos, size_type p_delta) noexcept {
+    for (size_type i = p_pos / c_block_bits + 1; i <= block_count();
+         i += lowbit(i)) {
+      m_blocks[i].m_count += p_delta; // Wraps around for negative deltas
+    }
+  }
+
+  // Position of the p_rank-th set bit of p_word, 1-based. Halves of the word
+  // are skipped or entered depending on their popcount.
+  static size_type select_bit(word_type p_word, size_type p_rank) noexcept {
+    size_type offset = 0;
+    for (size_type width = c_block_bits / 2; width; width /= 2) {
+      word_type low = p_word & ((word_type{1} << width) - 1);
+      size_type count = std::popcount(low);
+      if (count < p_rank) {
+        p_rank -= count;
+        p_word >>= width;
+        offset += width;
+      } else {
+        p_word = low;
+      }
+    }
+    return offset;
+  }
+
+  // 1-based position of p_key in the universe or 0 if it's not there
+  size_type find_position(const T &p_key) const {
+    size_type pos = universe_position(p_key);
+    if (pos == m_keys.size() || t_comp{}(p_key, m_keys[pos]))
+      return 0;
+    return pos + 1;
+  }
+
+public:
+  bool empty() const noexcept { return !m_size; }
+  size_type size() const noexcept { return m_size; }
+
+  const std::vector<T> &universe() const noexcept { return m_keys; }
+
+  // Number of keys in the universe less than p_key
+  size_type universe_position(const T &p_key) const {
+    return std::lower_bound(m_keys.begin(), m_keys.end(), p_key, t_comp{}) -
+           m_keys.begin();
+  }
+
+  bool contains_at(size_type p_pos) const noexcept {
+    return block_of(p_pos).m_bits & bit_of(p_pos);
+  }
+
+  bool contains(const T &p_key) const {
+    size_type pos = find_position(p_key);
+    return pos && contains_at(pos - 1);
+  }
+
+  // Inserts the key at position p_pos of the universe
+  void insert_at(size_type p_pos) {
+    block_ &block = block_of(p_pos);
+    if (block.m_bits & bit_of(p_pos))
+      throw std::out_of_range("Double insert");
+
+    block.m_bits |= bit_of(p_pos);
+    add(p_pos, 1);
+    ++m_size;
+  }
+
+  void insert(const T &p_key) {
+    size_type pos = find_position(p_key);
+    if (!pos)
+      throw std::out_of_range("Key is not in the universe");
+    insert_at(pos - 1);
+  }
+
+  void erase_at(size_type p_pos) {
+    block_ &block = block_of(p_pos);
+    if (!(block.m_bits & bit_of(p_pos)))
+      throw std::out_of_range("Can't erase element a non-present element");
+
+    block.m_bits &= ~bit_of(p_pos);
+    add(p_pos, -size_type{1});
+    --m_size;
+  }
+
+  void erase(const T &p_key) {
+    size_type pos = find_position(p_key);
+    if (!pos)
+      throw std::out_of_range("Can't erase element a non-present element");
+    erase_at(pos - 1);
+  }
+
+  // Binary lifting over the Fenwick tree finds the block, every step either
+  // skips the whole range of a node or descends into it. The key is then
+  // found among the bits of the block.
+  const T &select_rank(size_type p_rank) const {
+    if (p_rank > size() || !(p_rank > 0))
+      throw std::out_of_range("Rank is greater than size or is zero");
+
+    size_type block = 0;
+    for (size_type step = m_top_step; step; step /= 2) {
+      size_type next = block + step;
+      if (next <= block_count() && m_blocks[next].m_count < p_rank) {
+        block = next;
+        p_rank -= m_blocks[next].m_count;
+      }
+    }
+
+    size_type bit = select_bit(m_blocks[block + 1].m_bits, p_rank);
+    return m_keys[block * c_block_bits + bit];
+  }
+
+  // Number of present keys among the first p_pos keys of the universe. Whole
+  // blocks are summed up in the Fenwick tree, the rest is a popcount.
+  size_type count_before(size_type p_pos) const noexcept {
+    size_type count = 0;
+    for (size_type i = p_pos / c_block_bits; i; i -= lowbit(i)) {
+      count += m_blocks[i].m_count;
+    }
+
+    if (p_pos % c_block_bits)
+      count += std::popcount(block_of(p_pos).m_bits & (bit_of(p_pos) - 1));
+    return count;
+  }
+
+  size_type get_rank_of(const T &p_key) const {
+    size_type pos = find_position(p_key);
+    if (!pos || !contains_at(pos - 1))
+      throw std::out_of_range("Element not present");
+    return count_before(pos);
+  }
+
+  size_type count_less(const T &p_key) const {
+    return count_before(universe_position(p_key));
+  }
+
+  // Number of elements in [p_low, p_high]
+  size_type count_in_range(const T &p_low, const T &p_high) const {
+    if (t_comp{}(p_high, p_low))
+      return 0;
+
+    size_type high =
+        std::upper_bound(m_keys.begin(), m_keys.end(), p_high, t_comp{}) -
+        m_keys.begin();
+    return count_before(high) - count_less(p_low);
+  }
+
+public:
+  offline_order_statistic_set()
+      : m_keys{}, m_blocks(1), m_size{}, m_top_step{} {}
+
+  // The universe can be in any order and contain duplicates, a strictly
+  // ascending one is taken as is. The set starts out empty.
+  template <std::input_iterator t_iter>
+  offline_order_statistic_set(t_iter p_start, t_iter p_finish)
+      : m_keys(p_start, p_finish), m_blocks{}, m_size{}, m_top_step{} {
+    auto not_ascending = [](const T &p_a, const T &p_b) {
+      return !t_comp{}(p_a, p_b);
+    };
+
+    if (std::adjacent_find(m_keys.begin(), m_keys.end(), not_ascending) !=
+        m_keys.end()) {
+      std::sort(m_keys.begin(), m_keys.end(), t_comp{});
+      m_keys.erase(std::unique(m_keys.begin(), m_keys.end(), not_ascending),
+                   m_keys.end());
+    }
+
+    m_blocks.resize((m_keys.size() + c_block_bits - 1) / c_block_bits + 1);
+    m_top_step = std::bit_floor(block_count());
+  }
+};
+} // namespace throttle
@@ -0,0 +1,159 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "offline_order_statistic_set.hpp"
+
+#include <cctype>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <istream>
+#include <numeric>
+#include <ostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace throttle {
+struct offline_query {
+  char m_type;
+  int m_key;
+};
+
+namespace detail {
+template <typename T> void append_number(std::string &p_out, T p_num) {
+  char buf[24];
+  auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf), p_num);
+  p_out.append(buf, ptr);
+  p_out.push_back(' ');
+}
+
+// LSD radix sort by the upper 32 bits in two passes of 16 bits
+inline void radix_sort_upper(std::vector<std::uint64_t> &p_vec) {
+  std::vector<std::uint64_t> temp(p_vec.size());
+  for (unsigned shift = 32; shift < 64; shift += 16) {
+    std::vector<std::size_t> offsets((1 << 16) + 1);
+    for (auto v : p_vec) {
+      ++offsets[((v >> shift) & 0xffff) + 1];
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    for (auto v : p_vec) {
+      temp[offsets[(v >> shift) & 0xffff]++] = v;
+    }
+    p_vec.swap(temp);
+  }
+}
+} // namespace detail
+
+// Reads the whole stream at once and parses it the same way the online loop
+// does: a query is a character and an integer, and reading stops at the first
+// query that can't be parsed or has an unknown type.
+inline std::vector<offline_query> read_offline_queries(std::istream &p_is) {
+  std::string input;
+  char buf[1 << 16];
+  while (p_is.read(buf, sizeof(buf)) || p_is.gcount()) {
+    input.append(buf, p_is.gcount());
+  }
+
+  const char *curr = input.data(), *end = input.data() + input.size();
+  auto skip_spaces = [&]() {
+    while (curr != end && std::isspace(static_cast<unsigned char>(*curr)))
+      ++curr;
+  };
+
+  std::vector<offline_query> queries;
+  while (true) {
+    skip_spaces();
+    if (curr == end)
+      break;
+    char type = *curr++;
+
+    skip_spaces();
+    if (curr != end && *curr == '+')
+      ++curr;
+    int key = 0;
+    auto [ptr, ec] = std::from_chars(curr, end, key);
+    if (ec != std::errc{})
+      break;
+    curr = ptr;
+
+    queries.push_back({type, key});
+    if (type != 'k' && type != 'm' && type != 'n')
+      break;
+  }
+
+  return queries;
+}
+
+// Coordinate compression. The keys of 'k' and 'n' queries are sorted together
+// with their query indices, the distinct inserted keys form the universe and
+// every key is replaced by its position in it: the number of universe keys
+// less than the key.
+inline std::vector<int>
+compress_offline_queries(std::vector<offline_query> &p_queries) {
+  std::vector<std::uint64_t> entries;
+  entries.reserve(p_queries.size());
+  for (std::size_t i = 0; i < p_queries.size(); ++i) {
+    if (p_queries[i].m_type == 'k' || p_queries[i].m_type == 'n') {
+      // Flipping the sign bit makes unsigned order match signed order
+      auto key = static_cast<std::uint32_t>(p_queries[i].m_key) ^ 0x80000000u;
+      entries.push_back(std::uint64_t{key} << 32 | i);
+    }
+  }
+  detail::radix_sort_upper(entries);
+
+  std::vector<int> universe;
+  for (auto entry : entries) {
+    offline_query &q = p_queries[static_cast<std::uint32_t>(entry)];
+    bool in_universe = (!universe.empty() && universe.back() == q.m_key);
+    if (q.m_type == 'k') {
+      if (!in_universe)
+        universe.push_back(q.m_key);
+      q.m_key = static_cast<int>(universe.size() - 1);
+    } else {
+      q.m_key = static_cast<int>(universe.size() - in_universe);
+    }
+  }
+
+  return universe;
+}
+
+// All the keys that are ever inserted are known up front, so the set can be
+// a Fenwick tree over them. The answers are written to p_os in one go.
+inline void run_offline_queries(std::vector<offline_query> &p_queries,
+                                std::ostream &p_os) {
+  auto universe = compress_offline_queries(p_queries);
+  offline_order_statistic_set<int> t{universe.begin(), universe.end()};
+
+  std::string output;
+  try {
+    for (const auto &q : p_queries) {
+      if (q.m_type == 'k') {
+        t.insert_at(q.m_key);
+      } else if (q.m_type == 'm') {
+        detail::append_number(output, t.select_rank(q.m_key));
+      } else if (q.m_type == 'n') {
+        detail::append_number(output, t.count_before(q.m_key));
+      } else {
+        output += "Invalid operation";
+        break;
+      }
+    }
+  } catch (std::exception &e) {
+    output += e.what();
+  }
+
+  output += "\n";
+  p_os << output;
+}
+} // namespace throttle
@@ -1,32 +1,19 @@
 #include <chrono>
 #include <iostream>
 
-#include <order_statistic_set.hpp>
-
-template <typename T>
-typename throttle::order_statistic_set<T>::size_type
-get_count_less_than(const throttle::order_statistic_set<T> &p_set,
-                    const T &p_key) {
-  if (p_set.empty()) {
-    return 0;
-  }
-
-  auto min = p_set.min();
-  if (p_key <= min) {
-    return 0;
-  }
+#ifdef BOOST_FOUND__
+#include <boost/program_options.hpp>
+#include <boost/program_options/option.hpp>
+namespace po = boost::program_options;
+#endif
 
-  auto bound = p_set.closest_left(p_key);
-  auto rank = p_set.get_rank_of(bound);
-  return (bound == p_key ? rank - 1 : rank);
-}
-
-int main() {
-  if (!std::cin || !std::cout) {
-    std::abort();
-  }
-  throttle::order_statistic_set<int> t{};
+#include <btree_order_statistic_set.hpp>
+#include <int_order_statistic_set.hpp>
+#include <offline_queries.hpp>
+#include <order_statistic_set.hpp>
+#include <pool_allocator.hpp>
 
+template <typename t_set> void run_queries(t_set &t) {
   bool valid = true;
   while (valid) {
     char query_type;
@@ -45,7 +32,7 @@ int main() {
         std::cout << t.select_rank(key) << " ";
         break;
       case 'n':
-        std::cout << get_count_less_than(t, key) << " ";
+        std::cout << t.count_less(key) << " ";
         break;
       default:
         std::cout << "Invalid operation";
@@ -59,3 +46,56 @@ int main() {
 
   std::cout << "\n";
 }
+
+int main(int argc, char *argv[]) {
+  if (!std::cin || !std::cout) {
+    std::abort();
+  }
+
+  bool btree = false, integer = false, offline = false;
+#ifdef BOOST_FOUND__
+  po::options_description desc("Available options");
+  desc.add_options()("help,h", "Print this help message")(
+      "btree,b", "Use the B+ tree instead of the red-black tree")(
+      "int,i", "Use the bitwise trie for 32-bit keys instead of the "
+               "red-black tree")(
+      "offline,o", "Read all queries first and answer them with a Fenwick "
+                   "tree over the inserted keys");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << "\n";
+    return 1;
+  }
+
+  btree = vm.count("btree");
+  integer = vm.count("int");
+  offline = vm.count("offline");
+#endif
+
+  if (offline) {
+    // The whole input and output go through a single buffer each
+    std::ios::sync_with_stdio(false);
+    auto queries = throttle::read_offline_queries(std::cin);
+    throttle::run_offline_queries(queries, std::cout);
+    return 0;
+  }
+
+  if (integer) {
+    throttle::int_order_statistic_set<int> t{};
+    run_queries(t);
+  } else if (btree) {
+    throttle::btree_order_statistic_set<int, std::less<int>,
+                                        throttle::pool_allocator<int>>
+        t{};
+    run_queries(t);
+  } else {
+    throttle::order_statistic_set<int, std::less<int>,
+                                  throttle::pool_allocator<int>>
+        t{};
+    run_queries(t);
+  }
+}
@@ -12,7 +12,7 @@ cd $current_folder/$base_folder
 
 for file in *.dat; do
   echo -n "Testing $green$file$reset ..."
-  $1 < $file > ans.tmp
+  $1 "${@:3}" < $file > ans.tmp
   filename="${file}.ans"
 
   if diff -Z $filename ans.tmp; then
@@ -15,12 +15,15 @@
 #include <iostream>
 #include <iterator>
 #include <memory>
-#include <tuple>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace throttle {
 namespace detail {
 
+// Nodes don't store a parent pointer. Splaying is done top-down while
+// descending from the root, so nothing ever has to walk up the tree.
 struct bst_order_node_base {
   using base_ptr = bst_order_node_base *;
   using const_base_ptr = const bst_order_node_base *;
@@ -29,9 +32,8 @@ struct bst_order_node_base {
   size_type m_size;
   base_ptr m_left;
   base_ptr m_right;
-  base_ptr m_parent;
 
-  static size_type size(base_ptr p_x) noexcept {
+  static size_type size(const_base_ptr p_x) noexcept {
     return (p_x ? p_x->m_size : 0);
   }
 
@@ -60,62 +62,6 @@ struct bst_order_node_base {
       return (m_left)->maximum();
     return nullptr;
   }
-
-  base_ptr inorder_successor() noexcept {
-    base_ptr curr = this;
-
-    if (curr->m_right) {
-      curr = curr->successor();
-    }
-
-    else {
-      base_ptr parent = curr->m_parent;
-      while (parent && curr->is_right_child()) {
-        curr = parent;
-        parent = parent->m_parent;
-      }
-      curr = parent;
-    }
-
-    return curr;
-  }
-
-  base_ptr inorder_predecessor() noexcept {
-    base_ptr curr = this;
-
-    if (curr->m_left) {
-      curr = curr->predecessor();
-    }
-
-    else {
-      base_ptr parent = curr->m_parent;
-      while (parent && curr->is_left_child()) {
-        curr = parent;
-        parent = parent->m_parent;
-      }
-      curr = parent;
-    }
-
-    return curr;
-  }
-
-  base_ptr get_sibling() noexcept {
-    return (is_left_child() ? m_parent->m_right : m_parent->m_left);
-  }
-
-  base_ptr get_uncle() noexcept {
-    return (m_parent->is_right_child() ? m_parent->m_parent->m_left
-                                       : m_parent->m_parent->m_right);
-  }
-
-  bool is_left_child() const noexcept { return (this == m_parent->m_left); }
-
-  bool is_right_child() const noexcept { return (this == m_parent->m_right); }
-
-  bool is_linear() const noexcept {
-    return ((is_left_child() && m_parent->is_left_child()) ||
-            (is_right_child() && m_parent->is_right_child()));
-  }
 };
 
 template <typename t_value_type>
@@ -128,8 +74,7 @@ struct bst_order_node : public bst_order_node_base {
 
   bst_order_node() : bst_order_node_base{}, m_value{} {}
   bst_order_node(const t_value_type &p_key, size_type p_size = 1)
-      : bst_order_node_base{p_size, nullptr, nullptr, nullptr}, m_value{p_key} {
-  }
+      : bst_order_node_base{p_size, nullptr, nullptr}, m_value{p_key} {}
 };
 
 class bs_order_tree_impl {
@@ -141,14 +86,43 @@ protected:
 
 protected:
   mutable base_ptr m_root;
-  // Note that rotations don't change min and max values, only erase and insert
-  // does, thus pointers don't change as well.
+  // Note that splaying doesn't change min and max values, only erase and
+  // insert does, thus pointers don't change as well.
   base_ptr m_leftmost;
   base_ptr m_rightmost;
 
-  void rotate_left(base_ptr) const noexcept;
-  void rotate_right(base_ptr) const noexcept;
-  void rotate_to_parent(base_ptr) const noexcept;
+  // Both rotate the subtree rooted at the argument and return its new root.
+  static base_ptr rotate_left(base_ptr) noexcept;
+  static base_ptr rotate_right(base_ptr) noexcept;
+
+  // Left and right trees of a top-down splay [Sleator & Tarjan, 1985]. Nodes
+  // less than the target are hung on the right spine of the left tree and
+  // nodes greater than it on the left spine of the right tree. Only the
+  // number of nodes on each side is counted while descending, sizes of the
+  // spines are fixed once in assemble.
+  class splay_frame {
+    link_type m_header;
+    base_ptr m_left_max;
+    base_ptr m_right_min;
+    size_type m_left_size;
+    size_type m_right_size;
+
+  public:
+    splay_frame() noexcept
+        : m_header{}, m_left_max{&m_header}, m_right_min{&m_header},
+          m_left_size{}, m_right_size{} {}
+
+    splay_frame(const splay_frame &) = delete;
+    splay_frame &operator=(const splay_frame &) = delete;
+
+    // Both hang the node with one of its subtrees onto a side and return the
+    // other subtree to continue the descent with.
+    base_ptr link_left(base_ptr) noexcept;
+    base_ptr link_right(base_ptr) noexcept;
+
+    // Makes the node the root with the left and right trees as its subtrees
+    base_ptr assemble(base_ptr) noexcept;
+  };
 
   bs_order_tree_impl() : m_root{}, m_leftmost{}, m_rightmost{} {}
 };
@@ -186,8 +160,12 @@ public:
 
     pointer operator->() { return get(); }
 
+    // Without parent pointers the neighbours are found by splaying the
+    // current node first. An in-order walk over the whole tree takes O(n)
+    // rotations in total this way [Tarjan, 1985].
     iterator &operator++() {
-      m_curr = m_curr->inorder_successor();
+      m_tree->splay_to_root(m_curr);
+      m_curr = m_curr->successor();
       return *this;
     }
 
@@ -198,7 +176,13 @@ public:
     }
 
     iterator &operator--() {
-      m_curr = (m_curr ? m_curr->inorder_predecessor() : m_tree->m_rightmost);
+      if (!m_curr) {
+        m_curr = m_tree->m_rightmost;
+        return *this;
+      }
+
+      m_tree->splay_to_root(m_curr);
+      m_curr = m_curr->predecessor();
       return *this;
     }
 
@@ -228,26 +212,8 @@ public:
 
 public: // Modifiers
   void clear() {
-    base_ptr curr = m_root;
-    while (curr) {
-      if (curr->m_left)
-        curr = curr->m_left;
-      else if (curr->m_right)
-        curr = curr->m_right;
-
-      else {
-        base_ptr parent = curr->m_parent;
-        if (parent) {
-          if (curr->is_left_child())
-            parent->m_left = nullptr;
-          else
-            parent->m_right = nullptr;
-        }
-        delete static_cast<node_ptr>(curr);
-        curr = parent;
-      }
-    }
-    m_root = nullptr;
+    destroy(m_root);
+    m_root = m_leftmost = m_rightmost = nullptr;
   }
 
   void dump(std::ostream &p_ostream) const {
@@ -280,105 +246,142 @@ public: // Modifiers
   }
 
 protected:
-  // clang-format off
-  template <typename F>
-  std::tuple<node_ptr, node_ptr, bool> traverse_bs(node_ptr p_r, const t_key_type &p_k, F p_f) const {
-    if (empty()) {
-      return std::make_tuple(nullptr, nullptr, false);
+  // Locators steer a splay down the tree. compare returns a negative number if
+  // the target is in the left subtree of a node, a positive one if it is in
+  // the right subtree and zero if it is the node itself. pass is called for
+  // every node the descent goes right from.
+  struct key_locator {
+    const t_key_type &m_key;
+
+    int compare(const_base_ptr p_n) const {
+      const t_value_type &value = static_cast<const_node_ptr>(p_n)->m_value;
+      if (t_comp{}(m_key, value))
+        return -1;
+      return (t_comp{}(value, m_key) ? 1 : 0);
     }
 
-    node_ptr prev = nullptr, curr = p_r;
-    bool is_less_than_key{};
+    void pass(const_base_ptr) const noexcept {}
+  };
 
-    while (curr && (curr->m_value != p_k)) {
-      is_less_than_key = t_comp{}(curr->m_value, p_k);
-      p_f(*curr);
-      prev = curr;
-      if (is_less_than_key) {
-        curr = static_cast<node_ptr>(curr->m_right);
-      } else {
-        curr = static_cast<node_ptr>(curr->m_left);
-      }
+  // Looks for the p_rank-th smallest element, 1-based
+  struct rank_locator {
+    size_type m_rank;
+
+    int compare(const_base_ptr p_n) const noexcept {
+      size_type rank = link_type::size(p_n->m_left) + 1;
+      if (m_rank < rank)
+        return -1;
+      return (m_rank > rank ? 1 : 0);
     }
 
-    return std::make_tuple(curr, prev, is_less_than_key);
-  }
+    void pass(const_base_ptr p_n) noexcept {
+      m_rank -= link_type::size(p_n->m_left) + 1;
+    }
+  };
 
-  template <typename F> void traverse_postorder(const_base_ptr p_r, F p_f) const {
-    const_base_ptr prev{};
-
-    while (p_r) {
-      const_base_ptr parent{p_r->m_parent}, left{p_r->m_left}, right{p_r->m_right};
-
-      if (prev == parent) {
-        prev = p_r;
-        if (left) {
-          p_r = left;
-        } else if (right) {
-          p_r = right;
-        } else {
-          p_f(p_r);
-          p_r = parent;
+  // Top-down splay of the subtree p_t. The node found by the locator, or the
+  // last node on the search path if there's none, becomes the new root of the
+  // subtree, which is returned.
+  template <typename t_locator>
+  static base_ptr splay(base_ptr p_t, t_locator p_loc) {
+    assert(p_t);
+    splay_frame frame{};
+
+    while (true) {
+      int dir = p_loc.compare(p_t);
+
+      if (dir < 0) {
+        base_ptr child = p_t->m_left;
+        if (!child)
+          break;
+        if (p_loc.compare(child) < 0) { // Zig-zig
+          p_t = rotate_right(p_t);
+          if (!p_t->m_left)
+            break;
         }
+        p_t = frame.link_right(p_t);
       }
 
-      else if (prev == left) {
-        prev = p_r;
-        if (right) {
-          p_r = right;
-        } else {
-          p_f(p_r);
-          p_r = parent;
+      else if (dir > 0) {
+        base_ptr child = p_t->m_right;
+        if (!child)
+          break;
+        p_loc.pass(p_t);
+        if (p_loc.compare(child) > 0) { // Zig-zig
+          p_loc.pass(child);
+          p_t = rotate_left(p_t);
+          if (!p_t->m_right)
+            break;
         }
+        p_t = frame.link_left(p_t);
       }
 
       else {
-        prev = p_r;
-        p_f(p_r);
-        p_r = parent;
+        break;
       }
     }
+
+    return frame.assemble(p_t);
   }
-  // clang-format on
 
-  std::pair<node_ptr, node_ptr> bst_lookup(const t_key_type &p_key) const {
-    auto [found, prev, is_prev_less] = traverse_bs(
-        static_cast<node_ptr>(m_root), p_key, [](const node_type &) {});
-    return {found, prev};
+  template <typename t_locator> void splay_root(t_locator p_loc) const {
+    if (m_root)
+      m_root = splay(m_root, p_loc);
   }
 
-  std::pair<node_ptr, node_ptr> bst_insert(const t_value_type &p_key) {
-    std::unique_ptr<node_type> to_insert = std::make_unique<node_type>(p_key);
+  void splay_to_root(base_ptr p_node) const {
+    splay_root(key_locator{static_cast<node_ptr>(p_node)->m_value});
+  }
 
-    if (empty()) {
-      m_root = m_leftmost = m_rightmost = to_insert.get();
-      return {to_insert.release(), nullptr};
+  // Rotates left children up until the node has none and can be deleted
+  // together with its place on the right spine, so no stack is needed.
+  static void destroy(base_ptr p_root) noexcept {
+    base_ptr curr = p_root;
+    while (curr) {
+      if (curr->m_left) {
+        curr = rotate_right(curr);
+      } else {
+        base_ptr right = curr->m_right;
+        delete static_cast<node_ptr>(curr);
+        curr = right;
+      }
     }
+  }
 
-    auto [found, prev, is_prev_less] =
-        traverse_bs(static_cast<node_ptr>(m_root), p_key,
-                    [](node_type &p_node) { p_node.m_size++; });
+  // Copies the shape of the tree with an explicit stack, because a splay tree
+  // can be as deep as it is large.
+  static base_ptr clone(const_base_ptr p_root) {
+    if (!p_root)
+      return nullptr;
 
-    if (found) {
-      traverse_bs(static_cast<node_ptr>(m_root), p_key,
-                  [](node_type &p_node) { p_node.m_size--; });
-      return {nullptr, prev}; // Double insert
-    }
+    std::vector<std::pair<const_base_ptr, base_ptr>> stack;
+    auto copy_node = [](const_base_ptr p_n) {
+      return new node_type{static_cast<const_node_ptr>(p_n)->m_value,
+                           p_n->m_size};
+    };
 
-    to_insert->m_parent = prev;
-    if (is_prev_less) {
-      prev->m_right = to_insert.get();
-    } else {
-      prev->m_left = to_insert.get();
-    }
+    base_ptr root = copy_node(p_root);
+    stack.emplace_back(p_root, root);
 
-    if (t_comp{}(p_key, static_cast<node_ptr>(m_leftmost)->m_value)) {
-      m_leftmost = to_insert.get();
-    } else if (t_comp{}(static_cast<node_ptr>(m_rightmost)->m_value, p_key)) {
-      m_rightmost = to_insert.get();
+    try {
+      while (!stack.empty()) {
+        auto [from, to] = stack.back();
+        stack.pop_back();
+        if (from->m_left) {
+          to->m_left = copy_node(from->m_left);
+          stack.emplace_back(from->m_left, to->m_left);
+        }
+        if (from->m_right) {
+          to->m_right = copy_node(from->m_right);
+          stack.emplace_back(from->m_right, to->m_right);
+        }
+      }
+    } catch (...) {
+      destroy(root);
+      throw;
     }
 
-    return {to_insert.release(), prev};
+    return root;
   }
 
   // Constructors
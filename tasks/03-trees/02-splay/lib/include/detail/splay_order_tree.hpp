@@ -11,8 +11,11 @@
 #pragma once
 
 #include "bs_order_tree.hpp"
+#include <algorithm>
+#include <span>
 #include <stdexcept>
-#include <tuple>
+#include <utility>
+#include <vector>
 
 namespace throttle {
 namespace detail {
@@ -24,7 +27,13 @@ class splay_order_tree
   using typename base_tree::const_base_ptr;
   using typename base_tree::const_node_ptr;
   using typename base_tree::link_type;
+  using typename base_tree::key_locator;
   using typename base_tree::node_ptr;
+  using typename base_tree::node_type;
+  using typename base_tree::rank_locator;
+  using base_tree::splay;
+  using base_tree::splay_root;
+  using base_tree::splay_to_root;
   using self = splay_order_tree;
 
 public:
@@ -32,203 +41,389 @@ public:
   using typename base_tree::size_type;
 
 protected:
-  void splay_to_root(base_ptr p_node) const {
-    while (p_node->m_parent) {
-
-      if (!p_node->m_parent->m_parent) { // Case 1. Zig
-        this->rotate_to_parent(p_node);
-      }
+  bool is_root_key(const t_key_type &p_key) const {
+    return !key_locator{p_key}.compare(this->m_root);
+  }
 
-      else if (p_node->is_linear()) { // Case 2. Zig-zig
-        this->rotate_to_parent(p_node->m_parent);
-        this->rotate_to_parent(p_node);
-      }
+  static base_ptr splay_min(base_ptr p_t) {
+    return splay(p_t, rank_locator{1});
+  }
 
-      else { // Case 3. Zig-zag
-        this->rotate_to_parent(p_node);
-        this->rotate_to_parent(p_node);
-      }
-    }
+  static base_ptr splay_max(base_ptr p_t) {
+    return splay(p_t, rank_locator{p_t->m_size});
   }
 
-  void join(base_ptr p_left, base_ptr p_right) {
+  // Hangs p_right under the maximum of p_left, which has to be less than
+  // everything in p_right.
+  static base_ptr join(base_ptr p_left, base_ptr p_right) {
     assert(p_left);
     assert(p_right);
 
-    base_ptr max_left = p_left->maximum();
-
-    splay_to_root(max_left);
+    base_ptr max_left = splay_max(p_left);
     max_left->m_right = p_right;
-    p_right->m_parent = max_left;
-    this->m_root = max_left;
-
-    max_left->m_size = link_type::size(max_left->m_left) +
-                       link_type::size(max_left->m_right) + 1;
+    max_left->m_size += p_right->m_size;
+    return max_left;
   }
 
-  void erase(base_ptr p_node) {
-    base_ptr to_erase = p_node;
-    assert(to_erase);
+  // Cuts p_t into elements less than p_key, or not greater than it if
+  // p_inclusive is set, and the rest. The key is splayed first, so only one
+  // link of the new root has to be cut.
+  static std::pair<base_ptr, base_ptr>
+  split(base_ptr p_t, const t_key_type &p_key, bool p_inclusive) {
+    if (!p_t)
+      return {nullptr, nullptr};
+
+    base_ptr root = splay(p_t, key_locator{p_key});
+    int dir = key_locator{p_key}.compare(root);
+    if (dir > 0 || (p_inclusive && !dir)) {
+      base_ptr right = std::exchange(root->m_right, nullptr);
+      root->m_size -= link_type::size(right);
+      return {root, right};
+    }
+
+    base_ptr left = std::exchange(root->m_left, nullptr);
+    root->m_size -= link_type::size(left);
+    return {left, root};
+  }
 
-    if (this->size() == 1) {
+  // Makes the tree out of two parts with everything in p_left less than
+  // everything in p_right, either of which can be empty. The leftmost node is
+  // kept if p_left isn't empty, and the rightmost one if p_right isn't.
+  void assign_parts(base_ptr p_left, base_ptr p_right) {
+    if (!p_left && !p_right) {
       this->m_root = this->m_leftmost = this->m_rightmost = nullptr;
-      delete static_cast<node_ptr>(to_erase);
-      return;
+    } else if (!p_left) {
+      this->m_root = this->m_leftmost = splay_min(p_right);
+    } else if (!p_right) {
+      this->m_root = this->m_rightmost = splay_max(p_left);
+    } else {
+      this->m_root = join(p_left, p_right);
     }
+  }
 
-    // Move the node to the root. Depending on the number of children of the new
-    // root we should modify leftmost and rightmost pointers.
-    splay_to_root(to_erase);
-    if (!to_erase->m_left) {
+  void erase_root() {
+    base_ptr to_erase = this->m_root;
+    assert(to_erase);
+
+    // Depending on the number of children of the root we should modify
+    // leftmost and rightmost pointers.
+    if (!to_erase->m_left && !to_erase->m_right) {
+      this->m_root = this->m_leftmost = this->m_rightmost = nullptr;
+    } else if (!to_erase->m_left) {
       this->m_leftmost = to_erase->successor();
       this->m_root = to_erase->m_right;
-      to_erase->m_right->m_parent = nullptr;
-    }
-
-    else if (!to_erase->m_right) {
+    } else if (!to_erase->m_right) {
       this->m_rightmost = to_erase->predecessor();
       this->m_root = to_erase->m_left;
-      to_erase->m_left->m_parent = nullptr;
-    }
-
-    else {
-      to_erase->m_right->m_parent = nullptr;
-      to_erase->m_left->m_parent = nullptr;
-      join(to_erase->m_left, to_erase->m_right);
+    } else {
+      this->m_root = join(to_erase->m_left, to_erase->m_right);
     }
 
     delete static_cast<node_ptr>(to_erase);
   }
 
-  size_type get_rank_of(base_ptr p_node) const {
-    base_ptr node = p_node;
-    assert(node);
-
-    size_type rank = link_type::size(node->m_left) + 1;
-    while (node != this->m_root) {
-      if (node->is_right_child())
-        rank += link_type::size(node->m_parent->m_left) + 1;
-      node = node->m_parent;
-    }
-
-    splay_to_root(node);
-    return rank;
-  }
-
 public:
+  // The key is splayed first. If it's not present the root ends up next to
+  // where it belongs, and the new node takes the root's place with the old
+  // root as one of its children.
   void insert(const t_value_type &p_val) {
-    auto [inserted, prev] = this->bst_insert(p_val);
-    splay_to_root(inserted ? inserted : prev);
-    if (!inserted)
+    if (this->empty()) {
+      this->m_root = this->m_leftmost = this->m_rightmost =
+          new node_type{p_val};
+      return;
+    }
+
+    splay_root(key_locator{p_val});
+    int dir = key_locator{p_val}.compare(this->m_root);
+    if (!dir)
       throw std::out_of_range("Double insert");
+
+    base_ptr root = this->m_root;
+    node_ptr inserted = new node_type{p_val, root->m_size + 1};
+    if (dir < 0) {
+      inserted->m_left = root->m_left;
+      inserted->m_right = root;
+      root->m_left = nullptr;
+    } else {
+      inserted->m_right = root->m_right;
+      inserted->m_left = root;
+      root->m_right = nullptr;
+    }
+    root->m_size =
+        link_type::size(root->m_left) + link_type::size(root->m_right) + 1;
+    this->m_root = inserted;
+
+    if (t_comp{}(p_val, static_cast<node_ptr>(this->m_leftmost)->m_value)) {
+      this->m_leftmost = inserted;
+    } else if (t_comp{}(static_cast<node_ptr>(this->m_rightmost)->m_value,
+                        p_val)) {
+      this->m_rightmost = inserted;
+    }
   }
 
   void erase(const t_key_type &p_key) {
-    auto [to_erase, prev] = this->bst_lookup(p_key);
-    if (!to_erase) {
-      if (prev)
-        splay_to_root(prev);
+    splay_root(key_locator{p_key});
+    if (this->empty() || !is_root_key(p_key))
       throw std::out_of_range(
           "Trying to erase element not present in the tree");
-    }
-    erase(to_erase);
+    erase_root();
   }
 
-  void erase(iterator p_pos) { erase(p_pos.m_curr); }
+  void erase(iterator p_pos) {
+    splay_to_root(p_pos.m_curr);
+    erase_root();
+  }
 
   size_type get_rank_of(const t_key_type &p_elem) const {
-    base_ptr node, prev;
-    std::tie(node, prev) = this->bst_lookup(p_elem);
-    if (!node) {
-      if (prev)
-        splay_to_root(prev);
+    splay_root(key_locator{p_elem});
+    if (this->empty() || !is_root_key(p_elem))
       throw std::out_of_range("Element not present");
-    }
-
-    return get_rank_of(node);
+    return link_type::size(this->m_root->m_left) + 1;
   }
 
   size_type get_rank_of(iterator p_pos) const {
-    return get_rank_of(p_pos.m_curr);
+    splay_to_root(p_pos.m_curr);
+    return link_type::size(this->m_root->m_left) + 1;
   }
 
   iterator select_rank(size_type p_rank) const {
     if (p_rank > this->size() || !(p_rank > 0))
       return this->end();
 
-    base_ptr curr = this->m_root;
-    size_type r = link_type::size(curr->m_left) + 1;
-    while (r != p_rank) {
-      if (p_rank < r) {
-        curr = curr->m_left;
+    splay_root(rank_locator{p_rank});
+    return iterator{this->m_root, this};
+  }
+
+  // Number of elements less than p_key. The key doesn't have to be present.
+  // After the splay the root is either the key or its neighbour, so only the
+  // root has to be looked at.
+  size_type count_less(const t_key_type &p_key) const {
+    if (this->empty())
+      return 0;
+
+    splay_root(key_locator{p_key});
+    base_ptr root = this->m_root;
+    return link_type::size(root->m_left) +
+           (key_locator{p_key}.compare(root) > 0 ? 1 : 0);
+  }
+
+  // Number of elements in [p_low, p_high]. Both bounds follow the same path
+  // down to the first node between them, and only there the descent forks.
+  // The deepest node visited is splayed.
+  size_type count_in_range(const t_key_type &p_low,
+                           const t_key_type &p_high) const {
+    base_ptr split = this->m_root, deepest = nullptr;
+    size_type depth = 0;
+
+    while (split) {
+      deepest = split;
+      const t_value_type &value = static_cast<node_ptr>(split)->m_value;
+      if (t_comp{}(value, p_low)) {
+        split = split->m_right;
+      } else if (t_comp{}(p_high, value)) {
+        split = split->m_left;
       } else {
-        curr = curr->m_right;
-        p_rank -= r;
+        break;
       }
-      r = link_type::size(curr->m_left) + 1;
+      ++depth;
     }
 
-    splay_to_root(curr);
-    return iterator{curr, this};
-  }
-
-  iterator lower_bound(const t_key_type &p_key) const {
-    base_ptr curr = this->m_root, prev = nullptr, bound = nullptr;
+    if (!split) {
+      if (deepest)
+        splay_to_root(deepest);
+      return 0;
+    }
 
-    while (curr) {
-      prev = curr;
-      bool is_curr_less = t_comp{}(static_cast<node_ptr>(curr)->m_value, p_key);
-      if (is_curr_less) {
+    size_type count = 1, max_depth = depth;
+    // Elements not less than p_low in the left subtree
+    size_type curr_depth = depth;
+    for (base_ptr curr = split->m_left; curr;) {
+      if (++curr_depth > max_depth) {
+        max_depth = curr_depth;
+        deepest = curr;
+      }
+      if (t_comp{}(static_cast<node_ptr>(curr)->m_value, p_low)) {
         curr = curr->m_right;
       } else {
-        bound = curr;
+        count += link_type::size(curr->m_right) + 1;
         curr = curr->m_left;
       }
     }
 
-    if (!bound) {
-      if (prev)
-        splay_to_root(prev);
-      return this->end();
+    // Elements not greater than p_high in the right subtree
+    curr_depth = depth;
+    for (base_ptr curr = split->m_right; curr;) {
+      if (++curr_depth > max_depth) {
+        max_depth = curr_depth;
+        deepest = curr;
+      }
+      if (t_comp{}(p_high, static_cast<node_ptr>(curr)->m_value)) {
+        curr = curr->m_left;
+      } else {
+        count += link_type::size(curr->m_left) + 1;
+        curr = curr->m_right;
+      }
     }
 
-    splay_to_root(bound);
-    return iterator{bound, this};
+    splay_to_root(deepest);
+    return count;
   }
 
-  iterator upper_bound(const t_key_type &p_key) const {
-    base_ptr curr = this->m_root, prev = nullptr, bound = nullptr;
+  // count_less for every key of an ascending sequence. All the keys descend
+  // together and split up at nodes that fall between them, so the upper
+  // levels of the tree are visited once for the whole batch. The deepest node
+  // visited is splayed.
+  std::vector<size_type> batch_rank(std::span<const t_key_type> p_keys) const {
+    // Unsorted keys would get wrong ranks silently, and the check is cheaper
+    // than the descent
+    if (!std::is_sorted(p_keys.begin(), p_keys.end(), t_comp{}))
+      throw std::invalid_argument("Batch keys are not sorted");
+
+    std::vector<size_type> ranks(p_keys.size());
+    base_ptr deepest = batch_rank_helper(this->m_root, p_keys, ranks.data());
+
+    if (deepest)
+      splay_to_root(deepest);
+    return ranks;
+  }
 
-    while (curr) {
-      prev = curr;
-      bool is_key_less = t_comp{}(p_key, static_cast<node_ptr>(curr)->m_value);
-      if (is_key_less) {
-        bound = curr;
-        curr = curr->m_left;
-      } else {
-        curr = curr->m_right;
+private:
+  // A part of the batch that still has to descend into a subtree. Keys are
+  // given as [m_first, m_last) indices into the batch.
+  struct batch_rank_frame {
+    base_ptr m_node;
+    size_type m_first, m_last;
+    size_type m_offset; // Elements that precede the subtree
+    size_type m_depth;
+  };
+
+  // Walks the tree with an explicit stack, a chain of nodes is a valid splay
+  // tree. Frames on the stack hold disjoint nonempty parts of the batch, so
+  // there are never more of them than keys. Returns the deepest node visited.
+  static base_ptr batch_rank_helper(base_ptr p_root,
+                                    std::span<const t_key_type> p_keys,
+                                    size_type *p_ranks) {
+    base_ptr deepest = nullptr;
+    size_type max_depth = 0;
+    if (p_keys.empty()) {
+      return deepest;
+    }
+
+    std::vector<batch_rank_frame> stack{{p_root, 0, p_keys.size(), 0, 0}};
+    while (!stack.empty()) {
+      auto [node, first, last, offset, depth] = stack.back();
+      stack.pop_back();
+
+      if (!node) {
+        std::fill(p_ranks + first, p_ranks + last, offset);
+        continue;
+      }
+
+      if (!deepest || depth > max_depth) {
+        deepest = node;
+        max_depth = depth;
+      }
+
+      const t_value_type &value = static_cast<node_ptr>(node)->m_value;
+      auto split = std::partition_point(
+          p_keys.begin() + first, p_keys.begin() + last,
+          [&](const t_key_type &p_key) { return !t_comp{}(value, p_key); });
+      size_type middle = split - p_keys.begin();
+
+      if (middle != last) {
+        stack.push_back({node->m_right, middle, last,
+                         offset + link_type::size(node->m_left) + 1,
+                         depth + 1});
+      }
+      if (first != middle) {
+        stack.push_back({node->m_left, first, middle, offset, depth + 1});
       }
     }
 
-    if (!bound) {
-      if (prev)
-        splay_to_root(prev);
-      return this->end();
+    return deepest;
+  }
+
+public:
+  // Moves the elements not less than p_key to the returned tree, the rest
+  // stays in this one. Takes O(log n) amortized.
+  self split(const t_key_type &p_key) {
+    self right{};
+    auto [left_root, right_root] = split(this->m_root, p_key, false);
+    if (right_root) {
+      right.m_root = right.m_leftmost = splay_min(right_root);
+      right.m_rightmost = this->m_rightmost;
     }
 
-    splay_to_root(bound);
-    return iterator{bound, this};
+    assign_parts(left_root, nullptr);
+    return right;
+  }
+
+  // Moves every element of p_right to the end of this tree. All of them have
+  // to be greater than the elements of this tree.
+  void join(self &p_right) {
+    if (p_right.empty())
+      return;
+
+    if (this->empty()) {
+      std::swap(*this, p_right);
+      return;
+    }
+
+    if (!t_comp{}(static_cast<node_ptr>(this->m_rightmost)->m_value,
+                  static_cast<node_ptr>(p_right.m_leftmost)->m_value))
+      throw std::out_of_range("Joined trees overlap");
+
+    this->m_root = join(this->m_root, p_right.m_root);
+    this->m_rightmost = p_right.m_rightmost;
+    p_right.m_root = p_right.m_leftmost = p_right.m_rightmost = nullptr;
+  }
+
+  // Erases the elements in [p_low, p_high], or in [p_low, p_high) if
+  // p_inclusive is not set, and returns their number. The range is cut out
+  // with two splits and a join in O(log n) amortized. Freeing the k erased
+  // nodes takes another O(k).
+  size_type erase_range(const t_key_type &p_low, const t_key_type &p_high,
+                        bool p_inclusive = true) {
+    if (this->empty() || t_comp{}(p_high, p_low))
+      return 0;
+
+    auto [left, rest] = split(this->m_root, p_low, false);
+    auto [middle, right] = split(rest, p_high, p_inclusive);
+    assign_parts(left, right);
+
+    size_type erased = link_type::size(middle);
+    base_tree::destroy(middle);
+    return erased;
+  }
+
+  iterator lower_bound(const t_key_type &p_key) const {
+    if (this->empty())
+      return this->end();
+
+    splay_root(key_locator{p_key});
+    base_ptr root = this->m_root;
+    return iterator{(key_locator{p_key}.compare(root) > 0 ? root->successor()
+                                                          : root),
+                    this};
+  }
+
+  iterator upper_bound(const t_key_type &p_key) const {
+    if (this->empty())
+      return this->end();
+
+    splay_root(key_locator{p_key});
+    base_ptr root = this->m_root;
+    return iterator{(key_locator{p_key}.compare(root) < 0 ? root
+                                                          : root->successor()),
+                    this};
   }
 
   iterator find(const t_key_type &p_key) const {
-    auto [found, prev] = this->bst_lookup(p_key);
-    if (!found) {
-      if (prev)
-        splay_to_root(prev);
+    if (this->empty())
       return this->end();
-    }
-    splay_to_root(found);
-    return iterator{found, this};
+
+    splay_root(key_locator{p_key});
+    return (is_root_key(p_key) ? iterator{this->m_root, this} : this->end());
   }
 
   // Use default constructor, destructor and move constructor, assigment from
@@ -238,16 +433,13 @@ public:
   splay_order_tree(self &&) = default;
   self &operator=(self &&) = default;
 
-  // Traverse in post-order to improve perfomance. If a were to traverse in
-  // inorder, then inserted elements would be sorted and the copy would be a
-  // degenerate linked list.
+  // The copy has the same shape as the original.
   splay_order_tree(const self &p_other) : base_tree{} {
-    self temp{};
-    this->traverse_postorder(
-        static_cast<const_node_ptr>(p_other.m_root), [&](const_base_ptr p_n) {
-          temp.insert(static_cast<const_node_ptr>(p_n)->m_value);
-        });
-    *this = std::move(temp);
+    this->m_root = base_tree::clone(p_other.m_root);
+    if (this->m_root) {
+      this->m_leftmost = this->m_root->minimum();
+      this->m_rightmost = this->m_root->maximum();
+    }
   }
 
   // Define copy assignment in terms of copy constructor.
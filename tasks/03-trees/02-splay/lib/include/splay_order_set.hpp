@@ -11,6 +11,9 @@
 #include <functional>
 #include <initializer_list>
 #include <iostream>
+#include <span>
+#include <utility>
+#include <vector>
 
 #include "detail/splay_order_tree.hpp"
 
@@ -19,6 +22,9 @@ template <typename T, typename t_comp = std::less<T>> class splay_order_set {
 private:
   detail::splay_order_tree<T, t_comp, T> m_tree_impl;
 
+  explicit splay_order_set(detail::splay_order_tree<T, t_comp, T> &&p_tree)
+      : m_tree_impl{std::move(p_tree)} {}
+
 public:
   class iterator {
     friend class splay_order_set<T, t_comp>;
@@ -130,6 +136,23 @@ public: // Selectors
     return m_tree_impl.get_rank_of(p_pos.m_it_impl);
   }
 
+  // Number of elements less than "p_key".
+  size_type count_less(const key_type &p_key) const {
+    return m_tree_impl.count_less(p_key);
+  }
+
+  // Number of elements in [p_low, p_high].
+  size_type count_in_range(const key_type &p_low,
+                           const key_type &p_high) const {
+    return m_tree_impl.count_in_range(p_low, p_high);
+  }
+
+  // count_less for each of the keys, which have to be sorted. Throws
+  // std::invalid_argument if they are not.
+  std::vector<size_type> batch_rank(std::span<const key_type> p_keys) const {
+    return m_tree_impl.batch_rank(p_keys);
+  }
+
 public:
   splay_order_set() : m_tree_impl{} {}
 
@@ -154,13 +177,29 @@ public:
 
   // Erase all elements in range [p_start, p_finish). Must be a valid range
   void erase(iterator p_start, iterator p_finish) {
-    for (iterator its = p_start, ite = p_finish; its != ite;) {
-      iterator nextit = std::next(its);
-      erase(its);
-      its = nextit;
-    }
+    if (p_start == p_finish)
+      return;
+    if (p_finish == end())
+      m_tree_impl.erase_range(*p_start, *max());
+    else
+      m_tree_impl.erase_range(*p_start, *p_finish, false);
+  }
+
+  // Erase all elements in [p_low, p_high] and return their number.
+  size_type erase_range(const key_type &p_low, const key_type &p_high) {
+    return m_tree_impl.erase_range(p_low, p_high);
   }
 
+  // Move the elements not less than "p_key" to the returned set. This set
+  // keeps the rest.
+  splay_order_set split(const key_type &p_key) {
+    return splay_order_set{m_tree_impl.split(p_key)};
+  }
+
+  // Move all elements of "p_right" to this set. They all have to be greater
+  // than the elements of this set.
+  void join(splay_order_set &p_right) { m_tree_impl.join(p_right.m_tree_impl); }
+
   void dump(std::ostream &p_ostream) const { m_tree_impl.dump(p_ostream); }
 };
 
@@ -14,68 +14,77 @@
 namespace throttle {
 namespace detail {
 
-void bs_order_tree_impl::rotate_left(base_ptr p_n) const noexcept {
+bs_order_tree_impl::base_ptr
+bs_order_tree_impl::rotate_left(base_ptr p_n) noexcept {
   assert(p_n);
   assert(p_n->m_right);
 
   base_ptr root = p_n, rchild = p_n->m_right;
   root->m_right = rchild->m_left;
-  if (rchild->m_left) {
-    rchild->m_left->m_parent = root;
-  }
-
-  rchild->m_parent = root->m_parent;
-
-  if (!root->m_parent) {
-    m_root = rchild;
-  } else if (root->is_left_child()) {
-    root->m_parent->m_left = rchild;
-  } else {
-    root->m_parent->m_right = rchild;
-  }
-
   rchild->m_left = root;
-  root->m_parent = rchild;
 
   rchild->m_size = root->m_size;
   root->m_size =
       link_type::size(root->m_left) + link_type::size(root->m_right) + 1;
+  return rchild;
 }
 
-void bs_order_tree_impl::rotate_right(base_ptr p_n) const noexcept {
+bs_order_tree_impl::base_ptr
+bs_order_tree_impl::rotate_right(base_ptr p_n) noexcept {
   assert(p_n);
   assert(p_n->m_left);
 
   base_ptr root = p_n, lchild = p_n->m_left;
   root->m_left = lchild->m_right;
-  if (lchild->m_right) {
-    lchild->m_right->m_parent = root;
-  }
-
-  lchild->m_parent = root->m_parent;
-
-  if (!root->m_parent) {
-    m_root = lchild;
-  } else if (root->is_right_child()) {
-    root->m_parent->m_right = lchild;
-  } else {
-    root->m_parent->m_left = lchild;
-  }
-
   lchild->m_right = root;
-  root->m_parent = lchild;
 
   lchild->m_size = root->m_size;
   root->m_size =
       link_type::size(root->m_left) + link_type::size(root->m_right) + 1;
+  return lchild;
+}
+
+bs_order_tree_impl::base_ptr
+bs_order_tree_impl::splay_frame::link_left(base_ptr p_n) noexcept {
+  m_left_max->m_right = p_n;
+  m_left_max = p_n;
+  m_left_size += link_type::size(p_n->m_left) + 1;
+  return p_n->m_right;
+}
+
+bs_order_tree_impl::base_ptr
+bs_order_tree_impl::splay_frame::link_right(base_ptr p_n) noexcept {
+  m_right_min->m_left = p_n;
+  m_right_min = p_n;
+  m_right_size += link_type::size(p_n->m_right) + 1;
+  return p_n->m_left;
 }
 
-void bs_order_tree_impl::rotate_to_parent(base_ptr p_n) const noexcept {
-  if (p_n->is_left_child()) {
-    rotate_right(p_n->m_parent);
-  } else {
-    rotate_left(p_n->m_parent);
+bs_order_tree_impl::base_ptr
+bs_order_tree_impl::splay_frame::assemble(base_ptr p_n) noexcept {
+  m_left_size += link_type::size(p_n->m_left);
+  m_right_size += link_type::size(p_n->m_right);
+  p_n->m_size = m_left_size + m_right_size + 1;
+
+  // Every node on the right spine of the left tree has the rest of the spine
+  // and the left subtree of the new root under it. The same goes for the
+  // right tree.
+  m_left_max->m_right = m_right_min->m_left = nullptr;
+  for (base_ptr curr = m_header.m_right; curr; curr = curr->m_right) {
+    curr->m_size = m_left_size;
+    m_left_size -= link_type::size(curr->m_left) + 1;
+  }
+
+  for (base_ptr curr = m_header.m_left; curr; curr = curr->m_left) {
+    curr->m_size = m_right_size;
+    m_right_size -= link_type::size(curr->m_right) + 1;
   }
+
+  m_left_max->m_right = p_n->m_left;
+  m_right_min->m_left = p_n->m_right;
+  p_n->m_left = m_header.m_right;
+  p_n->m_right = m_header.m_left;
+  return p_n;
 }
 
 } // namespace detail
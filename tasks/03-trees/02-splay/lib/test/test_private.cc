@@ -7,6 +7,7 @@
 #include <numeric>
 #include <set>
 #include <string>
+#include <vector>
 
 #define private public
 #define protected public
@@ -26,20 +27,30 @@ namespace {
 using base_node_ptr = bst_order_node_base *;
 using base_node = bst_order_node_base;
 
+// Iterating over a splay tree splays every element, which can leave it as deep
+// as it is large, so the nodes are checked with an explicit stack.
 bool validate_size_helper(base_node_ptr p_base) {
-  if (!p_base) {
-    return true;
+  std::vector<base_node_ptr> stack;
+  if (p_base) {
+    stack.push_back(p_base);
   }
 
-  if (base_node::size(p_base) !=
-      base_node::size(p_base->m_left) + base_node::size(p_base->m_right) + 1) {
-    return false;
-  }
+  while (!stack.empty()) {
+    base_node_ptr curr = stack.back();
+    stack.pop_back();
+
+    if (base_node::size(curr) !=
+        base_node::size(curr->m_left) + base_node::size(curr->m_right) + 1) {
+      return false;
+    }
 
-  bool valid_left = validate_size_helper(p_base->m_left);
-  bool valid_right = validate_size_helper(p_base->m_right);
+    if (curr->m_left)
+      stack.push_back(curr->m_left);
+    if (curr->m_right)
+      stack.push_back(curr->m_right);
+  }
 
-  return valid_left && valid_right;
+  return true;
 }
 } // namespace
 
@@ -291,6 +302,197 @@ TEST(splay_order_test, test_11) {
   EXPECT_EQ(validate_size_helper(c.m_tree_impl.m_root), true);
 }
 
+TEST(splay_order_test, test_12) {
+  std::set<int> s;
+  throttle::splay_order_set<int> t;
+  EXPECT_EQ(t.count_less(0), 0);
+  EXPECT_EQ(t.count_in_range(-10, 10), 0);
+
+  for (int i = 0; i < 2000; i++) {
+    int temp = rand() % 10000;
+    if (s.insert(temp).second)
+      t.insert(temp);
+  }
+
+  for (int key = -5; key < 10005; key += 7) {
+    auto expected = std::distance(s.begin(), s.lower_bound(key));
+    ASSERT_EQ(t.count_less(key), expected);
+  }
+
+  for (int i = 0; i < 2000; i++) {
+    int low = rand() % 10100 - 50, high = rand() % 10100 - 50;
+    auto expected =
+        (low > high ? 0
+                    : std::distance(s.lower_bound(low), s.upper_bound(high)));
+    ASSERT_EQ(t.count_in_range(low, high), expected);
+  }
+
+  EXPECT_EQ(validate_size_helper(t.m_tree_impl.m_root), true);
+
+  std::vector<int> keys;
+  for (int key = -100; key < 10100; key += rand() % 50) {
+    keys.push_back(key);
+  }
+
+  auto ranks = t.batch_rank(keys);
+  ASSERT_EQ(ranks.size(), keys.size());
+  for (std::size_t i = 0; i < keys.size(); i++) {
+    ASSERT_EQ(ranks[i], std::distance(s.begin(), s.lower_bound(keys[i])));
+  }
+
+  EXPECT_EQ(validate_size_helper(t.m_tree_impl.m_root), true);
+}
+
+TEST(splay_order_test, test_13) {
+  // Nodes are a size and two links
+  EXPECT_EQ(sizeof(bst_order_node_base), 3 * sizeof(void *));
+
+  std::set<int> s;
+  throttle::splay_order_set<int> t;
+
+  for (int i = 0; i < 100000; i++) {
+    int key = rand() % 5000;
+    switch (rand() % 4) {
+    case 0:
+      if (s.insert(key).second) {
+        t.insert(key);
+      } else {
+        ASSERT_THROW(t.insert(key), std::out_of_range);
+      }
+      break;
+    case 1:
+      if (s.erase(key)) {
+        t.erase(key);
+      } else {
+        ASSERT_THROW(t.erase(key), std::out_of_range);
+      }
+      break;
+    case 2:
+      if (!s.empty()) {
+        std::size_t rank = rand() % s.size() + 1;
+        ASSERT_EQ(*t.select_rank(rank), *std::next(s.begin(), rank - 1));
+      }
+      break;
+    default:
+      ASSERT_EQ(t.contains(key), s.count(key) == 1);
+      ASSERT_EQ(t.count_less(key),
+                std::distance(s.begin(), s.lower_bound(key)));
+    }
+    ASSERT_EQ(t.size(), s.size());
+  }
+
+  EXPECT_EQ(validate_size_helper(t.m_tree_impl.m_root), true);
+  EXPECT_TRUE(std::equal(t.begin(), t.end(), s.begin(), s.end()));
+  EXPECT_TRUE(std::equal(std::make_reverse_iterator(t.end()),
+                         std::make_reverse_iterator(t.begin()), s.rbegin(),
+                         s.rend()));
+  EXPECT_EQ(*t.min(), *s.begin());
+  EXPECT_EQ(*t.max(), *s.rbegin());
+
+  throttle::splay_order_set<int> c{t};
+  EXPECT_TRUE(std::equal(c.begin(), c.end(), s.begin(), s.end()));
+  EXPECT_EQ(validate_size_helper(c.m_tree_impl.m_root), true);
+}
+
+TEST(splay_order_test, test_14) {
+  std::set<int> s;
+  throttle::splay_order_set<int> t;
+  EXPECT_EQ(t.erase_range(0, 10), 0);
+  EXPECT_TRUE(t.split(0).empty());
+
+  for (int i = 0; i < 20000; i++) {
+    int temp = rand() % 100000;
+    if (s.insert(temp).second)
+      t.insert(temp);
+  }
+
+  for (int i = 0; i < 200; i++) {
+    int low = rand() % 100000, high = low + rand() % 2000;
+    auto expected = std::distance(s.lower_bound(low), s.upper_bound(high));
+    s.erase(s.lower_bound(low), s.upper_bound(high));
+    ASSERT_EQ(t.erase_range(low, high), expected);
+    ASSERT_EQ(t.size(), s.size());
+  }
+
+  EXPECT_EQ(validate_size_helper(t.m_tree_impl.m_root), true);
+  EXPECT_TRUE(std::equal(t.begin(), t.end(), s.begin(), s.end()));
+
+  // Split in three and glue the parts back together
+  auto right = t.split(70000);
+  auto middle = t.split(30000);
+  EXPECT_EQ(t.size(), std::distance(s.begin(), s.lower_bound(30000)));
+  EXPECT_EQ(middle.size(), std::distance(s.lower_bound(30000),
+                                         s.lower_bound(70000)));
+  EXPECT_EQ(right.size(), std::distance(s.lower_bound(70000), s.end()));
+  EXPECT_EQ(*middle.min(), *s.lower_bound(30000));
+  EXPECT_EQ(*middle.max(), *std::prev(s.lower_bound(70000)));
+  EXPECT_EQ(*t.max(), *std::prev(s.lower_bound(30000)));
+  EXPECT_EQ(validate_size_helper(middle.m_tree_impl.m_root), true);
+
+  EXPECT_THROW(right.join(t), std::out_of_range);
+  t.join(middle);
+  t.join(right);
+  EXPECT_TRUE(middle.empty());
+  EXPECT_TRUE(right.empty());
+  EXPECT_EQ(validate_size_helper(t.m_tree_impl.m_root), true);
+  EXPECT_TRUE(std::equal(t.begin(), t.end(), s.begin(), s.end()));
+
+  // Erasing the whole set and everything past the end
+  t.erase(t.lower_bound(50000), t.end());
+  s.erase(s.lower_bound(50000), s.end());
+  EXPECT_EQ(*t.max(), *s.rbegin());
+  EXPECT_EQ(t.erase_range(-1, 100000), s.size());
+  EXPECT_TRUE(t.empty());
+  EXPECT_EQ(t.min(), t.end());
+}
+
+TEST(splay_order_test, test_15) {
+  // Ascending inserts leave a chain of left children as deep as the tree
+  const int n = 1 << 20;
+  throttle::splay_order_set<int> t;
+  for (int i = 0; i < n; i++) {
+    t.insert(2 * i);
+  }
+
+  std::size_t depth = 0;
+  for (auto node = t.m_tree_impl.m_root; node; node = node->m_left) {
+    depth++;
+  }
+  ASSERT_EQ(depth, n);
+
+  std::vector<int> keys{-1};
+  for (int key = 1; key < 2 * n; key += 2 * n / 64 + 1) {
+    keys.push_back(key);
+  }
+  keys.push_back(2 * n);
+
+  auto ranks = t.batch_rank(keys);
+  ASSERT_EQ(ranks.size(), keys.size());
+  for (std::size_t i = 0; i < keys.size(); i++) {
+    ASSERT_EQ(ranks[i], std::max(keys[i] + 1, 0) / 2);
+  }
+
+  EXPECT_EQ(t.size(), n);
+  EXPECT_EQ(t.count_less(2 * n), n);
+  EXPECT_EQ(validate_size_helper(t.m_tree_impl.m_root), true);
+}
+
+TEST(splay_order_test, test_16) {
+  throttle::splay_order_set<int> t;
+  for (int i = 0; i < 100; i++) {
+    t.insert(2 * i);
+  }
+
+  // Unsorted keys are rejected in release builds too
+  std::vector<int> keys{10, 50, 30};
+  EXPECT_THROW(t.batch_rank(keys), std::invalid_argument);
+  EXPECT_EQ(validate_size_helper(t.m_tree_impl.m_root), true);
+
+  std::vector<int> sorted{10, 30, 30, 50};
+  std::vector<std::size_t> expected{5, 15, 15, 25};
+  EXPECT_EQ(t.batch_rank(sorted), expected);
+}
+
 int main(int argc, char *argv[]) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -27,18 +27,7 @@ int set_range_query(const std::set<T> &p_set, T p_first, T p_second) {
 template <typename T>
 int my_set_range_query(throttle::splay_order_set<T> &p_set, T p_first,
                        T p_second) {
-  if (p_set.empty() || p_first > p_second || p_first > *p_set.max()) {
-    return 0;
-  }
-
-  auto its = p_set.lower_bound(p_first);
-  auto ite = p_set.upper_bound(p_second);
-
-  int rank_left = (its == p_set.end() ? 0 : p_set.get_rank_of(its));
-  int rank_right =
-      (ite == p_set.end() ? p_set.size() + 1 : p_set.get_rank_of(ite));
-
-  return rank_right - rank_left;
+  return p_set.count_in_range(p_first, p_second);
 }
 #else
 template <typename T>
@@ -1,29 +1,44 @@
 #include <chrono>
 #include <iostream>
 
+#ifdef BOOST_FOUND__
+#include <boost/program_options.hpp>
+#include <boost/program_options/option.hpp>
+namespace po = boost::program_options;
+#endif
+
+#include "offline_queries.hpp"
 #include "splay_order_set.hpp"
 
-template <typename T>
-typename throttle::splay_order_set<T>::size_type
-get_count_less_than(throttle::splay_order_set<T> &p_set, const T &p_key) {
-  if (p_set.empty()) {
-    return 0;
+int main(int argc, char *argv[]) {
+  if (!std::cin || !std::cout) {
+    std::abort();
   }
 
-  auto min = *p_set.min();
-  if (p_key <= min) {
-    return 0;
-  }
+#ifdef BOOST_FOUND__
+  po::options_description desc("Available options");
+  desc.add_options()("help,h", "Print this help message")(
+      "offline,o", "Read all queries first and answer them with a Fenwick "
+                   "tree over the inserted keys");
 
-  auto bound = std::prev(p_set.lower_bound(p_key));
-  auto rank = p_set.get_rank_of(bound);
-  return rank;
-}
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
 
-int main() {
-  if (!std::cin || !std::cout) {
-    std::abort();
+  if (vm.count("help")) {
+    std::cout << desc << "\n";
+    return 1;
+  }
+
+  if (vm.count("offline")) {
+    // The whole input and output go through a single buffer each
+    std::ios::sync_with_stdio(false);
+    auto queries = throttle::read_offline_queries(std::cin);
+    throttle::run_offline_queries(queries, std::cout);
+    return 0;
   }
+#endif
+
   throttle::splay_order_set<int> t{};
 
   bool valid = true;
@@ -44,7 +59,7 @@ int main() {
         std::cout << *t.select_rank(key) << " ";
         break;
       case 'n':
-        std::cout << get_count_less_than(t, key) << " ";
+        std::cout << t.count_less(key) << " ";
         break;
       default:
         std::cout << "Invalid operation";